@@ -69,6 +69,7 @@ extern "C"
 typedef CS_RETCODE(*CS_CSLIBMSG_FUNC) (CS_CONTEXT *, CS_CLIENTMSG *);
 typedef CS_RETCODE(*CS_CLIENTMSG_FUNC) (CS_CONTEXT *, CS_CONNECTION *, CS_CLIENTMSG *);
 typedef CS_RETCODE(*CS_SERVERMSG_FUNC) (CS_CONTEXT *, CS_CONNECTION *, CS_SERVERMSG *);
+typedef CS_RETCODE(*CS_COMPLETION_FUNC) (CS_CONNECTION *, CS_COMMAND *, CS_INT, CS_RETCODE);
 
 
 #define CS_IODATA          TDS_STATIC_CAST(CS_INT, 1600)
@@ -262,8 +263,12 @@ enum
 #define CS_PORT CS_PORT
 	CS_CLIENTCHARSET = 9301,
 #define CS_CLIENTCHARSET CS_CLIENTCHARSET
-	CS_DATABASE = 9302
+	CS_DATABASE = 9302,
 #define CS_DATABASE CS_DATABASE
+	CS_TIMEOUT_MS = 9303,
+#define CS_TIMEOUT_MS CS_TIMEOUT_MS
+	CS_LOGIN_TIMEOUT_MS = 9304
+#define CS_LOGIN_TIMEOUT_MS CS_LOGIN_TIMEOUT_MS
 };
 
 /* Arbitrary precision math operators */
@@ -92,14 +92,20 @@ struct _cs_context
 	CS_CSLIBMSG_FUNC _cslibmsg_cb;
 	CS_CLIENTMSG_FUNC _clientmsg_cb;
 	CS_SERVERMSG_FUNC _servermsg_cb;
+	CS_COMPLETION_FUNC _completion_cb;
 	/* code changes start here - CS_CONFIG - 01*/
 	void *userdata;
 	int userdata_len;
 	/* code changes end here - CS_CONFIG - 01*/
 	TDSCONTEXT *tds_ctx;
 	CS_CONFIG config;
-	int login_timeout;  /**< not used unless positive */
-	int query_timeout;  /**< not used unless positive */
+	int login_timeout;  /**< in milliseconds, not used unless positive */
+	int query_timeout;  /**< in milliseconds, not used unless positive */
+	CS_INT netio;	    /**< CS_SYNC_IO, CS_ASYNC_IO or CS_DEFER_IO, default for new connections */
+	/** connections allocated from this context, scanned by ct_poll */
+	CS_CONNECTION *conns;
+	/** rotate ready connections reported by ct_poll */
+	unsigned poll_rotor;
 };
 
 /*
@@ -113,6 +119,25 @@ CT_COLINFO;
 
 typedef struct _cs_dynamic CS_DYNAMIC;
 
+/**
+ * Asynchronous operation pending on a connection.
+ * Requests are sent when ct_send is called, reads are deferred
+ * until ct_poll finds the connection readable.
+ */
+typedef struct _ct_async
+{
+	/** CT_SEND, CT_RESULTS or CT_FETCH, 0 if nothing is pending */
+	CS_INT function;
+	CS_COMMAND *cmd;
+	/** operation already executed, status is its result */
+	bool completed;
+	CS_RETCODE status;
+	/* output and parameters saved for the deferred call */
+	CS_INT *result_type;
+	CS_INT fetch_type, fetch_offset, fetch_option;
+	CS_INT *rows_read;
+} CT_ASYNC;
+
 struct _cs_connection
 {
 	CS_CONTEXT *ctx;
@@ -120,6 +145,7 @@ struct _cs_connection
 	TDSSOCKET *tds_socket;
 	CS_CLIENTMSG_FUNC _clientmsg_cb;
 	CS_SERVERMSG_FUNC _servermsg_cb;
+	CS_COMPLETION_FUNC _completion_cb;
 	void *userdata;
 	int userdata_len;
 	CS_LOCALE *locale;
@@ -127,6 +153,10 @@ struct _cs_connection
 	CS_DYNAMIC *dynlist;
 	char *server_addr;
 	bool network_auth;
+	CS_INT netio;
+	CT_ASYNC async;
+	/** next connection in the context list */
+	CS_CONNECTION *next;
 };
 
 /*
@@ -56,6 +56,7 @@ typedef struct
 	int current;		/* dbnextrow() reads this row */
 	int capacity;		/* how many elements the queue can hold  */
 	struct dblib_buffer_row *rows;		/* pointer to the row storage */
+	TDSARENA arena;		/* memory for saved rows and sizes */
 } DBPROC_ROWBUF;
 
 typedef struct
@@ -81,6 +82,10 @@ typedef struct
 	TDS_INT lastrow;
 	TDS_INT maxerrs;
 	TDS_INT batch;
+	/** offset of first row to read */
+	TDS_INT8 range_start;
+	/** stop reading at first row starting at or after this offset, -1 for end of file */
+	TDS_INT8 range_end;
 } BCP_HOSTFILEINFO;
 
 /* linked list of rpc parameters */
@@ -142,6 +147,8 @@ struct tds_dblib_dbprocess
 	DBSTRING *dboptcmd;
 	BCP_HOSTFILEINFO *hostfileinfo;
 	TDSBCPINFO *bcpinfo;
+	/** hints set with bcp_options, bcpinfo->hint points here */
+	char *bcphint;
 	DBREMOTE_PROC *rpc;
 	DBUSMALLINT envchange_rcv;
 	char dbcurdb[DBMAXNAME + 1];
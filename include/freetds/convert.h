@@ -91,6 +91,12 @@ TDS_INT tds_convert(const TDSCONTEXT *context, int srctype, const void *src, TDS
 
 size_t tds_strftime(char *buf, size_t maxsize, const char *format, const TDSDATEREC * timeptr, int prec);
 
+typedef struct tds_date_format TDSDATEFORMAT;
+
+TDSDATEFORMAT *tds_date_format_compile(const char *format);
+size_t tds_date_format_apply(char *buf, size_t maxsize, const TDSDATEFORMAT *fmt, const TDSDATEREC * dr, int prec);
+void tds_date_format_free(TDSDATEFORMAT *fmt);
+
 #ifdef __cplusplus
 #if 0
 {
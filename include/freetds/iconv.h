@@ -81,11 +81,16 @@ typedef struct tds_errno_message_flags {
 	unsigned int einval:1;
 } TDS_ERRNO_MESSAGE_FLAGS;
 
+/** built-in converter, same semantic of iconv */
+typedef size_t (*tds_iconv_native_t)(const char **inbuf, size_t *inbytesleft, char **outbuf, size_t *outbytesleft);
+
 typedef struct tdsiconvdir
 {
 	TDS_ENCODING charset;
 
 	iconv_t cd;
+	/** if not NULL used instead of cd, cd is still used to handle errors */
+	tds_iconv_native_t native;
 } TDSICONVDIR;
 
 struct tdsiconvinfo
@@ -119,6 +124,9 @@ const char *tds_canonical_charset_name(const char *charset_name);
 TDSICONV *tds_iconv_get(TDSCONNECTION * conn, const char *client_charset, const char *server_charset);
 TDSICONV *tds_iconv_get_info(TDSCONNECTION * conn, int canonic_client, int canonic_server);
 
+/* iconv_native.c */
+tds_iconv_native_t tds_iconv_native_get(int from_canonic, int to_canonic);
+
 #ifdef __cplusplus
 }
 #endif
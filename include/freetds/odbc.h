@@ -337,6 +337,7 @@ struct _hsattr
 	/* apd->sql_desc_array_size */
 	/* SQLUINTEGER paramset_size; */
 	SQLUINTEGER query_timeout;
+	SQLUINTEGER query_timeout_ms;	/**< query_timeout in milliseconds, can be set with more precision */
 	SQLUINTEGER retrieve_data;
 	/* ard->sql_desc_bind_offset_ptr */
 	/* SQLUINTEGER *row_bind_offset_ptr; */
@@ -380,6 +381,28 @@ typedef enum
 	ODBC_SPECIAL_SPECIALCOLUMNS = 4
 } TDS_ODBC_SPECIAL_ROWS;
 
+struct _hstmt;
+struct _odbc_fetch_col;
+
+/** convert a bound column, see odbc_tds2sql_prepare */
+typedef SQLLEN (*odbc_fetch_conv_t)(struct _hstmt *stmt, const struct _odbc_fetch_col *fc, TDSCOLUMN *curcol,
+				    TDS_CHAR *dest, SQLULEN destlen);
+
+/** conversion of a bound column, resolved once for all rows of a rowset */
+typedef struct _odbc_fetch_col
+{
+	odbc_fetch_conv_t conv;
+	/** C type, never SQL_C_DEFAULT */
+	int c_type;
+	/** size of a single element using column-wise binding */
+	SQLLEN octet_len;
+	/** bytes to copy for types with same representation */
+	unsigned int size;
+	/** conversion for character data */
+	TDSICONV *char_conv;
+	const struct _drecord *drec;
+} ODBC_FETCH_COL;
+
 struct _hstmt
 {
 	SQLSMALLINT htype;	/* do not reorder this field */
@@ -434,6 +457,9 @@ struct _hstmt
 	TDS_ODBC_SPECIAL_ROWS special_row;
 	/* do NOT free cursor, free from socket or attach to connection */
 	TDSCURSOR *cursor;
+	/** converters for bound columns, allocated for num_fetch_cols columns */
+	ODBC_FETCH_COL *fetch_cols;
+	unsigned int num_fetch_cols;
 };
 
 typedef struct _henv TDS_ENV;
@@ -518,7 +544,11 @@ bool get_login_info(HWND hwndParent, TDSLOGIN * login);
 	ODBC_PARAM(ServerSPN) \
 	ODBC_PARAM(AttachDbFilename) \
 	ODBC_PARAM(ApplicationIntent) \
-	ODBC_PARAM(Timeout)
+	ODBC_PARAM(Timeout) \
+	ODBC_PARAM(StatementCacheSize) \
+	ODBC_PARAM(MultiSubnetFailover) \
+	ODBC_PARAM(ConnectRetryCount) \
+	ODBC_PARAM(ConnectRetryInterval)
 
 #define ODBC_PARAM(p) ODBC_PARAM_##p,
 enum {
@@ -555,6 +585,7 @@ int odbc_build_connect_string(TDS_ERRS *errs, TDS_PARSED_PARAM *params, char **o
  */
 SQLLEN odbc_tds2sql_col(TDS_STMT * stmt, TDSCOLUMN *curcol, int desttype, TDS_CHAR * dest, SQLULEN destlen, const struct _drecord *drec_ixd);
 SQLLEN odbc_tds2sql_int4(TDS_STMT * stmt, TDS_INT *src, int desttype, TDS_CHAR * dest, SQLULEN destlen);
+void odbc_tds2sql_prepare(TDS_STMT * stmt, TDSCOLUMN *curcol, int desttype, const struct _drecord *drec_ixd, ODBC_FETCH_COL *fc);
 
 
 
@@ -435,6 +435,18 @@ enum option_flag3_values {
 	TDS_EXTENSION			= 0x10, /* TDS 7.4 */
 };
 
+/* TDS 7.4 login feature extensions */
+enum tds_feature_ids {
+	TDS_FEATURE_SESSIONRECOVERY	= 0x01,
+	TDS_FEATURE_FEDAUTH		= 0x02,
+	TDS_FEATURE_COLUMNENCRYPTION	= 0x04,
+	TDS_FEATURE_GLOBALTRANSACTIONS	= 0x05,
+	TDS_FEATURE_AZURESQLSUPPORT	= 0x08,
+	TDS_FEATURE_DATACLASSIFICATION	= 0x09,
+	TDS_FEATURE_UTF8_SUPPORT	= 0x0a,
+	TDS_FEATURE_TERMINATOR		= 0xff,
+};
+
 enum type_flags {
 	TDS_OLEDB_ON	= 0x10,
 	TDS_READONLY_INTENT	= 0x20,
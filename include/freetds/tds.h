@@ -175,6 +175,7 @@ typedef struct tdsdaterec
  * precision.
  */
 extern const int tds_numeric_bytes_per_prec[];
+extern const char tds_digit_pairs[201];
 
 typedef int TDSRET;
 #define TDS_NO_MORE_RESULTS  ((TDSRET)1)
@@ -487,6 +488,18 @@ bool is_tds_type_valid(int type)
 #define TLS_STR_OPENSSL_CIPHERS "openssl ciphers"
 /* enable old TLS v1, required for instance if you are using a really old Windows XP */
 #define TDS_STR_ENABLE_TLS_V1 "enable tls v1"
+/* maximum number of free packets kept for reuse by a connection */
+#define TDS_STR_PACKET_POOL_SIZE "packet pool size"
+/* maximum number of prepared statements cached by a connection */
+#define TDS_STR_STMT_CACHE_SIZE "statement cache size"
+/* try all server addresses at the same time */
+#define TDS_STR_MULTI_SUBNET "multi subnet failover"
+/* file to save discovered TDS versions and instance ports */
+#define TDS_STR_DISCOVERY_FILE "discovery cache file"
+/* reconnections to try restoring the session of a broken idle connection */
+#define TDS_STR_RETRY_COUNT "connect retry count"
+/* seconds to wait between reconnections */
+#define TDS_STR_RETRY_INTERVAL "connect retry interval"
 
 
 /* TODO do a better check for alignment than this */
@@ -520,7 +533,7 @@ typedef struct tds_login
 	int block_size;
 	DSTR language;			/* e.g. us-english */
 	DSTR server_charset;		/**< charset of server e.g. iso_1 */
-	TDS_INT connect_timeout;
+	TDS_INT connect_timeout;	/**< connect timeout in milliseconds, 0 for none */
 	DSTR client_host_name;
 	DSTR server_host_name;
 	DSTR server_realm_name;		/**< server realm name (in freetds.conf) */
@@ -537,7 +550,7 @@ typedef struct tds_login
 	DSTR library;	/* Ct-Library, DB-Library,  TDS-Library or ODBC */
 	TDS_TINYINT encryption_level;
 
-	TDS_INT query_timeout;
+	TDS_INT query_timeout;		/**< query timeout in milliseconds, 0 for none */
 	TDS_CAPABILITIES capabilities;
 	DSTR client_charset;
 	DSTR database;
@@ -545,8 +558,13 @@ typedef struct tds_login
 	struct addrinfo *ip_addrs;	  		/**< ip(s) of server */
 	DSTR instance_name;
 	DSTR dump_file;
+	DSTR discovery_file;	/**< file to save protocol discovery, see discovery.c */
 	int debug_flags;
 	int text_size;
+	int packet_pool_size;		/**< free packets to keep for reuse, -1 if not specified */
+	int statement_cache_size;	/**< prepared statements to cache, -1 if not specified */
+	int connect_retry_count;	/**< reconnections to recover a broken session, -1 if not specified */
+	int connect_retry_interval;	/**< seconds between reconnections, -1 if not specified */
 	DSTR routing_address;
 	uint16_t routing_port;
 
@@ -566,6 +584,7 @@ typedef struct tds_login
 	unsigned int check_ssl_hostname:1;
 	unsigned int readonly_intent:1;
 	unsigned int enable_tls_v1:1;
+	unsigned int multi_subnet_failover:1;	/**< connect to all addresses in parallel */
 	unsigned int server_is_valid:1;
 } TDSLOGIN;
 
@@ -1006,8 +1025,30 @@ typedef struct tds_dynamic
 	TDSPARAMINFO *params;
 	/** saved query, we need to know original query if prepare is impossible */
 	char *query;
+	/**
+	 * key in connection statement cache (normalized query and parameter types),
+	 * NULL if not cached
+	 */
+	char *cache_key;
+	unsigned int cache_hash;
+	/** number of users of a dynamic shared using the statement cache */
+	unsigned int cache_users;
+	struct tds_dynamic *cache_next;	/**< next in cache hash bucket */
+	struct tds_dynamic *lru_prev;	/**< more recently used in cache */
+	struct tds_dynamic *lru_next;	/**< less recently used in cache */
 } TDSDYNAMIC;
 
+/** Prepared statements cached by a connection, looked up by query and parameter types */
+typedef struct tds_dynamic_cache
+{
+	TDSDYNAMIC **buckets;
+	unsigned int num_buckets;
+	unsigned int num_cached;
+	unsigned int max_cached;	/**< maximum number of statements, 0 to disable cache */
+	TDSDYNAMIC *lru_first;		/**< most recently used */
+	TDSDYNAMIC *lru_last;		/**< least recently used, first to be evicted */
+} TDSDYNAMICCACHE;
+
 typedef enum {
 	TDS_MULTIPLE_QUERY,
 	TDS_MULTIPLE_EXECUTE,
@@ -1072,6 +1113,30 @@ typedef struct tds_packet
 	unsigned char buf[1];
 } TDSPACKET;
 
+/** Number of size classes in packet pool, class n holds packets of at least 512 << n bytes */
+#define TDS_PACKET_POOL_CLASSES 8
+/** Default number of free packets kept by a connection */
+#define TDS_PACKET_POOL_DEFAULT 8
+
+/** Statistics about packet pool usage */
+typedef struct tds_packet_pool_stats
+{
+	TDS_UINT8 hits;		/**< packets reused from the pool */
+	TDS_UINT8 misses;	/**< packets allocated as pool could not satisfy the request */
+	TDS_UINT8 returned;	/**< packets given back to the pool */
+	TDS_UINT8 discarded;	/**< packets freed as pool was full */
+	unsigned cached;	/**< packets currently in the pool */
+} TDSPACKETPOOLSTATS;
+
+/** Free packets kept by a connection, split by size */
+typedef struct tds_packet_pool
+{
+	TDSPACKET *classes[TDS_PACKET_POOL_CLASSES];
+	unsigned num_cached;
+	unsigned max_cached;
+	TDSPACKETPOOLSTATS stats;
+} TDSPACKETPOOL;
+
 #if ENABLE_ODBC_MARS
 #define tds_packet_zero_data_start(pkt) do { (pkt)->data_start = 0; } while(0)
 #define tds_packet_get_data_start(pkt) ((pkt)->data_start)
@@ -1085,6 +1150,38 @@ typedef struct tds_poll_wakeup
 	TDS_SYS_SOCKET s_signal, s_signaled;
 } TDSPOLLWAKEUP;
 
+/** Session state reported by server, see SESSIONSTATE token */
+typedef struct tds_session_state
+{
+	struct tds_session_state *next;
+	TDS_UINT len;
+	TDS_TINYINT id;
+	unsigned char data[1];
+} TDSSESSIONSTATE;
+
+/** Information to restore the session of a broken connection (TDS 7.4) */
+typedef struct tds_session_recovery
+{
+	/** copy of login used to connect again, NULL if recovery is disabled */
+	TDSLOGIN *login;
+	/** database at login time */
+	char *database;
+	/** language at login time */
+	char *language;
+	/** collation at login time */
+	TDS_UCHAR collation[5];
+	/** states at login time, sent by server acknowledging the feature */
+	TDSSESSIONSTATE *initial_states;
+	/** states changed after login */
+	TDSSESSIONSTATE *states;
+	/** feature data to send during a recovery login */
+	unsigned char *data;
+	size_t data_len;
+	unsigned int acknowledged:1;	/**< server acknowledged session recovery */
+	unsigned int recoverable:1;	/**< server reported that session state can be restored */
+	unsigned int recovering:1;	/**< connecting again */
+} TDSSESSIONRECOVERY;
+
 /* field related to connection */
 struct tds_connection
 {
@@ -1109,6 +1206,8 @@ struct tds_connection
 	 * contains only dynamic allocated on the server
 	 */
 	TDSDYNAMIC *dyns;
+	/** prepared statements reusable by query text */
+	TDSDYNAMICCACHE dyn_cache;
 
 	int char_conv_count;
 	TDSICONV **char_convs;
@@ -1116,11 +1215,14 @@ struct tds_connection
 	TDS_UCHAR collation[5];
 	TDS_UCHAR tds72_transaction[8];
 
+	TDSSESSIONRECOVERY recovery;
+
 	TDS_CAPABILITIES capabilities;
 	unsigned int use_iconv:1;
 	unsigned int tds71rev1:1;
 	unsigned int pending_close:1;	/**< true is connection has pending closing (cursors or dynamic) */
 	unsigned int encrypt_single_packet:1;
+	unsigned int utf8_support:1;	/**< server acknowledged UTF-8 support (TDS 7.4) */
 #if ENABLE_ODBC_MARS
 	unsigned int mars:1;
 
@@ -1137,8 +1239,7 @@ struct tds_connection
 #endif
 	tds_mutex list_mtx;
 
-	unsigned num_cached_packets;
-	TDSPACKET *packet_cache;
+	TDSPACKETPOOL packet_pool;
 
 	int spid;
 	int client_spid;
@@ -1239,6 +1340,13 @@ struct tds_socket
 #endif
 	/* packet we received */
 	TDSPACKET *recv_packet;
+	/**
+	 * Packets already read but still referenced by row data.
+	 * See zero_copy.
+	 */
+	TDSPACKET *pinned_packets;
+	/** Number of column values pointing into recv_packet */
+	unsigned recv_packet_refs;
 	/** packet we are preparing to send */
 	TDSPACKET *send_packet;
 
@@ -1256,13 +1364,19 @@ struct tds_socket
 	bool bulk_query;		/**< true is query sent was a bulk query so we need to switch state to QUERYING */
 	bool has_status; 		/**< true is ret_status is valid */
 	bool in_row;			/**< true if we are getting rows */
+	bool decoding_row;		/**< true while reading row data from wire */
+	/**
+	 * true to allow row data to point directly into received packets.
+	 * Column data of a row is valid only till next row is read.
+	 */
+	bool zero_copy;
 	volatile 
 	unsigned char in_cancel; 	/**< indicate we are waiting a cancel reply; discard tokens till acknowledge; 
 	1 mean we have to send cancel packet, 2 already sent. */
 	TDS_INT ret_status;     	/**< return status from store procedure */
 	TDS_STATE state;
 
-	TDS_INT query_timeout;
+	TDS_INT query_timeout;		/**< query timeout in milliseconds, 0 for none */
 	TDS_INT8 rows_affected;		/**< rows updated/deleted/inserted/selected, TDS_NO_COUNT if not valid */
 
 	TDSDYNAMIC *cur_dyn;		/**< dynamic structure in use */
@@ -1305,6 +1419,7 @@ int tds_config_boolean(const char *option, const char *value, TDSLOGIN * login);
 
 TDSLOCALE *tds_get_locale(void);
 TDSRET tds_alloc_row(TDSRESULTINFO * res_info);
+void tds_reset_row_column_data(TDSRESULTINFO * res_info);
 TDSRET tds_alloc_compute_row(TDSCOMPUTEINFO * res_info);
 BCPCOLDATA * tds_alloc_bcp_column_data(unsigned int column_size);
 TDSDYNAMIC *tds_lookup_dynamic(TDSCONNECTION * conn, const char *id);
@@ -1353,6 +1468,8 @@ char *tds_alloc_lookup_sqlstate(TDSSOCKET * tds, int msgno);
 TDSLOGIN *tds_alloc_login(int use_environment);
 TDSDYNAMIC *tds_alloc_dynamic(TDSCONNECTION * conn, const char *id);
 void tds_free_login(TDSLOGIN * login);
+TDSLOGIN *tds_login_dup(const TDSLOGIN * login);
+void tds_free_session_states(TDSSESSIONSTATE * state);
 TDSLOGIN *tds_init_login(TDSLOGIN * login, TDSLOCALE * locale);
 TDSLOCALE *tds_alloc_locale(void);
 void *tds_alloc_param_data(TDSCOLUMN * curparam);
@@ -1369,6 +1486,26 @@ void * tds_realloc(void **pp, size_t new_size);
 #define tds_new(type, n) ((type *) malloc(sizeof(type) * (n)))
 #define tds_new0(type, n) ((type *) calloc(n, sizeof(type)))
 
+/**
+ * Region allocator.
+ * Allocations are served from large blocks; memory can be released
+ * all together (tds_arena_reset) or by single allocation.
+ * Initialize with all fields set to NULL.
+ */
+typedef struct tds_arena_block TDSARENABLOCK;
+typedef struct tds_arena
+{
+	/** blocks in use, first is the one serving allocations */
+	TDSARENABLOCK *blocks;
+	/** block kept for reuse */
+	TDSARENABLOCK *spare;
+} TDSARENA;
+
+void *tds_arena_alloc(TDSARENA * arena, size_t len);
+void tds_arena_release(TDSARENA * arena, void *ptr);
+void tds_arena_reset(TDSARENA * arena);
+void tds_arena_free(TDSARENA * arena);
+
 TDSPACKET *tds_alloc_packet(void *buf, unsigned len);
 TDSPACKET *tds_realloc_packet(TDSPACKET *packet, unsigned len);
 void tds_free_packets(TDSPACKET *packet);
@@ -1391,6 +1528,7 @@ bool tds_set_client_charset(TDSLOGIN * tds_login, const char *charset) TDS_WUR;
 bool tds_set_language(TDSLOGIN * tds_login, const char *language) TDS_WUR;
 void tds_set_version(TDSLOGIN * tds_login, TDS_TINYINT major_ver, TDS_TINYINT minor_ver);
 int tds_connect_and_login(TDSSOCKET * tds, TDSLOGIN * login);
+bool tds_recover_connection(TDSSOCKET * tds);
 
 
 /* query.c */
@@ -1444,7 +1582,30 @@ TDSRET tds_multiple_init(TDSSOCKET *tds, TDSMULTIPLE *multiple, TDS_MULTIPLE_TYP
 TDSRET tds_multiple_done(TDSSOCKET *tds, TDSMULTIPLE *multiple);
 TDSRET tds_multiple_query(TDSSOCKET *tds, TDSMULTIPLE *multiple, const char *query, TDSPARAMINFO * params);
 TDSRET tds_multiple_execute(TDSSOCKET *tds, TDSMULTIPLE *multiple, TDSDYNAMIC * dyn);
+TDSRET tds_multiple_rpc(TDSSOCKET *tds, TDSMULTIPLE *multiple, const char *rpc_name, TDSPARAMINFO * params);
+TDSRET tds_multiple_execdirect(TDSSOCKET *tds, TDSMULTIPLE *multiple, const char *query, TDSPARAMINFO * params);
+
 
+/* dynamic_cache.c */
+void tds_set_dynamic_cache_size(TDSCONNECTION *conn, unsigned int max_cached);
+TDSDYNAMIC *tds_dynamic_cache_get(TDSCONNECTION *conn, const char *query, TDSPARAMINFO *params);
+TDSRET tds_dynamic_cache_put(TDSCONNECTION *conn, TDSDYNAMIC *dyn, const char *query, TDSPARAMINFO *params);
+void tds_dynamic_cache_release(TDSCONNECTION *conn, TDSDYNAMIC **pdyn);
+void tds_dynamic_cache_remove(TDSCONNECTION *conn, TDSDYNAMIC *dyn);
+void tds_dynamic_cache_free(TDSCONNECTION *conn);
+
+/* discovery.c */
+/** Information discovered connecting to a server */
+typedef struct tds_discovery
+{
+	TDS_USMALLINT tds_version;	/**< TDS version detected, 0 if unknown */
+	int port;			/**< port of the instance, 0 if unknown */
+} TDSDISCOVERY;
+
+bool tds_discovery_get(const TDSLOGIN *login, int port, TDSDISCOVERY *info);
+void tds_discovery_set(const TDSLOGIN *login, int port, const TDSDISCOVERY *info);
+void tds_discovery_invalidate(const TDSLOGIN *login, int port);
+void tds_discovery_clear(void);
 
 /* token.c */
 TDSRET tds_process_cancel(TDSSOCKET * tds);
@@ -1454,6 +1615,24 @@ int tds5_send_optioncmd(TDSSOCKET * tds, TDS_OPTION_CMD tds_command, TDS_OPTION
 			TDS_INT * tds_argsize);
 TDSRET tds_process_tokens(TDSSOCKET * tds, /*@out@*/ TDS_INT * result_type, /*@out@*/ int *done_flags, unsigned flag);
 
+/**
+ * Column-major destination for tds_process_row_batch().
+ * Row \a n of a column is stored at \a values + n * \a stride.
+ */
+typedef struct tds_column_batch
+{
+	/** storage for values, rows * stride bytes. If NULL column data is discarded */
+	TDS_UCHAR *values;
+	/** size of every value slot */
+	TDS_UINT stride;
+	/** optional, lengths of values, -1 for NULL */
+	TDS_INT *lengths;
+	/** optional, bitmap of NULL values, bit set if NULL */
+	TDS_UCHAR *nulls;
+} TDSCOLUMNBATCH;
+
+TDSRET tds_process_row_batch(TDSSOCKET * tds, TDSCOLUMNBATCH * batch, TDS_UINT max_rows, /*@out@*/ TDS_UINT * rows_read);
+
 
 /* data.c */
 typedef struct tds_tvp_row
@@ -1558,7 +1737,7 @@ extern int tds_g_append_mode;
 
 
 /* net.c */
-TDSERRNO tds_open_socket(TDSSOCKET * tds, struct addrinfo *ipaddr, unsigned int port, int timeout, int *p_oserr);
+TDSERRNO tds_open_socket(TDSSOCKET * tds, struct addrinfo *ipaddr, unsigned int port, int timeout_ms, int *p_oserr);
 void tds_close_socket(TDSSOCKET * tds);
 int tds7_get_instance_ports(FILE *output, struct addrinfo *addr);
 int tds7_get_instance_port(struct addrinfo *addr, const char *instance);
@@ -1568,8 +1747,10 @@ int tds_connection_read(TDSSOCKET * tds, unsigned char *buf, int buflen);
 int tds_connection_write(TDSSOCKET *tds, const unsigned char *buf, int buflen, int final);
 #define TDSSELREAD  POLLIN
 #define TDSSELWRITE POLLOUT
-int tds_select(TDSSOCKET * tds, unsigned tds_sel, int timeout_seconds);
+int tds_select(TDSSOCKET * tds, unsigned tds_sel, int timeout_ms);
+bool tds_read_pending(TDSSOCKET * tds);
 void tds_connection_close(TDSCONNECTION *conn);
+bool tds_connection_closed(TDSCONNECTION *conn);
 int tds_goodread(TDSSOCKET * tds, unsigned char *buf, int buflen);
 int tds_goodwrite(TDSSOCKET * tds, const unsigned char *buffer, size_t buflen);
 void tds_socket_flush(TDS_SYS_SOCKET sock);
@@ -1585,6 +1766,11 @@ static inline TDS_SYS_SOCKET tds_wakeup_get_fd(const TDSPOLLWAKEUP *wakeup)
 
 /* packet.c */
 int tds_read_packet(TDSSOCKET * tds);
+void tds_release_row_packets(TDSSOCKET * tds);
+TDSPACKET *tds_get_packet(TDSCONNECTION *conn, unsigned len);
+void tds_put_packets(TDSCONNECTION *conn, TDSPACKET *packet);
+void tds_set_packet_pool_size(TDSCONNECTION *conn, unsigned max_cached);
+void tds_get_packet_pool_stats(TDSCONNECTION *conn, TDSPACKETPOOLSTATS *stats);
 TDSRET tds_write_packet(TDSSOCKET * tds, unsigned char final);
 #if ENABLE_ODBC_MARS
 int tds_append_cancel(TDSSOCKET *tds);
@@ -1643,6 +1829,8 @@ TDSRET tds_vstrbuild(char *buffer, int buflen, int *resultlen, const char *text,
 char *tds_money_to_string(const TDS_MONEY * money, char *s, bool use_2_digits);
 TDS_INT tds_numeric_to_string(const TDS_NUMERIC * numeric, char *s);
 TDS_INT tds_numeric_change_prec_scale(TDS_NUMERIC * numeric, unsigned char new_prec, unsigned char new_scale);
+bool tds_numeric_from_digits(TDS_NUMERIC * numeric, const char *digits, size_t num_digits,
+			     const char *decimals, size_t num_decimals);
 
 
 /* getmac.c */
@@ -1691,6 +1879,29 @@ typedef struct tds5_colinfo
 	TDS_INT length;
 } TDS5COLINFO;
 
+/** values of a column bound to an array, see tds_bcp_send_rows */
+typedef struct tds_bcp_array
+{
+	/** type of values, TDS_INVALID_TYPE if column is not bound (values are NULL) */
+	TDS_SERVER_TYPE type;
+	/** value of first row */
+	const TDS_CHAR *data;
+	/** bytes from a value to the value of next row */
+	TDS_INT stride;
+	/**
+	 * length of values, negative for NULL. If NULL values of variable
+	 * types are stride bytes long. Not used for fixed types.
+	 */
+	const TDS_INT *lengths;
+	/** NULL indicators, negative for NULL, can be NULL */
+	const TDS_SMALLINT *indicators;
+	/* following fields are set by tds_bcp_bind_array */
+	/** size of values of fixed types, 0 for variable types */
+	TDS_INT fixed_size;
+	/** type to convert values to, TDS_INVALID_TYPE if values are sent as they are */
+	TDS_SERVER_TYPE desttype;
+} TDSBCPARRAY;
+
 struct tds_bcpinfo
 {
 	const char *hint;
@@ -1704,12 +1915,16 @@ struct tds_bcpinfo
 	TDSRESULTINFO *bindinfo;
 	TDS5COLINFO *sybase_colinfo;
 	TDS_INT sybase_count;
+	/** columns bound to arrays, one for each column of bindinfo, NULL if none */
+	TDSBCPARRAY *arrays;
 };
 
 TDSRET tds_bcp_init(TDSSOCKET *tds, TDSBCPINFO *bcpinfo);
 typedef TDSRET (*tds_bcp_get_col_data) (TDSBCPINFO *bulk, TDSCOLUMN *bcpcol, int offset);
 typedef void (*tds_bcp_null_error)   (TDSBCPINFO *bulk, int index, int offset);
 TDSRET tds_bcp_send_record(TDSSOCKET *tds, TDSBCPINFO *bcpinfo, tds_bcp_get_col_data get_col_data, tds_bcp_null_error null_error, int offset);
+TDSRET tds_bcp_bind_array(TDSBCPINFO *bcpinfo, int column, const TDSBCPARRAY *array);
+TDSRET tds_bcp_send_rows(TDSSOCKET *tds, TDSBCPINFO *bcpinfo, tds_bcp_null_error null_error, int first, int num_rows);
 TDSRET tds_bcp_done(TDSSOCKET *tds, int *rows_copied);
 TDSRET tds_bcp_start(TDSSOCKET *tds, TDSBCPINFO *bcpinfo);
 TDSRET tds_bcp_start_copy_in(TDSSOCKET *tds, TDSBCPINFO *bcpinfo);
@@ -1717,6 +1932,31 @@ TDSRET tds_bcp_start_copy_in(TDSSOCKET *tds, TDSBCPINFO *bcpinfo);
 TDSRET tds_bcp_fread(TDSSOCKET * tds, TDSICONV * conv, FILE * stream,
 		     const char *terminator, size_t term_len, char **outbuf, size_t * outbytes);
 
+/** buffered reader of a BCP host file, returned data points into internal buffers */
+typedef struct tds_bcp_file
+{
+	/** file to read from, not owned */
+	FILE *f;
+	/** data read from file, data not consumed yet is from pos to len */
+	char *buf;
+	size_t pos, len, size;
+	/** file offset of buf[0] */
+	TDS_INT8 offset;
+	/** end of file reached */
+	bool eof;
+	/** buffer for converted fields */
+	void *conv_buf;
+	size_t conv_size;
+} TDSBCPFILE;
+
+TDSRET tds_bcp_file_init(TDSBCPFILE * file, FILE * f);
+void tds_bcp_file_free(TDSBCPFILE * file);
+const char *tds_bcp_file_get(TDSBCPFILE * file, size_t len);
+TDSRET tds_bcp_file_field(TDSSOCKET * tds, TDSICONV * conv, TDSBCPFILE * file,
+			  const char *terminator, size_t term_len, const char **outbuf, size_t * outbytes);
+TDS_INT8 tds_bcp_file_tell(const TDSBCPFILE * file);
+bool tds_bcp_file_seek(TDSBCPFILE * file, TDS_INT8 offset);
+
 TDSRET tds_writetext_start(TDSSOCKET *tds, const char *objname, const char *textptr, const char *timestamp, int with_log, TDS_UINT size);
 TDSRET tds_writetext_continue(TDSSOCKET *tds, const TDS_UCHAR *text, TDS_UINT size);
 TDSRET tds_writetext_end(TDSSOCKET *tds);
@@ -76,7 +76,7 @@ static inline int tds_raw_cond_wait(tds_condition *cond, tds_raw_mutex *mtx)
 {
 	return pthread_cond_wait(cond, mtx);
 }
-int tds_raw_cond_timedwait(tds_condition *cond, tds_raw_mutex *mtx, int timeout_sec);
+int tds_raw_cond_timedwait(tds_condition *cond, tds_raw_mutex *mtx, int timeout_ms);
 
 #define TDS_HAVE_MUTEX 1
 
@@ -188,7 +188,7 @@ typedef union {
 extern int (*tds_raw_cond_init)(tds_condition *cond);
 extern int (*tds_raw_cond_destroy)(tds_condition *cond);
 extern int (*tds_raw_cond_signal)(tds_condition *cond);
-extern int (*tds_raw_cond_timedwait)(tds_condition *cond, tds_raw_mutex *mtx, int timeout_sec);
+extern int (*tds_raw_cond_timedwait)(tds_condition *cond, tds_raw_mutex *mtx, int timeout_ms);
 static inline int tds_raw_cond_wait(tds_condition *cond, tds_raw_mutex *mtx)
 {
 	return tds_raw_cond_timedwait(cond, mtx, -1);
@@ -294,7 +294,7 @@ static inline int tds_raw_cond_destroy(tds_condition *cond)
 #define tds_raw_cond_wait(cond, mtx) \
 	FreeTDS_Condition_not_compiled
 
-#define tds_raw_cond_timedwait(cond, mtx, timeout_sec) \
+#define tds_raw_cond_timedwait(cond, mtx, timeout_ms) \
 	FreeTDS_Condition_not_compiled
 
 typedef struct {
@@ -416,12 +416,12 @@ static inline int tds_cond_wait(tds_condition *cond, tds_mutex *mtx)
 	return ret;
 }
 
-static inline int tds_cond_timedwait(tds_condition *cond, tds_mutex *mtx, int timeout_sec)
+static inline int tds_cond_timedwait(tds_condition *cond, tds_mutex *mtx, int timeout_ms)
 {
 	int ret;
 	assert(mtx && mtx->locked);
 	mtx->locked = 0;
-	ret = tds_raw_cond_timedwait(cond, &mtx->mtx, timeout_sec);
+	ret = tds_raw_cond_timedwait(cond, &mtx->mtx, timeout_ms);
 	mtx->locked = 1;
 	mtx->locked_by = tds_thread_get_current_id();
 	return ret;
@@ -55,6 +55,9 @@ extern "C" {
 #define SQL_INFO_FREETDS_TDS_VERSION	1300
 #define SQL_INFO_FREETDS_SOCKET	1301
 
+/* FreeTDS extension, like SQL_ATTR_QUERY_TIMEOUT but in milliseconds */
+#define SQL_SOPT_FREETDS_QUERY_TIMEOUT_MS	1310
+
 #ifndef SQL_MARS_ENABLED_NO
 #define SQL_MARS_ENABLED_NO	0
 #endif
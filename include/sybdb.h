@@ -890,11 +890,13 @@ void dbsetidle(DBPROCESS * dbprocess, DB_DBIDLE_FUNC idlefunc);
 void dbsetifile(char *filename);
 void dbsetinterrupt(DBPROCESS * dbproc, DB_DBCHKINTR_FUNC chkintr, DB_DBHNDLINTR_FUNC hndlintr);
 RETCODE dbsetlogintime(int seconds);
+RETCODE dbsetlogintime_ms(int milliseconds);
 RETCODE dbsetmaxprocs(int maxprocs);
 RETCODE dbsetnull(DBPROCESS * dbprocess, int bindtype, int bindlen, BYTE * bindval);
 RETCODE dbsetopt(DBPROCESS * dbproc, int option, const char *char_param, int int_param);
 STATUS dbsetrow(DBPROCESS * dbprocess, DBINT row);
 RETCODE dbsettime(int seconds);
+RETCODE dbsettime_ms(int milliseconds);
 void dbsetuserdata(DBPROCESS * dbproc, BYTE * ptr);
 RETCODE dbsetversion(DBINT version);
 
@@ -1316,11 +1318,13 @@ RETCODE bcp_colfmt_ps(DBPROCESS * dbproc, int host_column, int host_type, int ho
 RETCODE bcp_colptr(DBPROCESS * dbproc, BYTE * colptr, int table_column);
 RETCODE bcp_control(DBPROCESS * dbproc, int field, DBINT value);
 int bcp_getbatchsize(DBPROCESS * dbproc); /* FreeTDS only */
+RETCODE bcp_range(DBPROCESS * dbproc, DBBIGINT start, DBBIGINT end); /* FreeTDS only */
 RETCODE bcp_exec(DBPROCESS * dbproc, DBINT * rows_copied);
 DBBOOL bcp_getl(LOGINREC * login);
 RETCODE bcp_options(DBPROCESS * dbproc, int option, BYTE * value, int valuelen);
 RETCODE bcp_readfmt(DBPROCESS * dbproc, const char filename[]);
 RETCODE bcp_sendrow(DBPROCESS * dbproc);
+RETCODE bcp_sendrows(DBPROCESS * dbproc, DBINT nrows); /* FreeTDS only */
 
 #ifdef __cplusplus
 #if 0
@@ -57,11 +57,35 @@
 
 #include <freetds/tds.h>
 #include <freetds/utils.h>
+#include <freetds/thread.h>
 #include <freetds/replacements.h>
 #include <sybfront.h>
 #include <sybdb.h>
 #include "freebcp.h"
 
+#ifdef HAVE_FSEEKO
+typedef off_t offset_type;
+#elif defined(_WIN32) && defined(HAVE__FSEEKI64) && defined(HAVE__FTELLI64)
+typedef __int64 offset_type;
+#define fseeko(f,o,w) _fseeki64((f),o,w)
+#define ftello(f) _ftelli64((f))
+#else
+typedef long offset_type;
+#define fseeko(f,o,w) fseek(f,o,w)
+#define ftello(f) ftell(f)
+#endif
+
+/* a connection loading part of the host file */
+typedef struct
+{
+	BCPPARAMDATA params;
+	DBPROCESS *dbproc;
+	int ok;
+#ifdef TDS_HAVE_MUTEX
+	tds_thread thread;
+#endif
+} BCPWORKER;
+
 void pusage(void);
 int process_parameters(int, char **, struct pd *);
 static int unescape(char arg[]);
@@ -76,6 +100,7 @@ int err_handler(DBPROCESS * dbproc, int severity, int dberr, int oserr, char *db
 int msg_handler(DBPROCESS * dbproc, DBINT msgno, int msgstate, int severity, char *msgtext, char *srvname, char *procname,
 		int line);
 static int set_bcp_hints(BCPPARAMDATA *pdata, DBPROCESS *pdbproc);
+static int file_parallel(BCPPARAMDATA * pdata);
 
 int
 main(int argc, char **argv)
@@ -102,10 +127,16 @@ main(int argc, char **argv)
 		fprintf(stderr, "User name: \"%s\"\n", params.user);
 	}
 
+	if (params.jobs > 1) {
+		ok = file_parallel(&params);
+		exit((ok == TRUE) ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
 
 	if (login_to_database(&params, &dbproc) == FALSE) {
 		exit(EXIT_FAILURE);
 	}
+	if (params.pass)
+		memset(params.pass, 0, strlen(params.pass));
 
 	if (!setoptions(dbproc, &params))
 		return FALSE;
@@ -213,7 +244,7 @@ process_parameters(int argc, char **argv, BCPPARAMDATA *pdata)
 	 * Get the rest of the arguments
 	 */
 	optind = 4; /* start processing options after table, direction, & filename */
-	while ((ch = getopt(argc, argv, "m:f:e:F:L:b:t:r:U:P:i:I:S:h:T:A:o:O:0:C:ncEdvVD:")) != -1) {
+	while ((ch = getopt(argc, argv, "m:f:e:F:L:b:t:r:U:P:i:I:S:h:T:A:o:O:0:C:j:ncEdvVD:")) != -1) {
 		switch (ch) {
 		case 'v':
 		case 'V':
@@ -313,6 +344,9 @@ process_parameters(int argc, char **argv, BCPPARAMDATA *pdata)
 		case 'C':
 			pdata->charset = strdup(optarg);
 			break;
+		case 'j':
+			pdata->jobs = atoi(optarg);
+			break;
 		case '?':
 		default:
 			pusage();
@@ -342,6 +376,18 @@ process_parameters(int argc, char **argv, BCPPARAMDATA *pdata)
 		return (FALSE);
 	}
 
+	/* Parallel copy splits the host file at row terminators */
+	if (pdata->jobs > 1) {
+		if (pdata->direction != DB_IN || !pdata->cflag) {
+			fprintf(stderr, "-j can only be used to copy in a character mode file (-c).\n");
+			return (FALSE);
+		}
+		if (pdata->Fflag || pdata->Lflag) {
+			fprintf(stderr, "-j cannot be used with -F or -L.\n");
+			return (FALSE);
+		}
+	}
+
 	/* Character mode file: fill in default values */
 	if (pdata->cflag) {
 
@@ -413,10 +459,8 @@ login_to_database(BCPPARAMDATA * pdata, DBPROCESS ** pdbproc)
 
 	if (pdata->user)
 		DBSETLUSER(login, pdata->user);
-	if (pdata->pass) {
+	if (pdata->pass)
 		DBSETLPWD(login, pdata->pass);
-		memset(pdata->pass, 0, strlen(pdata->pass));
-	}
 
 	DBSETLAPP(login, "FreeBCP");
 	if (pdata->charset)
@@ -463,6 +507,9 @@ file_character(BCPPARAMDATA * pdata, DBPROCESS * dbproc, DBINT dir)
 	if (!set_bcp_hints(pdata, dbproc))
 		return FALSE;
 
+	if (pdata->worker && bcp_range(dbproc, pdata->range_start, pdata->range_end) == FAIL)
+		return FALSE;
+
 	if (pdata->Eflag) {
 
 		bcp_control(dbproc, BCPKEEPIDENTITY, 1);
@@ -534,14 +581,17 @@ file_character(BCPPARAMDATA * pdata, DBPROCESS * dbproc, DBINT dir)
 
 	bcp_control(dbproc, BCPBATCH, pdata->batchsize);
 
-	printf("\nStarting copy...\n");
+	if (!pdata->worker)
+		printf("\nStarting copy...\n");
 
 	if (FAIL == bcp_exec(dbproc, &li_rowsread)) {
 		fprintf(stderr, "bcp copy %s failed\n", (dir == DB_IN) ? "in" : "out");
 		return FALSE;
 	}
 
-	printf("%d rows copied.\n", li_rowsread);
+	pdata->rows_copied = li_rowsread;
+	if (!pdata->worker)
+		printf("%d rows copied.\n", li_rowsread);
 
 	return TRUE;
 }
@@ -689,6 +739,163 @@ file_formatted(BCPPARAMDATA * pdata, DBPROCESS * dbproc, DBINT dir)
 }
 
 
+/*
+ * Find the start of the first row at or after offset.
+ * Returns the file size if there are no more rows, -1 on error.
+ */
+static offset_type
+find_row_start(FILE *f, offset_type offset, const char *rowterm, int rowtermlen)
+{
+	char buf[0x10000];
+	size_t len = 0, keep;
+	offset_type pos = offset > rowtermlen ? offset - rowtermlen : 0;
+
+	if (fseeko(f, pos, SEEK_SET) != 0)
+		return -1;
+
+	for (;;) {
+		const char *p, *end;
+		size_t readed = fread(buf + len, 1, sizeof(buf) - len, f);
+
+		if (readed == 0)
+			return ferror(f) ? -1 : pos + (offset_type) len;
+		len += readed;
+
+		end = buf + len;
+		for (p = buf; (p = (const char *) memchr(p, rowterm[0], end - p)) != NULL; ++p) {
+			if ((size_t) (end - p) < (size_t) rowtermlen)
+				break;
+			if (memcmp(p, rowterm, rowtermlen) == 0)
+				return pos + (p - buf) + rowtermlen;
+		}
+
+		/* keep a possible partial terminator */
+		keep = len < (size_t) rowtermlen ? len : rowtermlen - 1;
+		memmove(buf, buf + len - keep, keep);
+		pos += len - keep;
+		len = keep;
+	}
+}
+
+static TDS_THREAD_PROC_DECLARE(worker_proc, arg)
+{
+	BCPWORKER *worker = (BCPWORKER *) arg;
+
+	worker->ok = file_character(&worker->params, worker->dbproc, DB_IN);
+	return TDS_THREAD_RESULT(0);
+}
+
+/*
+ * Copy a character mode file using pdata->jobs connections.
+ * The file is split in ranges of about the same size ending at row terminators,
+ * each range is loaded by its own connection.
+ */
+static int
+file_parallel(BCPPARAMDATA * pdata)
+{
+	BCPWORKER *workers;
+	FILE *f;
+	offset_type size, start, end;
+	int i, ok = TRUE, started = 0;
+	DBINT total = 0;
+
+	if ((f = fopen(pdata->hostfilename, "rb")) == NULL) {
+		fprintf(stderr, "%s: unable to open %s: %s\n", "freebcp", pdata->hostfilename, strerror(errno));
+		return FALSE;
+	}
+	if (fseeko(f, 0, SEEK_END) != 0 || (size = ftello(f)) < 0) {
+		fprintf(stderr, "%s: unable to seek %s: %s\n", "freebcp", pdata->hostfilename, strerror(errno));
+		fclose(f);
+		return FALSE;
+	}
+
+	workers = tds_new0(BCPWORKER, pdata->jobs);
+	if (!workers) {
+		fprintf(stderr, "Out of memory!\n");
+		fclose(f);
+		return FALSE;
+	}
+
+	/* split file */
+	start = 0;
+	for (i = 0; i < pdata->jobs; ++i) {
+		BCPWORKER *worker = &workers[i];
+
+		worker->params = *pdata;
+		worker->params.worker = i + 1;
+		worker->params.range_start = start;
+		worker->params.range_end = -1;
+		worker->params.errorfile = NULL;
+		if (i + 1 < pdata->jobs) {
+			end = find_row_start(f, size / pdata->jobs * (i + 1), pdata->rowterm, pdata->rowtermlen);
+			if (end < 0) {
+				fprintf(stderr, "%s: error reading %s: %s\n", "freebcp", pdata->hostfilename, strerror(errno));
+				ok = FALSE;
+				break;
+			}
+			if (end < start)
+				end = start;
+			worker->params.range_end = end;
+			start = end;
+		}
+		/* every connection writes its own error file */
+		if (pdata->errorfile && asprintf(&worker->params.errorfile, "%s.%d", pdata->errorfile, i + 1) < 0) {
+			fprintf(stderr, "Out of memory!\n");
+			ok = FALSE;
+			break;
+		}
+	}
+	fclose(f);
+
+	/* connect all workers, password is cleared after all logins */
+	for (i = 0; ok && i < pdata->jobs; ++i) {
+		if (login_to_database(&workers[i].params, &workers[i].dbproc) == FALSE
+		    || !setoptions(workers[i].dbproc, &workers[i].params))
+			ok = FALSE;
+	}
+	if (pdata->pass)
+		memset(pdata->pass, 0, strlen(pdata->pass));
+
+	if (ok) {
+		printf("\nStarting copy using %d connections...\n", pdata->jobs);
+		for (; started < pdata->jobs; ++started) {
+#ifdef TDS_HAVE_MUTEX
+			if (tds_thread_create(&workers[started].thread, worker_proc, &workers[started]) != 0) {
+				fprintf(stderr, "Error creating thread\n");
+				ok = FALSE;
+				break;
+			}
+#else
+			worker_proc(&workers[started]);
+#endif
+		}
+	}
+
+	for (i = 0; i < pdata->jobs; ++i) {
+		BCPWORKER *worker = &workers[i];
+
+#ifdef TDS_HAVE_MUTEX
+		if (i < started)
+			tds_thread_join(worker->thread, NULL);
+#endif
+		if (i < started) {
+			if (!worker->ok)
+				ok = FALSE;
+			printf("Connection %d: %d rows copied.\n", i + 1, worker->params.rows_copied);
+			total += worker->params.rows_copied;
+		}
+		if (worker->dbproc)
+			dbclose(worker->dbproc);
+		free(worker->params.errorfile);
+	}
+	free(workers);
+
+	if (started)
+		printf("%d rows copied.\n", total);
+	return ok;
+}
+
+
 int
 setoptions(DBPROCESS * dbproc, BCPPARAMDATA * params)
 {
@@ -774,11 +981,16 @@ pusage(void)
 	fprintf(stderr, "        [-U username] [-P password] [-I interfaces_file] [-S server] [-D database]\n");
 	fprintf(stderr, "        [-v] [-d] [-h \"hint [,...]\" [-O \"set connection_option on|off, ...]\"\n");
 	fprintf(stderr, "        [-A packet size] [-T text or image size] [-E]\n");
-	fprintf(stderr, "        [-i input_file] [-o output_file]\n");
+	fprintf(stderr, "        [-i input_file] [-o output_file] [-j connections]\n");
 	fprintf(stderr, "        \n");
 	fprintf(stderr, "example: freebcp testdb.dbo.inserttest in inserttest.txt -S mssql -U guest -P password -c\n");
 }
 
+#ifdef TDS_HAVE_MUTEX
+/* protect progress from parallel connections */
+static tds_mutex progress_mtx = TDS_MUTEX_INITIALIZER;
+#endif
+
 int
 err_handler(DBPROCESS * dbproc, int severity, int dberr, int oserr, char *dberrstr, char *oserrstr)
 {
@@ -786,7 +998,13 @@ err_handler(DBPROCESS * dbproc, int severity, int dberr, int oserr, char *dberrs
 
 	if (dberr == SYBEBBCI) { /* Batch successfully bulk copied to the server */
 		int batch = bcp_getbatchsize(dbproc);
+#ifdef TDS_HAVE_MUTEX
+		tds_mutex_lock(&progress_mtx);
+#endif
 		printf("%d rows sent to SQL Server.\n", sent += batch);
+#ifdef TDS_HAVE_MUTEX
+		tds_mutex_unlock(&progress_mtx);
+#endif
 		return INT_CANCEL;
 	}
 
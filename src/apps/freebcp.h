@@ -70,5 +70,13 @@ typedef struct pd
 	int Eflag;
 	char *inputfile;
 	char *outputfile;
+	/* number of connections loading the file in parallel */
+	int jobs;
+	/* worker number, 0 if not running in parallel */
+	int worker;
+	/* byte range of the host file loaded by a worker */
+	DBBIGINT range_start;
+	DBBIGINT range_end;
+	DBINT rows_copied;
 }
 BCPPARAMDATA;
@@ -42,6 +42,7 @@ static void _blk_null_error(TDSBCPINFO *bcpinfo, int index, int offset);
 static TDSRET _blk_get_col_data(TDSBCPINFO *bulk, TDSCOLUMN *bcpcol, int offset);
 static CS_RETCODE _blk_rowxfer_in(CS_BLKDESC * blkdesc, CS_INT rows_to_xfer, CS_INT * rows_xferred);
 static CS_RETCODE _blk_rowxfer_out(CS_BLKDESC * blkdesc, CS_INT rows_to_xfer, CS_INT * rows_xferred);
+static bool _blk_bind_arrays(CS_BLKDESC * blkdesc, CS_INT rows_to_xfer);
 
 #define CONN(bulk) ((CS_CONNECTION *) (bulk)->bcpinfo.parent)
 
@@ -590,6 +591,14 @@ _blk_rowxfer_in(CS_BLKDESC * blkdesc, CS_INT rows_to_xfer, CS_INT * rows_xferred
 		blkdesc->bcpinfo.xfer_init = 1;
 	} 
 
+	/* send all rows at once if no conversions are needed */
+	if (_blk_bind_arrays(blkdesc, rows_to_xfer)) {
+		if (TDS_FAILED(tds_bcp_send_rows(tds, &blkdesc->bcpinfo, _blk_null_error, 0, rows_to_xfer)))
+			return CS_FAIL;
+		*rows_xferred = rows_to_xfer;
+		return CS_SUCCEED;
+	}
+
 	for (each_row = 0; each_row < rows_to_xfer; each_row++ ) {
 
 		if (tds_bcp_send_record(tds, &blkdesc->bcpinfo, _blk_get_col_data, _blk_null_error, each_row) == TDS_SUCCESS) {
@@ -600,6 +609,62 @@ _blk_rowxfer_in(CS_BLKDESC * blkdesc, CS_INT rows_to_xfer, CS_INT * rows_xferred
 	return CS_SUCCEED;
 }
 
+/**
+ * Bind columns to the arrays given to blk_bind to send rows with tds_bcp_send_rows.
+ * Only bindings with values which can be sent as they are and with the
+ * same meaning of lengths and indicators of _blk_get_col_data are used.
+ * \return true if all columns were bound
+ */
+static bool
+_blk_bind_arrays(CS_BLKDESC * blkdesc, CS_INT rows_to_xfer)
+{
+	TDSBCPINFO *bcpinfo = &blkdesc->bcpinfo;
+	TDSBCPARRAY array;
+	int i;
+	CS_INT row;
+
+	for (i = 0; i < bcpinfo->bindinfo->num_cols; i++) {
+		TDSCOLUMN *bindcol = bcpinfo->bindinfo->columns[i];
+		bool fixed;
+
+		if (!bindcol->column_varaddr)
+			return false;
+
+		memset(&array, 0, sizeof(array));
+		array.type = _ct_get_server_type(NULL, bindcol->column_bindtype);
+		if (array.type == TDS_INVALID_TYPE)
+			return false;
+		array.data = (const TDS_CHAR *) bindcol->column_varaddr;
+		array.stride = bindcol->column_bindlen;
+		array.lengths = bindcol->column_lenbind;
+		array.indicators = bindcol->column_nullbind;
+		if (TDS_FAILED(tds_bcp_bind_array(bcpinfo, i, &array))
+		    || bcpinfo->arrays[i].desttype != TDS_INVALID_TYPE)
+			return false;
+
+		fixed = bcpinfo->arrays[i].fixed_size > 0;
+		if (!fixed && !bindcol->column_lenbind)
+			return false;
+
+		/* a value is NULL only if its length is 0 and indicator -1 */
+		for (row = 0; row < rows_to_xfer; row++) {
+			CS_INT srclen = 0;
+			CS_SMALLINT ind = bindcol->column_nullbind ? bindcol->column_nullbind[row] : 0;
+
+			if (bindcol->column_lenbind) {
+				srclen = bindcol->column_lenbind[row];
+				if (srclen == CS_UNUSED && fixed)
+					srclen = bcpinfo->arrays[i].fixed_size;
+			}
+			if ((srclen == 0 && ind == -1) != (ind < 0 || (!fixed && srclen < 0)))
+				return false;
+			if (!fixed && srclen > bindcol->on_server.column_size)
+				return false;
+		}
+	}
+	return true;
+}
+
 static void
 _blk_null_error(TDSBCPINFO *bcpinfo, int index, int offset)
 {
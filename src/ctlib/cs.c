@@ -338,6 +338,7 @@ cs_ctx_alloc(CS_INT version, CS_CONTEXT ** out_ctx)
 
 	ctx->login_timeout = -1;
 	ctx->query_timeout = -1;
+	ctx->netio = CS_SYNC_IO;
 
 	*out_ctx = ctx;
 	return CS_SUCCEED;
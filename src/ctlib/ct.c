@@ -24,6 +24,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <assert.h>
+#include <limits.h>
 
 #if HAVE_STDLIB_H
 #include <stdlib.h>
@@ -33,6 +34,10 @@
 #include <string.h>
 #endif /* HAVE_STRING_H */
 
+#if HAVE_POLL_H
+#include <poll.h>
+#endif /* HAVE_POLL_H */
+
 #include "ctpublic.h"
 #include "ctlib.h"
 #include <freetds/utils/string.h>
@@ -55,6 +60,14 @@ static int _ct_fill_param(CS_INT cmd_type, CS_PARAM * param, CS_DATAFMT * datafm
 static void _ct_initialise_cmd(CS_COMMAND *cmd);
 static CS_RETCODE _ct_cancel_cleanup(CS_COMMAND * cmd);
 static CS_INT _ct_map_compute_op(CS_INT comp_op);
+static int _ct_timeout_to_ms(CS_INT seconds);
+static CS_INT _ct_timeout_from_ms(int ms);
+static CS_RETCODE _ct_send(CS_COMMAND * cmd);
+static CS_RETCODE _ct_results(CS_COMMAND * cmd, CS_INT * result_type);
+static CS_RETCODE _ct_fetch(CS_COMMAND * cmd, CS_INT type, CS_INT offset, CS_INT option, CS_INT * prows_read);
+static bool _ct_is_async(CS_CONNECTION * con);
+static CS_RETCODE _ct_async_start(CS_COMMAND * cmd, CS_INT function);
+static void _ct_async_cancel(CS_CONNECTION * con, CS_COMMAND * cmd);
 
 /* Added for CT_DIAG */
 /* Code changes starts here - CT_DIAG - 01 */
@@ -81,6 +94,26 @@ static CS_DYNAMIC * _ct_locate_dynamic(CS_CONNECTION * con, char *id, int idlen)
 
 /* RPC Code changes ends here */
 
+/* convert a timeout from seconds to milliseconds, special values are kept */
+static int
+_ct_timeout_to_ms(CS_INT seconds)
+{
+	if (seconds <= 0)
+		return seconds;
+	if (seconds > INT_MAX / 1000)
+		return INT_MAX;
+	return seconds * 1000;
+}
+
+/* convert a timeout from milliseconds to seconds rounding up, special values are kept */
+static CS_INT
+_ct_timeout_from_ms(int ms)
+{
+	if (ms <= 0)
+		return ms;
+	return (CS_INT) ((ms + 999u) / 1000u);
+}
+
 static const char *
 _ct_get_layer(int layer)
 {
@@ -293,6 +326,9 @@ ct_con_alloc(CS_CONTEXT * ctx, CS_CONNECTION ** con)
 
 	/* so we know who we belong to */
 	(*con)->ctx = ctx;
+	(*con)->netio = ctx->netio;
+	(*con)->next = ctx->conns;
+	ctx->conns = *con;
 
 	/* tds_set_packet((*con)->tds_login, TDS_DEF_BLKSZ); */
 	return CS_SUCCEED;
@@ -318,6 +354,9 @@ ct_callback(CS_CONTEXT * ctx, CS_CONNECTION * con, CS_INT action, CS_INT type, C
 		case CS_SERVERMSG_CB:
 			*(void **) func = (CS_VOID *) (con ? con->_servermsg_cb : ctx->_servermsg_cb);
 			return CS_SUCCEED;
+		case CS_COMPLETION_CB:
+			*(void **) func = (CS_VOID *) (con ? con->_completion_cb : ctx->_completion_cb);
+			return CS_SUCCEED;
 		default:
 			fprintf(stderr, "Unknown callback %d\n", type);
 			*(void **) func = NULL;
@@ -338,6 +377,12 @@ ct_callback(CS_CONTEXT * ctx, CS_CONNECTION * con, CS_INT action, CS_INT type, C
 		else
 			ctx->_servermsg_cb = (CS_SERVERMSG_FUNC) funcptr;
 		break;
+	case CS_COMPLETION_CB:
+		if (con)
+			con->_completion_cb = (CS_COMPLETION_FUNC) (void (*)(void)) funcptr;
+		else
+			ctx->_completion_cb = (CS_COMPLETION_FUNC) (void (*)(void)) funcptr;
+		break;
 	}
 	return CS_SUCCEED;
 }
@@ -500,18 +545,24 @@ ct_con_props(CS_CONNECTION * con, CS_INT action, CS_INT property, CS_VOID * buff
 			}
 			break;
 		case CS_TIMEOUT:
-			/* set the query timeout as an integer in seconds */
+		case CS_TIMEOUT_MS:
+			/* set the query timeout as an integer in seconds (or milliseconds) */
 		        tds_login->query_timeout = *(CS_INT *) buffer;
 			if (tds_login->query_timeout == CS_NO_LIMIT)
 				tds_login->query_timeout = 0;
+			else if (property == CS_TIMEOUT)
+				tds_login->query_timeout = _ct_timeout_to_ms(tds_login->query_timeout);
 			if (tds)
 				tds->query_timeout = tds_login->query_timeout;
 			break;
 		case CS_LOGIN_TIMEOUT:
-			/* set the connect timeout as an integer in seconds */
+		case CS_LOGIN_TIMEOUT_MS:
+			/* set the connect timeout as an integer in seconds (or milliseconds) */
 		        tds_login->connect_timeout = *(CS_INT *) buffer;
 			if (tds_login->connect_timeout == CS_NO_LIMIT)
 				tds_login->connect_timeout = 0;
+			else if (property == CS_LOGIN_TIMEOUT)
+				tds_login->connect_timeout = _ct_timeout_to_ms(tds_login->connect_timeout);
 			break;
 		case CS_SEC_NETWORKAUTH:
 			con->network_auth = !!(*(CS_INT *) buffer);
@@ -522,6 +573,14 @@ ct_con_props(CS_CONNECTION * con, CS_INT action, CS_INT property, CS_VOID * buff
 		case CS_SEC_DELEGATION:
 		        tds_login->gssapi_use_delegation = !!(*(CS_INT *) buffer);
 			break;
+		case CS_NETIO:
+			intval = *(CS_INT *) buffer;
+			if (intval != CS_SYNC_IO && intval != CS_ASYNC_IO && intval != CS_DEFER_IO)
+				return CS_FAIL;
+			if (con->async.function)
+				return CS_FAIL;
+			con->netio = intval;
+			break;
 		default:
 			tdsdump_log(TDS_DBG_ERROR, "Unknown property %d\n", property);
 			break;
@@ -638,15 +697,28 @@ ct_con_props(CS_CONNECTION * con, CS_INT action, CS_INT property, CS_VOID * buff
 			*(CS_CONTEXT **) buffer = con->ctx;
 			break;
 		case CS_TIMEOUT:
+		        *(CS_INT *) buffer = _ct_timeout_from_ms(tds_login->query_timeout);
+			if (tds_login->query_timeout == 0)
+				*(CS_INT *) buffer = CS_NO_LIMIT;
+			break;
+		case CS_TIMEOUT_MS:
 		        *(CS_INT *) buffer = tds_login->query_timeout;
 			if (tds_login->query_timeout == 0)
 				*(CS_INT *) buffer = CS_NO_LIMIT;
 			break;
 		case CS_LOGIN_TIMEOUT:
+		        *(CS_INT *) buffer = _ct_timeout_from_ms(tds_login->connect_timeout);
+			if (tds_login->connect_timeout == 0)
+				*(CS_INT *) buffer = CS_NO_LIMIT;
+			break;
+		case CS_LOGIN_TIMEOUT_MS:
 		        *(CS_INT *) buffer = tds_login->connect_timeout;
 			if (tds_login->connect_timeout == 0)
 				*(CS_INT *) buffer = CS_NO_LIMIT;
 			break;
+		case CS_NETIO:
+			*(CS_INT *) buffer = con->netio;
+			break;
 		default:
 			tdsdump_log(TDS_DBG_ERROR, "Unknown property %d\n", property);
 			break;
@@ -939,6 +1011,23 @@ _ct_initialise_cmd(CS_COMMAND *cmd)
 
 CS_RETCODE
 ct_send(CS_COMMAND * cmd)
+{
+	CS_RETCODE ret;
+
+	if (!cmd || !cmd->con || !_ct_is_async(cmd->con))
+		return _ct_send(cmd);
+
+	/* request is written now, completion is reported by ct_poll */
+	ret = _ct_async_start(cmd, CT_SEND);
+	if (ret == CS_PENDING) {
+		cmd->con->async.status = _ct_send(cmd);
+		cmd->con->async.completed = true;
+	}
+	return ret;
+}
+
+static CS_RETCODE
+_ct_send(CS_COMMAND * cmd)
 {
 	TDSSOCKET *tds;
 	TDSPARAMINFO *pparam_info;
@@ -1194,6 +1283,20 @@ ct_send(CS_COMMAND * cmd)
 
 CS_RETCODE
 ct_results(CS_COMMAND * cmd, CS_INT * result_type)
+{
+	CS_RETCODE ret;
+
+	if (!cmd->con || !_ct_is_async(cmd->con))
+		return _ct_results(cmd, result_type);
+
+	ret = _ct_async_start(cmd, CT_RESULTS);
+	if (ret == CS_PENDING)
+		cmd->con->async.result_type = result_type;
+	return ret;
+}
+
+static CS_RETCODE
+_ct_results(CS_COMMAND * cmd, CS_INT * result_type)
 {
 	TDSSOCKET *tds;
 	CS_CONTEXT *context;
@@ -1611,6 +1714,26 @@ ct_bind(CS_COMMAND * cmd, CS_INT item, CS_DATAFMT * datafmt, CS_VOID * buffer, C
 
 CS_RETCODE
 ct_fetch(CS_COMMAND * cmd, CS_INT type, CS_INT offset, CS_INT option, CS_INT * prows_read)
+{
+	CS_RETCODE ret;
+	CT_ASYNC *async;
+
+	if (!cmd->con || !_ct_is_async(cmd->con))
+		return _ct_fetch(cmd, type, offset, option, prows_read);
+
+	ret = _ct_async_start(cmd, CT_FETCH);
+	if (ret == CS_PENDING) {
+		async = &cmd->con->async;
+		async->fetch_type = type;
+		async->fetch_offset = offset;
+		async->fetch_option = option;
+		async->rows_read = prows_read;
+	}
+	return ret;
+}
+
+static CS_RETCODE
+_ct_fetch(CS_COMMAND * cmd, CS_INT type, CS_INT offset, CS_INT option, CS_INT * prows_read)
 {
 	TDS_INT ret_type;
 	TDSRET ret;
@@ -1929,6 +2052,12 @@ ct_cmd_drop(CS_COMMAND * cmd)
 		if (con) {
 			CS_COMMAND **pvictim;
 
+			/* a pending operation cannot complete without its command */
+			if (con->async.cmd == cmd) {
+				con->async.function = 0;
+				con->async.cmd = NULL;
+			}
+
 			for (pvictim = &con->cmds; *pvictim != cmd; ) {
 				if (!*pvictim) {
 					tdsdump_log(TDS_DBG_FUNC, "ct_cmd_drop() : cannot find command entry in list \n");
@@ -1951,6 +2080,9 @@ ct_close(CS_CONNECTION * con, CS_INT option)
 {
 	tdsdump_log(TDS_DBG_FUNC, "ct_close(%p, %d)\n", con, option);
 
+	/* pending operations cannot complete anymore */
+	con->async.function = 0;
+	con->async.cmd = NULL;
 	tds_close_socket(con->tds_socket);
 	tds_free_socket(con->tds_socket);
 	con->tds_socket = NULL;
@@ -1961,10 +2093,16 @@ CS_RETCODE
 ct_con_drop(CS_CONNECTION * con)
 {
 	CS_COMMAND *cmd, *next_cmd;
+	CS_CONNECTION **pcon;
 
 	tdsdump_log(TDS_DBG_FUNC, "ct_con_drop(%p)\n", con);
 
 	if (con) {
+		for (pcon = &con->ctx->conns; *pcon; pcon = &(*pcon)->next)
+			if (*pcon == con) {
+				*pcon = con->next;
+				break;
+			}
 		free(con->userdata);
 		if (con->tds_login)
 			tds_free_login(con->tds_login);
@@ -2215,7 +2353,7 @@ ct_cancel(CS_CONNECTION * conn, CS_COMMAND * cmd, CS_INT type)
 
 		tdsdump_log(TDS_DBG_FUNC, "ct_cancel() - fetching results()\n");
 		do {
-			ret = ct_fetch(cmd, CS_UNUSED, CS_UNUSED, CS_UNUSED, NULL);
+			ret = _ct_fetch(cmd, CS_UNUSED, CS_UNUSED, CS_UNUSED, NULL);
 		} while ((ret == CS_SUCCEED) || (ret == CS_ROW_FAIL));
 
 		if (cmd->con && cmd->con->tds_socket)
@@ -2337,6 +2475,7 @@ ct_cancel(CS_CONNECTION * conn, CS_COMMAND * cmd, CS_INT type)
 		if (cmd) {
 			tdsdump_log(TDS_DBG_FUNC, "CS_CANCEL_ALL with cmd\n");
 			cmd_conn = cmd->con;
+			_ct_async_cancel(cmd_conn, cmd);
 			switch (cmd->command_state) {
 				case _CS_COMMAND_IDLE:
 				case _CS_COMMAND_BUILDING:
@@ -2356,6 +2495,7 @@ ct_cancel(CS_CONNECTION * conn, CS_COMMAND * cmd, CS_INT type)
 		}
 		if (conn) {
 			tdsdump_log(TDS_DBG_FUNC, "CS_CANCEL_ALL with connection\n");
+			_ct_async_cancel(conn, NULL);
 			for (cmds = conn->cmds; cmds != NULL; cmds = cmds->next) {
 				tdsdump_log(TDS_DBG_FUNC, "ct_cancel() cancelling a command for a connection\n");
 				conn_cmd = cmds;
@@ -2593,10 +2733,10 @@ ct_config(CS_CONTEXT * ctx, CS_INT action, CS_INT property, CS_VOID * buffer, CS
 	case CS_TIMEOUT:
 		switch (action) {
 		case CS_SET:
-			ctx->query_timeout = *((unsigned int*)buf);
+			ctx->query_timeout = _ct_timeout_to_ms(*buf);
 			break;
 		case CS_GET:
-			*((unsigned int*)buf) = ctx->query_timeout;
+			*buf = _ct_timeout_from_ms(ctx->query_timeout);
 			break;
 		case CS_CLEAR:
 			ctx->query_timeout = -1;
@@ -2609,10 +2749,42 @@ ct_config(CS_CONTEXT * ctx, CS_INT action, CS_INT property, CS_VOID * buffer, CS
 	case CS_LOGIN_TIMEOUT:
 		switch (action) {
 		case CS_SET:
-			ctx->login_timeout = *((unsigned int*)buf);
+			ctx->login_timeout = _ct_timeout_to_ms(*buf);
+			break;
+		case CS_GET:
+			*buf = _ct_timeout_from_ms(ctx->login_timeout);
+			break;
+		case CS_CLEAR:
+			ctx->login_timeout = -1;
+			break;
+		default:
+			ret = CS_FAIL;
+			break;
+		}
+		break;
+	case CS_TIMEOUT_MS:
+		switch (action) {
+		case CS_SET:
+			ctx->query_timeout = *buf;
 			break;
 		case CS_GET:
-			*((unsigned int*)buf) = ctx->login_timeout;
+			*buf = ctx->query_timeout;
+			break;
+		case CS_CLEAR:
+			ctx->query_timeout = -1;
+			break;
+		default:
+			ret = CS_FAIL;
+			break;
+		}
+		break;
+	case CS_LOGIN_TIMEOUT_MS:
+		switch (action) {
+		case CS_SET:
+			ctx->login_timeout = *buf;
+			break;
+		case CS_GET:
+			*buf = ctx->login_timeout;
 			break;
 		case CS_CLEAR:
 			ctx->login_timeout = -1;
@@ -2622,6 +2794,25 @@ ct_config(CS_CONTEXT * ctx, CS_INT action, CS_INT property, CS_VOID * buffer, CS
 			break;
 		}
 		break;
+	case CS_NETIO:
+		switch (action) {
+		case CS_SET:
+			if (*buf != CS_SYNC_IO && *buf != CS_ASYNC_IO && *buf != CS_DEFER_IO)
+				ret = CS_FAIL;
+			else
+				ctx->netio = *buf;
+			break;
+		case CS_GET:
+			*buf = ctx->netio;
+			break;
+		case CS_CLEAR:
+			ctx->netio = CS_SYNC_IO;
+			break;
+		default:
+			ret = CS_FAIL;
+			break;
+		}
+		break;
 	default:
 		ret = CS_SUCCEED;
 		break;
@@ -3809,15 +4000,213 @@ SEND_OPTION:
 	return CS_SUCCEED;
 }				/* end ct_options() */
 
+static bool
+_ct_is_async(CS_CONNECTION * con)
+{
+	return con->netio == CS_ASYNC_IO || con->netio == CS_DEFER_IO;
+}
+
+/**
+ * Record an asynchronous operation on the command connection.
+ * Only one operation can be pending on a connection.
+ * \return CS_PENDING if recorded, CS_BUSY if another operation is pending
+ */
+static CS_RETCODE
+_ct_async_start(CS_COMMAND * cmd, CS_INT function)
+{
+	CT_ASYNC *async = &cmd->con->async;
+
+	if (async->function) {
+		tdsdump_log(TDS_DBG_FUNC, "_ct_async_start(%p, %d) operation %d already pending\n", cmd, function, async->function);
+		return CS_BUSY;
+	}
+
+	memset(async, 0, sizeof(*async));
+	async->function = function;
+	async->cmd = cmd;
+	return CS_PENDING;
+}
+
+/**
+ * Complete a pending read with CS_CANCELED.
+ * Used when results are discarded synchronously so the socket won't become readable.
+ */
+static void
+_ct_async_cancel(CS_CONNECTION * con, CS_COMMAND * cmd)
+{
+	CT_ASYNC *async;
+
+	if (!con)
+		return;
+
+	async = &con->async;
+	if (!async->function || async->completed || (cmd && async->cmd != cmd))
+		return;
+
+	async->status = CS_CANCELED;
+	async->completed = true;
+}
+
+/**
+ * Check if the pending operation of a connection can be executed without waiting.
+ */
+static bool
+_ct_async_ready(CS_CONNECTION * con)
+{
+	return con->async.completed || !con->tds_socket || IS_TDSDEAD(con->tds_socket)
+		|| tds_read_pending(con->tds_socket);
+}
+
+/**
+ * Execute the pending operation of a connection, if not done yet, and report it.
+ */
+static void
+_ct_async_complete(CS_CONNECTION * con, CS_CONNECTION ** compconn, CS_COMMAND ** compcmd, CS_INT * compid, CS_INT * compstatus)
+{
+	CT_ASYNC async = con->async;
+	CS_COMPLETION_FUNC completion_cb;
+
+	if (!async.completed) {
+		switch (async.function) {
+		case CT_RESULTS:
+			async.status = _ct_results(async.cmd, async.result_type);
+			break;
+		case CT_FETCH:
+			async.status = _ct_fetch(async.cmd, async.fetch_type, async.fetch_offset, async.fetch_option,
+						 async.rows_read);
+			break;
+		default:
+			async.status = CS_FAIL;
+			break;
+		}
+	}
+
+	/* clear before calling the callback so it can start another operation */
+	con->async.function = 0;
+	con->async.cmd = NULL;
+
+	tdsdump_log(TDS_DBG_FUNC, "ct_poll() completed connection %p command %p function %d status %d\n",
+		    con, async.cmd, async.function, async.status);
+
+	if (compconn)
+		*compconn = con;
+	if (compcmd)
+		*compcmd = async.cmd;
+	if (compid)
+		*compid = async.function;
+	if (compstatus)
+		*compstatus = async.status;
+
+	completion_cb = con->_completion_cb ? con->_completion_cb : con->ctx->_completion_cb;
+	if (completion_cb)
+		completion_cb(con, async.cmd, async.function, async.status);
+}
+
+/**
+ * Wait for asynchronous operations to complete.
+ * All connections with a pending read are multiplexed in a single poll(2) call,
+ * together with their wakeup descriptors so a ct_cancel from another thread
+ * stops the wait. One completion is reported for each call, ready connections
+ * are taken in turn to avoid starving any of them.
+ * \param ctx context to check, used if connection is NULL
+ * \param connection connection to check, NULL to check all connections of ctx
+ * \param milliseconds time to wait, 0 to just check, CS_NO_LIMIT to wait forever
+ * \return CS_SUCCEED if an operation completed, CS_TIMED_OUT if none completed in time,
+ *         CS_QUIET if no operations are pending
+ */
 CS_RETCODE
 ct_poll(CS_CONTEXT * ctx, CS_CONNECTION * connection, CS_INT milliseconds, CS_CONNECTION ** compconn, CS_COMMAND ** compcmd,
 	CS_INT * compid, CS_INT * compstatus)
 {
-	tdsdump_log(TDS_DBG_FUNC, "UNIMPLEMENTED ct_poll()\n");
+	CS_CONNECTION *con, *ready = NULL;
+	CS_CONNECTION **poll_cons;
+	struct pollfd *fds;
+	unsigned num_cons = 0, n, start;
+	int rc = 0;
+
 	tdsdump_log(TDS_DBG_FUNC, "ct_poll(%p, %p, %d, %p, %p, %p, %p)\n",
 				ctx, connection, milliseconds, compconn, compcmd, compid, compstatus);
 
-	return CS_FAIL;
+	if (!ctx && !connection)
+		return CS_FAIL;
+	if (milliseconds < 0 && milliseconds != CS_NO_LIMIT)
+		return CS_FAIL;
+	if (connection)
+		ctx = connection->ctx;
+
+	for (con = connection ? connection : ctx->conns; con; con = connection ? NULL : con->next) {
+		if (!con->async.function)
+			continue;
+		if (_ct_async_ready(con)) {
+			ready = con;
+			break;
+		}
+		++num_cons;
+	}
+
+	if (ready) {
+		_ct_async_complete(ready, compconn, compcmd, compid, compstatus);
+		return CS_SUCCEED;
+	}
+	if (!num_cons)
+		return CS_QUIET;
+
+	fds = tds_new(struct pollfd, num_cons * 2);
+	poll_cons = tds_new(CS_CONNECTION *, num_cons);
+	if (!fds || !poll_cons) {
+		free(fds);
+		free(poll_cons);
+		return CS_FAIL;
+	}
+
+	n = 0;
+	for (con = connection ? connection : ctx->conns; con; con = connection ? NULL : con->next) {
+		if (!con->async.function)
+			continue;
+		poll_cons[n] = con;
+		fds[n * 2].fd = tds_get_s(con->tds_socket);
+		fds[n * 2].events = POLLIN;
+		fds[n * 2].revents = 0;
+		fds[n * 2 + 1].fd = tds_wakeup_get_fd(&con->tds_socket->conn->wakeup);
+		fds[n * 2 + 1].events = POLLIN;
+		fds[n * 2 + 1].revents = 0;
+		++n;
+	}
+
+	start = tds_gettime_ms();
+	for (;;) {
+		int timeout = -1;
+
+		if (milliseconds != CS_NO_LIMIT) {
+			unsigned int elapsed = tds_gettime_ms() - start;
+
+			timeout = elapsed >= (unsigned int) milliseconds ? 0 : milliseconds - elapsed;
+		}
+
+		rc = poll(fds, num_cons * 2, timeout);
+		if (rc >= 0 || sock_errno != TDSSOCK_EINTR)
+			break;
+	}
+
+	if (rc > 0) {
+		for (n = 0; n < num_cons; ++n) {
+			unsigned i = (n + ctx->poll_rotor) % num_cons;
+
+			if (fds[i * 2].revents || fds[i * 2 + 1].revents) {
+				ready = poll_cons[i];
+				ctx->poll_rotor = i + 1;
+				break;
+			}
+		}
+	}
+	free(fds);
+	free(poll_cons);
+
+	if (!ready)
+		return rc < 0 ? CS_FAIL : CS_TIMED_OUT;
+
+	_ct_async_complete(ready, compconn, compcmd, compid, compstatus);
+	return CS_SUCCEED;
 }
 
 CS_RETCODE
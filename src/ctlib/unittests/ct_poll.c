@@ -0,0 +1,229 @@
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctpublic.h>
+#include "common.h"
+
+/*
+ * Run queries on two connections in deferred mode.
+ * Operations are chained from the completion callback and
+ * ct_poll multiplexes both connections.
+ */
+
+#define NUM_CONNS 2
+
+typedef struct
+{
+	CS_CONNECTION *conn;
+	CS_COMMAND *cmd;
+	CS_INT result_type;
+	CS_INT value;
+	CS_INT rows;
+	CS_INT len;
+	CS_SMALLINT ind;
+	int done;
+	int failed;
+} ASYNC_QUERY;
+
+static ASYNC_QUERY queries[NUM_CONNS];
+static int completions;
+
+static ASYNC_QUERY *
+find_query(CS_CONNECTION *conn)
+{
+	int i;
+
+	for (i = 0; i < NUM_CONNS; ++i)
+		if (queries[i].conn == conn)
+			return &queries[i];
+	return NULL;
+}
+
+static CS_RETCODE
+completion_cb(CS_CONNECTION *conn, CS_COMMAND *cmd, CS_INT function, CS_RETCODE status)
+{
+	ASYNC_QUERY *q = find_query(conn);
+	CS_DATAFMT datafmt;
+	CS_RETCODE ret = CS_PENDING;
+
+	++completions;
+	if (!q || q->cmd != cmd) {
+		fprintf(stderr, "completion for unknown connection\n");
+		exit(1);
+	}
+
+	switch (function) {
+	case CT_SEND:
+		if (status != CS_SUCCEED)
+			break;
+		ret = ct_results(cmd, &q->result_type);
+		break;
+	case CT_RESULTS:
+		if (status == CS_END_RESULTS) {
+			q->done = 1;
+			return CS_SUCCEED;
+		}
+		if (status != CS_SUCCEED)
+			break;
+		if (q->result_type == CS_ROW_RESULT) {
+			memset(&datafmt, 0, sizeof(datafmt));
+			datafmt.datatype = CS_INT_TYPE;
+			datafmt.maxlength = sizeof(CS_INT);
+			datafmt.count = 1;
+			if (ct_bind(cmd, 1, &datafmt, &q->value, &q->len, &q->ind) != CS_SUCCEED)
+				break;
+			ret = ct_fetch(cmd, CS_UNUSED, CS_UNUSED, CS_UNUSED, NULL);
+		} else {
+			ret = ct_results(cmd, &q->result_type);
+		}
+		break;
+	case CT_FETCH:
+		if (status == CS_SUCCEED) {
+			++q->rows;
+			ret = ct_fetch(cmd, CS_UNUSED, CS_UNUSED, CS_UNUSED, NULL);
+		} else if (status == CS_END_DATA) {
+			ret = ct_results(cmd, &q->result_type);
+		}
+		break;
+	}
+
+	if (ret != CS_PENDING) {
+		fprintf(stderr, "operation %d failed, status %d ret %d\n", function, status, ret);
+		q->failed = 1;
+		return CS_FAIL;
+	}
+	return CS_SUCCEED;
+}
+
+int
+main(int argc, char **argv)
+{
+	CS_CONTEXT *ctx;
+	CS_CONNECTION *conn, *compconn;
+	CS_COMMAND *cmd, *compcmd;
+	CS_INT compid, compstatus, netio;
+	CS_RETCODE ret;
+	int verbose = 0;
+	int i;
+	char sql[64];
+
+	printf("%s: Testing asynchronous operations with ct_poll\n", __FILE__);
+
+	ret = try_ctlogin(&ctx, &conn, &cmd, verbose);
+	if (ret != CS_SUCCEED) {
+		fprintf(stderr, "Login failed\n");
+		return 1;
+	}
+	queries[0].conn = conn;
+	queries[0].cmd = cmd;
+
+	/* second connection on the same context */
+	if (ct_con_alloc(ctx, &conn) != CS_SUCCEED
+	    || ct_con_props(conn, CS_SET, CS_USERNAME, common_pwd.USER, CS_NULLTERM, NULL) != CS_SUCCEED
+	    || ct_con_props(conn, CS_SET, CS_PASSWORD, common_pwd.PASSWORD, CS_NULLTERM, NULL) != CS_SUCCEED
+	    || ct_connect(conn, common_pwd.SERVER, CS_NULLTERM) != CS_SUCCEED
+	    || ct_cmd_alloc(conn, &cmd) != CS_SUCCEED) {
+		fprintf(stderr, "Second connection failed\n");
+		return 1;
+	}
+	queries[1].conn = conn;
+	queries[1].cmd = cmd;
+
+	/* nothing pending */
+	if (ct_poll(ctx, NULL, 0, NULL, NULL, NULL, NULL) != CS_QUIET) {
+		fprintf(stderr, "ct_poll() should return CS_QUIET\n");
+		return 1;
+	}
+
+	if (ct_callback(ctx, NULL, CS_SET, CS_COMPLETION_CB, (CS_VOID *) completion_cb) != CS_SUCCEED) {
+		fprintf(stderr, "ct_callback() failed\n");
+		return 1;
+	}
+
+	for (i = 0; i < NUM_CONNS; ++i) {
+		netio = CS_DEFER_IO;
+		if (ct_con_props(queries[i].conn, CS_SET, CS_NETIO, &netio, CS_UNUSED, NULL) != CS_SUCCEED) {
+			fprintf(stderr, "ct_con_props(CS_NETIO) failed\n");
+			return 1;
+		}
+		netio = 0;
+		if (ct_con_props(queries[i].conn, CS_GET, CS_NETIO, &netio, CS_UNUSED, NULL) != CS_SUCCEED
+		    || netio != CS_DEFER_IO) {
+			fprintf(stderr, "ct_con_props(CS_NETIO) get failed\n");
+			return 1;
+		}
+
+		sprintf(sql, "select %d", (i + 1) * 100);
+		if (ct_command(queries[i].cmd, CS_LANG_CMD, sql, CS_NULLTERM, CS_UNUSED) != CS_SUCCEED) {
+			fprintf(stderr, "ct_command() failed\n");
+			return 1;
+		}
+		if (ct_send(queries[i].cmd) != CS_PENDING) {
+			fprintf(stderr, "ct_send() should return CS_PENDING\n");
+			return 1;
+		}
+	}
+
+	/* only one operation at a time */
+	if (ct_results(queries[0].cmd, &queries[0].result_type) != CS_BUSY) {
+		fprintf(stderr, "ct_results() should return CS_BUSY\n");
+		return 1;
+	}
+
+	while ((ret = ct_poll(ctx, NULL, 10000, &compconn, &compcmd, &compid, &compstatus)) == CS_SUCCEED) {
+		if (verbose)
+			printf("completed %p %p function %d status %d\n", compconn, compcmd, compid, compstatus);
+		if (!find_query(compconn)) {
+			fprintf(stderr, "ct_poll() returned wrong connection\n");
+			return 1;
+		}
+	}
+	if (ret != CS_QUIET) {
+		fprintf(stderr, "ct_poll() returned %d\n", ret);
+		return 1;
+	}
+
+	/* dropping a command discards its pending operation */
+	if (ct_cmd_alloc(queries[1].conn, &cmd) != CS_SUCCEED
+	    || ct_command(cmd, CS_LANG_CMD, "select 300", CS_NULLTERM, CS_UNUSED) != CS_SUCCEED
+	    || ct_send(cmd) != CS_PENDING) {
+		fprintf(stderr, "ct_send() on dropped command failed\n");
+		return 1;
+	}
+	if (ct_cmd_drop(cmd) != CS_SUCCEED) {
+		fprintf(stderr, "ct_cmd_drop() with pending operation failed\n");
+		return 1;
+	}
+	if (ct_poll(ctx, queries[1].conn, 0, NULL, NULL, NULL, NULL) != CS_QUIET) {
+		fprintf(stderr, "ct_poll() should not complete dropped commands\n");
+		return 1;
+	}
+
+	for (i = 0; i < NUM_CONNS; ++i) {
+		ASYNC_QUERY *q = &queries[i];
+
+		if (q->failed || !q->done || q->rows != 1 || q->value != (i + 1) * 100) {
+			fprintf(stderr, "query %d: failed %d done %d rows %d value %d\n", i, q->failed, q->done,
+				q->rows, q->value);
+			return 1;
+		}
+		netio = CS_SYNC_IO;
+		ct_con_props(q->conn, CS_SET, CS_NETIO, &netio, CS_UNUSED, NULL);
+	}
+	if (verbose)
+		printf("%d completions\n", completions);
+
+	ct_cmd_drop(queries[1].cmd);
+	ct_close(queries[1].conn, CS_UNUSED);
+	ct_con_drop(queries[1].conn);
+
+	ret = try_ctlogout(ctx, queries[0].conn, queries[0].cmd, verbose);
+	if (ret != CS_SUCCEED) {
+		fprintf(stderr, "Logout failed\n");
+		return 1;
+	}
+
+	return 0;
+}
@@ -22,6 +22,7 @@
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <ctype.h>
 #include <assert.h>
 
 #if HAVE_STRING_H
@@ -59,25 +60,6 @@
 #define MAX(a,b) ( (a) > (b) ? (a) : (b) )
 #endif
 
-#ifdef HAVE_FSEEKO
-typedef off_t offset_type;
-#elif defined(_WIN32) || defined(_WIN64)
-/* win32 version */
-typedef __int64 offset_type;
-# if defined(HAVE__FSEEKI64) && defined(HAVE__FTELLI64)
-#  define fseeko(f,o,w) _fseeki64((f),o,w)
-#  define ftello(f) _ftelli64((f))
-# else
-#  define fseeko(f,o,w) (_lseeki64(fileno(f),o,w) == -1 ? -1 : 0)
-#  define ftello(f) _telli64(fileno(f))
-# endif
-#else
-/* use old version */
-#define fseeko(f,o,w) fseek(f,o,w)
-#define ftello(f) ftell(f)
-typedef long offset_type;
-#endif
-
 static void _bcp_free_storage(DBPROCESS * dbproc);
 static void _bcp_free_columns(DBPROCESS * dbproc);
 static void _bcp_null_error(TDSBCPINFO *bcpinfo, int index, int offset);
@@ -86,9 +68,10 @@ static TDSRET _bcp_no_get_col_data(TDSBCPINFO *bcpinfo, TDSCOLUMN *bindcol, int
 
 static int rtrim(char *, int);
 static int rtrim_u16(uint16_t *str, int len, uint16_t space);
-static STATUS _bcp_read_hostfile(DBPROCESS * dbproc, FILE * hostfile, int *row_error, bool skip);
+static STATUS _bcp_read_hostfile(DBPROCESS * dbproc, TDSBCPFILE * hostfile, int *row_error, bool skip);
 static int _bcp_readfmt_colinfo(DBPROCESS * dbproc, char *buf, BCP_HOSTCOLINFO * ci);
 static int _bcp_get_term_var(const BYTE * pdata, const BYTE * term, int term_len);
+static RETCODE _bcp_bind_array(DBPROCESS * dbproc, int index, DBINT nrows, TDS_INT *lengths, TDS_SMALLINT *nulls);
 
 /*
  * "If a host file is being used ... the default data formats are as follows:
@@ -230,6 +213,7 @@ bcp_init(DBPROCESS * dbproc, const char *tblname, const char *hfile, const char
 		goto memory_error;
 	dbproc->hostfileinfo->maxerrs = 10;
 	dbproc->hostfileinfo->firstrow = 1;
+	dbproc->hostfileinfo->range_end = -1;
 	if ((dbproc->hostfileinfo->hostfile = strdup(hfile)) == NULL)
 		goto memory_error;
 
@@ -596,6 +580,88 @@ bcp_getbatchsize(DBPROCESS * dbproc)
 	return dbproc->hostfileinfo->batch;
 }
 
+/**
+ * \ingroup dblib_bcp_internal
+ * \brief Check every hint in a comma separated list is known.
+ *
+ * Each hint is a keyword, optionally followed by a parenthesized argument
+ * or by "=" and a number.
+ * \param value hints, like "TABLOCK, ORDER(id ASC), ROWS_PER_BATCH = 1000"
+ * \param len length of \a value in bytes
+ * \return true if all hints are valid
+ */
+static bool
+_bcp_check_hints(const char *value, size_t len)
+{
+	static const char *const hints[] = {
+		"ORDER", "ROWS_PER_BATCH", "KILOBYTES_PER_BATCH", "TABLOCK", "CHECK_CONSTRAINTS",
+		"FIRE_TRIGGERS", "KEEP_NULLS", NULL
+	};
+	const char *end = value + len;
+	int i;
+
+	for (;;) {
+		size_t name_len;
+		int depth = 0;
+
+		while (value < end && isspace((unsigned char) *value))
+			++value;
+		for (name_len = 0; value + name_len < end; ++name_len)
+			if (!isalpha((unsigned char) value[name_len]) && value[name_len] != '_')
+				break;
+
+		/* look up hint */
+		for (i = 0; hints[i]; i++)
+			if (strlen(hints[i]) == name_len && strncasecmp(value, hints[i], name_len) == 0)
+				break;
+		if (!hints[i]) {
+			tdsdump_log(TDS_DBG_FUNC, "failed, no such hint\n");
+			return false;
+		}
+
+		value += name_len;
+		while (value < end && isspace((unsigned char) *value))
+			++value;
+
+		/* optional argument, parenthesis must be balanced */
+		if (value < end && *value == '(') {
+			do {
+				if (*value == '(')
+					++depth;
+				else if (*value == ')')
+					--depth;
+				++value;
+			} while (depth != 0 && value < end);
+			if (depth != 0)
+				return false;
+			while (value < end && isspace((unsigned char) *value))
+				++value;
+		} else if (value < end && *value == '=') {
+			/* like ROWS_PER_BATCH = 1000 */
+			const char *digits;
+
+			do
+				++value;
+			while (value < end && isspace((unsigned char) *value));
+			for (digits = value; value < end && isdigit((unsigned char) *value); ++value)
+				continue;
+			if (value == digits)
+				return false;
+			while (value < end && isspace((unsigned char) *value))
+				++value;
+		}
+
+		/* only a separator can follow */
+		if (value >= end)
+			return true;
+		if (*value != ',') {
+			tdsdump_log(TDS_DBG_FUNC, "failed, unexpected characters after hint\n");
+			return false;
+		}
+		++value;
+	}
+}
+
 /** 
  * \ingroup dblib_bcp
  * \brief Set "hints" for uploading a file.  A FreeTDS-only function.  
@@ -603,29 +669,27 @@ bcp_getbatchsize(DBPROCESS * dbproc)
  * \param dbproc contains all information needed by db-lib to manage communications with the server.
  * \param option symbolic constant indicating the option to be set, one of:
  * 		- \b BCPLABELED Not implemented.
- * 		- \b BCPHINTS The hint to be passed when the bulk-copy begins.  
- * \param value The string constant for \a option a/k/a the hint.  One of:
+ * 		- \b BCPHINTS The hints to be passed when the bulk-copy begins.  
+ * \param value The string constant for \a option a/k/a the hint.  A comma separated list of:
  * 		- \b ORDER The data are ordered in accordance with the table's clustered index.
  * 		- \b ROWS_PER_BATCH The batch size
  * 		- \b KILOBYTES_PER_BATCH The approximate number of kilobytes to use for a batch size
  * 		- \b TABLOCK Lock the table
  * 		- \b CHECK_CONSTRAINTS Apply constraints
  * 		- \b FIRE_TRIGGERS Fire any INSERT triggers on the target table
+ * 		- \b KEEP_NULLS Keep NULL values instead of using column defaults
+ * 		with their arguments, like "TABLOCK, ORDER(id ASC)".
  * \param valuelen The strlen of \a value.  
  * 
  * \return SUCCEED or FAIL.
  * \sa 	bcp_control(), 
  * 	bcp_exec(), 
- * \todo Simplify.  Remove \a valuelen, and dbproc->bcpinfo->hint = strdup(hints[i])
+ * \todo Simplify.  Remove \a valuelen.
  */
 RETCODE
 bcp_options(DBPROCESS * dbproc, int option, BYTE * value, int valuelen)
 {
-	int i;
-	static const char *const hints[] = {
-		"ORDER", "ROWS_PER_BATCH", "KILOBYTES_PER_BATCH", "TABLOCK", "CHECK_CONSTRAINTS",
-		"FIRE_TRIGGERS", "KEEP_NULLS", NULL
-	};
+	char *hint;
 
 	tdsdump_log(TDS_DBG_FUNC, "bcp_options(%p, %d, %p, %d)\n", dbproc, option, value, valuelen);
 	CHECK_CONN(FAIL);
@@ -640,14 +704,16 @@ bcp_options(DBPROCESS * dbproc, int option, BYTE * value, int valuelen)
 		if (!value || valuelen <= 0)
 			break;
 
-		for (i = 0; hints[i]; i++) {	/* look up hint */
-			if (strncasecmp((char *) value, hints[i], strlen(hints[i])) == 0) {
-				dbproc->bcpinfo->hint = hints[i];	/* safe: hints[i] is static constant, above */
-				return SUCCEED;
-			}
+		if (!_bcp_check_hints((const char *) value, valuelen))
+			break;
+		if ((hint = tds_strndup(value, valuelen)) == NULL) {
+			dbperror(dbproc, SYBEMEM, errno);
+			break;
 		}
-		tdsdump_log(TDS_DBG_FUNC, "failed, no such hint\n");
-		break;
+		free(dbproc->bcphint);
+		dbproc->bcphint = hint;
+		dbproc->bcpinfo->hint = hint;
+		return SUCCEED;
 	default:
 		tdsdump_log(TDS_DBG_FUNC, "UNIMPLEMENTED bcp option: %u\n", option);
 		break;
@@ -655,6 +721,35 @@ bcp_options(DBPROCESS * dbproc, int option, BYTE * value, int valuelen)
 	return FAIL;
 }
 
+/**
+ * \ingroup dblib_bcp
+ * \brief Restrict the rows read from the host file to a range of bytes.  A FreeTDS-only function.
+ *
+ * \param dbproc contains all information needed by db-lib to manage communications with the server.
+ * \param start offset of the first row to read, must be the start of a row.
+ * \param end reading stops at the first row starting at or after this offset, -1 to read up to end of file.
+ * \remarks Allows to split a host file between several connections.
+ *	Row numbers used by bcp_control() BCPFIRST and BCPLAST are relative to \a start.
+ * \return SUCCEED or FAIL.
+ * \sa 	bcp_control(), bcp_exec(), bcp_init()
+ */
+RETCODE
+bcp_range(DBPROCESS * dbproc, DBBIGINT start, DBBIGINT end)
+{
+	tdsdump_log(TDS_DBG_FUNC, "bcp_range(%p, %" PRId64 ", %" PRId64 ")\n", dbproc, start, end);
+	CHECK_CONN(FAIL);
+	CHECK_PARAMETER(dbproc->bcpinfo, SYBEBCPI, FAIL);
+	CHECK_PARAMETER(dbproc->hostfileinfo, SYBEBIVI, FAIL);
+
+	if (start < 0 || (end >= 0 && end < start)) {
+		dbperror(dbproc, SYBEIFNB, 0);
+		return FAIL;
+	}
+	dbproc->hostfileinfo->range_start = start;
+	dbproc->hostfileinfo->range_end = end < 0 ? -1 : end;
+	return SUCCEED;
+}
+
 /** 
  * \ingroup dblib_bcp
  * \brief Override bcp_bind() by pointing to a different host variable.
@@ -1027,7 +1122,7 @@ Cleanup:
 }
 
 static STATUS
-_bcp_check_eof(DBPROCESS * dbproc, FILE *file, int icol)
+_bcp_check_eof(DBPROCESS * dbproc, TDSBCPFILE *file, int icol)
 {
 	int errnum = errno;
 
@@ -1035,7 +1130,7 @@ _bcp_check_eof(DBPROCESS * dbproc, FILE *file, int icol)
 	assert(dbproc);
 	assert(file);
 
-	if (feof(file)) {
+	if (file->eof) {
 		if (icol == 0) {
 			tdsdump_log(TDS_DBG_FUNC, "Normal end-of-file reached while loading bcp data file.\n");
 			return NO_MORE_ROWS;
@@ -1138,7 +1233,7 @@ rtrim_bcpcol(TDSCOLUMN *bcpcol)
  * \sa 	BCP_SETL(), bcp_batch(), bcp_bind(), bcp_colfmt(), bcp_colfmt_ps(), bcp_collen(), bcp_colptr(), bcp_columns(), bcp_control(), bcp_done(), bcp_exec(), bcp_getl(), bcp_init(), bcp_moretext(), bcp_options(), bcp_readfmt(), bcp_sendrow()
  */
 static STATUS
-_bcp_read_hostfile(DBPROCESS * dbproc, FILE * hostfile, int *row_error, bool skip)
+_bcp_read_hostfile(DBPROCESS * dbproc, TDSBCPFILE * hostfile, int *row_error, bool skip)
 {
 	int i;
 
@@ -1152,10 +1247,10 @@ _bcp_read_hostfile(DBPROCESS * dbproc, FILE * hostfile, int *row_error, bool ski
 	for (i = 0; i < dbproc->hostfileinfo->host_colcount; i++) {
 		TDSCOLUMN *bcpcol = NULL;
 		BCP_HOSTCOLINFO *hostcol;
-		TDS_CHAR *coldata;
+		const TDS_CHAR *coldata;
 		int collen = 0;
 		bool data_is_null = false;
-		offset_type col_start;
+		TDS_INT8 col_start;
 
 		tdsdump_log(TDS_DBG_FUNC, "parsing host column %d\n", i + 1);
 		hostcol = dbproc->hostfileinfo->host_columns[i];
@@ -1193,18 +1288,21 @@ _bcp_read_hostfile(DBPROCESS * dbproc, FILE * hostfile, int *row_error, bool ski
 
 			switch (hostcol->prefix_len) {
 			case 1:
-				if (fread(&u.ti, 1, 1, hostfile) != 1)
+				if ((coldata = tds_bcp_file_get(hostfile, 1)) == NULL)
 					return _bcp_check_eof(dbproc, hostfile, i);
+				memcpy(&u.ti, coldata, 1);
 				collen = u.ti ? u.ti : -1;
 				break;
 			case 2:
-				if (fread(&u.si, 2, 1, hostfile) != 1)
+				if ((coldata = tds_bcp_file_get(hostfile, 2)) == NULL)
 					return _bcp_check_eof(dbproc, hostfile, i);
+				memcpy(&u.si, coldata, 2);
 				collen = u.si;
 				break;
 			case 4:
-				if (fread(&u.li, 4, 1, hostfile) != 1)
+				if ((coldata = tds_bcp_file_get(hostfile, 4)) == NULL)
 					return _bcp_check_eof(dbproc, hostfile, i);
+				memcpy(&u.li, coldata, 4);
 				collen = u.li;
 				break;
 			default:
@@ -1239,40 +1337,36 @@ _bcp_read_hostfile(DBPROCESS * dbproc, FILE * hostfile, int *row_error, bool ski
 		if (is_fixed_type(hostcol->datatype))
 			collen = tds_get_size_by_type(hostcol->datatype);
 
-		col_start = ftello(hostfile);
+		col_start = tds_bcp_file_tell(hostfile);
 
 		/*
 		 * The data file either contains prefixes stating the length, or is delimited.  
 		 * If delimited, we "measure" the field by looking for the terminator, then read it, 
 		 * and set collen to the field's post-iconv size.  
+		 * Data point into reader buffers, no need to free them.
 		 */
 		if (hostcol->term_len > 0) { /* delimited data file */
 			size_t col_bytes;
 			TDSRET conv_res;
 
 			/* 
-			 * Read and convert the data
+			 * Read and convert the data, skipped rows are not converted
 			 */
-			coldata = NULL;
-			conv_res = tds_bcp_fread(dbproc->tds_socket, bcpcol ? bcpcol->char_conv : NULL, hostfile,
-						 (const char *) hostcol->terminator, hostcol->term_len, &coldata, &col_bytes);
+			conv_res = tds_bcp_file_field(dbproc->tds_socket, bcpcol && !skip ? bcpcol->char_conv : NULL, hostfile,
+						      (const char *) hostcol->terminator, hostcol->term_len, &coldata, &col_bytes);
 
 			if (TDS_FAILED(conv_res)) {
 				tdsdump_log(TDS_DBG_FUNC, "col %d: error converting %ld bytes!\n",
 							(i+1), (long) collen);
 				*row_error = TRUE;
-				free(coldata);
 				dbperror(dbproc, SYBEBCOR, 0);
 				return FAIL;
 			}
 
-			if (conv_res == TDS_NO_MORE_RESULTS) {
-				free(coldata);
+			if (conv_res == TDS_NO_MORE_RESULTS)
 				return _bcp_check_eof(dbproc, hostfile, i);
-			}
 
 			if (col_bytes > 0x7fffffffl) {
-				free(coldata);
 				*row_error = TRUE;
 				tdsdump_log(TDS_DBG_FUNC, "data from file is too large!\n");
 				dbperror(dbproc, SYBEBCOR, 0);
@@ -1294,29 +1388,20 @@ _bcp_read_hostfile(DBPROCESS * dbproc, FILE * hostfile, int *row_error, bool ski
 			 */
 		} else {	/* unterminated field */
 
-			coldata = tds_new(TDS_CHAR, 1 + collen);
-			if (coldata == NULL) {
-				*row_error = TRUE;
-				dbperror(dbproc, SYBEMEM, errno);
-				return FAIL;
-			}
-
-			coldata[collen] = 0;
+			coldata = "";
 			if (collen) {
 				/* 
 				 * Read and convert the data
-				 * TODO: Call tds_bcp_fread() instead of fread(3).
+				 * TODO: Call tds_bcp_file_field() instead of tds_bcp_file_get().
 				 *       The columns should each have their iconv cd set, and noncharacter data
-				 *       should have -1 as the iconv cd, causing tds_bcp_fread() to not attempt
+				 *       should have -1 as the iconv cd, causing tds_bcp_file_field() to not attempt
 				 * 	 any conversion.  We do not need a datatype switch here to decide what to do.  
 				 *	 As of 0.62, this *should* actually work.  All that remains is to change the
 				 *	 call and test it. 
 				 */
 				tdsdump_log(TDS_DBG_FUNC, "Reading %d bytes from hostfile.\n", collen);
-				if (fread(coldata, collen, 1, hostfile) != 1) {
-					free(coldata);
+				if ((coldata = tds_bcp_file_get(hostfile, collen)) == NULL)
 					return _bcp_check_eof(dbproc, hostfile, i);
-				}
 			}
 		}
 
@@ -1359,7 +1444,6 @@ _bcp_read_hostfile(DBPROCESS * dbproc, FILE * hostfile, int *row_error, bool ski
 			}
 #endif
 		}
-		free(coldata);
 	}
 	return MORE_ROWS;
 }
@@ -1419,6 +1503,198 @@ bcp_sendrow(DBPROCESS * dbproc)
 			  _bcp_get_col_data, _bcp_null_error, 0)) ? FAIL : SUCCEED;
 }
 
+/** 
+ * \ingroup dblib_bcp
+ * \brief Write data in arrays of host variables to the table.
+ * 
+ * \param dbproc contains all information needed by db-lib to manage communications with the server.
+ * \param nrows number of rows to send.
+ * 
+ * \remarks Every variable bound with bcp_bind() is the first element of an array of \a nrows elements.
+ *	Elements are prefixlen + varlen bytes apart, for fixed types with varlen -1 the size of the type is used.
+ *	Prefixes, terminators and varlen are applied to every element as bcp_sendrow() does.
+ *	Conversions are resolved once for all rows.
+ * \return SUCCEED or FAIL.
+ * \sa 	bcp_batch(), bcp_bind(), bcp_done(), bcp_init(), bcp_sendrow()
+ */
+RETCODE
+bcp_sendrows(DBPROCESS * dbproc, DBINT nrows)
+{
+	TDSBCPINFO *bcpinfo;
+	TDS_INT *lengths = NULL;
+	TDS_SMALLINT *nulls = NULL;
+	int i, num_cols;
+	RETCODE ret = FAIL;
+
+	tdsdump_log(TDS_DBG_FUNC, "bcp_sendrows(%p, %d)\n", dbproc, nrows);
+	CHECK_CONN(FAIL);
+	CHECK_PARAMETER(dbproc->bcpinfo, SYBEBCPI, FAIL);
+
+	bcpinfo = dbproc->bcpinfo;
+
+	if (bcpinfo->direction != DB_IN) {
+		dbperror(dbproc, SYBEBCPN, 0);
+		return FAIL;
+	}
+
+	if (dbproc->hostfileinfo != NULL) {
+		dbperror(dbproc, SYBEBCPB, 0);
+		return FAIL;
+	}
+
+	if (nrows <= 0)
+		return SUCCEED;
+
+	if (bcpinfo->xfer_init == 0) {
+
+		/* The start_copy function retrieves details of the table's columns */
+		if (TDS_FAILED(tds_bcp_start_copy_in(dbproc->tds_socket, bcpinfo))) {
+			dbperror(dbproc, SYBEBULKINSERT, 0);
+			return FAIL;
+		}
+
+		bcpinfo->xfer_init = 1;
+	}
+
+	num_cols = bcpinfo->bindinfo->num_cols;
+	lengths = tds_new(TDS_INT, (size_t) nrows * num_cols);
+	nulls = tds_new(TDS_SMALLINT, (size_t) nrows * num_cols);
+	if (!lengths || !nulls) {
+		dbperror(dbproc, SYBEMEM, 0);
+		goto cleanup;
+	}
+
+	for (i = 0; i < num_cols; i++) {
+		if (_bcp_bind_array(dbproc, i, nrows, lengths + (size_t) i * nrows, nulls + (size_t) i * nrows) != SUCCEED)
+			goto cleanup;
+	}
+
+	bcpinfo->parent = dbproc;
+	if (TDS_SUCCEED(tds_bcp_send_rows(dbproc->tds_socket, bcpinfo, _bcp_null_error, 0, nrows)))
+		ret = SUCCEED;
+
+cleanup:
+	free(lengths);
+	free(nulls);
+	return ret;
+}
+
+/**
+ * \ingroup dblib_bcp_internal
+ * \brief Bind a column to the arrays of host variables for bcp_sendrows().
+ *
+ * Lengths and NULLs of values are computed like _bcp_get_col_data() does.
+ * \param dbproc contains all information needed by db-lib to manage communications with the server.
+ * \param index column index, 0 based
+ * \param nrows number of rows
+ * \param lengths array of \a nrows lengths to fill
+ * \param nulls array of \a nrows NULL indicators to fill
+ * \return SUCCEED or FAIL.
+ */
+static RETCODE
+_bcp_bind_array(DBPROCESS * dbproc, int index, DBINT nrows, TDS_INT *lengths, TDS_SMALLINT *nulls)
+{
+	TDSCOLUMN *bindcol = dbproc->bcpinfo->bindinfo->columns[index];
+	TDS_SERVER_TYPE coltype, desttype;
+	TDSBCPARRAY array;
+	int prefix_len = bindcol->bcp_prefix_len > 0 ? bindcol->bcp_prefix_len : 0;
+	TDS_INT elem_len;
+	bool trim;
+	DBINT row;
+
+	memset(&array, 0, sizeof(array));
+
+	/* not bound, all NULLs */
+	if (!bindcol->column_varaddr && bindcol->column_bindlen <= 0 && prefix_len == 0)
+		return TDS_FAILED(tds_bcp_bind_array(dbproc->bcpinfo, index, &array)) ? FAIL : SUCCEED;
+
+	desttype = tds_get_conversion_type(bindcol->column_type, bindcol->column_size);
+	coltype = bindcol->column_bindtype == 0 ? desttype : (TDS_SERVER_TYPE) bindcol->column_bindtype;
+
+	/* we must know the size of every element */
+	if (bindcol->column_bindlen >= 0)
+		elem_len = bindcol->column_bindlen;
+	else if (is_fixed_type(coltype))
+		elem_len = tds_get_size_by_type(coltype);
+	else
+		elem_len = -1;
+	if (!bindcol->column_varaddr || elem_len < 0) {
+		dbperror(dbproc, SYBEVDPT, 0);
+		return FAIL;
+	}
+
+	trim = is_ascii_type(bindcol->on_server.column_type) && is_char_type(coltype);
+
+	for (row = 0; row < nrows; ++row) {
+		const BYTE *dataptr = (const BYTE *) bindcol->column_varaddr + (size_t) row * (prefix_len + elem_len);
+		int collen = 0;
+
+		nulls[row] = -1;
+		lengths[row] = 0;
+
+		switch (prefix_len) {
+		case 1:
+			collen = TDS_GET_UA1(dataptr);
+			break;
+		case 2:
+			collen = (TDS_SMALLINT) TDS_GET_UA2(dataptr);
+			break;
+		case 4:
+			collen = (TDS_INT) TDS_GET_UA4(dataptr);
+			break;
+		}
+		dataptr += prefix_len;
+		if (prefix_len && collen <= 0)
+			continue;
+
+		if (bindcol->column_bindlen >= 0) {
+			if (bindcol->column_bindlen == 0)
+				continue;
+			if (collen)
+				collen = (int) ((bindcol->column_bindlen < (TDS_UINT)collen) ? bindcol->column_bindlen : (TDS_UINT)collen);
+			else
+				collen = bindcol->column_bindlen;
+		}
+
+		if (is_fixed_type(coltype))
+			collen = tds_get_size_by_type(coltype);
+
+		if (bindcol->bcp_term_len > 0) {
+			int bytes_read = _bcp_get_term_var(dataptr, (BYTE *)bindcol->bcp_terminator, bindcol->bcp_term_len);
+
+			if (collen <= 0 || bytes_read < collen)
+				collen = bytes_read;
+			if (collen == 0)
+				continue;
+		}
+
+		if (collen < 0)
+			collen = (int) strlen((const char *) dataptr);
+
+		/* as rtrim_bcpcol */
+		if (trim) {
+			if (collen == 1 && dataptr[0] == '\0')
+				collen = 0;
+			while (collen > 1 && dataptr[collen - 1] == ' ')
+				--collen;
+		}
+
+		nulls[row] = 0;
+		lengths[row] = collen;
+	}
+
+	array.type = coltype;
+	array.data = (const TDS_CHAR *) bindcol->column_varaddr + prefix_len;
+	array.stride = prefix_len + elem_len;
+	array.lengths = lengths;
+	array.indicators = nulls;
+	if (TDS_FAILED(tds_bcp_bind_array(dbproc->bcpinfo, index, &array))) {
+		_dblib_convert_err(dbproc, TDS_CONVERT_NOAVAIL);
+		return FAIL;
+	}
+	return SUCCEED;
+}
+
 
 /** 
  * \ingroup dblib_bcp_internal
@@ -1434,14 +1710,15 @@ static RETCODE
 _bcp_exec_in(DBPROCESS * dbproc, DBINT * rows_copied)
 {
 	FILE *hostfile, *errfile = NULL;
+	TDSBCPFILE reader;
 	TDSSOCKET *tds = dbproc->tds_socket;
 	BCP_HOSTCOLINFO *hostcol;
 	STATUS ret;
 
 	int i, row_of_hostfile, rows_written_so_far;
 	int row_error, row_error_count;
-	offset_type row_start, row_end;
-	offset_type error_row_size;
+	TDS_INT8 row_start, row_end;
+	TDS_INT8 error_row_size;
 	const size_t chunk_size = 0x20000u;
 	
 	tdsdump_log(TDS_DBG_FUNC, "_bcp_exec_in(%p, %p)\n", dbproc, rows_copied);
@@ -1455,7 +1732,23 @@ _bcp_exec_in(DBPROCESS * dbproc, DBINT * rows_copied)
 		return FAIL;
 	}
 
+	if (TDS_FAILED(tds_bcp_file_init(&reader, hostfile))) {
+		tds_bcp_file_free(&reader);
+		fclose(hostfile);
+		dbperror(dbproc, SYBEMEM, errno);
+		return FAIL;
+	}
+
+	if (dbproc->hostfileinfo->range_start > 0
+	    && !tds_bcp_file_seek(&reader, dbproc->hostfileinfo->range_start)) {
+		tds_bcp_file_free(&reader);
+		fclose(hostfile);
+		dbperror(dbproc, SYBEBCRE, errno);
+		return FAIL;
+	}
+
 	if (TDS_FAILED(tds_bcp_start_copy_in(tds, dbproc->bcpinfo))) {
+		tds_bcp_file_free(&reader);
 		fclose(hostfile);
 		return FAIL;
 	}
@@ -1469,16 +1762,22 @@ _bcp_exec_in(DBPROCESS * dbproc, DBINT * rows_copied)
 	for (;;) {
 		bool skip;
 
-		row_start = ftello(hostfile);
+		row_start = tds_bcp_file_tell(&reader);
 		row_error = 0;
 
+		/* end of range assigned to this connection */
+		if (dbproc->hostfileinfo->range_end >= 0 && row_start >= dbproc->hostfileinfo->range_end) {
+			ret = NO_MORE_ROWS;
+			break;
+		}
+
 		row_of_hostfile++;
 
 		if (row_of_hostfile > MAX(dbproc->hostfileinfo->lastrow, 0x7FFFFFFF))
 			break;
 
 		skip = dbproc->hostfileinfo->firstrow > row_of_hostfile;
-		ret = _bcp_read_hostfile(dbproc, hostfile, &row_error, skip);
+		ret = _bcp_read_hostfile(dbproc, &reader, &row_error, skip);
 		if (ret != MORE_ROWS)
 			break;
 
@@ -1487,6 +1786,7 @@ _bcp_exec_in(DBPROCESS * dbproc, DBINT * rows_copied)
 
 			if (errfile == NULL && dbproc->hostfileinfo->errorfile) {
 				if (!(errfile = fopen(dbproc->hostfileinfo->errorfile, "w"))) {
+					tds_bcp_file_free(&reader);
 					fclose(hostfile);
 					dbperror(dbproc, SYBEBUOE, 0);
 					return FAIL;
@@ -1494,7 +1794,7 @@ _bcp_exec_in(DBPROCESS * dbproc, DBINT * rows_copied)
 			}
 
 			if (errfile != NULL) {
-				char *row_in_error = NULL;
+				const char *row_in_error;
 
 				for (i = 0; i < dbproc->hostfileinfo->host_colcount; i++) {
 					hostcol = dbproc->hostfileinfo->host_columns[i];
@@ -1516,33 +1816,25 @@ _bcp_exec_in(DBPROCESS * dbproc, DBINT * rows_copied)
 					}
 				}
 
-				row_end = ftello(hostfile);
+				row_end = tds_bcp_file_tell(&reader);
 
 				/* error data can be very long so split in chunks */
 				error_row_size = row_end - row_start;
-				fseeko(hostfile, row_start, SEEK_SET);
+				tds_bcp_file_seek(&reader, row_start);
 
 				while (error_row_size > 0) {
 					size_t chunk = error_row_size > chunk_size ? chunk_size : (size_t) error_row_size;
 
-					if (!row_in_error) {
-						if ((row_in_error = tds_new(char, chunk)) == NULL) {
-							dbperror(dbproc, SYBEMEM, errno);
-						}
-					}
-
-					if (fread(row_in_error, chunk, 1, hostfile) != 1) {
-						printf("BILL fread failed after fseek\n");
+					if ((row_in_error = tds_bcp_file_get(&reader, chunk)) == NULL) {
+						tdsdump_log(TDS_DBG_FUNC, "reading row in error failed after seek\n");
+						break;
 					}
-					count = (int)fwrite(row_in_error, chunk, 1, errfile);
-					if( (size_t)count < chunk ) {
+					if (fwrite(row_in_error, chunk, 1, errfile) != 1)
 						dbperror(dbproc, SYBEBWEF, errno);
-					}
 					error_row_size -= chunk;
 				}
-				free(row_in_error);
 
-				fseeko(hostfile, row_end, SEEK_SET);
+				tds_bcp_file_seek(&reader, row_end);
 				count = fprintf(errfile, "\n");
 				if( count < 0 ) {
 					dbperror(dbproc, SYBEBWEF, errno);
@@ -1566,6 +1858,7 @@ _bcp_exec_in(DBPROCESS * dbproc, DBINT * rows_copied)
 				if (TDS_FAILED(tds_bcp_done(tds, &rows_written_so_far))) {
 					if (errfile)
 						fclose(errfile);
+					tds_bcp_file_free(&reader);
 					fclose(hostfile);
 					return FAIL;
 				}
@@ -1589,6 +1882,7 @@ _bcp_exec_in(DBPROCESS * dbproc, DBINT * rows_copied)
 		dbperror(dbproc, SYBEBUCE, 0);
 	}
 
+	tds_bcp_file_free(&reader);
 	if (fclose(hostfile) != 0) {
 		dbperror(dbproc, SYBEBCUC, 0);
 		ret = FAIL;
@@ -2389,5 +2683,6 @@ _bcp_free_storage(DBPROCESS * dbproc)
 
 	tds_free_bcpinfo(dbproc->bcpinfo);
 	dbproc->bcpinfo = NULL;
+	TDS_ZERO_FREE(dbproc->bcphint);
 }
 
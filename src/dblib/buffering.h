@@ -127,6 +127,27 @@ buffer_is_full(const DBPROC_ROWBUF *buf)
 	return buf->capacity == buffer_count(buf) && buf->capacity > 1;
 }
 
+/**
+ * Release data of a saved row, including blobs.
+ */
+static void
+buffer_release_row_data(DBPROC_ROWBUF *buf, DBLIB_BUFFER_ROW *row)
+{
+	int i;
+	TDSRESULTINFO *resinfo = row->resinfo;
+
+	for (i = 0; i < resinfo->num_cols; ++i) {
+		const TDSCOLUMN *col = resinfo->columns[i];
+
+		if (is_blob_col(col)) {
+			TDSBLOB *blob = (TDSBLOB *) &row->row_data[col->column_data - resinfo->current_row];
+			tds_arena_release(&buf->arena, blob->textvalue);
+		}
+	}
+	tds_arena_release(&buf->arena, row->row_data);
+	row->row_data = NULL;
+}
+
 #ifndef NDEBUG
 static int
 buffer_index_valid(const DBPROC_ROWBUF *buf, int idx)
@@ -150,14 +171,12 @@ buffer_index_valid(const DBPROC_ROWBUF *buf, int idx)
 #endif
 
 static void
-buffer_free_row(DBLIB_BUFFER_ROW *row)
+buffer_free_row(DBPROC_ROWBUF *buf, DBLIB_BUFFER_ROW *row)
 {
-	if (row->sizes)
-		TDS_ZERO_FREE(row->sizes);
-	if (row->row_data) {
-		tds_free_row(row->resinfo, row->row_data);
-		row->row_data = NULL;
-	}
+	tds_arena_release(&buf->arena, row->sizes);
+	row->sizes = NULL;
+	if (row->row_data)
+		buffer_release_row_data(buf, row);
 	tds_free_results(row->resinfo);
 	row->resinfo = NULL;
 	row->row = 0;
@@ -180,9 +199,10 @@ buffer_free(DBPROC_ROWBUF *buf)
 	if (buf->rows != NULL) {
 		int i;
 		for (i = 0; i < buf->capacity; ++i)
-			buffer_free_row(&buf->rows[i]);
+			buffer_free_row(buf, &buf->rows[i]);
 		TDS_ZERO_FREE(buf->rows);
 	}
+	tds_arena_free(&buf->arena);
 	BUFFER_CHECK(buf);
 }
 
@@ -283,7 +303,7 @@ buffer_delete_rows(DBPROC_ROWBUF * buf,	int count)
 
 	for (i=0; i < count; i++) {
 		if (buf->tail < buf->capacity)
-			buffer_free_row(&buf->rows[buf->tail]);
+			buffer_free_row(buf, &buf->rows[buf->tail]);
 		buf->tail = buffer_idx_increment(buf, buf->tail);
 		/* 
 		 * If deleting rows from the buffer catches the tail to the head, 
@@ -498,19 +518,16 @@ buffer_add_row(DBPROCESS *dbproc, TDSRESULTINFO *resinfo)
 	row = buffer_row_address(buf, buf->head);
 
 	/* bump the row number, write it, and move the data to head */
-	if (row->resinfo) {
-		tds_free_row(row->resinfo, row->row_data);
-		tds_free_results(row->resinfo);
-	}
+	if (row->resinfo)
+		buffer_free_row(buf, row);
 	row->row = ++buf->received;
 	++resinfo->ref_count;
 	row->resinfo = resinfo;
 	row->row_data = NULL;
+	row->sizes = (TDS_INT *) tds_arena_alloc(&buf->arena, sizeof(TDS_INT) * resinfo->num_cols);
 	if (row->sizes)
-		free(row->sizes);
-	row->sizes = tds_new0(TDS_INT, resinfo->num_cols);
-	for (i = 0; i < resinfo->num_cols; ++i)
-		row->sizes[i] = resinfo->columns[i]->column_cur_size;
+		for (i = 0; i < resinfo->num_cols; ++i)
+			row->sizes[i] = resinfo->columns[i]->column_cur_size;
 
 	/* initial condition is head == 0 and tail == capacity */
 	if (buf->tail == buf->capacity) {
@@ -526,6 +543,66 @@ buffer_add_row(DBPROCESS *dbproc, TDSRESULTINFO *resinfo)
 	return buf->current;
 }
 
+/**
+ * Copy current row of a result into the buffer arena.
+ * Blobs are copied too so current row can be reused.
+ */
+static RETCODE
+buffer_copy_row(DBPROC_ROWBUF *buf, DBLIB_BUFFER_ROW *row)
+{
+	int i;
+	TDSRESULTINFO *resinfo = row->resinfo;
+	unsigned char *data;
+
+	data = (unsigned char *) tds_arena_alloc(&buf->arena, resinfo->row_size);
+	if (!data)
+		return FAIL;
+	memcpy(data, resinfo->current_row, resinfo->row_size);
+	row->row_data = data;
+
+	for (i = 0; i < resinfo->num_cols; ++i) {
+		const TDSCOLUMN *col = resinfo->columns[i];
+		TDSBLOB *blob;
+		TDS_INT len;
+		void *value;
+
+		if (!is_blob_col(col))
+			continue;
+
+		blob = (TDSBLOB *) &data[col->column_data - resinfo->current_row];
+		if (!blob->textvalue)
+			continue;
+
+		len = col->column_cur_size;
+		if (col->column_type == SYBVARIANT)
+			len = ((TDSVARIANT *) blob)->data_len;
+		value = NULL;
+		if (len > 0) {
+			value = tds_arena_alloc(&buf->arena, len);
+			if (!value)
+				goto memory_error;
+			memcpy(value, blob->textvalue, len);
+		}
+		blob->textvalue = (TDS_CHAR *) value;
+	}
+
+	return SUCCEED;
+
+memory_error:
+	/* blobs after the failing one still point to the current row, release only our copies */
+	while (--i >= 0) {
+		const TDSCOLUMN *col = resinfo->columns[i];
+
+		if (is_blob_col(col)) {
+			TDSBLOB *blob = (TDSBLOB *) &data[col->column_data - resinfo->current_row];
+			tds_arena_release(&buf->arena, blob->textvalue);
+		}
+	}
+	tds_arena_release(&buf->arena, data);
+	row->row_data = NULL;
+	return FAIL;
+}
+
 /**
  * Save current row into row buffer
  */
@@ -544,10 +621,8 @@ buffer_save_row(DBPROCESS *dbproc)
 	if (idx >= 0 && idx < buf->capacity) {
 		row = &buf->rows[idx];
 
-		if (row->resinfo && !row->row_data) {
-			row->row_data = row->resinfo->current_row;
-			tds_alloc_row(row->resinfo);
-		}
+		if (row->resinfo && !row->row_data)
+			return buffer_copy_row(buf, row);
 	}
 
 	return SUCCEED;
@@ -26,6 +26,7 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <limits.h>
 
 #if HAVE_STDLIB_H
 #include <stdlib.h>
@@ -184,8 +185,8 @@ typedef struct dblib_context
 	int connection_list_size_represented;
 	char *recftos_filename;
 	int recftos_filenum;
-	int login_timeout;	/**< not used unless positive */
-	int query_timeout;	/**< not used unless positive */
+	int login_timeout;	/**< in milliseconds, not used unless positive */
+	int query_timeout;	/**< in milliseconds, not used unless positive */
 }
 DBLIBCONTEXT;
 
@@ -1513,6 +1514,7 @@ dbclose(DBPROCESS * dbproc)
 	}
 
 	tds_free_bcpinfo(dbproc->bcpinfo);
+	free(dbproc->bcphint);
 	if (dbproc->hostfileinfo) {
 		free(dbproc->hostfileinfo->hostfile);
 		free(dbproc->hostfileinfo->errorfile);
@@ -2124,7 +2126,11 @@ dbnextrow(DBPROCESS * dbproc)
 		const int mask = TDS_STOPAT_ROWFMT|TDS_RETURN_DONE|TDS_RETURN_ROW|TDS_RETURN_COMPUTE;
 		TDS_INT8 row_count = TDS_NO_COUNT;
 		bool rows_set = false;
-		buffer_save_row(dbproc);
+
+		if (buffer_save_row(dbproc) != SUCCEED) {
+			dbperror(dbproc, SYBEMEM, errno);
+			return FAIL;
+		}
 
 		/* Get the row from the TDS stream.  */
 again:
@@ -4206,31 +4212,59 @@ dbgetmaxprocs(void)
 	return r;
 }
 
+/* convert a timeout in seconds to milliseconds */
+static int
+dblib_seconds_to_ms(int seconds)
+{
+	if (seconds <= 0)
+		return seconds;
+	if (seconds > INT_MAX / 1000)
+		return INT_MAX;
+	return seconds * 1000;
+}
+
 /**
  * \ingroup dblib_core
  * \brief Set maximum seconds db-lib waits for a server response to query.  
  * 
  * \param seconds New limit for application.  
  * \retval SUCCEED Always.  
- * \sa dberrhandle(), DBGETTIME(), dbsetlogintime(), dbsqlexec(), dbsqlok(), dbsqlsend().
+ * \sa dberrhandle(), DBGETTIME(), dbsetlogintime(), dbsettime_ms(), dbsqlexec(), dbsqlok(), dbsqlsend().
  */
 RETCODE
 dbsettime(int seconds)
+{
+	tdsdump_log(TDS_DBG_FUNC, "dbsettime(%d)\n", seconds);
+
+	return dbsettime_ms(dblib_seconds_to_ms(seconds));
+}
+
+/**
+ * \ingroup dblib_core
+ * \brief Set maximum milliseconds db-lib waits for a server response to query.  
+ * 
+ * \param milliseconds New limit for application.  
+ * \retval SUCCEED Always.  
+ * \remarks This is a FreeTDS extension, allows timeouts shorter than a second.
+ * \sa dberrhandle(), DBGETTIME(), dbsetlogintime_ms(), dbsettime(), dbsqlexec(), dbsqlok(), dbsqlsend().
+ */
+RETCODE
+dbsettime_ms(int milliseconds)
 {
 	TDSSOCKET **tds;
 	int i;
 	DBPROCESS *dbproc;
-	tdsdump_log(TDS_DBG_FUNC, "dbsettime(%d)\n", seconds);
+	tdsdump_log(TDS_DBG_FUNC, "dbsettime_ms(%d)\n", milliseconds);
 
 	tds_mutex_lock(&dblib_mutex);
-	g_dblib_ctx.query_timeout = seconds;
+	g_dblib_ctx.query_timeout = milliseconds;
 	
 	tds = g_dblib_ctx.connection_list;
 	for (i = 0; i <  TDS_MAX_CONN; i++) {
 		if (tds[i]) {
 			dbproc = (DBPROCESS *) tds_get_parent(tds[i]);
 			if (!dbisopt(dbproc, DBSETTIME, 0))
-				tds[i]->query_timeout = seconds;
+				tds[i]->query_timeout = milliseconds > 0 ? milliseconds : 0;
 		}
 	}
 	
@@ -4248,9 +4282,13 @@ dbsettime(int seconds)
 int
 dbgettime(void)
 {
+	int timeout;
+
 	tdsdump_log(TDS_DBG_FUNC, "dbgettime()\n");
 
-	return g_dblib_ctx.query_timeout;
+	timeout = g_dblib_ctx.query_timeout;
+	/* round up, a timeout is never reported as none */
+	return timeout > 0 ? (int) ((timeout + 999u) / 1000u) : timeout;
 }
 
 /**
@@ -4266,8 +4304,25 @@ dbsetlogintime(int seconds)
 {
 	tdsdump_log(TDS_DBG_FUNC, "dbsetlogintime(%d)\n", seconds);
 
+	return dbsetlogintime_ms(dblib_seconds_to_ms(seconds));
+}
+
+/**
+ * \ingroup dblib_core
+ * \brief Set maximum milliseconds db-lib waits for a server response to a login attempt.  
+ * 
+ * \param milliseconds New limit for application.  
+ * \retval SUCCEED Always.  
+ * \remarks This is a FreeTDS extension, allows timeouts shorter than a second.
+ * \sa dberrhandle(), dbsetlogintime(), dbsettime_ms()
+ */
+RETCODE
+dbsetlogintime_ms(int milliseconds)
+{
+	tdsdump_log(TDS_DBG_FUNC, "dbsetlogintime_ms(%d)\n", milliseconds);
+
 	tds_mutex_lock(&dblib_mutex);
-	g_dblib_ctx.login_timeout = seconds;
+	g_dblib_ctx.login_timeout = milliseconds;
 	tds_mutex_unlock(&dblib_mutex);
 	return SUCCEED;
 }
@@ -4630,7 +4685,7 @@ dbsetopt(DBPROCESS * dbproc, int option, const char *char_param, int int_param)
 			if (0 < i) {
 				rc = dbstring_assign(&(dbproc->dbopts[option].param), char_param);
 				if (rc == SUCCEED) {
-					dbproc->tds_socket->query_timeout = i;
+					dbproc->tds_socket->query_timeout = dblib_seconds_to_ms(i);
 				}
 			}
 		}
@@ -6723,7 +6778,10 @@ dbreadtext(DBPROCESS * dbproc, void *buf, DBINT bufsize)
 
 	if (curcol->column_textpos == 0) {
 		const int mask = TDS_STOPAT_ROWFMT|TDS_STOPAT_DONE|TDS_RETURN_ROW|TDS_RETURN_COMPUTE;
-		buffer_save_row(dbproc);
+		if (buffer_save_row(dbproc) != SUCCEED) {
+			dbperror(dbproc, SYBEMEM, errno);
+			return -1;
+		}
 		switch (tds_process_tokens(dbproc->tds_socket, &result_type, NULL, mask)) {
 		case TDS_SUCCESS:
 			if (result_type == TDS_ROW_RESULT || result_type == TDS_COMPUTE_RESULT)
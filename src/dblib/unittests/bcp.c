@@ -1,6 +1,6 @@
 /* 
  * Purpose: Test bcp functions
- * Functions: bcp_batch bcp_bind bcp_done bcp_init bcp_sendrow 
+ * Functions: bcp_batch bcp_bind bcp_done bcp_init bcp_options bcp_sendrow 
  */
 
 #include "common.h"
@@ -209,6 +209,14 @@ main(int argc, char **argv)
 	}
 	printf("OK\n");
 
+	/* malformed hints are refused */
+	if (bcp_options(dbproc, BCPHINTS, (BYTE *) "ORDER(id) garbage", 17) != FAIL
+	    || bcp_options(dbproc, BCPHINTS, (BYTE *) "TABLOCK,", 8) != FAIL
+	    || bcp_options(dbproc, BCPHINTS, (BYTE *) "ORDER(id", 8) != FAIL) {
+		fprintf(stderr, "bcp_options accepted invalid hints\n");
+		exit(1);
+	}
+
 	test_bind(dbproc);
 
 	printf("Sending same row 10 times... \n");
@@ -0,0 +1,167 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test saving buffered rows when memory is exhausted.
+ * Does not need a server, row buffer code is included directly.
+ */
+#undef NDEBUG
+#include <config.h>
+
+#include <stdio.h>
+#include <assert.h>
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif /* HAVE_STDLIB_H */
+
+#if HAVE_STRING_H
+#include <string.h>
+#endif /* HAVE_STRING_H */
+
+#include <freetds/tds.h>
+#include <sybfront.h>
+#include <sybdb.h>
+#include <dblib.h>
+
+/* number of arena allocation which should fail, -1 for none */
+static int fail_alloc = -1;
+static int num_allocs = 0;
+
+static void *
+test_arena_alloc(TDSARENA * arena, size_t len)
+{
+	if (num_allocs++ == fail_alloc)
+		return NULL;
+	return tds_arena_alloc(arena, len);
+}
+
+#define tds_arena_alloc test_arena_alloc
+#include "../buffering.h"
+#undef tds_arena_alloc
+
+static DBPROCESS dbproc;
+
+static void
+set_blob(TDSRESULTINFO *resinfo, int n, const char *value)
+{
+	TDSCOLUMN *col = resinfo->columns[n];
+	TDSBLOB *blob = (TDSBLOB *) col->column_data;
+
+	blob->textvalue = strdup(value);
+	assert(blob->textvalue);
+	col->column_cur_size = (TDS_INT) strlen(value);
+}
+
+static TDSBLOB *
+row_blob(const DBLIB_BUFFER_ROW *row, int n)
+{
+	const TDSCOLUMN *col = row->resinfo->columns[n];
+
+	return (TDSBLOB *) &row->row_data[col->column_data - row->resinfo->current_row];
+}
+
+static void
+test(TDSRESULTINFO *resinfo, int fail_at)
+{
+	DBLIB_BUFFER_ROW *row;
+	RETCODE ret;
+	int idx, i;
+
+	buffer_set_capacity(&dbproc, 4);
+	buffer_alloc(&dbproc);
+
+	/* allocations are: sizes (optional), row data, first blob, second blob */
+	num_allocs = 0;
+	fail_alloc = fail_at;
+	idx = buffer_add_row(&dbproc, resinfo);
+	assert(idx == 0);
+	ret = buffer_save_row(&dbproc);
+	fail_alloc = -1;
+
+	assert(buffer_row2idx(&dbproc.row_buf, 1) == idx);
+	row = buffer_row_address(&dbproc.row_buf, idx);
+	if (fail_at < 1) {
+		assert(ret == SUCCEED);
+		assert(row->row_data != NULL);
+		for (i = 1; i < 3; ++i) {
+			const TDSBLOB *orig = (const TDSBLOB *) resinfo->columns[i]->column_data;
+			const TDSBLOB *copy = row_blob(row, i);
+
+			assert(copy->textvalue != NULL && copy->textvalue != orig->textvalue);
+			assert(memcmp(copy->textvalue, orig->textvalue, resinfo->columns[i]->column_cur_size) == 0);
+		}
+
+		/* reading back the row restores saved sizes */
+		resinfo->columns[1]->column_cur_size = 0;
+		buffer_transfer_bound_data(&dbproc.row_buf, TDS_ROW_RESULT, 0, &dbproc, idx);
+		assert(buffer_current_index(&dbproc) == -1);
+		if (row->sizes)
+			assert(resinfo->columns[1]->column_cur_size == 10);
+		resinfo->columns[1]->column_cur_size = 10;
+	} else {
+		/* a row without its blobs must not be kept */
+		assert(ret == FAIL);
+		assert(row->row_data == NULL);
+	}
+
+	/* current row must be untouched */
+	assert(memcmp(((TDSBLOB *) resinfo->columns[1]->column_data)->textvalue, "first blob", 10) == 0);
+	assert(memcmp(((TDSBLOB *) resinfo->columns[2]->column_data)->textvalue, "second blob", 11) == 0);
+
+	buffer_delete_rows(&dbproc.row_buf, 1);
+	assert(buffer_count(&dbproc.row_buf) == 0);
+	buffer_free(&dbproc.row_buf);
+}
+
+int
+main(void)
+{
+	TDSCONTEXT *ctx;
+	TDSSOCKET *tds;
+	TDSRESULTINFO *resinfo;
+	int i;
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+	tds = tds_alloc_socket(ctx, 512);
+	assert(tds);
+	tds->conn->tds_version = 0x704;
+
+	/* an INT4, a TEXT and an IMAGE */
+	resinfo = tds_alloc_results(3);
+	assert(resinfo);
+	tds_set_column_type(tds->conn, resinfo->columns[0], SYBINT4);
+	tds_set_column_type(tds->conn, resinfo->columns[1], SYBTEXT);
+	tds_set_column_type(tds->conn, resinfo->columns[2], SYBIMAGE);
+	for (i = 1; i < 3; ++i)
+		resinfo->columns[i]->column_size = resinfo->columns[i]->on_server.column_size = 0x7fffffff;
+	assert(TDS_SUCCEED(tds_alloc_row(resinfo)));
+	set_blob(resinfo, 1, "first blob");
+	set_blob(resinfo, 2, "second blob");
+
+	test(resinfo, -1);
+	for (i = 0; i < 4; ++i)
+		test(resinfo, i);
+
+	tds_free_results(resinfo);
+	tds_free_socket(tds);
+	tds_free_context(ctx);
+	return 0;
+}
@@ -254,6 +254,18 @@ odbc_get_dsn_info(TDS_ERRS *errs, const char *DSN, TDSLOGIN * login)
 	if (myGetPrivateProfileString(DSN, odbc_param_Timeout, tmp) > 0)
 		tds_parse_conf_section(TDS_STR_TIMEOUT, tmp, login);
 
+	if (myGetPrivateProfileString(DSN, odbc_param_StatementCacheSize, tmp) > 0)
+		tds_parse_conf_section(TDS_STR_STMT_CACHE_SIZE, tmp, login);
+
+	if (myGetPrivateProfileString(DSN, odbc_param_MultiSubnetFailover, tmp) > 0)
+		tds_parse_conf_section(TDS_STR_MULTI_SUBNET, tmp, login);
+
+	if (myGetPrivateProfileString(DSN, odbc_param_ConnectRetryCount, tmp) > 0)
+		tds_parse_conf_section(TDS_STR_RETRY_COUNT, tmp, login);
+
+	if (myGetPrivateProfileString(DSN, odbc_param_ConnectRetryInterval, tmp) > 0)
+		tds_parse_conf_section(TDS_STR_RETRY_INTERVAL, tmp, login);
+
 	return 1;
 }
 
@@ -489,6 +501,14 @@ odbc_parse_connect_string(TDS_ERRS *errs, const char *connect_string, const char
 			tdsdump_log(TDS_DBG_INFO1, "Application Intent %s\n", readonly_intent);
 		} else if (CHK_PARAM(Timeout)) {
 			tds_parse_conf_section(TDS_STR_TIMEOUT, tds_dstr_cstr(&value), login);
+		} else if (CHK_PARAM(StatementCacheSize)) {
+			tds_parse_conf_section(TDS_STR_STMT_CACHE_SIZE, tds_dstr_cstr(&value), login);
+		} else if (CHK_PARAM(MultiSubnetFailover)) {
+			tds_parse_conf_section(TDS_STR_MULTI_SUBNET, tds_dstr_cstr(&value), login);
+		} else if (CHK_PARAM(ConnectRetryCount)) {
+			tds_parse_conf_section(TDS_STR_RETRY_COUNT, tds_dstr_cstr(&value), login);
+		} else if (CHK_PARAM(ConnectRetryInterval)) {
+			tds_parse_conf_section(TDS_STR_RETRY_INTERVAL, tds_dstr_cstr(&value), login);
 		}
 
 		if (num_param >= 0 && parsed_params) {
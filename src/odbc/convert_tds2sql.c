@@ -58,15 +58,11 @@ eat_iconv_left(TDSCOLUMN * curcol, char **pbuf, size_t *plen)
 }
 
 /**
- * Handle conversions from TDS (N)CHAR to ODBC (W)CHAR
+ * Get conversion from TDS (N)CHAR column to ODBC (W)CHAR
  */
-static SQLLEN
-odbc_convert_char(TDS_STMT * stmt, TDSCOLUMN * curcol, TDS_CHAR * src, TDS_UINT srclen, int desttype, TDS_CHAR * dest, SQLULEN destlen)
+static TDSICONV *
+odbc_get_char_conv(TDS_STMT * stmt, TDSCOLUMN * curcol, int desttype)
 {
-	const char *ib;
-	char *ob;
-	size_t il, ol, char_size;
-
 	/* FIXME MARS not correct cause is the global tds but stmt->tds can be NULL on SQLGetData */
 	TDSSOCKET *tds = stmt->dbc->tds_socket;
 
@@ -88,6 +84,22 @@ odbc_convert_char(TDS_STMT * stmt, TDSCOLUMN * curcol, TDS_CHAR * src, TDS_UINT
 			conv = tds_iconv_get_info(tds->conn, TDS_CHARSET_ISO_8859_1, TDS_CHARSET_ISO_8859_1);
 #endif
 	}
+	return conv;
+}
+
+/**
+ * Handle conversions from TDS (N)CHAR to ODBC (W)CHAR using a given conversion
+ */
+static SQLLEN
+odbc_convert_char_conv(TDS_STMT * stmt, TDSCOLUMN * curcol, TDSICONV * conv, TDS_CHAR * src, TDS_UINT srclen,
+		       int desttype, TDS_CHAR * dest, SQLULEN destlen)
+{
+	const char *ib;
+	char *ob;
+	size_t il, ol, char_size;
+
+	/* FIXME MARS not correct cause is the global tds but stmt->tds can be NULL on SQLGetData */
+	TDSSOCKET *tds = stmt->dbc->tds_socket;
 
 	ib = src;
 	il = srclen;
@@ -136,6 +148,17 @@ odbc_convert_char(TDS_STMT * stmt, TDSCOLUMN * curcol, TDS_CHAR * src, TDS_UINT
 	return ol;
 }
 
+/**
+ * Handle conversions from TDS (N)CHAR to ODBC (W)CHAR
+ */
+static SQLLEN
+odbc_convert_char(TDS_STMT * stmt, TDSCOLUMN * curcol, TDS_CHAR * src, TDS_UINT srclen, int desttype, TDS_CHAR * dest, SQLULEN destlen)
+{
+	TDSICONV *conv = odbc_get_char_conv(stmt, curcol, desttype);
+
+	return odbc_convert_char_conv(stmt, curcol, conv, src, srclen, desttype, dest, destlen);
+}
+
 /**
  * Handle conversions from TDS NCHAR to ISO8859-1 striping spaces (for fixed types)
  */
@@ -642,3 +665,108 @@ SQLLEN odbc_tds2sql_int4(TDS_STMT * stmt, TDS_INT *src, int desttype, TDS_CHAR *
 	return odbc_tds2sql(stmt, NULL, SYBINT4, (TDS_CHAR *) src, sizeof(*src),
 			    desttype, dest, destlen, NULL);
 }
+
+static SQLLEN
+odbc_fetch_generic(TDS_STMT * stmt, const ODBC_FETCH_COL *fc, TDSCOLUMN *curcol, TDS_CHAR * dest, SQLULEN destlen)
+{
+	return odbc_tds2sql_col(stmt, curcol, fc->c_type, dest, destlen, fc->drec);
+}
+
+static SQLLEN
+odbc_fetch_copy(TDS_STMT * stmt, const ODBC_FETCH_COL *fc, TDSCOLUMN *curcol, TDS_CHAR * dest, SQLULEN destlen)
+{
+	memcpy(dest, curcol->column_data, fc->size);
+	return fc->size;
+}
+
+static SQLLEN
+odbc_fetch_char(TDS_STMT * stmt, const ODBC_FETCH_COL *fc, TDSCOLUMN *curcol, TDS_CHAR * dest, SQLULEN destlen)
+{
+	return odbc_convert_char_conv(stmt, curcol, fc->char_conv,
+				      (TDS_CHAR *) curcol->column_data + curcol->column_text_sqlgetdatapos,
+				      curcol->column_cur_size - curcol->column_text_sqlgetdatapos,
+				      fc->c_type, dest, destlen);
+}
+
+/**
+ * Return size of data if server type and C type have the same
+ * representation so data can just be copied, 0 otherwise
+ */
+static unsigned int
+odbc_same_representation(int srctype, int desttype)
+{
+	switch (desttype) {
+	case SQL_C_BIT:
+		if (srctype == SYBBIT)
+			return 1;
+		break;
+	case SQL_C_UTINYINT:
+		if (srctype == SYBINT1 || srctype == SYBBIT)
+			return 1;
+		break;
+	case SQL_C_SHORT:
+	case SQL_C_SSHORT:
+		if (srctype == SYBINT2)
+			return sizeof(TDS_SMALLINT);
+		break;
+	case SQL_C_LONG:
+	case SQL_C_SLONG:
+		if (srctype == SYBINT4)
+			return sizeof(TDS_INT);
+		break;
+#ifdef SQL_C_SBIGINT
+	case SQL_C_SBIGINT:
+		if (srctype == SYBINT8)
+			return sizeof(TDS_INT8);
+		break;
+#endif
+	case SQL_C_DOUBLE:
+		if (srctype == SYBFLT8)
+			return sizeof(TDS_FLOAT);
+		break;
+	case SQL_C_FLOAT:
+		if (srctype == SYBREAL)
+			return sizeof(TDS_REAL);
+		break;
+#ifdef SQL_C_GUID
+	case SQL_C_GUID:
+		if (srctype == SYBUNIQUE)
+			return sizeof(TDS_UNIQUE);
+		break;
+#endif
+	}
+	return 0;
+}
+
+/**
+ * Resolve conversion of a bound column.
+ * The conversion is the same for all rows of a result set so
+ * type checks are done once and not for every row fetched.
+ * \param stmt     statement
+ * \param curcol   column to convert
+ * \param desttype C type, not SQL_C_DEFAULT
+ * \param drec_ixd record, passed to odbc_tds2sql_col
+ * \param fc       returned conversion
+ */
+void
+odbc_tds2sql_prepare(TDS_STMT * stmt, TDSCOLUMN *curcol, int desttype, const struct _drecord *drec_ixd, ODBC_FETCH_COL *fc)
+{
+	int srctype = tds_get_conversion_type(curcol->on_server.column_type, curcol->on_server.column_size);
+
+	fc->conv = odbc_fetch_generic;
+	fc->c_type = desttype;
+	fc->size = 0;
+	fc->char_conv = NULL;
+	fc->drec = drec_ixd;
+
+	if (is_blob_col(curcol))
+		return;
+
+	if ((fc->size = odbc_same_representation(srctype, desttype)) != 0) {
+		fc->conv = odbc_fetch_copy;
+	} else if (is_char_type(srctype) && (desttype == SQL_C_CHAR || desttype == SQL_C_WCHAR)) {
+		fc->char_conv = odbc_get_char_conv(stmt, curcol, desttype);
+		if (fc->char_conv)
+			fc->conv = odbc_fetch_char;
+	}
+}
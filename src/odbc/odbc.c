@@ -33,6 +33,7 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <limits.h>
 
 #include <freetds/utils.h>
 #include <freetds/odbc.h>
@@ -120,6 +121,15 @@ static void odbc_ird_check(TDS_STMT * stmt);
 
 #define DEFAULT_QUERY_TIMEOUT (~((SQLUINTEGER) 0))
 
+/* convert a timeout in seconds (as used by ODBC) to milliseconds (as used by libTDS) */
+static SQLUINTEGER
+odbc_timeout_ms(SQLUINTEGER seconds)
+{
+	if (seconds > INT_MAX / 1000)
+		return INT_MAX;
+	return seconds * 1000;
+}
+
 /*
  * Note: I *HATE* hungarian notation, it has to be the most idiotic thing
  * I've ever seen. So, you will note it is avoided other than in the function
@@ -380,11 +390,11 @@ odbc_connect(TDS_DBC * dbc, TDSLOGIN * login)
 
 	/* use connection timeout if set */
 	if (dbc->attr.connection_timeout)
-		login->connect_timeout = dbc->attr.connection_timeout;
+		login->connect_timeout = odbc_timeout_ms(dbc->attr.connection_timeout);
 
 	/* but override with login timeout, if set */
 	if (dbc->attr.login_timeout)
-		login->connect_timeout = dbc->attr.login_timeout;
+		login->connect_timeout = odbc_timeout_ms(dbc->attr.login_timeout);
 
 	if (dbc->attr.mars_enabled != SQL_MARS_ENABLED_NO)
 		login->mars = 1;
@@ -819,8 +829,8 @@ odbc_lock_statement(TDS_STMT* stmt)
 			tds = tds_alloc_additional_socket(dbc_tds->conn);
 	}
 	if (tds) {
-		tds->query_timeout = (stmt->attr.query_timeout != DEFAULT_QUERY_TIMEOUT) ?
-			stmt->attr.query_timeout : stmt->dbc->default_query_timeout;
+		tds->query_timeout = (stmt->attr.query_timeout_ms != DEFAULT_QUERY_TIMEOUT) ?
+			stmt->attr.query_timeout_ms : stmt->dbc->default_query_timeout;
 		tds_set_parent(tds, stmt);
 		stmt->tds = tds;
 		return 1;
@@ -842,8 +852,8 @@ odbc_lock_statement(TDS_STMT* stmt)
 	}
 	stmt->dbc->current_statement = stmt;
 	if (tds) {
-		tds->query_timeout = (stmt->attr.query_timeout != DEFAULT_QUERY_TIMEOUT) ?
-			stmt->attr.query_timeout : stmt->dbc->default_query_timeout;
+		tds->query_timeout = (stmt->attr.query_timeout_ms != DEFAULT_QUERY_TIMEOUT) ?
+			stmt->attr.query_timeout_ms : stmt->dbc->default_query_timeout;
 		tds_set_parent(tds, stmt);
 		stmt->tds = tds;
 	}
@@ -1868,6 +1878,7 @@ _SQLAllocStmt(SQLHDBC hdbc, SQLHSTMT FAR * phstmt)
 	assert(stmt->ipd->header.sql_desc_rows_processed_ptr == NULL);
 	assert(stmt->apd->header.sql_desc_array_size == 1);
 	stmt->attr.query_timeout = DEFAULT_QUERY_TIMEOUT;
+	stmt->attr.query_timeout_ms = DEFAULT_QUERY_TIMEOUT;
 	stmt->attr.retrieve_data = SQL_RD_ON;
 	assert(stmt->ard->header.sql_desc_array_size == 1);
 	assert(stmt->ard->header.sql_desc_bind_offset_ptr == NULL);
@@ -3368,6 +3379,54 @@ odbc_init_headers(TDS_STMT * stmt, TDSHEADERS * head)
 	return head;
 }
 
+/**
+ * Check if statement can be shared using the connection statement cache
+ */
+static bool
+odbc_can_cache_dynamic(TDS_STMT * stmt)
+{
+	TDSCONNECTION *conn = stmt->tds->conn;
+	int i;
+
+	if (!conn->dyn_cache.max_cached || !IS_TDS71_PLUS(conn))
+		return false;
+
+	/* output parameters are not returned by sp_prepexec */
+	if (stmt->params)
+		for (i = 0; i < stmt->params->num_cols; ++i)
+			if (stmt->params->columns[i]->column_output)
+				return false;
+	return true;
+}
+
+/**
+ * Execute a query with parameters reusing a statement already prepared
+ * on this connection. If not found the statement is prepared and cached.
+ */
+static TDSRET
+odbc_execute_cached(TDS_STMT * stmt)
+{
+	TDSSOCKET *tds = stmt->tds;
+	const char *query = tds_dstr_cstr(&stmt->query);
+	TDSDYNAMIC *dyn;
+	TDSRET ret;
+
+	dyn = tds_dynamic_cache_get(tds->conn, query, stmt->params);
+	if (dyn) {
+		tds_free_input_params(dyn);
+		dyn->params = stmt->params;
+		ret = tds_submit_execute(tds, dyn);
+		/* parameters are still owned by the statement */
+		dyn->params = NULL;
+	} else {
+		ret = tds71_submit_prepexec(tds, query, NULL, &dyn, stmt->params);
+		if (TDS_SUCCEED(ret))
+			tds_dynamic_cache_put(tds->conn, dyn, query, stmt->params);
+	}
+	tds_dynamic_cache_release(tds->conn, &dyn);
+	return ret;
+}
+
 static SQLRETURN
 _SQLExecute(TDS_STMT * stmt)
 {
@@ -3415,7 +3474,6 @@ _SQLExecute(TDS_STMT * stmt)
 	stmt->row_count = TDS_NO_COUNT;
 
 	if (stmt->prepared_query_is_rpc) {
-		/* TODO support stmt->apd->header.sql_desc_array_size for RPC */
 		/* get rpc name */
 		/* TODO change method */
 		/* TODO cursor change way of calling */
@@ -3425,10 +3483,34 @@ _SQLExecute(TDS_STMT * stmt)
 		end = name;
 		end = (char *) odbc_skip_rpc_name(end);
 		stmt->prepared_pos = end - name;
-		tmp = *end;
-		*end = 0;
-		ret = tds_submit_rpc(tds, name, stmt->params, odbc_init_headers(stmt, &head));
-		*end = tmp;
+		if (stmt->num_param_rows <= 1 || !IS_TDS7_PLUS(tds->conn)) {
+			tmp = *end;
+			*end = 0;
+			ret = tds_submit_rpc(tds, name, stmt->params, odbc_init_headers(stmt, &head));
+			*end = tmp;
+		} else {
+			/* pack multiple RPC calls in a single request */
+			TDSMULTIPLE multiple;
+
+			name = tds_strndup(name, end - name);
+			if (!name) {
+				odbc_errs_add(&stmt->errs, "HY001", NULL);
+				return SQL_ERROR;
+			}
+			ret = tds_multiple_init(tds, &multiple, TDS_MULTIPLE_RPC, odbc_init_headers(stmt, &head));
+			for (stmt->curr_param_row = 0; TDS_SUCCEED(ret); ) {
+				ret = tds_multiple_rpc(tds, &multiple, name, stmt->params);
+				if (++stmt->curr_param_row >= stmt->num_param_rows)
+					break;
+				/* than process others parameters */
+				stmt->prepared_pos = end - tds_dstr_cstr(&stmt->query);
+				if (start_parse_prepared_query(stmt, true) != SQL_SUCCESS)
+					break;
+			}
+			if (TDS_SUCCEED(ret))
+				ret = tds_multiple_done(tds, &multiple);
+			free(name);
+		}
 	} else if (stmt->attr.cursor_type != SQL_CURSOR_FORWARD_ONLY || stmt->attr.concurrency != SQL_CONCUR_READ_ONLY) {
 		ret = odbc_cursor_execute(stmt);
 	} else if (!stmt->is_prepared_query) {
@@ -3438,9 +3520,26 @@ _SQLExecute(TDS_STMT * stmt)
 		if (stmt->num_param_rows <= 1) {
 			if (!stmt->params) {
 				ret = tds_submit_query_params(tds, tds_dstr_cstr(&stmt->query), NULL, odbc_init_headers(stmt, &head));
+			} else if (!odbc_init_headers(stmt, &head) && odbc_can_cache_dynamic(stmt)) {
+				ret = odbc_execute_cached(stmt);
 			} else {
 				ret = tds_submit_execdirect(tds, tds_dstr_cstr(&stmt->query), stmt->params, odbc_init_headers(stmt, &head));
 			}
+		} else if (stmt->params && IS_TDS7_PLUS(tds->conn)) {
+			/* pack multiple submit using RPCs, parameters are sent in binary */
+			TDSMULTIPLE multiple;
+
+			ret = tds_multiple_init(tds, &multiple, TDS_MULTIPLE_RPC, odbc_init_headers(stmt, &head));
+			for (stmt->curr_param_row = 0; TDS_SUCCEED(ret); ) {
+				ret = tds_multiple_execdirect(tds, &multiple, tds_dstr_cstr(&stmt->query), stmt->params);
+				if (++stmt->curr_param_row >= stmt->num_param_rows)
+					break;
+				/* than process others parameters */
+				if (start_parse_prepared_query(stmt, true) != SQL_SUCCESS)
+					break;
+			}
+			if (TDS_SUCCEED(ret))
+				ret = tds_multiple_done(tds, &multiple);
 		} else {
 			/* pack multiple submit using language */
 			TDSMULTIPLE multiple;
@@ -3465,7 +3564,20 @@ _SQLExecute(TDS_STMT * stmt)
 					ODBC_RETURN(stmt, SQL_ERROR);
 			}
 			stmt->need_reprepare = 0;
-			ret = tds71_submit_prepexec(tds, tds_dstr_cstr(&stmt->query), NULL, &stmt->dyn, stmt->params);
+			if (!odbc_can_cache_dynamic(stmt)) {
+				ret = tds71_submit_prepexec(tds, tds_dstr_cstr(&stmt->query), NULL, &stmt->dyn, stmt->params);
+			} else if ((stmt->dyn = tds_dynamic_cache_get(tds->conn, tds_dstr_cstr(&stmt->query), stmt->params)) != NULL) {
+				/* already prepared by another statement */
+				tds_free_input_params(stmt->dyn);
+				stmt->dyn->params = stmt->params;
+				/* prevent double free */
+				stmt->params = NULL;
+				ret = tds_submit_execute(tds, stmt->dyn);
+			} else {
+				ret = tds71_submit_prepexec(tds, tds_dstr_cstr(&stmt->query), NULL, &stmt->dyn, stmt->params);
+				if (TDS_SUCCEED(ret))
+					tds_dynamic_cache_put(tds->conn, stmt->dyn, tds_dstr_cstr(&stmt->query), stmt->params);
+			}
 	} else {
 		/* TODO cursor change way of calling */
 		/* SQLPrepare */
@@ -3841,6 +3953,39 @@ odbc_fix_data_type_col(TDS_STMT *stmt, int idx)
  * - handle correctly results (SQL_SUCCESS_WITH_INFO if error on some rows,
  *   SQL_ERROR for all rows, see doc)
  */
+/**
+ * Resolve conversions of bound columns for the rows to fetch
+ */
+static bool
+odbc_fetch_prepare(TDS_STMT * stmt, TDSRESULTINFO * resinfo)
+{
+	TDS_DESC *ard = stmt->ard;
+	unsigned int i, num_cols;
+
+	num_cols = ODBC_MIN(resinfo->num_cols, ard->header.sql_desc_count);
+	if (num_cols > stmt->num_fetch_cols) {
+		if (!TDS_RESIZE(stmt->fetch_cols, num_cols))
+			return false;
+		stmt->num_fetch_cols = num_cols;
+	}
+
+	for (i = 0; i < num_cols; ++i) {
+		struct _drecord *drec_ard = &ard->records[i];
+		ODBC_FETCH_COL *fc = &stmt->fetch_cols[i];
+		int c_type;
+
+		if (!drec_ard->sql_desc_data_ptr)
+			continue;
+
+		c_type = drec_ard->sql_desc_concise_type;
+		if (c_type == SQL_C_DEFAULT)
+			c_type = odbc_sql_to_c_type_default(stmt->ird->records[i].sql_desc_concise_type);
+		odbc_tds2sql_prepare(stmt, resinfo->columns[i], c_type, drec_ard, fc);
+		fc->octet_len = odbc_get_octet_len(c_type, drec_ard);
+	}
+	return true;
+}
+
 static SQLRETURN
 _SQLFetch(TDS_STMT * stmt, SQLSMALLINT FetchOrientation, SQLLEN FetchOffset)
 {
@@ -4032,6 +4177,13 @@ _SQLFetch(TDS_STMT * stmt, SQLSMALLINT FetchOrientation, SQLLEN FetchOffset)
 			break;
 		}
 
+		/* all rows of the rowset come from the same result set */
+		if (curr_row == 0 && !odbc_fetch_prepare(stmt, resinfo)) {
+			odbc_errs_add(&stmt->errs, "HY001", NULL);
+			stmt->errs.lastrc = SQL_ERROR;
+			break;
+		}
+
 		/* we got a row, return a row readed even if error (for ODBC specifications) */
 		++(*fetched_ptr);
 		for (i = 0; i < resinfo->num_cols; i++) {
@@ -4058,26 +4210,21 @@ _SQLFetch(TDS_STMT * stmt, SQLSMALLINT FetchOrientation, SQLLEN FetchOffset)
 			/* TODO what happen to length if no data is returned (drec->sql_desc_data_ptr == NULL) ?? */
 			len = 0;
 			if (drec_ard->sql_desc_data_ptr) {
-				int c_type;
+				const ODBC_FETCH_COL *fc = &stmt->fetch_cols[i];
 				TDS_CHAR *data_ptr = (TDS_CHAR *) drec_ard->sql_desc_data_ptr;
 
-				colinfo->column_text_sqlgetdatapos = 0;
-				colinfo->column_iconv_left = 0;
-				c_type = drec_ard->sql_desc_concise_type;
-				if (c_type == SQL_C_DEFAULT)
-					c_type = odbc_sql_to_c_type_default(stmt->ird->records[i].sql_desc_concise_type);
 				if (row_offset || curr_row == 0) {
 					data_ptr += row_offset;
 				} else {
-					data_ptr += odbc_get_octet_len(c_type, drec_ard) * curr_row;
+					data_ptr += fc->octet_len * curr_row;
 				}
-				len = odbc_tds2sql_col(stmt, colinfo, c_type, data_ptr, drec_ard->sql_desc_octet_length, drec_ard);
+				len = fc->conv(stmt, fc, colinfo, data_ptr, drec_ard->sql_desc_octet_length);
 				if (len == SQL_NULL_DATA) {
 					row_status = SQL_ROW_ERROR;
 					break;
 				}
-				if ((c_type == SQL_C_CHAR && len >= drec_ard->sql_desc_octet_length)
-				    || (c_type == SQL_C_BINARY && len > drec_ard->sql_desc_octet_length)) {
+				if ((fc->c_type == SQL_C_CHAR && len >= drec_ard->sql_desc_octet_length)
+				    || (fc->c_type == SQL_C_BINARY && len > drec_ard->sql_desc_octet_length)) {
 					truncated = 1;
 					stmt->errs.lastrc = SQL_SUCCESS_WITH_INFO;
 				}
@@ -4341,6 +4488,7 @@ _SQLFreeStmt(SQLHSTMT hstmt, SQLUSMALLINT fOption, int force)
 		desc_free(stmt->ipd);
 		desc_free(stmt->orig_ard);
 		desc_free(stmt->orig_apd);
+		free(stmt->fetch_cols);
 		tds_mutex_unlock(&stmt->mtx);
 		tds_mutex_free(&stmt->mtx);
 		free(stmt);
@@ -4573,6 +4721,10 @@ _SQLGetStmtAttr(SQLHSTMT hstmt, SQLINTEGER Attribute, SQLPOINTER Value, SQLINTEG
 		size = sizeof(stmt->sql_rowset_size);
 		src = &stmt->sql_rowset_size;
 		break;
+	case SQL_SOPT_FREETDS_QUERY_TIMEOUT_MS:
+		size = sizeof(stmt->attr.query_timeout_ms);
+		src = &stmt->attr.query_timeout_ms;
+		break;
 	case SQL_SOPT_SS_QUERYNOTIFICATION_TIMEOUT:
 		size = sizeof(stmt->attr.qn_timeout);
 		src = &stmt->attr.qn_timeout;
@@ -6730,6 +6882,16 @@ _SQLSetStmtAttr(SQLHSTMT hstmt, SQLINTEGER Attribute, SQLPOINTER ValuePtr, SQLIN
 		break;
 	case SQL_ATTR_QUERY_TIMEOUT:
 		stmt->attr.query_timeout = ui;
+		stmt->attr.query_timeout_ms = odbc_timeout_ms(ui);
+		break;
+	case SQL_SOPT_FREETDS_QUERY_TIMEOUT_MS:
+		if (ui > INT_MAX) {
+			odbc_errs_add(&stmt->errs, "HY024", NULL);
+			break;
+		}
+		stmt->attr.query_timeout_ms = ui;
+		/* round up, a timeout is never reported as none */
+		stmt->attr.query_timeout = (ui + 999u) / 1000u;
 		break;
 		/* retrieve data after positioning the cursor */
 	case SQL_ATTR_RETRIEVE_DATA:
@@ -7513,6 +7675,13 @@ odbc_free_dynamic(TDS_STMT * stmt)
 		return TDS_SUCCESS;
 
 	tds = stmt->dbc->tds_socket;
+
+	/* shared statements are unprepared by the cache */
+	if (stmt->dyn->cache_users) {
+		tds_dynamic_cache_release(tds->conn, &stmt->dyn);
+		return SQL_SUCCESS;
+	}
+
 	if (!tds_needs_unprepare(tds->conn, stmt->dyn)) {
 		tds_release_dynamic(&stmt->dyn);
 		return SQL_SUCCESS;
@@ -0,0 +1,161 @@
+#include "common.h"
+#include <assert.h>
+#include <freetds/bool.h>
+#include <freetds/time.h>
+
+/*
+ * Test fetching rows using block cursors, both column-wise and
+ * row-wise binding, checking data and comparing speed with
+ * fetching a row at a time (if TDS_BENCHMARK is set).
+ */
+
+#define NUM_ROWS 10000
+#define MAX_ARRAY 1000
+#define STR_LEN 21
+
+typedef struct
+{
+	SQLINTEGER id;
+	SQLLEN id_ind;
+	double num;
+	SQLLEN num_ind;
+	char str[STR_LEN];
+	SQLLEN str_ind;
+} Record;
+
+static SQLINTEGER ids[MAX_ARRAY];
+static SQLLEN id_inds[MAX_ARRAY];
+static double nums[MAX_ARRAY];
+static SQLLEN num_inds[MAX_ARRAY];
+static char strs[MAX_ARRAY][STR_LEN];
+static SQLLEN str_inds[MAX_ARRAY];
+static Record records[MAX_ARRAY];
+static bool benchmark = false;
+
+static double
+now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (double) tv.tv_sec + (double) tv.tv_usec * 0.000001;
+}
+
+static void
+check_row(int n, SQLINTEGER id, SQLLEN id_ind, double num, SQLLEN num_ind, const char *str, SQLLEN str_ind)
+{
+	char expected[STR_LEN];
+
+	sprintf(expected, "row %d", n);
+	if (id_ind != sizeof(SQLINTEGER) || id != n || num_ind != sizeof(double) || num != n / 4.0) {
+		fprintf(stderr, "Wrong numeric data at row %d\n", n);
+		exit(1);
+	}
+	if (n % 7 == 0) {
+		if (str_ind != SQL_NULL_DATA) {
+			fprintf(stderr, "NULL expected at row %d\n", n);
+			exit(1);
+		}
+	} else if (str_ind != (SQLLEN) strlen(expected) || strcmp(str, expected) != 0) {
+		fprintf(stderr, "Wrong string data at row %d\n", n);
+		exit(1);
+	}
+}
+
+static void
+start_query(SQLULEN array_size, bool row_wise)
+{
+	odbc_reset_statement();
+
+	CHKSetStmtAttr(SQL_ATTR_ROW_ARRAY_SIZE, TDS_INT2PTR(array_size), 0, "S");
+	if (row_wise) {
+		CHKSetStmtAttr(SQL_ATTR_ROW_BIND_TYPE, TDS_INT2PTR(sizeof(Record)), 0, "S");
+		CHKBindCol(1, SQL_C_SLONG, &records[0].id, 0, &records[0].id_ind, "S");
+		CHKBindCol(2, SQL_C_DOUBLE, &records[0].num, 0, &records[0].num_ind, "S");
+		CHKBindCol(3, SQL_C_CHAR, records[0].str, STR_LEN, &records[0].str_ind, "S");
+	} else {
+		CHKSetStmtAttr(SQL_ATTR_ROW_BIND_TYPE, TDS_INT2PTR(SQL_BIND_BY_COLUMN), 0, "S");
+		CHKBindCol(1, SQL_C_SLONG, ids, 0, id_inds, "S");
+		CHKBindCol(2, SQL_C_DOUBLE, nums, 0, num_inds, "S");
+		CHKBindCol(3, SQL_C_CHAR, strs, STR_LEN, str_inds, "S");
+	}
+
+	CHKExecDirect(T("SELECT id, num, str FROM #blockfetch ORDER BY id"), SQL_NTS, "S");
+}
+
+static void
+fetch_all(SQLULEN array_size, bool row_wise, bool use_fetch)
+{
+	SQLULEN fetched, i;
+	SQLUSMALLINT statuses[MAX_ARRAY];
+	int n = 0;
+	double start;
+	SQLRETURN rc;
+
+	start_query(array_size, row_wise);
+	CHKSetStmtAttr(SQL_ATTR_ROWS_FETCHED_PTR, &fetched, 0, "S");
+	CHKSetStmtAttr(SQL_ATTR_ROW_STATUS_PTR, statuses, 0, "S");
+
+	start = now();
+	for (;;) {
+		if (use_fetch)
+			rc = CHKFetch("SNo");
+		else
+			rc = CHKFetchScroll(SQL_FETCH_NEXT, 0, "SNo");
+		if (rc == SQL_NO_DATA)
+			break;
+		for (i = 0; i < fetched; ++i, ++n) {
+			if (statuses[i] != SQL_ROW_SUCCESS) {
+				fprintf(stderr, "Wrong status at row %d\n", n);
+				exit(1);
+			}
+			if (row_wise)
+				check_row(n, records[i].id, records[i].id_ind, records[i].num, records[i].num_ind,
+					  records[i].str, records[i].str_ind);
+			else
+				check_row(n, ids[i], id_inds[i], nums[i], num_inds[i], strs[i], str_inds[i]);
+		}
+	}
+	if (n != NUM_ROWS) {
+		fprintf(stderr, "Wrong number of rows %d\n", n);
+		exit(1);
+	}
+
+	if (benchmark)
+		printf("%-13s %-10s array %4u: %.3f sec\n", use_fetch ? "SQLFetch" : "SQLFetchScroll",
+		       row_wise ? "row-wise" : "column-wise", (unsigned) array_size, now() - start);
+
+	CHKMoreResults("No");
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const SQLULEN sizes[] = { 1, 100, 1000 };
+	const char *env = getenv("TDS_BENCHMARK");
+	int i;
+
+	benchmark = env && env[0] && strcmp(env, "0") != 0;
+
+	odbc_use_version3 = 1;
+	odbc_connect();
+
+	odbc_command("CREATE TABLE #blockfetch(id INT, num FLOAT, str VARCHAR(20) NULL)");
+	odbc_command("SET NOCOUNT ON DECLARE @i INT SET @i = 0 "
+		     "WHILE @i < 10000 BEGIN "
+		     "INSERT INTO #blockfetch VALUES(@i, @i / 4.0, "
+		     "CASE WHEN @i % 7 = 0 THEN NULL ELSE 'row ' + CAST(@i AS VARCHAR(10)) END) "
+		     "SET @i = @i + 1 END SET NOCOUNT OFF");
+
+	fetch_all(1, false, true);
+	for (i = 0; i < TDS_VECTOR_SIZE(sizes); ++i) {
+		fetch_all(sizes[i], false, false);
+		fetch_all(sizes[i], true, false);
+	}
+
+	/* SQLFetch use array size too */
+	fetch_all(100, false, true);
+
+	odbc_disconnect();
+	return 0;
+}
@@ -51,6 +51,10 @@
 #define POOL_STR_MAX_POOL_CONN	"max pool conn"
 #define POOL_STR_MIN_POOL_CONN	"min pool conn"
 #define POOL_STR_MAX_POOL_USERS	"max pool users"
+#define POOL_STR_WORKERS	"worker threads"
+#define POOL_STR_ZERO_COPY	"zero copy"
+#define POOL_STR_MODE	"pool mode"
+#define POOL_STR_RESET_QUERY	"reset query"
 
 typedef struct {
 	TDS_POOL *pool;
@@ -158,6 +162,27 @@ pool_parse(const char *option, const char *value, void *param)
 	} else if (!strcmp(option, POOL_STR_MIN_POOL_CONN)) {
 		val = pool_get_uint(value);
 		pool->min_open_conn = val;
+	} else if (!strcmp(option, POOL_STR_MAX_POOL_USERS)) {
+		val = pool_get_uint(value);
+		pool->max_users = val;
+	} else if (!strcmp(option, POOL_STR_WORKERS)) {
+		val = pool_get_uint(value);
+		if (val < 1 || val > 1024)
+			val = -1;
+		pool->num_workers = val;
+	} else if (!strcmp(option, POOL_STR_ZERO_COPY)) {
+		val = tds_parse_boolean(value, -1);
+		pool->zero_copy = val > 0;
+	} else if (!strcmp(option, POOL_STR_MODE)) {
+		if (!strcasecmp(value, "session"))
+			pool->mode = POOL_MODE_SESSION;
+		else if (!strcasecmp(value, "transaction"))
+			pool->mode = POOL_MODE_TRANSACTION;
+		else
+			val = -1;
+	} else if (!strcmp(option, POOL_STR_RESET_QUERY)) {
+		free(pool->reset_query);
+		pool->reset_query = value[0] ? strdup(value) : NULL;
 	}
 	if (val < 0) {
 		free(*params->err);
@@ -51,6 +51,10 @@
 #include <poll.h>
 #endif /* HAVE_POLL_H */
 
+#if HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif /* HAVE_SYS_EPOLL_H */
+
 #if HAVE_NETINET_IN_H
 #include <netinet/in.h>
 #endif /* HAVE_NETINET_IN_H */
@@ -66,20 +70,32 @@
 #include "pool.h"
 
 /* to be set by sig term */
-static bool got_sigterm = false;
+static volatile bool got_sigterm = false;
 static const char *logfile_name = NULL;
 
+/* shards of the pool, one for each worker thread */
+static TDS_POOL **shards = NULL;
+static unsigned num_shards = 0;
+
 static void sigterm_handler(int sig);
 static void pool_schedule_waiters(TDS_POOL * pool);
 static TDS_POOL *pool_init(const char *name, const char *config_path);
 static void pool_socket_init(TDS_POOL * pool);
+static void pool_events_init(TDS_POOL * pool);
+static void pool_shards_init(TDS_POOL * pool);
 static void pool_main_loop(TDS_POOL * pool);
 static bool pool_open_logfile(TDS_POOL * pool);
 
 static void
 sigterm_handler(int sig)
 {
+	unsigned n;
+
 	got_sigterm = true;
+
+	/* wake up all workers */
+	for (n = 0; n < num_shards; ++n)
+		WRITESOCKET(shards[n]->event_fd, "x", 1);
 }
 
 #ifndef _WIN32
@@ -118,8 +134,11 @@ pool_init(const char *name, const char *config_path)
 		exit(EXIT_FAILURE);
 	}
 	pool->password = strdup("");
+	pool->num_workers = 1;
+	pool->zero_copy = true;
 
 	pool->event_fd = INVALID_SOCKET;
+	pool->epoll_fd = -1;
 	if (tds_mutex_init(&pool->events_mtx)) {
 		fprintf(stderr, "Error initializing pool mutex\n");
 		exit(EXIT_FAILURE);
@@ -149,18 +168,112 @@ pool_init(const char *name, const char *config_path)
 		exit(EXIT_FAILURE);
 	}
 
+	if (pool->num_workers < 1) {
+		fprintf(stderr, "At least a worker thread is required\n");
+		exit(EXIT_FAILURE);
+	}
+
 	pool->name = strdup(name);
 
 	pool_open_logfile(pool);
 
-	pool_mbr_init(pool);
-	pool_user_init(pool);
-
 	pool_socket_init(pool);
 
+	pool_shards_init(pool);
+
 	return pool;
 }
 
+static char *
+pool_strdup(const char *s)
+{
+	char *res;
+
+	if (!s)
+		return NULL;
+	res = strdup(s);
+	if (!res) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	return res;
+}
+
+/*
+ * Split a limit among workers, the first ones take the remainder.
+ */
+static int
+pool_split_limit(int limit, unsigned n, unsigned num)
+{
+	return limit / num + (n < limit % num ? 1 : 0);
+}
+
+/*
+ * pool_shards_init
+ * Split the pool in shards, one for each worker thread.
+ * Every shard owns its users and members and has its own event loop,
+ * so no locking is needed between them. The listening socket and the
+ * number of users (limited by max_users) are shared.
+ */
+static void
+pool_shards_init(TDS_POOL * pool)
+{
+	unsigned n, num = pool->num_workers;
+	int min_open_conn = pool->min_open_conn;
+	int max_open_conn = pool->max_open_conn;
+
+	/* every worker needs at least a member */
+	if (max_open_conn > 0 && num > (unsigned) max_open_conn) {
+		fprintf(stderr, "Reducing worker threads to %d, the maximum number of connections\n", max_open_conn);
+		num = max_open_conn;
+	}
+
+	shards = tds_new0(TDS_POOL *, num);
+	if (!shards) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (n = 0; n < num; ++n) {
+		TDS_POOL *shard = pool;
+
+		if (n) {
+			shard = tds_new0(TDS_POOL, 1);
+			if (!shard || tds_mutex_init(&shard->events_mtx)) {
+				fprintf(stderr, "Could not allocate memory for pool\n");
+				exit(EXIT_FAILURE);
+			}
+			shard->name = pool_strdup(pool->name);
+			shard->user = pool_strdup(pool->user);
+			shard->password = pool_strdup(pool->password);
+			shard->server = pool_strdup(pool->server);
+			shard->database = pool_strdup(pool->database);
+			shard->server_user = pool_strdup(pool->server_user);
+			shard->server_password = pool_strdup(pool->server_password);
+			shard->port = pool->port;
+			shard->max_member_age = pool->max_member_age;
+			shard->max_users = pool->max_users;
+			shard->zero_copy = pool->zero_copy;
+			shard->mode = pool->mode;
+			shard->reset_query = pool_strdup(pool->reset_query);
+			shard->num_workers = num;
+			/* only first shard owns the listening socket */
+			shard->listen_fd = pool->listen_fd;
+			shard->event_fd = INVALID_SOCKET;
+			shard->epoll_fd = -1;
+		}
+		shard->min_open_conn = pool_split_limit(min_open_conn, n, num);
+		shard->max_open_conn = pool_split_limit(max_open_conn, n, num);
+
+		pool_events_init(shard);
+		pool_mbr_init(shard);
+		pool_user_init(shard);
+		shards[n] = shard;
+	}
+	pool->num_workers = num;
+	num_shards = num;
+}
+
 static void
 pool_destroy(TDS_POOL *pool)
 {
@@ -168,8 +281,13 @@ pool_destroy(TDS_POOL *pool)
 	pool_user_destroy(pool);
 
 	CLOSESOCKET(pool->wakeup_fd);
-	CLOSESOCKET(pool->listen_fd);
+	if (pool == shards[0])
+		CLOSESOCKET(pool->listen_fd);
 	CLOSESOCKET(pool->event_fd);
+#if HAVE_SYS_EPOLL_H
+	if (pool->epoll_fd >= 0)
+		close(pool->epoll_fd);
+#endif
 	tds_mutex_free(&pool->events_mtx);
 
 	free(pool->user);
@@ -179,6 +297,7 @@ pool_destroy(TDS_POOL *pool)
 	free(pool->name);
 	free(pool->server_user);
 	free(pool->server_password);
+	free(pool->reset_query);
 	free(pool);
 }
 
@@ -204,9 +323,121 @@ pool_schedule_waiters(TDS_POOL * pool)
 	}
 }
 
+/**
+ * Queue a socket to be processed if it is ready for the
+ * operation the pool is waiting for.
+ */
+static void
+pool_socket_queue(TDS_POOL * pool, TDS_POOL_SOCKET * sock)
+{
+	if (!(sock->poll_recv && sock->can_recv) && !(sock->poll_send && sock->can_send))
+		return;
+	if (!dlist_ready_in_list(&pool->ready, sock))
+		dlist_ready_append(&pool->ready, sock);
+}
+
+/**
+ * Tell the event loop the socket state or interest changed.
+ * Register the socket if needed. As notifications are edge
+ * triggered readiness already reported must be checked again.
+ */
+void
+pool_socket_changed(TDS_POOL * pool, TDS_POOL_SOCKET * sock)
+{
+	if (!sock->tds || IS_TDSDEAD(sock->tds))
+		return;
+
+#if HAVE_SYS_EPOLL_H
+	if (!sock->registered && pool->epoll_fd >= 0) {
+		struct epoll_event ev;
+
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		ev.data.ptr = sock;
+		if (epoll_ctl(pool->epoll_fd, EPOLL_CTL_ADD, tds_get_s(sock->tds), &ev) < 0) {
+			char *errstr = sock_strerror(sock_errno);
+			fprintf(stderr, "Error: epoll_ctl failed, %s\n", errstr);
+			sock_strerror_free(errstr);
+			exit(EXIT_FAILURE);
+		}
+		sock->registered = true;
+	}
+#endif
+
+	pool_socket_queue(pool, sock);
+}
+
+/**
+ * Remove a socket from the event loop, must be called before freeing it.
+ */
+void
+pool_socket_remove(TDS_POOL * pool, TDS_POOL_SOCKET * sock)
+{
+	if (dlist_ready_in_list(&pool->ready, sock))
+		dlist_ready_remove(&pool->ready, sock);
+
+#if HAVE_SYS_EPOLL_H
+	if (sock->registered && sock->tds && !TDS_IS_SOCKET_INVALID(tds_get_s(sock->tds)))
+		epoll_ctl(pool->epoll_fd, EPOLL_CTL_DEL, tds_get_s(sock->tds), NULL);
+#endif
+	sock->registered = false;
+}
+
+static void
+pool_socket_set_ready(TDS_POOL * pool, TDS_POOL_SOCKET * sock, unsigned events)
+{
+	if ((events & (POLLIN | POLLHUP | POLLERR)) != 0)
+		sock->can_recv = true;
+	if ((events & (POLLOUT | POLLHUP | POLLERR)) != 0)
+		sock->can_send = true;
+	pool_socket_queue(pool, sock);
+}
+
+#if HAVE_SYS_EPOLL_H
+#define POOL_MAX_EVENTS 256
+
+typedef struct select_info
+{
+	struct epoll_event events[POOL_MAX_EVENTS];
+} SELECT_INFO;
+
+/*
+ * Wait for events using epoll(7).
+ * Registrations are persistent so cost depends only on ready sockets.
+ */
+static int
+pool_wait_events(TDS_POOL * pool, SELECT_INFO *sel, int timeout, bool *listen_ready, bool *wakeup_ready)
+{
+	struct epoll_event *events = sel->events;
+	int rc, n;
+
+	rc = epoll_wait(pool->epoll_fd, events, POOL_MAX_EVENTS, timeout);
+	for (n = 0; n < rc; ++n) {
+		void *ptr = events[n].data.ptr;
+		unsigned ev = 0;
+
+		if (ptr == &pool->listen_fd) {
+			*listen_ready = true;
+			continue;
+		}
+		if (ptr == &pool->wakeup_fd) {
+			*wakeup_ready = true;
+			continue;
+		}
+		if ((events[n].events & (EPOLLIN | EPOLLRDHUP)) != 0)
+			ev |= POLLIN;
+		if ((events[n].events & EPOLLOUT) != 0)
+			ev |= POLLOUT;
+		if ((events[n].events & (EPOLLHUP | EPOLLERR)) != 0)
+			ev |= POLLHUP;
+		pool_socket_set_ready(pool, (TDS_POOL_SOCKET *) ptr, ev);
+	}
+	return rc;
+}
+#else
 typedef struct select_info
 {
 	struct pollfd *fds;
+	TDS_POOL_SOCKET **socks;
 	uint32_t num_fds, alloc_fds;
 } SELECT_INFO;
 
@@ -217,7 +448,7 @@ pool_select_add_socket(SELECT_INFO *sel, TDS_POOL_SOCKET *sock)
 	struct pollfd *fd;
 
 	/* skip dead connections */
-	if (IS_TDSDEAD(sock->tds))
+	if (!sock->tds || IS_TDSDEAD(sock->tds))
 		return;
 	if (!sock->poll_recv && !sock->poll_send)
 		return;
@@ -229,18 +460,84 @@ pool_select_add_socket(SELECT_INFO *sel, TDS_POOL_SOCKET *sock)
 		events |= POLLOUT;
 	if (sel->num_fds >= sel->alloc_fds) {
 		sel->alloc_fds *= 2;
-		if (!TDS_RESIZE(sel->fds, sel->alloc_fds)) {
+		if (!TDS_RESIZE(sel->fds, sel->alloc_fds) || !TDS_RESIZE(sel->socks, sel->alloc_fds)) {
 			fprintf(stderr, "Out of memory allocating fds\n");
 			exit(EXIT_FAILURE);
 		}
 	}
-	sock->poll_index = sel->num_fds;
+	sel->socks[sel->num_fds] = sock;
 	fd = &sel->fds[sel->num_fds++];
 	fd->fd = tds_get_s(sock->tds);
 	fd->events = events;
 	fd->revents = 0;
 }
 
+/*
+ * Wait for events using poll(2).
+ * Used if epoll is not available, the set is rebuilt at every call.
+ */
+static int
+pool_wait_events(TDS_POOL * pool, SELECT_INFO *sel, int timeout, bool *listen_ready, bool *wakeup_ready)
+{
+	TDS_POOL_MEMBER *pmbr;
+	TDS_POOL_USER *puser;
+	uint32_t n;
+	int rc;
+
+	if (!sel->fds) {
+		sel->alloc_fds = 8;
+		if (!TDS_RESIZE(sel->fds, sel->alloc_fds) || !TDS_RESIZE(sel->socks, sel->alloc_fds)) {
+			fprintf(stderr, "Out of memory allocating fds\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	sel->num_fds = 2;
+	sel->fds[0].fd = pool->listen_fd;
+	sel->fds[0].events = POLLIN;
+	sel->fds[0].revents = 0;
+	sel->fds[1].fd = pool->wakeup_fd;
+	sel->fds[1].events = POLLIN;
+	sel->fds[1].revents = 0;
+
+	/* add the user sockets to the read list */
+	DLIST_FOREACH(dlist_user, &pool->users, puser)
+		pool_select_add_socket(sel, &puser->sock);
+
+	/* add the pool member sockets to the read list */
+	DLIST_FOREACH(dlist_member, &pool->active_members, pmbr)
+		pool_select_add_socket(sel, &pmbr->sock);
+
+	rc = poll(sel->fds, sel->num_fds, timeout);
+	if (rc <= 0)
+		return rc;
+
+	*listen_ready = (sel->fds[0].revents & POLLIN) != 0;
+	*wakeup_ready = (sel->fds[1].revents & POLLIN) != 0;
+	for (n = 2; n < sel->num_fds; ++n)
+		if (sel->fds[n].revents)
+			pool_socket_set_ready(pool, sel->socks[n], sel->fds[n].revents);
+	return rc;
+}
+#endif
+
+/*
+ * Process sockets ready for the operations the pool wants to do.
+ */
+static void
+pool_process_ready(TDS_POOL * pool)
+{
+	TDS_POOL_SOCKET *sock;
+
+	while ((sock = dlist_ready_first(&pool->ready)) != NULL) {
+		dlist_ready_remove(&pool->ready, sock);
+		if (sock->is_member)
+			pool_process_member(pool, (TDS_POOL_MEMBER *) sock);
+		else
+			pool_process_user(pool, (TDS_POOL_USER *) sock);
+	}
+}
+
 static void
 pool_process_events(TDS_POOL *pool)
 {
@@ -294,7 +591,7 @@ static void
 pool_socket_init(TDS_POOL * pool)
 {
 	struct sockaddr_in sin;
-	TDS_SYS_SOCKET s, event_pair[2];
+	TDS_SYS_SOCKET s;
 	int socktrue = 1;
 
 	/* FIXME -- read the interfaces file and bind accordingly */
@@ -315,8 +612,20 @@ pool_socket_init(TDS_POOL * pool)
 		perror("bind");
 		exit(1);
 	}
-	listen(s, 5);
+	listen(s, SOMAXCONN);
 	pool->listen_fd = s;
+}
+
+/*
+ * pool_events_init
+ * Create the event loop of a shard, with the descriptor used to wake it up.
+ */
+static void
+pool_events_init(TDS_POOL * pool)
+{
+	TDS_SYS_SOCKET event_pair[2];
+
+	dlist_ready_init(&pool->ready);
 
 	if (socketpair(AF_UNIX, SOCK_STREAM, 0, event_pair) < 0) {
 		perror("socketpair");
@@ -326,54 +635,58 @@ pool_socket_init(TDS_POOL * pool)
 	tds_socket_set_nonblocking(event_pair[1]);
 	pool->event_fd = event_pair[1];
 	pool->wakeup_fd = event_pair[0];
+
+#if HAVE_SYS_EPOLL_H
+	{
+		struct epoll_event ev;
+
+		pool->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (pool->epoll_fd < 0) {
+			perror("epoll_create1");
+			exit(1);
+		}
+
+		/* these are level triggered, all workers wait on listening socket */
+		ev.events = EPOLLIN;
+#ifdef EPOLLEXCLUSIVE
+		ev.events |= EPOLLEXCLUSIVE;
+#endif
+		ev.data.ptr = &pool->listen_fd;
+		if (epoll_ctl(pool->epoll_fd, EPOLL_CTL_ADD, pool->listen_fd, &ev) < 0) {
+			perror("epoll_ctl");
+			exit(1);
+		}
+		ev.events = EPOLLIN;
+		ev.data.ptr = &pool->wakeup_fd;
+		if (epoll_ctl(pool->epoll_fd, EPOLL_CTL_ADD, pool->wakeup_fd, &ev) < 0) {
+			perror("epoll_ctl");
+			exit(1);
+		}
+	}
+#endif
 }
 
 /*
  * pool_main_loop
  * Accept new connections from clients, and handle all input from clients and
- * pool members.
+ * pool members. Each worker thread runs a loop for its shard.
  */
 static void
 pool_main_loop(TDS_POOL * pool)
 {
-	TDS_POOL_MEMBER *pmbr;
-	TDS_POOL_USER *puser;
-	TDS_SYS_SOCKET s, wakeup;
-	SELECT_INFO sel = { NULL, 0, 8 };
+	SELECT_INFO sel;
 	int min_expire_left = -1;
 	int rc;
 
-	s = pool->listen_fd;
-	wakeup = pool->wakeup_fd;
-
-	/* add the listening socket to the read list */
-	if (!TDS_RESIZE(sel.fds, sel.alloc_fds)) {
-		fprintf(stderr, "Out of memory allocating fds\n");
-		exit(EXIT_FAILURE);
-	}
-	sel.fds[0].fd = s;
-	sel.fds[0].events = POLLIN;
-	sel.fds[1].fd = wakeup;
-	sel.fds[1].events = POLLIN;
+	memset(&sel, 0, sizeof(sel));
 
 	while (!got_sigterm) {
-
-		sel.num_fds = 2;
-		sel.fds[0].revents = 0;
-		sel.fds[1].revents = 0;
-
-		/* add the user sockets to the read list */
-		DLIST_FOREACH(dlist_user, &pool->users, puser)
-			pool_select_add_socket(&sel, &puser->sock);
-
-		/* add the pool member sockets to the read list */
-		DLIST_FOREACH(dlist_member, &pool->active_members, pmbr)
-			pool_select_add_socket(&sel, &pmbr->sock);
+		bool listen_ready = false, wakeup_ready = false;
 
 		if (min_expire_left > 0)
 			min_expire_left *= 1000;
 
-		rc = poll(sel.fds, sel.num_fds, min_expire_left);
+		rc = pool_wait_events(pool, &sel, min_expire_left, &listen_ready, &wakeup_ready);
 		if (TDS_UNLIKELY(rc < 0)) {
 			char *errstr;
 
@@ -388,34 +701,44 @@ pool_main_loop(TDS_POOL * pool)
 			break;
 
 #ifndef _WIN32
-		if (TDS_UNLIKELY(got_sighup)) {
+		if (TDS_UNLIKELY(got_sighup) && pool == shards[0]) {
 			got_sighup = false;
 			pool_open_logfile(pool);
 		}
 #endif
 
 		/* process events */
-		if ((sel.fds[1].revents & POLLIN) != 0) {
+		if (wakeup_ready) {
 			char buf[32];
-			READSOCKET(wakeup, buf, sizeof(buf));
+			READSOCKET(pool->wakeup_fd, buf, sizeof(buf));
 
 			pool_process_events(pool);
 		}
 
 		/* process the sockets */
-		if ((sel.fds[0].revents & POLLIN) != 0) {
-			pool_user_create(pool, s);
-		}
-		pool_process_users(pool, sel.fds, sel.num_fds);
-		min_expire_left = pool_process_members(pool, sel.fds, sel.num_fds);
+		if (listen_ready)
+			pool_user_create(pool, pool->listen_fd);
+		pool_process_ready(pool);
+		min_expire_left = pool_expire_members(pool);
 
 		/* back from members */
 		if (dlist_user_first(&pool->waiters))
 			pool_schedule_waiters(pool);
 	}			/* while !got_sigterm */
+
+#if !HAVE_SYS_EPOLL_H
+	free(sel.fds);
+	free(sel.socks);
+#endif
 	tdsdump_log(TDS_DBG_INFO2, "Shutdown Requested\n");
 }
 
+static TDS_THREAD_PROC_DECLARE(pool_worker_proc, arg)
+{
+	pool_main_loop((TDS_POOL *) arg);
+	return TDS_THREAD_RESULT(0);
+}
+
 static void
 print_usage(const char *progname)
 {
@@ -434,6 +757,9 @@ main(int argc, char **argv)
 #endif
 	TDS_POOL *pool;
 	const char *config_path = NULL;
+	unsigned n;
+	unsigned long user_logins = 0, member_logins = 0;
+	int num_active_members = 0;
 
 	signal(SIGTERM, sigterm_handler);
 	signal(SIGINT, sigterm_handler);
@@ -473,9 +799,30 @@ main(int argc, char **argv)
 		}
 	}
 #endif
+
+	/* first shard is served by main thread */
+	for (n = 1; n < num_shards; ++n) {
+		if (tds_thread_create(&shards[n]->worker, pool_worker_proc, shards[n]) != 0) {
+			fprintf(stderr, "error creating thread\n");
+			return EXIT_FAILURE;
+		}
+	}
 	pool_main_loop(pool);
-	printf("User logins %lu members logins %lu members at end %d\n", pool->user_logins, pool->member_logins, pool->num_active_members);
-	pool_destroy(pool);
+	for (n = 1; n < num_shards; ++n)
+		tds_thread_join(shards[n]->worker, NULL);
+
+	for (n = 0; n < num_shards; ++n) {
+		user_logins += shards[n]->user_logins;
+		member_logins += shards[n]->member_logins;
+		num_active_members += shards[n]->num_active_members;
+	}
+	printf("User logins %lu members logins %lu members at end %d\n", user_logins, member_logins, num_active_members);
+
+	/* destroy from last as first shard owns the listening socket */
+	for (n = num_shards; n-- > 0; )
+		pool_destroy(shards[n]);
+	num_shards = 0;
+	free(shards);
 	printf("tdspool Shutdown\n");
 	return EXIT_SUCCESS;
 }
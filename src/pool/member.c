@@ -53,6 +53,7 @@
 
 #include "pool.h"
 #include <freetds/utils/string.h>
+#include <freetds/bytes.h>
 
 #ifndef MAXHOSTNAMELEN
 #define MAXHOSTNAMELEN 256
@@ -185,6 +186,10 @@ pool_reset_member(TDS_POOL * pool, TDS_POOL_MEMBER * pmbr)
 		pool_free_user(pool, puser);
 	}
 
+	/* a packet body is being spliced, we can't resync the stream */
+	if (pmbr->sock.splice_left || pmbr->sock.pipe_len)
+		goto failure;
+
 	/* cancel whatever pending */
 	tds_init_write_buf(tds);
 	if (tds_set_state(tds, TDS_WRITING) != TDS_WRITING)
@@ -210,6 +215,13 @@ pool_reset_member(TDS_POOL * pool, TDS_POOL_MEMBER * pmbr)
 		if (TDS_FAILED(tds_process_simple_query(tds)))
 			goto failure;
 	}
+
+	/* state of the session is unknown, reset before reusing */
+	pool_stream_init(&pmbr->stream, IS_TDS72_PLUS(tds->conn));
+	pmbr->busy = false;
+	pmbr->cancel_pending = false;
+	pmbr->pinned = false;
+	pmbr->dirty = true;
 	return;
 
 failure:
@@ -222,6 +234,8 @@ pool_free_member(TDS_POOL * pool, TDS_POOL_MEMBER * pmbr)
 	TDSSOCKET *tds;
 	TDS_POOL_USER *puser;
 
+	pool_socket_remove(pool, &pmbr->sock);
+	pool_splice_free(&pmbr->sock);
 	tds = pmbr->sock.tds;
 	if (tds) {
 		if (!IS_TDSDEAD(tds))
@@ -244,6 +258,8 @@ pool_free_member(TDS_POOL * pool, TDS_POOL_MEMBER * pmbr)
 		pool->num_active_members--;
 		dlist_member_remove(&pool->active_members, pmbr);
 	}
+	pool_stream_free(&pmbr->stream);
+	free(pmbr->session_sql);
 	free(pmbr);
 }
 
@@ -266,12 +282,16 @@ pool_mbr_init(TDS_POOL * pool)
 			exit(1);
 		}
 		pmbr->sock.poll_recv = true;
+		pmbr->sock.is_member = true;
+		pool_splice_init(pool, &pmbr->sock);
 
 		pmbr->sock.tds = pool_mbr_login(pool, 0);
 		if (!pmbr->sock.tds) {
 			fprintf(stderr, "Could not open initial connection\n");
 			exit(1);
 		}
+		pool_socket_changed(pool, &pmbr->sock);
+		pool_stream_init(&pmbr->stream, IS_TDS72_PLUS(pmbr->sock.tds->conn));
 		pmbr->last_used_tm = time(NULL);
 		pool->num_active_members++;
 		dlist_member_append(&pool->idle_members, pmbr);
@@ -302,31 +322,42 @@ pool_process_data(TDS_POOL *pool, TDS_POOL_MEMBER *pmbr)
 	TDS_POOL_USER *puser = NULL;
 
 	for (;;) {
-		if (pool_packet_read(tds))
+		/* continue splicing packet body */
+		if (pmbr->sock.splice_left || pmbr->sock.pipe_len) {
+			if (!pmbr->current_user)
+				break;
+		} else if (pool_packet_read(&pmbr->sock)) {
+			pmbr->sock.can_recv = false;
 			break;
-
-		/* disconnected */
-		if (tds->in_len == 0) {
+		} else if (tds->in_len == 0 && !pool_write_pending(&pmbr->sock)) {
+			/* disconnected */
 			tdsdump_log(TDS_DBG_INFO1, "Uh oh! member disconnected\n");
 			/* mark as dead */
 			pool_free_member(pool, pmbr);
 			return false;
+		} else {
+			tdsdump_dump_buf(TDS_DBG_NETWORK, "Got packet from server:", tds->in_buf, tds->in_len);
+			if (pool->mode == POOL_MODE_TRANSACTION && tds->in_pos == 0)
+				pool_stream_parse(&pmbr->stream, tds->in_buf + 8, tds->in_len - 8);
 		}
 
-		tdsdump_dump_buf(TDS_DBG_NETWORK, "Got packet from server:", tds->in_buf, tds->in_len);
 		puser = pmbr->current_user;
 		if (!puser)
 			break;
 
 		tdsdump_log(TDS_DBG_INFO1, "writing it sock %d\n", tds_get_s(puser->sock.tds));
-		if (!pool_write_data(&pmbr->sock, &puser->sock)) {
+		if (!pool_write_data(pool, &pmbr->sock, &puser->sock)) {
 			tdsdump_log(TDS_DBG_ERROR, "member received error while writing\n");
 			pool_free_user(pool, puser);
 			return false;
 		}
-		if (tds->in_pos < tds->in_len)
+		if (pool_write_pending(&pmbr->sock))
 			/* partial write, schedule a future write */
 			break;
+
+		pool_member_check_end(pool, pmbr);
+		if (!pmbr->current_user)
+			break;
 	}
 	if (puser && !puser->sock.poll_send)
 		tds_socket_flush(tds_get_s(puser->sock.tds));
@@ -334,49 +365,46 @@ pool_process_data(TDS_POOL *pool, TDS_POOL_MEMBER *pmbr)
 }
 
 /* 
- * pool_process_members
- * check the fd_set for members returning data to the client, lookup the 
- * client holding this member and forward the results.
+ * pool_process_member
+ * forward results from a member to the client holding it and
+ * pending writes of client queries.
+ */
+void
+pool_process_member(TDS_POOL * pool, TDS_POOL_MEMBER * pmbr)
+{
+	bool processed = false;
+
+	if (pmbr->doing_async || !pmbr->sock.tds)
+		return;
+
+	if (pmbr->sock.poll_recv && pmbr->sock.can_recv) {
+		if (!pool_process_data(pool, pmbr))
+			return;
+		processed = true;
+	}
+	if (pmbr->sock.poll_send && pmbr->sock.can_send) {
+		if (!pool_write_data(pool, &pmbr->current_user->sock, &pmbr->sock)) {
+			pool_free_member(pool, pmbr);
+			return;
+		}
+		processed = true;
+	}
+	if (processed)
+		pmbr->last_used_tm = time(NULL);
+}
+
+/*
+ * pool_expire_members
+ * close members idle for too long.
  * @return Timeout you should call this function again or -1 for infinite
  */
 int
-pool_process_members(TDS_POOL * pool, struct pollfd *fds, unsigned num_fds)
+pool_expire_members(TDS_POOL * pool)
 {
 	TDS_POOL_MEMBER *pmbr, *next;
-	TDSSOCKET *tds;
 	time_t age;
 	time_t time_now;
 	int min_expire_left = -1;
-	short revents;
-
-	for (next = dlist_member_first(&pool->active_members); (pmbr = next) != NULL; ) {
-		bool processed = false;
-
-		next = dlist_member_next(&pool->active_members, pmbr);
-
-		if (pmbr->doing_async || pmbr->sock.poll_index > num_fds)
-			continue;
-
-		revents = fds[pmbr->sock.poll_index].revents;
-		tds = pmbr->sock.tds;
-		assert(tds);
-
-		time_now = time(NULL);
-		if (pmbr->sock.poll_recv && (revents & POLLIN) != 0) {
-			if (!pool_process_data(pool, pmbr))
-				continue;
-			processed = true;
-		}
-		if (pmbr->sock.poll_send && (revents & POLLOUT) != 0) {
-			if (!pool_write_data(&pmbr->current_user->sock, &pmbr->sock)) {
-				pool_free_member(pool, pmbr);
-				continue;
-			}
-			processed = true;
-		}
-		if (processed)
-			pmbr->last_used_tm = time_now;
-	}
 
 	if (pool->num_active_members <= pool->min_open_conn)
 		return min_expire_left;
@@ -387,6 +415,10 @@ pool_process_members(TDS_POOL * pool, struct pollfd *fds, unsigned num_fds)
 
 		next = dlist_member_next(&pool->idle_members, pmbr);
 
+		/* still connecting or resetting */
+		if (pmbr->doing_async)
+			continue;
+
 		assert(pmbr->sock.tds);
 		assert(!pmbr->current_user);
 
@@ -403,10 +435,19 @@ pool_process_members(TDS_POOL * pool, struct pollfd *fds, unsigned num_fds)
 	return min_expire_left;
 }
 
+/* version required by user, after login is the version negotiated */
+static int
+user_tds_version(const TDS_POOL_USER *user)
+{
+	if (user->login)
+		return user->login->tds_version;
+	return user->sock.tds->conn->tds_version;
+}
+
 static bool
 compatible_versions(const TDSSOCKET *tds, const TDS_POOL_USER *user)
 {
-	if (tds->conn->tds_version != user->login->tds_version)
+	if (tds->conn->tds_version != user_tds_version(user))
 		return false;
 	return true;
 }
@@ -416,6 +457,8 @@ typedef struct {
 	TDS_POOL *pool;
 	TDS_POOL_MEMBER *pmbr;
 	int tds_version;
+	/** user is logging in, login must be acknowledged */
+	bool login;
 } CONNECT_EVENT;
 
 static void connect_execute_ok(TDS_POOL_EVENT *base_event);
@@ -439,7 +482,7 @@ static TDS_THREAD_PROC_DECLARE(connect_proc, arg)
 		}
 
 		/* if already attached to a user we can send login directly */
-		if (pmbr->current_user)
+		if (ev->login && pmbr->current_user)
 			if (!pool_user_send_login_ack(pool, pmbr->current_user))
 				break;
 
@@ -471,13 +514,28 @@ connect_execute_ok(TDS_POOL_EVENT *base_event)
 	pmbr->doing_async = false;
 
 	pmbr->last_used_tm = time(NULL);
+	pool_stream_init(&pmbr->stream, IS_TDS72_PLUS(pmbr->sock.tds->conn));
 
+	if (puser && !ev->login) {
+		/* connection opened for a request */
+		pmbr->sock.poll_recv = true;
+		pool_member_prepare(ev->pool, pmbr, puser);
+		return;
+	}
 	if (puser) {
 		pmbr->sock.poll_recv = true;
 		puser->sock.poll_recv = true;
 
 		puser->user_state = TDS_SRV_QUERY;
+		pool_socket_changed(ev->pool, &puser->sock);
+
+		/* in transaction mode member is needed only for requests */
+		if (ev->pool->mode == POOL_MODE_TRANSACTION) {
+			pmbr->dirty = true;
+			pool_deassign_member(ev->pool, pmbr);
+		}
 	}
+	pool_socket_changed(ev->pool, &pmbr->sock);
 }
 
 /*
@@ -495,7 +553,10 @@ pool_assign_idle_member(TDS_POOL * pool, TDS_POOL_USER *puser)
 
 	DLIST_FOREACH(dlist_member, &pool->idle_members, pmbr) {
 		assert(pmbr->current_user == NULL);
-		assert(!pmbr->doing_async);
+
+		/* still resetting for a previous user */
+		if (pmbr->doing_async)
+			continue;
 
 		assert(pmbr->sock.tds);
 
@@ -513,7 +574,10 @@ pool_assign_idle_member(TDS_POOL * pool, TDS_POOL_USER *puser)
 		pmbr->sock.poll_recv = false;
 		pmbr->sock.poll_send = false;
 
-		pool_user_finish_login(pool, puser);
+		if (puser->login)
+			pool_user_finish_login(pool, puser);
+		else
+			pool_member_prepare(pool, pmbr, puser);
 		return pmbr;
 	}
 
@@ -528,6 +592,8 @@ pool_assign_idle_member(TDS_POOL * pool, TDS_POOL_USER *puser)
 		fprintf(stderr, "Out of memory\n");
 		return NULL;
 	}
+	pmbr->sock.is_member = true;
+	pool_splice_init(pool, &pmbr->sock);
 
 	tdsdump_log(TDS_DBG_INFO1, "No open connections left, opening new member\n");
 
@@ -539,7 +605,8 @@ pool_assign_idle_member(TDS_POOL * pool, TDS_POOL_USER *puser)
 	}
 	ev->pmbr = pmbr;
 	ev->pool = pool;
-	ev->tds_version = puser->login->tds_version;
+	ev->tds_version = user_tds_version(puser);
+	ev->login = puser->login != NULL;
 
 	if (tds_thread_create_detached(connect_proc, ev) != 0) {
 		free(pmbr);
@@ -558,3 +625,218 @@ pool_assign_idle_member(TDS_POOL * pool, TDS_POOL_USER *puser)
 
 	return pmbr;
 }
+
+/** RESETCONNECTION status flag is supported only by TDS 7.1+ */
+static bool
+pool_member_can_reset(const TDS_POOL_MEMBER *pmbr)
+{
+	return IS_TDS71_PLUS(pmbr->sock.tds->conn);
+}
+
+/**
+ * Track a request packet the user is sending to the member.
+ * In transaction mode the member must be kept till the end of
+ * the response.
+ * @param packet  full packet received from the user
+ */
+void
+pool_member_request(TDS_POOL * pool, TDS_POOL_MEMBER * pmbr, unsigned char *packet)
+{
+	unsigned int packet_len;
+
+	if (pool->mode != POOL_MODE_TRANSACTION)
+		return;
+
+	switch (packet[0]) {
+	case TDS_CANCEL:
+		/* wait for the acknowledge */
+		pmbr->cancel_pending = true;
+		pmbr->stream.attention = false;
+		break;
+	case TDS_QUERY:
+	case TDS_RPC:
+	case TDS7_TRANS:
+		/* first packet of a new request */
+		if (pmbr->busy)
+			break;
+		if (pmbr->reset_next && pool_member_can_reset(pmbr)) {
+			packet[1] |= POOL_STATUS_RESETCONNECTION;
+			pmbr->reset_next = false;
+		}
+		packet_len = TDS_GET_A2BE(packet + 2);
+		if (packet[0] == TDS_QUERY
+		    && pool_query_is_bulk(packet + 8, packet_len - 8, pmbr->stream.tds72)) {
+			tdsdump_log(TDS_DBG_INFO1, "bulk copy, member pinned to user\n");
+			pmbr->pinned = true;
+		}
+		break;
+	}
+	pmbr->busy = true;
+}
+
+/**
+ * Check if the packet just forwarded to the user ends the response.
+ * In transaction mode a member with no transaction open is released.
+ */
+void
+pool_member_check_end(TDS_POOL * pool, TDS_POOL_MEMBER * pmbr)
+{
+	TDSSOCKET *tds = pmbr->sock.tds;
+
+	if (pool->mode != POOL_MODE_TRANSACTION || !pmbr->busy)
+		return;
+	if (pool_write_pending(&pmbr->sock) || tds->in_len < 8 || !(tds->in_buf[1] & POOL_STATUS_EOM))
+		return;
+	/* after an attention other data can follow */
+	if (pmbr->cancel_pending && !pmbr->stream.attention)
+		return;
+
+	pmbr->busy = false;
+	pmbr->cancel_pending = false;
+	if (pmbr->pinned || pmbr->stream.in_xact || !pool_stream_idle(&pmbr->stream))
+		return;
+
+	tdsdump_log(TDS_DBG_INFO1, "end of request, releasing member\n");
+	pmbr->dirty = true;
+	pool_deassign_member(pool, pmbr);
+	pmbr->sock.poll_recv = true;
+	pool_socket_changed(pool, &pmbr->sock);
+}
+
+typedef struct {
+	TDS_POOL_EVENT common;
+	TDS_POOL *pool;
+	TDS_POOL_MEMBER *pmbr;
+	/** batch to execute */
+	char *sql;
+	/** session setup of the user */
+	char *session_sql;
+	/** reset using RESETCONNECTION */
+	bool reset;
+	bool success;
+} PREPARE_EVENT;
+
+static void prepare_execute(TDS_POOL_EVENT *base_event);
+
+static TDS_THREAD_PROC_DECLARE(prepare_proc, arg)
+{
+	PREPARE_EVENT *ev = (PREPARE_EVENT *) arg;
+	TDSSOCKET *tds = ev->pmbr->sock.tds;
+
+	ev->success = false;
+	if (tds_set_state(tds, TDS_WRITING) == TDS_WRITING) {
+		tds_start_query(tds, TDS_QUERY);
+		tds_put_string(tds, ev->sql, -1);
+		tds_write_packet(tds, ev->reset ? POOL_STATUS_EOM | POOL_STATUS_RESETCONNECTION : POOL_STATUS_EOM);
+		tds_set_state(tds, TDS_PENDING);
+		ev->success = TDS_SUCCEED(tds_process_simple_query(tds));
+	}
+
+	pool_event_add(ev->pool, &ev->common, prepare_execute);
+	return TDS_THREAD_RESULT(0);
+}
+
+static void
+prepare_execute(TDS_POOL_EVENT *base_event)
+{
+	PREPARE_EVENT *ev = (PREPARE_EVENT *) base_event;
+	TDS_POOL_MEMBER *pmbr = ev->pmbr;
+	TDS_POOL_USER *puser = pmbr->current_user;
+
+	pmbr->doing_async = false;
+	free(ev->sql);
+	if (!ev->success) {
+		free(ev->session_sql);
+		pool_free_member(ev->pool, pmbr);
+		return;
+	}
+
+	free(pmbr->session_sql);
+	pmbr->session_sql = ev->session_sql;
+	pmbr->dirty = false;
+	pmbr->reset_next = false;
+	pmbr->sock.poll_recv = true;
+	pool_socket_changed(ev->pool, &pmbr->sock);
+
+	if (puser)
+		pool_user_resume(ev->pool, puser);
+}
+
+static bool
+same_sql(const char *a, const char *b)
+{
+	if (!a || !b)
+		return a == b;
+	return strcmp(a, b) == 0;
+}
+
+/**
+ * Prepare a member for a request in transaction mode.
+ * Session state left by previous user is reset and the session
+ * setup of the user is replayed, then user is resumed.
+ */
+void
+pool_member_prepare(TDS_POOL * pool, TDS_POOL_MEMBER * pmbr, TDS_POOL_USER * puser)
+{
+	PREPARE_EVENT *ev = NULL;
+	size_t len;
+
+	if (!pmbr->dirty && same_sql(pmbr->session_sql, puser->session_sql)) {
+		pool_user_resume(pool, puser);
+		return;
+	}
+
+	/* session of previous user cannot be cleaned */
+	if (!pool->reset_query && !pool_member_can_reset(pmbr)) {
+		fprintf(stderr, "Transaction mode requires TDS 7.1 or \"reset query\"\n");
+		goto failure;
+	}
+
+	/* reset with the request itself */
+	if (!pool->reset_query && !puser->session_sql) {
+		pmbr->reset_next = true;
+		pmbr->dirty = false;
+		free(pmbr->session_sql);
+		pmbr->session_sql = NULL;
+		pool_user_resume(pool, puser);
+		return;
+	}
+
+	ev = tds_new0(PREPARE_EVENT, 1);
+	if (!ev)
+		goto failure;
+	ev->pool = pool;
+	ev->pmbr = pmbr;
+	ev->reset = !pool->reset_query;
+	len = (pool->reset_query ? strlen(pool->reset_query) : 0)
+	      + (puser->session_sql ? strlen(puser->session_sql) : 0) + 2;
+	ev->sql = tds_new(char, len);
+	if (puser->session_sql)
+		ev->session_sql = strdup(puser->session_sql);
+	if (!ev->sql || (puser->session_sql && !ev->session_sql))
+		goto failure;
+	strcpy(ev->sql, pool->reset_query ? pool->reset_query : "");
+	if (puser->session_sql) {
+		if (pool->reset_query)
+			strcat(ev->sql, "\n");
+		strcat(ev->sql, puser->session_sql);
+	}
+
+	tdsdump_log(TDS_DBG_INFO1, "resetting member\n");
+	pmbr->doing_async = true;
+	pmbr->sock.poll_recv = false;
+	pmbr->sock.poll_send = false;
+	pool_socket_changed(pool, &pmbr->sock);
+	if (tds_thread_create_detached(prepare_proc, ev) == 0)
+		return;
+	pmbr->doing_async = false;
+	fprintf(stderr, "error creating thread\n");
+
+failure:
+	if (ev) {
+		free(ev->sql);
+		free(ev->session_sql);
+		free(ev);
+	}
+	pool_free_member(pool, pmbr);
+}
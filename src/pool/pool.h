@@ -42,13 +42,13 @@
 #endif /* HAVE_POLL_H */
 
 #include <freetds/tds.h>
+#include <freetds/thread.h>
 #include <freetds/utils/dlist.h>
 #include <freetds/replacements.h>
 
 /* defines */
 #define PGSIZ 2048
 #define BLOCKSIZ 512
-#define MAX_POOL_USERS 1024
 
 /* enums and typedefs */
 typedef enum
@@ -57,6 +57,16 @@ typedef enum
 	TDS_SRV_QUERY,
 } TDS_USER_STATE;
 
+/* packet header status bits */
+#define POOL_STATUS_EOM			0x01
+#define POOL_STATUS_RESETCONNECTION	0x08
+
+typedef enum
+{
+	POOL_MODE_SESSION,	/* a member is assigned for the entire user session */
+	POOL_MODE_TRANSACTION,	/* a member is assigned for a request or transaction */
+} TDS_POOL_MODE;
+
 /* forward declaration */
 typedef struct tds_pool_event TDS_POOL_EVENT;
 typedef struct tds_pool_socket TDS_POOL_SOCKET;
@@ -74,11 +84,73 @@ struct tds_pool_event
 struct tds_pool_socket
 {
 	TDSSOCKET *tds;
-	uint32_t poll_index;
+	/** link in the list of sockets ready to be processed */
+	DLIST_FIELDS(dlist_ready_item);
+	/* what the pool wants to do with the socket */
 	bool poll_recv;
 	bool poll_send;
+	/*
+	 * readiness reported by the poller, reset when an operation would block.
+	 * Notifications are edge triggered so readiness must be remembered.
+	 */
+	bool can_recv;
+	bool can_send;
+	/** socket added to the epoll set */
+	bool registered;
+	/** socket is embedded in a TDS_POOL_MEMBER, otherwise in a TDS_POOL_USER */
+	bool is_member;
+	/** packet bodies can be forwarded with splice(2) */
+	bool use_splice;
+	/** last packet was big, read next header alone to try splicing the body */
+	bool splice_next;
+	/** pipe used to splice packet bodies, -1 if not allocated */
+	int pipe_fds[2];
+	/** bytes of current packet still to move from the socket to the pipe */
+	unsigned int splice_left;
+	/** bytes in the pipe still to be written */
+	unsigned int pipe_len;
 };
 
+#define DLIST_PREFIX dlist_ready
+#define DLIST_LIST_TYPE dlist_sockets
+#define DLIST_ITEM_TYPE TDS_POOL_SOCKET
+#include <freetds/utils/dlist.tmpl.h>
+
+/** what is needed to skip a column value in a row */
+typedef struct tds_pool_column
+{
+	unsigned char kind;
+	unsigned char size;
+} TDS_POOL_COLUMN;
+
+/**
+ * State of the scanner of the token stream from the server.
+ * Tokens are parsed just enough to track transaction state.
+ */
+typedef struct tds_pool_stream
+{
+	unsigned char state;
+	bool tds72;
+	/** got some data we can't parse, state is unknown */
+	bool lost;
+	/** a transaction is open */
+	bool in_xact;
+	/** got a DONE acknowledging an attention */
+	bool attention;
+	/** parsing a RETURNVALUE token, not a row */
+	bool retval;
+	/** bytes to ignore before next item */
+	TDS_UINT8 skip;
+	unsigned int num_cols, cur_col, alloc_cols;
+	TDS_POOL_COLUMN *cols;
+	TDS_POOL_COLUMN retval_col;
+	/** null bitmap of current NBCROW */
+	unsigned char *nulls;
+	/** partial item from previous packet */
+	unsigned char *pending;
+	size_t pending_len, pending_alloc;
+} TDS_POOL_STREAM;
+
 struct tds_pool_user
 {
 	TDS_POOL_SOCKET sock;
@@ -86,6 +158,8 @@ struct tds_pool_user
 	TDSLOGIN *login;
 	TDS_USER_STATE user_state;
 	TDS_POOL_MEMBER *assigned_member;
+	/** SQL to setup the session after login, NULL if none */
+	char *session_sql;
 };
 
 struct tds_pool_member
@@ -95,6 +169,19 @@ struct tds_pool_member
 	bool doing_async;
 	time_t last_used_tm;
 	TDS_POOL_USER *current_user;
+	/** a request was sent, waiting for the end of the response */
+	bool busy;
+	/** an attention was sent, waiting for its acknowledge */
+	bool cancel_pending;
+	/** keep assigned to user till the end of the session */
+	bool pinned;
+	/** used by a user and not reset yet */
+	bool dirty;
+	/** set RESETCONNECTION on next request */
+	bool reset_next;
+	/** session setup executed, as TDS_POOL_USER session_sql */
+	char *session_sql;
+	TDS_POOL_STREAM stream;
 };
 
 #define DLIST_PREFIX dlist_member
@@ -120,11 +207,25 @@ struct tds_pool
 	int max_member_age;	/* in seconds */
 	int min_open_conn;
 	int max_open_conn;
+	/** maximum number of users of all shards, 0 for no limit */
+	int max_users;
+	/** number of worker threads, each serving a shard of the pool */
+	int num_workers;
+	/** forward big packets from members using splice(2) */
+	bool zero_copy;
+	TDS_POOL_MODE mode;
+	/** batch to reset members released in transaction mode, NULL to use RESETCONNECTION (TDS 7.1+) */
+	char *reset_query;
 	tds_mutex events_mtx;
 	TDS_SYS_SOCKET listen_fd;
 	TDS_SYS_SOCKET wakeup_fd;
 	TDS_SYS_SOCKET event_fd;
 	TDS_POOL_EVENT *events;
+	/** epoll descriptor, -1 if poll(2) is used */
+	int epoll_fd;
+	/** sockets ready for an operation the pool is interested in */
+	dlist_sockets ready;
+	tds_thread worker;
 
 	int num_active_members;
 	dlist_members active_members;
@@ -132,7 +233,6 @@ struct tds_pool
 
 	/** users in wait state */
 	dlist_users waiters;
-	int num_users;
 	dlist_users users;
 	TDSCONTEXT *ctx;
 
@@ -142,8 +242,13 @@ struct tds_pool
 
 /* prototypes */
 
+/* main.c */
+void pool_socket_changed(TDS_POOL * pool, TDS_POOL_SOCKET * sock);
+void pool_socket_remove(TDS_POOL * pool, TDS_POOL_SOCKET * sock);
+
 /* member.c */
-int pool_process_members(TDS_POOL * pool, struct pollfd *fds, unsigned num_fds);
+void pool_process_member(TDS_POOL * pool, TDS_POOL_MEMBER * pmbr);
+int pool_expire_members(TDS_POOL * pool);
 TDS_POOL_MEMBER *pool_assign_idle_member(TDS_POOL * pool, TDS_POOL_USER *user);
 void pool_mbr_init(TDS_POOL * pool);
 void pool_mbr_destroy(TDS_POOL * pool);
@@ -151,10 +256,13 @@ void pool_free_member(TDS_POOL *pool, TDS_POOL_MEMBER * pmbr);
 void pool_assign_member(TDS_POOL *pool, TDS_POOL_MEMBER * pmbr, TDS_POOL_USER *puser);
 void pool_deassign_member(TDS_POOL *pool, TDS_POOL_MEMBER * pmbr);
 void pool_reset_member(TDS_POOL *pool, TDS_POOL_MEMBER * pmbr);
-bool pool_packet_read(TDSSOCKET * tds);
+bool pool_packet_read(TDS_POOL_SOCKET * sock);
+void pool_member_request(TDS_POOL * pool, TDS_POOL_MEMBER * pmbr, unsigned char *packet);
+void pool_member_check_end(TDS_POOL * pool, TDS_POOL_MEMBER * pmbr);
+void pool_member_prepare(TDS_POOL * pool, TDS_POOL_MEMBER * pmbr, TDS_POOL_USER * puser);
 
 /* user.c */
-void pool_process_users(TDS_POOL * pool, struct pollfd *fds, unsigned num_fds);
+void pool_process_user(TDS_POOL * pool, TDS_POOL_USER * puser);
 void pool_user_init(TDS_POOL * pool);
 void pool_user_destroy(TDS_POOL * pool);
 TDS_POOL_USER *pool_user_create(TDS_POOL * pool, TDS_SYS_SOCKET s);
@@ -162,12 +270,23 @@ void pool_free_user(TDS_POOL * pool, TDS_POOL_USER * puser);
 void pool_user_query(TDS_POOL * pool, TDS_POOL_USER * puser);
 bool pool_user_send_login_ack(TDS_POOL * pool, TDS_POOL_USER * puser);
 void pool_user_finish_login(TDS_POOL * pool, TDS_POOL_USER * puser);
+void pool_user_resume(TDS_POOL * pool, TDS_POOL_USER * puser);
+
+/* stream.c */
+void pool_stream_init(TDS_POOL_STREAM * stream, bool tds72);
+void pool_stream_free(TDS_POOL_STREAM * stream);
+bool pool_stream_parse(TDS_POOL_STREAM * stream, const unsigned char *buf, size_t len);
+bool pool_stream_idle(const TDS_POOL_STREAM * stream);
+bool pool_query_is_bulk(const unsigned char *buf, size_t len, bool tds72);
 
 /* util.c */
 void dump_login(TDSLOGIN * login);
 void pool_event_add(TDS_POOL *pool, TDS_POOL_EVENT *ev, TDS_POOL_EXECUTE execute);
 int pool_write(TDS_SYS_SOCKET sock, const void *buf, size_t len);
-bool pool_write_data(TDS_POOL_SOCKET *from, TDS_POOL_SOCKET *to);
+bool pool_write_data(TDS_POOL * pool, TDS_POOL_SOCKET *from, TDS_POOL_SOCKET *to);
+bool pool_write_pending(TDS_POOL_SOCKET *sock);
+void pool_splice_init(TDS_POOL * pool, TDS_POOL_SOCKET *sock);
+void pool_splice_free(TDS_POOL_SOCKET *sock);
 
 /* config.c */
 bool pool_read_conf_files(const char *path, const char *poolname, TDS_POOL * pool, char **err);
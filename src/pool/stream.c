@@ -1,5 +1,6 @@
 /* TDSPool - Connection pooling for TDS based databases
  * Copyright (C) 2001, 2002, 2003, 2004, 2005  Brian Bruns
+ * Copyright (C) 2026  Frediano Ziglio
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
@@ -20,12 +21,18 @@
 /*
  * Name: stream.c
  * Description: Controls the result stream processing.
+ *
+ * Data from the server are scanned while forwarded to track
+ * transaction state (ENVCHANGE tokens) and attention acknowledges.
+ * Only TDS 7.1+ is supported. Data are received in packets so any
+ * item can be split, parsing can be resumed at any byte.
  */
 
 #include <config.h>
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <ctype.h>
 
 #if HAVE_STDLIB_H
 #include <stdlib.h>
@@ -33,454 +40,603 @@
 
 #if HAVE_STRING_H
 #include <string.h>
-#endif /* HAVE_STDLIB_H */
+#endif /* HAVE_STRING_H */
 
 #include "pool.h"
-#include <freetds/tds.h>
+#include <freetds/bytes.h>
 
-int pool_find_end_token(TDS_POOL_MEMBER * pmbr, const unsigned char *buf, int len);
+/* parser states */
+enum
+{
+	POOL_STREAM_TOKEN,	/* expecting a token */
+	POOL_STREAM_COLUMN,	/* expecting a column value */
+	POOL_STREAM_PLP,	/* expecting a PLP chunk length */
+};
 
-struct tmp_col_struct
+/* column kinds, how values are encoded */
+enum
 {
-	char *column_name;
-	struct tmp_col_struct *next;
+	POOL_COL_FIXED,		/* fixed size, no length */
+	POOL_COL_BYTELEN,	/* 1 byte length */
+	POOL_COL_USHORTLEN,	/* 2 bytes length, 0xffff for NULL */
+	POOL_COL_LONGLEN,	/* 4 bytes length */
+	POOL_COL_TEXT,		/* text pointer, timestamp and 4 bytes length */
+	POOL_COL_PLP,		/* partially length prefixed */
 };
 
-/*
- *  returns 1 if this end token has the final bit set
- */
-static int
-is_final_token(const unsigned char *buf)
+/* TDS 7.4 tokens not defined in proto.h with TDS 7 meaning */
+#define POOL_OFFSET_TOKEN	0x78
+#define POOL_FEDAUTHINFO_TOKEN	0xEE
+
+/* ENVCHANGE types not defined in proto.h */
+#define POOL_ENV_ENLISTDTC	11
+#define POOL_ENV_TRANSENDED	17
+
+/* returned by item parsers */
+#define NEED_MORE (-2)
+#define LOST (-1)
+
+/* limit for a single item kept in memory */
+#define POOL_STREAM_MAX_PENDING (1024u * 1024u)
+
+#define NEED(n) do { if (len < (size_t) (n)) return NEED_MORE; } while(0)
+
+void
+pool_stream_init(TDS_POOL_STREAM * stream, bool tds72)
 {
-	return buf[1] & 0x01 ? 0 : 1;
+	pool_stream_free(stream);
+	memset(stream, 0, sizeof(*stream));
+	stream->state = POOL_STREAM_TOKEN;
+	stream->tds72 = tds72;
 }
 
-/*
- *  computes the number of bytes left to be read from the input stream 
- *  after this packet is completely processed.
- *  returns 1 if token overruns the current packet, 0 otherwise.
+void
+pool_stream_free(TDS_POOL_STREAM * stream)
+{
+	free(stream->cols);
+	free(stream->nulls);
+	free(stream->pending);
+	stream->cols = NULL;
+	stream->nulls = NULL;
+	stream->pending = NULL;
+	stream->alloc_cols = stream->num_cols = 0;
+	stream->pending_len = stream->pending_alloc = 0;
+}
+
+/**
+ * Check if stream is between tokens.
  */
-static int
-bytes_left(TDS_POOL_MEMBER * pmbr, const unsigned char *buf, int pos, int maxlen, int need)
+bool
+pool_stream_idle(const TDS_POOL_STREAM * stream)
 {
-	if (pos + need > maxlen) {
-		return 1;
-	} else
-		return 0;
+	return !stream->lost && stream->state == POOL_STREAM_TOKEN && !stream->skip && !stream->pending_len;
 }
 
 /**
- * tds_get_token_size() returns the size of a fixed length token
- * \param marker token type.
+ * Skip a B_VARCHAR or US_VARCHAR (UCS-2 characters).
+ * @return new position or NEED_MORE
  */
 static int
-tds_get_token_size(int marker)
+skip_varchar(const unsigned char *p, size_t len, int pos, int len_size)
 {
-	/* TODO finish */
-	switch (marker) {
-	case TDS_DONE_TOKEN:
-	case TDS_DONEPROC_TOKEN:
-	case TDS_DONEINPROC_TOKEN:
-		// XXX 12 for TDS >= 7.2
-		return 8;
-	case TDS_RETURNSTATUS_TOKEN:
-		return 4;
-	case TDS_PROCID_TOKEN:
-		return 8;
-	default:
-		return 0;
-	}
+	unsigned int chars;
+
+	NEED(pos + len_size);
+	chars = len_size == 1 ? p[pos] : TDS_GET_UA2LE(p + pos);
+	pos += len_size + chars * 2;
+	NEED(pos);
+	return pos;
 }
 
-/*
- * attempts to read a fixed length token, returns 1 if successful
- * bytes_read is set to the number of bytes read fromt the input stream.
+/**
+ * Parse a TYPE_INFO.
+ * @return bytes used, NEED_MORE or LOST
  */
 static int
-read_fixed_token(TDS_POOL_MEMBER * pmbr, const unsigned char *buf, int maxlen, int *bytes_read)
+parse_type_info(const unsigned char *p, size_t len, TDS_POOL_COLUMN * col)
 {
-	TDS_SMALLINT sz;
-	int marker;
-	int pos = 0;
+	int pos, i;
 
-	if (bytes_left(pmbr, buf, pos, maxlen, 1)) {
-		*bytes_read = maxlen;
-		return 0;
-	}
-	marker = buf[pos++];
-	sz = tds_get_token_size(marker);
-	if (bytes_left(pmbr, buf, pos, maxlen, sz)) {
-		*bytes_read = maxlen;
-		return 0;
-	} else {
-		*bytes_read = sz + 1;
+	NEED(1);
+	col->size = 0;
+	switch (p[0]) {
+	case SYBVOID:
+		col->kind = POOL_COL_FIXED;
+		return 1;
+	case SYBINT1:
+	case SYBBIT:
+		col->kind = POOL_COL_FIXED;
+		col->size = 1;
+		return 1;
+	case SYBINT2:
+		col->kind = POOL_COL_FIXED;
+		col->size = 2;
+		return 1;
+	case SYBINT4:
+	case SYBDATETIME4:
+	case SYBREAL:
+	case SYBMONEY4:
+		col->kind = POOL_COL_FIXED;
+		col->size = 4;
+		return 1;
+	case SYBMONEY:
+	case SYBDATETIME:
+	case SYBFLT8:
+	case SYBINT8:
+		col->kind = POOL_COL_FIXED;
+		col->size = 8;
+		return 1;
+	case SYBUNIQUE:
+	case SYBINTN:
+	case SYBBITN:
+	case SYBFLTN:
+	case SYBMONEYN:
+	case SYBDATETIMN:
+	case SYBCHAR:
+	case SYBVARCHAR:
+	case SYBBINARY:
+	case SYBVARBINARY:
+		NEED(2);
+		col->kind = POOL_COL_BYTELEN;
+		return 2;
+	case SYBDECIMAL:
+	case SYBNUMERIC:
+	case 0x37:	/* legacy DECIMAL */
+	case 0x3F:	/* legacy NUMERIC */
+		NEED(4);
+		col->kind = POOL_COL_BYTELEN;
+		return 4;
+	case SYBMSDATE:
+		col->kind = POOL_COL_BYTELEN;
 		return 1;
+	case SYBMSTIME:
+	case SYBMSDATETIME2:
+	case SYBMSDATETIMEOFFSET:
+		NEED(2);
+		col->kind = POOL_COL_BYTELEN;
+		return 2;
+	case XSYBVARBINARY:
+	case XSYBBINARY:
+		NEED(3);
+		col->kind = TDS_GET_UA2LE(p + 1) == 0xffff ? POOL_COL_PLP : POOL_COL_USHORTLEN;
+		return 3;
+	case XSYBVARCHAR:
+	case XSYBCHAR:
+	case XSYBNVARCHAR:
+	case XSYBNCHAR:
+		/* length and collation */
+		NEED(8);
+		col->kind = TDS_GET_UA2LE(p + 1) == 0xffff ? POOL_COL_PLP : POOL_COL_USHORTLEN;
+		return 8;
+	case SYBMSXML:
+		NEED(2);
+		pos = 2;
+		if (p[1]) {
+			/* database, owner and collection */
+			for (i = 0; i < 3; ++i)
+				if ((pos = skip_varchar(p, len, pos, i < 2 ? 1 : 2)) < 0)
+					return pos;
+		}
+		col->kind = POOL_COL_PLP;
+		return pos;
+	case SYBMSUDT:
+		NEED(3);
+		col->kind = TDS_GET_UA2LE(p + 1) == 0xffff ? POOL_COL_PLP : POOL_COL_USHORTLEN;
+		pos = 3;
+		/* database, schema, type and assembly names */
+		for (i = 0; i < 4; ++i)
+			if ((pos = skip_varchar(p, len, pos, i < 3 ? 1 : 2)) < 0)
+				return pos;
+		return pos;
+	case SYBIMAGE:
+		NEED(5);
+		col->kind = POOL_COL_TEXT;
+		return 5;
+	case SYBTEXT:
+	case SYBNTEXT:
+		NEED(10);
+		col->kind = POOL_COL_TEXT;
+		return 10;
+	case SYBVARIANT:
+		NEED(5);
+		col->kind = POOL_COL_LONGLEN;
+		return 5;
 	}
+	tdsdump_log(TDS_DBG_ERROR, "pool stream: unsupported type %d\n", p[0]);
+	return LOST;
 }
 
 static int
-read_variable_token(TDS_POOL_MEMBER * pmbr, const unsigned char *buf, int maxlen, int *bytes_read)
+parse_colmetadata(TDS_POOL_STREAM * stream, const unsigned char *p, size_t len)
 {
-	TDS_SMALLINT sz;
-	int pos = 0;
-
-	if (bytes_left(pmbr, buf, pos, maxlen, 3)) {
-		*bytes_read = maxlen;
-		return 0;
+	unsigned int num_cols, n;
+	int pos, used;
+
+	NEED(3);
+	num_cols = TDS_GET_UA2LE(p + 1);
+	if (num_cols == 0xffff)
+		num_cols = 0;
+
+	if (num_cols > stream->alloc_cols) {
+		if (!TDS_RESIZE(stream->cols, num_cols) || !TDS_RESIZE(stream->nulls, (num_cols + 7) / 8))
+			return LOST;
+		stream->alloc_cols = num_cols;
 	}
 
-	/* memcpy(&sz,&buf[1],2); */
-	/* FIX ME -- works only in emul little endian mode on bigend boxen */
-	sz = buf[1] + buf[2] * 256;
-	pos += 3;
-	if (bytes_left(pmbr, buf, pos, maxlen, sz)) {
-		*bytes_read = maxlen;
-		return 0;
-	} else {
-		*bytes_read = sz + 3;
-		return 1;
+	pos = 3;
+	for (n = 0; n < num_cols; ++n) {
+		TDS_POOL_COLUMN *col = &stream->cols[n];
+
+		/* user type and flags */
+		pos += stream->tds72 ? 6 : 4;
+		NEED(pos);
+		used = parse_type_info(p + pos, len - pos, col);
+		if (used < 0)
+			return used;
+		pos += used;
+
+		/* table name */
+		if (col->kind == POOL_COL_TEXT) {
+			unsigned int parts = 1;
+
+			if (stream->tds72) {
+				NEED(pos + 1);
+				parts = p[pos++];
+			}
+			while (parts--)
+				if ((pos = skip_varchar(p, len, pos, 2)) < 0)
+					return pos;
+		}
+
+		/* column name */
+		if ((pos = skip_varchar(p, len, pos, 1)) < 0)
+			return pos;
 	}
+	stream->num_cols = num_cols;
+	return pos;
 }
 
 static int
-read_row(TDS_POOL_MEMBER * pmbr, const unsigned char *buf, int maxlen, int *bytes_read)
+parse_returnvalue(TDS_POOL_STREAM * stream, const unsigned char *p, size_t len)
 {
-	TDSCOLUMN *curcol;
-	TDSRESULTINFO *info;
-	int i, colsize;
-	int pos = 1;		/* skip marker */
-
-	info = pmbr->tds->res_info;
+	int pos, used;
+
+	/* ordinal, name, status, user type and flags */
+	pos = skip_varchar(p, len, 3, 1);
+	if (pos < 0)
+		return pos;
+	pos += stream->tds72 ? 7 : 5;
+	NEED(pos);
+	used = parse_type_info(p + pos, len - pos, &stream->retval_col);
+	if (used < 0)
+		return used;
+
+	stream->retval = true;
+	stream->state = POOL_STREAM_COLUMN;
+	return pos + used;
+}
 
-	die_if((!info), "Entered read_row() without a res_info structure.");
+static int
+parse_featureextack(const unsigned char *p, size_t len)
+{
+	int pos = 1;
 
-	for (i = 0; i < info->num_cols; i++) {
-		curcol = info->columns[i];
-		if (!is_fixed_type(curcol->column_type)) {
-			if (bytes_left(pmbr, buf, pos, maxlen, 1)) {
-				*bytes_read = maxlen;
-				return 0;
-			}
-			colsize = buf[pos++];
-		} else {
-			colsize = tds_get_size_by_type(curcol->column_type);
-		}
-		if (bytes_left(pmbr, buf, pos, maxlen, colsize)) {
-			*bytes_read = maxlen;
-			return 0;
-		}
-		pos += colsize;
+	for (;;) {
+		NEED(pos + 1);
+		if (p[pos++] == 0xff)
+			return pos;
+		NEED(pos + 4);
+		pos += 4 + TDS_GET_UA4LE(p + pos);
+		NEED(pos);
 	}
-
-	*bytes_read = pos;
-
-	return 1;
 }
 
+/* move to next column, skipping NULL columns in a NBCROW */
 static void
-free_col_struct(struct tmp_col_struct *head)
+next_column(TDS_POOL_STREAM * stream)
 {
-	while (head) {
-		struct tmp_col_struct *prev = head;
-		head = prev->next;
-		free(prev->column_name);
-		free(prev);
+	stream->state = POOL_STREAM_COLUMN;
+	if (stream->retval) {
+		stream->retval = false;
+		stream->state = POOL_STREAM_TOKEN;
+		return;
+	}
+	for (;;) {
+		if (++stream->cur_col >= stream->num_cols) {
+			stream->state = POOL_STREAM_TOKEN;
+			return;
+		}
+		if (!(stream->nulls[stream->cur_col / 8] & (1 << (stream->cur_col % 8))))
+			return;
 	}
 }
 
 static int
-read_col_name(TDS_POOL_MEMBER * pmbr, const unsigned char *buf, int maxlen, int *bytes_read)
+parse_token(TDS_POOL_STREAM * stream, const unsigned char *p, size_t len)
 {
-	TDS_SMALLINT hdrsize;
-	int pos = 0;
-	int num_cols = 0;
-	int namelen;
-	struct tmp_col_struct *head = NULL, *cur = NULL, *prev;
-	int col;
-	TDSCOLUMN *curcol;
-	TDSRESULTINFO *info;
-
-	/* header size */
-	if (bytes_left(pmbr, buf, pos, maxlen, 3)) {
-		*bytes_read = maxlen;
-		return 0;
-	}
-	/* FIXME -- endian */
-	hdrsize = buf[1] + buf[2] * 256;
-	pos += 3;
+	unsigned int size;
 
-	for (;;) {
-		prev = cur;
-		cur = (struct tmp_col_struct *)
-			malloc(sizeof(struct tmp_col_struct));
-		cur->next = NULL;
-		cur->column_name = NULL;
-
-		if (prev)
-			prev->next = cur;
-		if (!head)
-			head = cur;
-
-		if (bytes_left(pmbr, buf, pos, maxlen, 1)) {
-			*bytes_read = maxlen;
-			free_col_struct(head);
-			return 0;
+	switch (p[0]) {
+	case TDS_DONE_TOKEN:
+	case TDS_DONEPROC_TOKEN:
+	case TDS_DONEINPROC_TOKEN:
+		size = stream->tds72 ? 13 : 9;
+		NEED(size);
+		if (TDS_GET_UA2LE(p + 1) & TDS_DONE_CANCELLED)
+			stream->attention = true;
+		return size;
+
+	case TDS_ENVCHANGE_TOKEN:
+		NEED(4);
+		size = TDS_GET_UA2LE(p + 1);
+		if (!size)
+			return 3;
+		switch (p[3]) {
+		case TDS_ENV_BEGINTRANS:
+		case POOL_ENV_ENLISTDTC:
+			stream->in_xact = true;
+			break;
+		case TDS_ENV_COMMITTRANS:
+		case TDS_ENV_ROLLBACKTRANS:
+		case POOL_ENV_TRANSENDED:
+			stream->in_xact = false;
+			break;
 		}
-		namelen = buf[pos++];
-
+		stream->skip = size - 1;
+		return 4;
 
-		if (bytes_left(pmbr, buf, pos, maxlen, namelen)) {
-			*bytes_read = maxlen;
-			free_col_struct(head);
-			return 0;
-		}
-		cur->column_name = (char *) malloc(namelen + 1);
-		strlcpy(cur->column_name, (char *) &buf[pos], namelen + 1);
+	case TDS_TABNAME_TOKEN:
+	case TDS_COLINFO_TOKEN:
+	case TDS_ORDERBY_TOKEN:
+	case TDS_ERROR_TOKEN:
+	case TDS_INFO_TOKEN:
+	case TDS_LOGINACK_TOKEN:
+	case TDS_AUTH_TOKEN:
+		NEED(3);
+		stream->skip = TDS_GET_UA2LE(p + 1);
+		return 3;
+
+	case TDS_SESSIONSTATE_TOKEN:
+	case POOL_FEDAUTHINFO_TOKEN:
+		NEED(5);
+		stream->skip = TDS_GET_UA4LE(p + 1);
+		return 5;
 
-		pos += namelen;
+	case TDS_RETURNSTATUS_TOKEN:
+	case POOL_OFFSET_TOKEN:
+		NEED(5);
+		return 5;
 
-		num_cols++;
+	case TDS7_RESULT_TOKEN:
+		return parse_colmetadata(stream, p, len);
 
-		if (pos >= hdrsize)
-			break;
-	}
+	case TDS_ROW_TOKEN:
+		memset(stream->nulls, 0, (stream->num_cols + 7) / 8);
+		stream->cur_col = (unsigned int) -1;
+		next_column(stream);
+		return 1;
 
-	tds_free_all_results(pmbr->tds);
-	pmbr->tds->res_info = tds_alloc_results(num_cols);
-	info = pmbr->tds->res_info;
-
-	cur = head;
-
-	for (col = 0; col < info->num_cols; col++) {
-		curcol = info->columns[col];
-		strlcpy(curcol->column_name, cur->column_name, sizeof(curcol->column_name));
-		/* FIXME ucs2 client and others */
-		curcol->column_namelen = strlen(curcol->column_name);
-		prev = cur;
-		cur = cur->next;
-		free(prev->column_name);
-		free(prev);
-	}
+	case TDS_NBC_ROW_TOKEN:
+		size = (stream->num_cols + 7) / 8;
+		NEED(1 + size);
+		memcpy(stream->nulls, p + 1, size);
+		stream->cur_col = (unsigned int) -1;
+		next_column(stream);
+		return 1 + size;
 
+	case TDS_PARAM_TOKEN:
+		return parse_returnvalue(stream, p, len);
 
-	*bytes_read = pos;
-	return 1;
+	case TDS_CONTROL_FEATUREEXTACK_TOKEN:
+		return parse_featureextack(p, len);
+	}
+	tdsdump_log(TDS_DBG_ERROR, "pool stream: unsupported token %d\n", p[0]);
+	return LOST;
 }
 
 static int
-read_col_info(TDS_POOL_MEMBER * pmbr, const unsigned char *buf, int maxlen, int *bytes_read)
+parse_value(TDS_POOL_STREAM * stream, const unsigned char *p, size_t len)
 {
-	TDS_SMALLINT hdrsize;
-	int pos = 0;
-	int col, rest;
-	TDSCOLUMN *curcol;
-	TDSRESULTINFO *info;
-	TDSSOCKET *tds = pmbr->tds;
-
-	/* header size */
-	if (bytes_left(pmbr, buf, pos, maxlen, 3)) {
-		*bytes_read = maxlen;
-		return 0;
-	}
-	/* FIX ME -- endian */
-	hdrsize = buf[1] + buf[2] * 256;
-	pos += 3;
-
-	info = tds->res_info;
-	for (col = 0; col < info->num_cols; col++) {
-		curcol = info->columns[col];
-		if (bytes_left(pmbr, buf, pos, maxlen, 5)) {
-			*bytes_read = maxlen;
-			return 0;
-		}
-		pos += 4;
-		curcol->column_type = buf[pos++];
-
-		/* FIX ME -- blob types */
-		if (!is_fixed_type(curcol->column_type)) {
-			if (bytes_left(pmbr, buf, pos, maxlen, 1)) {
-				*bytes_read = maxlen;
-				return 0;
-			}
-			curcol->column_size = buf[pos++];
-		} else {
-			curcol->column_size = tds_get_size_by_type(curcol->column_type);
-		}
-	}
+	const TDS_POOL_COLUMN *col = stream->retval ? &stream->retval_col : &stream->cols[stream->cur_col];
+	unsigned int size;
 
-	rest = hdrsize + 3 - pos;
-	if (rest > 0) {
-		if (bytes_left(pmbr, buf, pos, maxlen, rest)) {
-			*bytes_read = maxlen;
-			return 0;
+	switch (col->kind) {
+	case POOL_COL_FIXED:
+		stream->skip = col->size;
+		next_column(stream);
+		return 0;
+	case POOL_COL_BYTELEN:
+		NEED(1);
+		stream->skip = p[0];
+		next_column(stream);
+		return 1;
+	case POOL_COL_USHORTLEN:
+		NEED(2);
+		size = TDS_GET_UA2LE(p);
+		stream->skip = size == 0xffff ? 0 : size;
+		next_column(stream);
+		return 2;
+	case POOL_COL_LONGLEN:
+		NEED(4);
+		stream->skip = TDS_GET_UA4LE(p);
+		next_column(stream);
+		return 4;
+	case POOL_COL_TEXT:
+		NEED(1);
+		if (!p[0]) {
+			next_column(stream);
+			return 1;
 		}
-		fprintf(stderr, "read_col_info: draining %d bytes\n", rest);
-		pos += rest;
+		/* text pointer, timestamp, length */
+		size = 1 + p[0] + 8;
+		NEED(size + 4);
+		stream->skip = TDS_GET_UA4LE(p + size);
+		next_column(stream);
+		return size + 4;
+	case POOL_COL_PLP:
+		NEED(8);
+		if (TDS_GET_UA4LE(p) == 0xffffffffu && TDS_GET_UA4LE(p + 4) == 0xffffffffu)
+			next_column(stream);
+		else
+			stream->state = POOL_STREAM_PLP;
+		return 8;
 	}
-	*bytes_read = pos;
+	return LOST;
+}
 
-	return 1;
+static int
+parse_plp_chunk(TDS_POOL_STREAM * stream, const unsigned char *p, size_t len)
+{
+	NEED(4);
+	stream->skip = TDS_GET_UA4LE(p);
+	if (!stream->skip)
+		next_column(stream);
+	return 4;
 }
 
-/*
- * TDS 5 style result sets
- */
 static int
-read_result(TDS_POOL_MEMBER * pmbr, const unsigned char *buf, int maxlen, int *bytes_read)
+parse_item(TDS_POOL_STREAM * stream, const unsigned char *p, size_t len)
 {
-	TDS_SMALLINT hdrsize;
-	int pos = 0;
-	int namelen;
-	int col;
-	TDSSOCKET *tds = pmbr->tds;
-	int num_cols;
-	TDSCOLUMN *curcol;
-	TDSRESULTINFO *info;
-
-	if (bytes_left(pmbr, buf, pos, maxlen, 3)) {
-		*bytes_read = maxlen;
-		return 0;
+	switch (stream->state) {
+	case POOL_STREAM_TOKEN:
+		return parse_token(stream, p, len);
+	case POOL_STREAM_COLUMN:
+		return parse_value(stream, p, len);
+	case POOL_STREAM_PLP:
+		return parse_plp_chunk(stream, p, len);
 	}
-	/* FIX ME -- endian */
-	hdrsize = buf[1] + buf[2] * 256;
-	pos += 3;
-
-	/* read number of columns and allocate the columns structure */
-	num_cols = buf[pos] + buf[pos+1] * 256;
-	pos += 2;
-
-	tds_free_all_results(tds);
-
-	tds->res_info = tds_alloc_results(num_cols);
-	info = pmbr->tds->res_info;
-
-	/*
-	 * loop through the columns populating COLINFO struct from
- 	 * server response
-	 */
-
-	for (col = 0; col < info->num_cols; col++) {
-		curcol = info->columns[col];
-
-		namelen = buf[pos++];
-
-		strlcpy(curcol->column_name, (char *) &buf[pos], namelen + 1);
-		pos += namelen;
-
-		curcol->column_namelen = namelen;
-
-		pos++;     /* flags */
-		pos += 4;  /* user type */
-
-		tds_set_column_type(tds->conn, curcol, (int)buf[pos]);
-		switch(curcol->column_varint_size) {
-			/* FIX ME - endian */
-			case 2: curcol->column_size = buf[pos] + buf[pos+1]*256; break;
-			case 1: curcol->column_size = buf[pos]; break;
-			case 0: break;
-		}
-		pos+=curcol->column_varint_size;
-		if (is_numeric_type(curcol->column_type))
-			pos+=2;
+	return LOST;
+}
 
-		/* skip locale information */
-		pos += buf[pos];
+static bool
+pending_append(TDS_POOL_STREAM * stream, const unsigned char *buf, size_t len)
+{
+	size_t needed = stream->pending_len + len;
+
+	if (needed > POOL_STREAM_MAX_PENDING)
+		return false;
+	if (needed > stream->pending_alloc) {
+		size_t alloc = stream->pending_alloc ? stream->pending_alloc * 2 : 256;
+
+		while (alloc < needed)
+			alloc *= 2;
+		if (!TDS_RESIZE(stream->pending, alloc))
+			return false;
+		stream->pending_alloc = alloc;
 	}
-	return tds_alloc_row(info);
+	memcpy(stream->pending + stream->pending_len, buf, len);
+	stream->pending_len = needed;
+	return true;
 }
 
-/* 
- * is_end_token processes one token and returns 0 for an incomplete token
- * or -1 if this is the END token, and 1 for successful processing of token.  
- * The number of bytes read from the stream is returned in 'bytes_read'.
+/**
+ * Scan data received from the server.
+ * Data do not need to be complete tokens.
+ * @return false if data can't be parsed, state is lost
  */
-static int
-pool_is_end_token(TDS_POOL_MEMBER * pmbr, const unsigned char *buf, int maxlen, int *bytes_read)
+bool
+pool_stream_parse(TDS_POOL_STREAM * stream, const unsigned char *buf, size_t len)
 {
-	TDS_SMALLINT sz;
-	int marker;
-	int ret;
+	int used;
 
-	if (maxlen == 0)
-		return 0;
+	while (len && !stream->lost) {
+		if (stream->skip) {
+			size_t n = stream->skip < len ? (size_t) stream->skip : len;
 
-	marker = buf[0];
-	sz = tds_get_token_size(marker);
-
-	if (sz) {
-		ret = read_fixed_token(pmbr, buf, maxlen, bytes_read);
-	} else if (marker == TDS_ROW_TOKEN) {
-		ret = read_row(pmbr, buf, maxlen, bytes_read);
-	} else if (marker == TDS_COLNAME_TOKEN) {
-		ret = read_col_name(pmbr, buf, maxlen, bytes_read);
-	} else if (marker == TDS_COLFMT_TOKEN) {
-		ret = read_col_info(pmbr, buf, maxlen, bytes_read);
-	} else if (marker == TDS_RESULT_TOKEN) {
-		ret = read_result(pmbr, buf, maxlen, bytes_read);
-	} else {
-		ret = read_variable_token(pmbr, buf, maxlen, bytes_read);
-	}
+			stream->skip -= n;
+			buf += n;
+			len -= n;
+			continue;
+		}
 
-	/* fprintf(stderr,"bytes_read = %d\n",*bytes_read); */
-	if (!ret) {
-		return 0;
-	}
+		/* complete item split from previous data */
+		if (stream->pending_len) {
+			size_t old_len = stream->pending_len;
+			size_t add = old_len < 256 ? 256 : old_len;
 
-	if (is_end_token(marker)) {
-		if (is_final_token(buf)) {
-			/* clean up */
-			return -1;
+			if (add > len)
+				add = len;
+			if (!pending_append(stream, buf, add)) {
+				stream->lost = true;
+				break;
+			}
+			used = parse_item(stream, stream->pending, stream->pending_len);
+			if (used == NEED_MORE) {
+				buf += add;
+				len -= add;
+				continue;
+			}
+			stream->pending_len = 0;
+			if (used < (int) old_len) {
+				stream->lost = true;
+				break;
+			}
+			buf += used - old_len;
+			len -= used - old_len;
+			continue;
 		}
-	}
 
-	return 1;
+		used = parse_item(stream, buf, len);
+		if (used == NEED_MORE) {
+			if (!pending_append(stream, buf, len))
+				stream->lost = true;
+			break;
+		}
+		if (used < 0) {
+			stream->lost = true;
+			break;
+		}
+		buf += used;
+		len -= used;
+	}
+	return !stream->lost;
 }
 
-int
-pool_find_end_token(TDS_POOL_MEMBER * pmbr, const unsigned char *buf, int len)
+/**
+ * Check if a SQL batch is an INSERT BULK statement.
+ * After it the client sends bulk data so the connection must be kept.
+ * @param buf  first packet of the request, without header
+ */
+bool
+pool_query_is_bulk(const unsigned char *buf, size_t len, bool tds72)
 {
-	int pos = 0, startpos, ret;
-	int bytes_read;
-	int stop = 0;
-	const unsigned char *curbuf;
-	unsigned char tmpbuf[PGSIZ + BLOCKSIZ];
-	int totlen;
-	static int last_mark;
-
-	/*
-	 * if we had part of a token left over, copy to tmpbuf
-	 */
-	if (pmbr->num_bytes_left) {
-		/* fprintf(stderr,"%d bytes left from last packet\n",pmbr->num_bytes_left); */
-		if (pmbr->num_bytes_left > 2000) {
-			fprintf(stderr, "marker is %d last mark was %d\n", pmbr->fragment[0], last_mark);
-		}
-		memcpy(tmpbuf, pmbr->fragment, pmbr->num_bytes_left);
-		memcpy(&tmpbuf[pmbr->num_bytes_left], buf, len);
-		curbuf = tmpbuf;
-		totlen = len + pmbr->num_bytes_left;
-	} else {
-		curbuf = buf;
-		totlen = len;
+	static const char keywords[] = "insert bulk";
+	const char *k = keywords;
+	size_t pos = 0;
+	bool space = true;
+
+	/* skip ALL_HEADERS */
+	if (tds72) {
+		if (len < 4)
+			return false;
+		pos = TDS_GET_UA4LE(buf);
 	}
 
-	do {
-		startpos = pos;
+	for (; pos + 1 < len && *k; pos += 2) {
+		unsigned int c = TDS_GET_UA2LE(buf + pos);
 
-		ret = pool_is_end_token(pmbr, &curbuf[pos], totlen - pos, &bytes_read);
-		if (ret <= 0)
-			stop = 1;
+		if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+			if (!space && *k != ' ')
+				return false;
+			if (*k == ' ')
+				++k;
+			space = true;
+			continue;
+		}
+		if (*k == ' ' || c >= 128 || (c | 0x20) != (unsigned char) *k)
+			return false;
+		space = false;
+		++k;
+	}
+	if (*k)
+		return false;
 
-		pos += bytes_read;
-	} while (!stop);
+	/* keyword must be followed by a separator */
+	if (pos + 1 < len) {
+		unsigned int c = TDS_GET_UA2LE(buf + pos);
 
-	if (ret == -1) {
-		pmbr->num_bytes_left = 0;
-		return 1;	/* found end token */
-	} else {
-		last_mark = buf[0];
-		pmbr->num_bytes_left = totlen - startpos;
-		memcpy(pmbr->fragment, &curbuf[startpos], pmbr->num_bytes_left);
-		return 0;	/* exhausted the stream */
+		if (c < 128 && (isalnum(c) || c == '_'))
+			return false;
 	}
+	return true;
 }
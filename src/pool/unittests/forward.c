@@ -0,0 +1,299 @@
+/* TDSPool - Connection pooling for TDS based databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * Purpose: test packet forwarding from a member to an user and
+ * compare the throughput of copying and splicing.
+ * A fake server thread sends big packets on a local TCP connection,
+ * a fake client thread checks what the pool forwards.
+ */
+#include <config.h>
+
+#include <stdio.h>
+#include <assert.h>
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif /* HAVE_STDLIB_H */
+
+#if HAVE_STRING_H
+#include <string.h>
+#endif /* HAVE_STRING_H */
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#if HAVE_POLL_H
+#include <poll.h>
+#endif /* HAVE_POLL_H */
+
+#if HAVE_NETINET_IN_H
+#include <netinet/in.h>
+#endif /* HAVE_NETINET_IN_H */
+
+#if HAVE_ARPA_INET_H
+#include <arpa/inet.h>
+#endif /* HAVE_ARPA_INET_H */
+
+#if HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif /* HAVE_SYS_RESOURCE_H */
+
+#include "pool.h"
+#include <freetds/bytes.h>
+#include <freetds/data.h>
+
+#define PACKET_SIZE 32768
+#define NUM_PACKETS 4096
+
+/* the loop in this test does not use the pool event loop */
+void
+pool_socket_changed(TDS_POOL * pool, TDS_POOL_SOCKET * sock)
+{
+}
+
+/* packets sent by the server, packet n is packets[n % 256] */
+static uint8_t packets[256][PACKET_SIZE];
+
+static void
+build_packets(void)
+{
+	unsigned n, i;
+
+	for (n = 0; n < 256; ++n) {
+		uint8_t *packet = packets[n];
+
+		packet[0] = TDS_REPLY;
+		TDS_PUT_UA2BE(packet + 2, PACKET_SIZE);
+		packet[6] = (uint8_t) n;
+		for (i = 8; i < PACKET_SIZE; ++i)
+			packet[i] = (uint8_t) (i * 7u + n);
+	}
+}
+
+/* get a connected pair of TCP sockets */
+static void
+tcp_pair(TDS_SYS_SOCKET sockets[2])
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+	TDS_SYS_SOCKET s;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	s = socket(AF_INET, SOCK_STREAM, 0);
+	assert(!TDS_IS_SOCKET_INVALID(s));
+	assert(bind(s, (struct sockaddr *) &sin, sizeof(sin)) == 0);
+	assert(listen(s, 1) == 0);
+	assert(getsockname(s, (struct sockaddr *) &sin, &len) == 0);
+
+	sockets[0] = socket(AF_INET, SOCK_STREAM, 0);
+	assert(!TDS_IS_SOCKET_INVALID(sockets[0]));
+	assert(connect(sockets[0], (struct sockaddr *) &sin, sizeof(sin)) == 0);
+	sockets[1] = accept(s, NULL, NULL);
+	assert(!TDS_IS_SOCKET_INVALID(sockets[1]));
+	CLOSESOCKET(s);
+}
+
+static TDS_THREAD_PROC_DECLARE(fake_server_proc, arg)
+{
+	TDS_SYS_SOCKET s = TDS_PTR2INT(arg);
+	uint8_t last[PACKET_SIZE];
+	unsigned n;
+
+	for (n = 0; n + 1 < NUM_PACKETS; ++n)
+		if (pool_write(s, packets[n % 256], PACKET_SIZE) != PACKET_SIZE)
+			break;
+
+	/* last packet has EOM status */
+	memcpy(last, packets[n % 256], PACKET_SIZE);
+	last[1] = 1;
+	pool_write(s, last, PACKET_SIZE);
+
+	CLOSESOCKET(s);
+	return TDS_THREAD_RESULT(0);
+}
+
+static bool
+read_full(TDS_SYS_SOCKET s, uint8_t *buf, size_t len)
+{
+	while (len) {
+		int got = READSOCKET(s, buf, len);
+		if (got <= 0)
+			return false;
+		buf += got;
+		len -= got;
+	}
+	return true;
+}
+
+static unsigned received;
+
+static TDS_THREAD_PROC_DECLARE(fake_client_proc, arg)
+{
+	TDS_SYS_SOCKET s = TDS_PTR2INT(arg);
+	uint8_t packet[PACKET_SIZE];
+
+	received = 0;
+	while (read_full(s, packet, 8)) {
+		assert(packet[0] == TDS_REPLY);
+		assert(packet[1] == (received + 1 == NUM_PACKETS ? 1 : 0));
+		assert(TDS_GET_A2BE(packet + 2) == PACKET_SIZE);
+		assert(packet[6] == (uint8_t) received);
+		assert(read_full(s, packet + 8, PACKET_SIZE - 8));
+		assert(memcmp(packet + 8, packets[received % 256] + 8, PACKET_SIZE - 8) == 0);
+		++received;
+	}
+
+	CLOSESOCKET(s);
+	return TDS_THREAD_RESULT(0);
+}
+
+/* forward data from member to user as pool_process_data does */
+static void
+forward(TDS_POOL *pool, TDS_POOL_SOCKET *member, TDS_POOL_SOCKET *user)
+{
+	TDSSOCKET *tds = member->tds;
+	struct pollfd fds[2];
+
+	member->poll_recv = true;
+	for (;;) {
+		fds[0].fd = tds_get_s(member->tds);
+		fds[0].events = member->poll_recv ? POLLIN : 0;
+		fds[1].fd = tds_get_s(user->tds);
+		fds[1].events = user->poll_send ? POLLOUT : 0;
+		fds[0].revents = fds[1].revents = 0;
+		assert(poll(fds, 2, -1) > 0);
+		if (fds[0].revents)
+			member->can_recv = true;
+		if (fds[1].revents)
+			user->can_send = true;
+
+		if (user->poll_send && user->can_send)
+			assert(pool_write_data(pool, member, user));
+
+		while (member->poll_recv && member->can_recv) {
+			if (!pool_write_pending(member)) {
+				if (pool_packet_read(member)) {
+					member->can_recv = false;
+					break;
+				}
+				/* server closed connection */
+				if (tds->in_len == 0 && !pool_write_pending(member))
+					return;
+			}
+			assert(pool_write_data(pool, member, user));
+			if (pool_write_pending(member))
+				break;
+		}
+	}
+}
+
+/* CPU time used by current thread in microseconds, 0 if unknown */
+static unsigned long
+thread_cpu_us(void)
+{
+#if defined(HAVE_SYS_RESOURCE_H) && defined(RUSAGE_THREAD)
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_THREAD, &usage) == 0)
+		return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000ul
+			+ usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+#endif
+	return 0;
+}
+
+static unsigned
+test(bool zero_copy, unsigned long *cpu_us)
+{
+	TDS_POOL pool;
+	TDSCONTEXT *ctx;
+	TDS_POOL_SOCKET member, user;
+	TDS_SYS_SOCKET server_sockets[2], client_sockets[2];
+	tds_thread server_thread, client_thread;
+	unsigned start;
+
+	memset(&pool, 0, sizeof(pool));
+	pool.zero_copy = zero_copy;
+	memset(&member, 0, sizeof(member));
+	memset(&user, 0, sizeof(user));
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+	member.tds = tds_alloc_socket(ctx, 4096);
+	user.tds = tds_alloc_socket(ctx, 4096);
+	assert(member.tds && user.tds);
+	member.is_member = true;
+	pool_splice_init(&pool, &member);
+
+	tcp_pair(server_sockets);
+	tcp_pair(client_sockets);
+	tds_set_s(member.tds, server_sockets[0]);
+	tds_set_s(user.tds, client_sockets[0]);
+	assert(tds_socket_set_nonblocking(server_sockets[0]) == 0);
+	assert(tds_socket_set_nonblocking(client_sockets[0]) == 0);
+
+	start = tds_gettime_ms();
+	assert(tds_thread_create(&server_thread, fake_server_proc, TDS_INT2PTR(server_sockets[1])) == 0);
+	assert(tds_thread_create(&client_thread, fake_client_proc, TDS_INT2PTR(client_sockets[1])) == 0);
+
+	*cpu_us = thread_cpu_us();
+	forward(&pool, &member, &user);
+	*cpu_us = thread_cpu_us() - *cpu_us;
+	assert(!pool_write_pending(&member));
+	CLOSESOCKET(client_sockets[0]);
+	tds_set_s(user.tds, INVALID_SOCKET);
+
+	tds_thread_join(client_thread, NULL);
+	tds_thread_join(server_thread, NULL);
+	start = tds_gettime_ms() - start;
+
+	assert(received == NUM_PACKETS);
+
+	pool_splice_free(&member);
+	CLOSESOCKET(server_sockets[0]);
+	tds_set_s(member.tds, INVALID_SOCKET);
+	tds_free_socket(member.tds);
+	tds_free_socket(user.tds);
+	tds_free_context(ctx);
+	return start;
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned copy, splice;
+	unsigned long copy_cpu, splice_cpu;
+	double mb = (double) PACKET_SIZE * NUM_PACKETS / (1024. * 1024.);
+
+	tdsdump_open(getenv("TDSDUMP"));
+	build_packets();
+
+	copy = test(false, &copy_cpu);
+	splice = test(true, &splice_cpu);
+	printf("%u packets of %u bytes\n", NUM_PACKETS, PACKET_SIZE);
+	printf("copy: %u ms (%.0f MB/s), forwarding cpu %lu us\n",
+	       copy, mb * 1000. / (copy ? copy : 1), copy_cpu);
+	printf("zero copy: %u ms (%.0f MB/s), forwarding cpu %lu us\n",
+	       splice, mb * 1000. / (splice ? splice : 1), splice_cpu);
+	return 0;
+}
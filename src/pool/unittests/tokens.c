@@ -0,0 +1,383 @@
+/* TDSPool - Connection pooling for TDS based databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+ * Purpose: test the scanner of server responses used in
+ * transaction mode. Responses are split at every position to
+ * check parsing can be resumed.
+ */
+#include <config.h>
+
+#include <stdio.h>
+#include <assert.h>
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif /* HAVE_STDLIB_H */
+
+#if HAVE_STRING_H
+#include <string.h>
+#endif /* HAVE_STRING_H */
+
+#include "pool.h"
+#include <freetds/data.h>
+
+static unsigned char buf[1024];
+static size_t buf_len;
+static bool tds72;
+
+static void
+put_byte(unsigned char c)
+{
+	assert(buf_len < sizeof(buf));
+	buf[buf_len++] = c;
+}
+
+static void
+put_n(const void *p, size_t len)
+{
+	assert(buf_len + len <= sizeof(buf));
+	memcpy(buf + buf_len, p, len);
+	buf_len += len;
+}
+
+static void
+put_u16(unsigned int n)
+{
+	put_byte(n & 0xff);
+	put_byte(n >> 8);
+}
+
+static void
+put_u32(unsigned int n)
+{
+	put_u16(n & 0xffff);
+	put_u16(n >> 16);
+}
+
+/* put a string in UCS-2 with a length of len_size bytes */
+static void
+put_varchar(const char *s, int len_size)
+{
+	if (len_size == 1)
+		put_byte(strlen(s));
+	else
+		put_u16(strlen(s));
+	for (; *s; ++s)
+		put_u16((unsigned char) *s);
+}
+
+static void
+put_done(unsigned int status)
+{
+	put_byte(TDS_DONE_TOKEN);
+	put_u16(status);
+	put_u16(0);
+	put_u32(0);
+	if (tds72)
+		put_u32(0);
+}
+
+static void
+put_xact_change(unsigned char type)
+{
+	static const unsigned char xact[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+
+	put_byte(TDS_ENVCHANGE_TOKEN);
+	put_u16(11);
+	put_byte(type);
+	if (type == TDS_ENV_BEGINTRANS) {
+		put_byte(8);
+		put_n(xact, 8);
+		put_byte(0);
+	} else {
+		put_byte(0);
+		put_byte(8);
+		put_n(xact, 8);
+	}
+}
+
+static void
+put_info(void)
+{
+	size_t start;
+
+	put_byte(TDS_INFO_TOKEN);
+	start = buf_len;
+	put_u16(0);
+	put_u32(5701);
+	put_byte(2);
+	put_byte(0);
+	put_varchar("Changed database context", 2);
+	put_varchar("srv", 1);
+	put_varchar("", 1);
+	put_u32(1);
+	buf[start] = (buf_len - start - 2) & 0xff;
+	buf[start + 1] = (buf_len - start - 2) >> 8;
+}
+
+static void
+put_usertype_flags(void)
+{
+	if (tds72)
+		put_u32(0);
+	else
+		put_u16(0);
+	put_u16(0);
+}
+
+static void
+put_collation(void)
+{
+	static const unsigned char collation[5] = { 0x09, 0x04, 0xd0, 0x00, 0x34 };
+
+	put_n(collation, 5);
+}
+
+static void
+put_results(void)
+{
+	static const unsigned char textptr[16] = { 0 };
+	static const unsigned char timestamp[8] = { 0 };
+
+	put_byte(TDS7_RESULT_TOKEN);
+	put_u16(6);
+
+	put_usertype_flags();
+	put_byte(SYBINT4);
+	put_varchar("a", 1);
+
+	put_usertype_flags();
+	put_byte(XSYBNVARCHAR);
+	put_u16(20);
+	put_collation();
+	put_varchar("b", 1);
+
+	put_usertype_flags();
+	put_byte(XSYBNVARCHAR);
+	put_u16(0xffff);
+	put_collation();
+	put_varchar("c", 1);
+
+	put_usertype_flags();
+	put_byte(SYBNTEXT);
+	put_u32(0x7ffffffe);
+	put_collation();
+	if (tds72)
+		put_byte(1);
+	put_varchar("t", 2);
+	put_varchar("d", 1);
+
+	put_usertype_flags();
+	put_byte(SYBINTN);
+	put_byte(4);
+	put_varchar("e", 1);
+
+	put_usertype_flags();
+	put_byte(SYBDECIMAL);
+	put_byte(17);
+	put_byte(38);
+	put_byte(2);
+	put_varchar("f", 1);
+
+	/* a row with all values */
+	put_byte(TDS_ROW_TOKEN);
+	put_u32(123);
+	put_u16(4);
+	put_u32(0x00620061);
+	/* PLP, 2 chunks */
+	put_u32(6);
+	put_u32(0);
+	put_u32(4);
+	put_u32(0x00620061);
+	put_u32(2);
+	put_u16(0x63);
+	put_u32(0);
+	put_byte(16);
+	put_n(textptr, 16);
+	put_n(timestamp, 8);
+	put_u32(2);
+	put_u16(0x64);
+	put_byte(4);
+	put_u32(321);
+	put_byte(5);
+	put_byte(1);
+	put_u32(12345);
+
+	/* a row with NULLs */
+	put_byte(TDS_ROW_TOKEN);
+	put_u32(124);
+	put_u16(0xffff);
+	put_u32(0xffffffff);
+	put_u32(0xffffffff);
+	put_byte(0);
+	put_byte(0);
+	put_byte(0);
+
+	if (tds72) {
+		/* columns 1-3 and 5 are NULL */
+		put_byte(TDS_NBC_ROW_TOKEN);
+		put_byte(0x2e);
+		put_u32(125);
+		put_byte(4);
+		put_u32(1);
+	}
+
+	put_done(TDS_DONE_COUNT);
+
+	/* output parameter of a RPC */
+	put_byte(TDS_PARAM_TOKEN);
+	put_u16(1);
+	put_varchar("@p", 1);
+	put_byte(1);
+	put_usertype_flags();
+	put_byte(SYBINTN);
+	put_byte(4);
+	put_byte(4);
+	put_u32(7);
+}
+
+/* parse buffer in two parts, each split position is tried */
+static void
+check(bool in_xact, bool attention, bool lost)
+{
+	TDS_POOL_STREAM stream;
+	size_t split, i;
+
+	memset(&stream, 0, sizeof(stream));
+	for (split = 0; split <= buf_len; ++split) {
+		pool_stream_init(&stream, tds72);
+		pool_stream_parse(&stream, buf, split);
+		pool_stream_parse(&stream, buf + split, buf_len - split);
+		if (stream.in_xact != in_xact || stream.attention != attention || stream.lost != lost) {
+			fprintf(stderr, "tds72 %d split %u: xact %d attention %d lost %d\n",
+				tds72, (unsigned) split, stream.in_xact, stream.attention, stream.lost);
+			exit(1);
+		}
+		if (!lost && !pool_stream_idle(&stream)) {
+			fprintf(stderr, "tds72 %d split %u: state %d skip %u pending %u\n", tds72, (unsigned) split,
+				stream.state, (unsigned) stream.skip, (unsigned) stream.pending_len);
+			exit(1);
+		}
+	}
+
+	/* byte by byte */
+	pool_stream_init(&stream, tds72);
+	for (i = 0; i < buf_len; ++i)
+		pool_stream_parse(&stream, buf + i, 1);
+	assert(stream.in_xact == in_xact && stream.attention == attention && stream.lost == lost);
+	pool_stream_free(&stream);
+}
+
+static void
+test_tokens(void)
+{
+	/* begin a transaction */
+	buf_len = 0;
+	put_info();
+	put_xact_change(TDS_ENV_BEGINTRANS);
+	put_done(0);
+	check(true, false, false);
+
+	/* results inside a transaction, then commit */
+	buf_len = 0;
+	put_xact_change(TDS_ENV_BEGINTRANS);
+	put_results();
+	put_done(TDS_DONE_MORE_RESULTS);
+	check(true, false, false);
+	put_xact_change(TDS_ENV_COMMITTRANS);
+	put_done(0);
+	check(false, false, false);
+
+	/* rollback */
+	buf_len = 0;
+	put_xact_change(TDS_ENV_BEGINTRANS);
+	put_xact_change(TDS_ENV_ROLLBACKTRANS);
+	put_done(TDS_DONE_ERROR);
+	check(false, false, false);
+
+	/* attention acknowledge */
+	buf_len = 0;
+	put_results();
+	put_done(TDS_DONE_CANCELLED);
+	check(false, true, false);
+
+	/* unknown token */
+	buf_len = 0;
+	put_xact_change(TDS_ENV_BEGINTRANS);
+	put_byte(0x01);
+	put_done(0);
+	check(true, false, true);
+}
+
+/* build a SQL batch packet content */
+static void
+put_query(const char *sql)
+{
+	buf_len = 0;
+	if (tds72) {
+		/* ALL_HEADERS with a transaction descriptor */
+		put_u32(22);
+		put_u32(18);
+		put_u16(2);
+		put_u32(0);
+		put_u32(0);
+		put_u32(1);
+	}
+	for (; *sql; ++sql)
+		put_u16((unsigned char) *sql);
+}
+
+static void
+test_bulk(void)
+{
+	put_query("insert bulk t (a int)");
+	assert(pool_query_is_bulk(buf, buf_len, tds72));
+	put_query(" \r\nINSERT\tBulk [t]");
+	assert(pool_query_is_bulk(buf, buf_len, tds72));
+	put_query("insert bulk");
+	assert(pool_query_is_bulk(buf, buf_len, tds72));
+	put_query("insert into t values(1)");
+	assert(!pool_query_is_bulk(buf, buf_len, tds72));
+	put_query("insertbulk");
+	assert(!pool_query_is_bulk(buf, buf_len, tds72));
+	put_query("insert bulky");
+	assert(!pool_query_is_bulk(buf, buf_len, tds72));
+	put_query("insert bul");
+	assert(!pool_query_is_bulk(buf, buf_len, tds72));
+	put_query("select 1");
+	assert(!pool_query_is_bulk(buf, buf_len, tds72));
+}
+
+int
+main(int argc, char **argv)
+{
+	tdsdump_open(getenv("TDSDUMP"));
+
+	tds72 = false;
+	test_tokens();
+	test_bulk();
+
+	tds72 = true;
+	test_tokens();
+	test_bulk();
+
+	printf("Stream parsing ok\n");
+	return 0;
+}
@@ -53,6 +53,35 @@ static bool pool_user_login(TDS_POOL * pool, TDS_POOL_USER * puser);
 static bool pool_user_read(TDS_POOL * pool, TDS_POOL_USER * puser);
 static void login_execute(TDS_POOL_EVENT *base_event);
 static void end_login_execute(TDS_POOL_EVENT *base_event);
+static bool pool_user_cancel_ack(TDS_POOL_USER * puser);
+
+/*
+ * Users of all shards. All shards accept from the same listening
+ * socket so max_users limits the total, not the users of a shard.
+ */
+#if defined(__GNUC__)
+static int total_users = 0;
+#define pool_users_inc() __atomic_add_fetch(&total_users, 1, __ATOMIC_RELAXED)
+#define pool_users_dec() __atomic_sub_fetch(&total_users, 1, __ATOMIC_RELAXED)
+#elif defined(_WIN32)
+static volatile LONG total_users = 0;
+#define pool_users_inc() InterlockedIncrement(&total_users)
+#define pool_users_dec() InterlockedDecrement(&total_users)
+#else
+static tds_mutex total_users_mtx = TDS_MUTEX_INITIALIZER;
+static int total_users = 0;
+
+static int
+pool_users_add(int n)
+{
+	tds_mutex_lock(&total_users_mtx);
+	n = (total_users += n);
+	tds_mutex_unlock(&total_users_mtx);
+	return n;
+}
+#define pool_users_inc() pool_users_add(1)
+#define pool_users_dec() pool_users_add(-1)
+#endif
 
 void
 pool_user_init(TDS_POOL * pool)
@@ -80,19 +109,20 @@ pool_user_find_new(TDS_POOL * pool)
 	TDS_POOL_USER *puser;
 
 	/* did we exhaust the number of concurrent users? */
-	if (pool->num_users >= MAX_POOL_USERS) {
-		fprintf(stderr, "Max concurrent users exceeded, increase in pool.h\n");
+	if (pool_users_inc() > pool->max_users && pool->max_users > 0) {
+		pool_users_dec();
+		fprintf(stderr, "Max concurrent users exceeded, increase \"max pool users\"\n");
 		return NULL;
 	}
 
 	puser = tds_new0(TDS_POOL_USER, 1);
 	if (!puser) {
+		pool_users_dec();
 		fprintf(stderr, "Out of memory\n");
 		return NULL;
 	}
 
 	dlist_user_append(&pool->users, puser);
-	pool->num_users++;
 
 	return puser;
 }
@@ -132,6 +162,7 @@ login_execute(TDS_POOL_EVENT *base_event)
 	/* try to assign a member, connection can have transactions
 	 * and so on so deassign only when disconnected */
 	pool_user_query(pool, puser);
+	pool_socket_changed(pool, &puser->sock);
 
 	tdsdump_log(TDS_DBG_INFO1, "user state %d\n", puser->user_state);
 
@@ -153,7 +184,12 @@ pool_user_create(TDS_POOL * pool, TDS_SYS_SOCKET s)
 
 	tdsdump_log(TDS_DBG_NETWORK, "accepting connection\n");
 	if (TDS_IS_SOCKET_INVALID(fd = tds_accept(s, NULL, NULL))) {
-		char *errstr = sock_strerror(errno);
+		char *errstr;
+
+		/* another worker got the connection */
+		if (TDSSOCK_WOULDBLOCK(sock_errno))
+			return NULL;
+		errstr = sock_strerror(sock_errno);
 		tdsdump_log(TDS_DBG_ERROR, "error calling assert :%s\n", errstr);
 		sock_strerror_free(errstr);
 		return NULL;
@@ -190,6 +226,8 @@ pool_user_create(TDS_POOL * pool, TDS_SYS_SOCKET s)
 	puser->user_state = TDS_SRV_QUERY;
 	puser->sock.poll_recv = false;
 	puser->sock.poll_send = false;
+	/* register now, login thread will read from socket directly */
+	pool_socket_changed(pool, &puser->sock);
 
 	/* launch login asyncronously */
 	ev->puser = puser;
@@ -215,51 +253,49 @@ pool_free_user(TDS_POOL *pool, TDS_POOL_USER * puser)
 	if (pmbr) {
 		assert(pmbr->current_user == puser);
 		pool_deassign_member(pool, pmbr);
-		pool_reset_member(pool, pmbr);
+		/* a thread is using the member, it will check the user */
+		if (!pmbr->doing_async)
+			pool_reset_member(pool, pmbr);
 	}
 
+	pool_socket_remove(pool, &puser->sock);
 	tds_free_socket(puser->sock.tds);
 	tds_free_login(puser->login);
+	free(puser->session_sql);
 
 	/* make sure to decrement the waiters list if he is waiting */
 	if (puser->user_state == TDS_SRV_WAIT)
 		dlist_user_remove(&pool->waiters, puser);
 	else
 		dlist_user_remove(&pool->users, puser);
-	pool->num_users--;
+	pool_users_dec();
 	free(puser);
 }
 
 /* 
- * pool_process_users
- * check the fd_set for user input, allocate a pool member to it, and forward
- * the query to that member.
+ * pool_process_user
+ * handle user input, forwarding queries to the assigned member,
+ * and pending writes of member results.
  */
 void
-pool_process_users(TDS_POOL * pool, struct pollfd *fds, unsigned num_fds)
+pool_process_user(TDS_POOL * pool, TDS_POOL_USER * puser)
 {
-	TDS_POOL_USER *puser, *next;
-	short revents;
+	if (!puser->sock.tds)
+		return;	/* dead connection */
 
-	for (next = dlist_user_first(&pool->users); (puser = next) != NULL; ) {
-
-		next = dlist_user_next(&pool->users, puser);
-
-		if (!puser->sock.tds || puser->sock.poll_index >= num_fds)
-			continue;	/* dead connection */
-
-		revents = fds[puser->sock.poll_index].revents;
+	if (puser->sock.poll_recv && puser->sock.can_recv) {
+		assert(puser->user_state == TDS_SRV_QUERY);
+		if (!pool_user_read(pool, puser))
+			return;
+	}
+	if (puser->sock.poll_send && puser->sock.can_send) {
+		TDS_POOL_MEMBER *pmbr = puser->assigned_member;
 
-		if (puser->sock.poll_recv && (revents & POLLIN) != 0) {
-			assert(puser->user_state == TDS_SRV_QUERY);
-			if (!pool_user_read(pool, puser))
-				continue;
-		}
-		if (puser->sock.poll_send && (revents & POLLOUT) != 0) {
-			if (!pool_write_data(&puser->assigned_member->sock, &puser->sock))
-				pool_free_member(pool, puser->assigned_member);
-		}
-	}			/* for */
+		if (!pool_write_data(pool, &pmbr->sock, &puser->sock))
+			pool_free_member(pool, pmbr);
+		else
+			pool_member_check_end(pool, pmbr);
+	}
 }
 
 /*
@@ -380,9 +416,15 @@ pool_user_send_login_ack(TDS_POOL * pool, TDS_POOL_USER * puser)
 			tds_quote_id(mtds, strchr(str, 0), tds_dstr_cstr(&login->database), -1);
 		}
 		ret = tds_submit_query(mtds, str);
-		free(str);
-		if (TDS_FAILED(ret) || TDS_FAILED(tds_process_simple_query(mtds)))
+		if (TDS_FAILED(ret) || TDS_FAILED(tds_process_simple_query(mtds))) {
+			free(str);
 			return false;
+		}
+		/* keep to setup other members in transaction mode */
+		free(puser->session_sql);
+		puser->session_sql = str;
+		free(puser->assigned_member->session_sql);
+		puser->assigned_member->session_sql = strdup(str);
 		if (dbname_mismatch)
 			database = tds_dstr_cstr(&login->database);
 		else
@@ -456,8 +498,10 @@ pool_user_read(TDS_POOL * pool, TDS_POOL_USER * puser)
 	for (;;) {
 		TDS_UCHAR in_flag;
 
-		if (pool_packet_read(tds))
+		if (pool_packet_read(&puser->sock)) {
+			puser->sock.can_recv = false;
 			break;
+		}
 		if (tds->in_len == 0) {
 			tdsdump_log(TDS_DBG_INFO1, "user disconnected\n");
 			pool_free_user(pool, puser);
@@ -474,11 +518,26 @@ pool_user_read(TDS_POOL * pool, TDS_POOL_USER * puser)
 		case TDS_BULK:
 		case TDS_CANCEL:
 		case TDS7_TRANS:
-			if (!pool_write_data(&puser->sock, &puser->assigned_member->sock)) {
-				pool_reset_member(pool, puser->assigned_member);
+			pmbr = puser->assigned_member;
+			if (!pmbr) {
+				/* transaction mode, no request running */
+				if (in_flag == TDS_CANCEL) {
+					tds->in_pos = tds->in_len;
+					if (!pool_user_cancel_ack(puser)) {
+						pool_free_user(pool, puser);
+						return false;
+					}
+					continue;
+				}
+				/* get a member, packet is kept till user is resumed */
+				pool_user_query(pool, puser);
+				return true;
+			}
+			pool_member_request(pool, pmbr, tds->in_buf);
+			if (!pool_write_data(pool, &puser->sock, &pmbr->sock)) {
+				pool_reset_member(pool, pmbr);
 				return false;
 			}
-			pmbr = puser->assigned_member;
 			break;
 
 		default:
@@ -503,7 +562,7 @@ pool_user_query(TDS_POOL * pool, TDS_POOL_USER * puser)
 	tdsdump_log(TDS_DBG_FUNC, "pool_user_query\n");
 
 	assert(puser->assigned_member == NULL);
-	assert(puser->login);
+	assert(puser->login || pool->mode == POOL_MODE_TRANSACTION);
 
 	puser->user_state = TDS_SRV_QUERY;
 	pmbr = pool_assign_idle_member(pool, puser);
@@ -556,6 +615,14 @@ end_login_execute(TDS_POOL_EVENT *base_event)
 	puser->sock.poll_send = false;
 	pmbr->sock.poll_recv = true;
 	pmbr->sock.poll_send = false;
+	pool_socket_changed(pool, &puser->sock);
+	pool_socket_changed(pool, &pmbr->sock);
+
+	/* in transaction mode member is needed only for requests */
+	if (pool->mode == POOL_MODE_TRANSACTION) {
+		pmbr->dirty = true;
+		pool_deassign_member(pool, pmbr);
+	}
 }
 
 /**
@@ -579,3 +646,35 @@ pool_user_finish_login(TDS_POOL * pool, TDS_POOL_USER * puser)
 		fprintf(stderr, "error creating thread\n");
 	}
 }
+
+/**
+ * Resume a user waiting for a member to be prepared.
+ */
+void
+pool_user_resume(TDS_POOL * pool, TDS_POOL_USER * puser)
+{
+	TDS_POOL_MEMBER *pmbr = puser->assigned_member;
+
+	puser->user_state = TDS_SRV_QUERY;
+	puser->sock.poll_recv = true;
+	/* a request could be already in the buffer */
+	puser->sock.can_recv = true;
+	pool_socket_changed(pool, &puser->sock);
+	if (pmbr) {
+		pmbr->sock.poll_recv = true;
+		pool_socket_changed(pool, &pmbr->sock);
+	}
+}
+
+/**
+ * Acknowledge an attention received while no request is running.
+ */
+static bool
+pool_user_cancel_ack(TDS_POOL_USER * puser)
+{
+	TDSSOCKET *tds = puser->sock.tds;
+
+	tds->out_flag = TDS_REPLY;
+	tds_send_done_token(tds, TDS_DONE_CANCELLED, 0);
+	return TDS_SUCCEED(tds_flush_packet(tds));
+}
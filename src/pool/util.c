@@ -37,6 +37,10 @@
 
 #include <ctype.h>
 
+#if HAVE_FCNTL_H
+#include <fcntl.h>
+#endif /* HAVE_FCNTL_H */
+
 #include "pool.h"
 #include <freetds/utils/string.h>
 #include <freetds/checks.h>
@@ -57,14 +61,34 @@ dump_login(TDSLOGIN * login)
 	fprintf(stderr, "bsiz %d\n", login->block_size);
 }
 
+#if defined(HAVE_SPLICE) && defined(HAVE_FCNTL_H)
+#define ENABLE_POOL_SPLICE 1
+
+/** packets smaller than this are copied */
+#define POOL_SPLICE_MIN 8192
+/**
+ * bytes at the end of a packet always read in memory,
+ * enough to contain final tokens.
+ */
+#define POOL_SPLICE_TAIL 64
+
+static int pool_splice_start(TDS_POOL_SOCKET *sock);
+static bool pool_splice_data(TDS_POOL * pool, TDS_POOL_SOCKET *from, TDS_POOL_SOCKET *to);
+#else
+#define ENABLE_POOL_SPLICE 0
+#endif
+
 /**
  * Read part of packet. Function does not block.
+ * If the packet is going to be spliced only the header is
+ * copied in in_buf and in_len is 0, see pool_write_data.
  * @return true if packet is not complete and we must call again,
  *         false on full packet or error.
  */
 bool
-pool_packet_read(TDSSOCKET *tds)
+pool_packet_read(TDS_POOL_SOCKET *sock)
 {
+	TDSSOCKET *tds = sock->tds;
 	unsigned int packet_len;
 	int readed;
 
@@ -88,6 +112,14 @@ pool_packet_read(TDSSOCKET *tds)
 		tds->in_len = 0;
 	}
 
+#if ENABLE_POOL_SPLICE
+	if (tds->in_len == 0 && sock->splice_next) {
+		int rc = pool_splice_start(sock);
+		if (rc)
+			return rc < 0;
+	}
+#endif
+
 	for (;;) {
 		/* determine packet size */
 		packet_len = 8;
@@ -107,8 +139,10 @@ pool_packet_read(TDSSOCKET *tds)
 				tds->recv_packet = packet;
 			}
 			CHECK_TDS_EXTRA(tds);
-			if (tds->in_len >= packet_len)
+			if (tds->in_len >= packet_len) {
+				sock->splice_next = sock->use_splice && packet_len >= POOL_SPLICE_MIN;
 				return false;
+			}
 		}
 
 		assert(packet_len > tds->in_len);
@@ -151,7 +185,9 @@ pool_write(TDS_SYS_SOCKET sock, const void *buf, size_t len)
 		ret = WRITESOCKET(sock, p, len);
 		if (ret <= 0) {
 			int err = errno;
-			if (TDSSOCK_WOULDBLOCK(err) || err == EINTR)
+			if (err == EINTR)
+				continue;
+			if (TDSSOCK_WOULDBLOCK(err))
 				break;
 			return -1;
 		}
@@ -173,7 +209,7 @@ pool_event_add(TDS_POOL *pool, TDS_POOL_EVENT *ev, TDS_POOL_EXECUTE execute)
 }
 
 bool
-pool_write_data(TDS_POOL_SOCKET *from, TDS_POOL_SOCKET *to)
+pool_write_data(TDS_POOL * pool, TDS_POOL_SOCKET *from, TDS_POOL_SOCKET *to)
 {
 	int ret;
 	TDSSOCKET *tds;
@@ -189,13 +225,183 @@ pool_write_data(TDS_POOL_SOCKET *from, TDS_POOL_SOCKET *to)
 		return false;
 
 	tds->in_pos += ret;
+#if ENABLE_POOL_SPLICE
+	if (tds->in_pos >= tds->in_len && (from->splice_left || from->pipe_len))
+		return pool_splice_data(pool, from, to);
+#endif
 	if (tds->in_pos < tds->in_len) {
 		/* partial write, schedule a future write */
 		to->poll_send = true;
+		to->can_send = false;
 		from->poll_recv = false;
 	} else {
 		to->poll_send = false;
 		from->poll_recv = true;
+		/* data could be already waiting */
+		pool_socket_changed(pool, from);
+	}
+	return true;
+}
+
+/**
+ * Check if data read from a socket was not fully forwarded.
+ */
+bool
+pool_write_pending(TDS_POOL_SOCKET *sock)
+{
+	return sock->tds->in_pos < sock->tds->in_len || sock->splice_left || sock->pipe_len;
+}
+
+/**
+ * Setup a member socket to forward packets using splice(2)
+ * if configured and supported.
+ */
+void
+pool_splice_init(TDS_POOL * pool, TDS_POOL_SOCKET *sock)
+{
+	sock->pipe_fds[0] = sock->pipe_fds[1] = -1;
+	/* in transaction mode packets are parsed */
+	sock->use_splice = ENABLE_POOL_SPLICE && pool->zero_copy && pool->mode == POOL_MODE_SESSION;
+}
+
+void
+pool_splice_free(TDS_POOL_SOCKET *sock)
+{
+	if (sock->pipe_fds[0] >= 0) {
+		close(sock->pipe_fds[0]);
+		close(sock->pipe_fds[1]);
+	}
+	sock->pipe_fds[0] = sock->pipe_fds[1] = -1;
+	sock->splice_left = sock->pipe_len = 0;
+}
+
+#if ENABLE_POOL_SPLICE
+/**
+ * Bytes at the end of the packet to read in memory.
+ * Only last packet of a response can contain final tokens.
+ */
+static unsigned int
+pool_splice_tail(const unsigned char *header)
+{
+	/* status bit 0 marks the final packet */
+	return (header[1] & 1) ? POOL_SPLICE_TAIL : 0;
+}
+
+/**
+ * Peek next packet header and decide if the packet must be spliced.
+ * Allocate the pipe if needed.
+ * @return 1 if packet is going to be spliced, 0 if it must be read,
+ *         -1 if no data is available.
+ */
+static int
+pool_splice_start(TDS_POOL_SOCKET *sock)
+{
+	TDSSOCKET *tds = sock->tds;
+	unsigned int packet_len;
+	int got;
+
+	got = recv(tds_get_s(tds), (char *) tds->in_buf, 8, MSG_PEEK);
+	if (got < 0 && TDSSOCK_WOULDBLOCK(sock_errno))
+		return -1;
+	if (got < 8)
+		return 0;
+
+	packet_len = TDS_GET_A2BE(&tds->in_buf[2]);
+	if (packet_len < POOL_SPLICE_MIN)
+		return 0;
+
+	/* the tail is read at its offset */
+	if (packet_len > tds->recv_packet->capacity) {
+		TDSPACKET *packet = tds_realloc_packet(tds->recv_packet, packet_len);
+		if (!packet)
+			return 0;
+		tds->in_buf = packet->buf;
+		tds->recv_packet = packet;
+	}
+
+	if (sock->pipe_fds[0] < 0) {
+		if (pipe2(sock->pipe_fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+			tdsdump_log(TDS_DBG_ERROR, "error creating pipe, splice disabled\n");
+			sock->pipe_fds[0] = sock->pipe_fds[1] = -1;
+			sock->use_splice = sock->splice_next = false;
+			return 0;
+		}
+#ifdef F_SETPIPE_SZ
+		/* try to hold an entire packet */
+		fcntl(sock->pipe_fds[1], F_SETPIPE_SZ, (int) packet_len);
+#endif
 	}
+
+	tdsdump_log(TDS_DBG_INFO1, "splicing packet_len %u\n", packet_len);
+	sock->splice_left = packet_len - pool_splice_tail(tds->in_buf);
+	sock->pipe_len = 0;
+	return 1;
+}
+
+/**
+ * Move a packet from a socket to another using a pipe,
+ * data never reach user space.
+ * On completion in_len and in_pos are moved so the remaining
+ * tail of the packet is read at its offset in in_buf.
+ * @return false on error
+ */
+static bool
+pool_splice_data(TDS_POOL * pool, TDS_POOL_SOCKET *from, TDS_POOL_SOCKET *to)
+{
+	TDSSOCKET *tds = from->tds;
+	ssize_t ret;
+
+	while (from->splice_left || from->pipe_len) {
+		/* fill the pipe */
+		if (from->splice_left) {
+			ret = splice(tds_get_s(tds), NULL, from->pipe_fds[1], NULL, from->splice_left,
+				     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (ret == 0)
+				return false;
+			if (ret < 0) {
+				int err = errno;
+				if (err == EINTR)
+					continue;
+				if (!TDSSOCK_WOULDBLOCK(err))
+					return false;
+				/* no data from source, wait for it */
+				if (!from->pipe_len) {
+					from->can_recv = false;
+					from->poll_recv = true;
+					to->poll_send = false;
+					return true;
+				}
+			} else {
+				from->splice_left -= ret;
+				from->pipe_len += ret;
+			}
+		}
+
+		/* drain the pipe */
+		if (from->pipe_len) {
+			ret = splice(from->pipe_fds[0], NULL, tds_get_s(to->tds), NULL, from->pipe_len,
+				     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (ret <= 0) {
+				int err = errno;
+				if (ret < 0 && err == EINTR)
+					continue;
+				if (ret == 0 || !TDSSOCK_WOULDBLOCK(err))
+					return false;
+				/* destination full, schedule a future write */
+				to->poll_send = true;
+				to->can_send = false;
+				from->poll_recv = false;
+				return true;
+			}
+			from->pipe_len -= ret;
+		}
+	}
+
+	/* packet forwarded, continue reading the tail if any */
+	tds->in_pos = tds->in_len = TDS_GET_A2BE(&tds->in_buf[2]) - pool_splice_tail(tds->in_buf);
+	to->poll_send = false;
+	from->poll_recv = true;
+	pool_socket_changed(pool, from);
 	return true;
 }
+#endif
@@ -38,6 +38,10 @@
 
 #include <assert.h>
 
+#ifdef _WIN32
+#include <io.h>
+#endif
+
 #include <freetds/tds.h>
 #include <freetds/checks.h>
 #include <freetds/bytes.h>
@@ -51,6 +55,25 @@
 #ifndef MAX
 #define MAX(a,b) ( (a) > (b) ? (a) : (b) )
 #endif
+
+#ifdef HAVE_FSEEKO
+typedef off_t offset_type;
+#elif defined(_WIN32) || defined(_WIN64)
+/* win32 version */
+typedef __int64 offset_type;
+# if defined(HAVE__FSEEKI64) && defined(HAVE__FTELLI64)
+#  define fseeko(f,o,w) _fseeki64((f),o,w)
+#  define ftello(f) _ftelli64((f))
+# else
+#  define fseeko(f,o,w) (_lseeki64(fileno(f),o,w) == -1 ? -1 : 0)
+#  define ftello(f) _telli64(fileno(f))
+# endif
+#else
+/* use old version */
+#define fseeko(f,o,w) fseek(f,o,w)
+#define ftello(f) ftell(f)
+typedef long offset_type;
+#endif
 /** \endcond */
 
 /**
@@ -486,6 +509,245 @@ tds_bcp_send_record(TDSSOCKET *tds, TDSBCPINFO *bcpinfo,
 	return rc;
 }
 
+/**
+ * Bind a column to an array of values to be sent with tds_bcp_send_rows.
+ * The conversion needed to send values is resolved here.
+ * \param bcpinfo BCP information, already initialized with tds_bcp_init
+ * \param column column index, 0 based
+ * \param array values to bind, copied. If type is TDS_INVALID_TYPE column is unbound
+ * \return TDS_SUCCESS or TDS_FAIL if values can't be converted to the column type.
+ */
+TDSRET
+tds_bcp_bind_array(TDSBCPINFO *bcpinfo, int column, const TDSBCPARRAY *array)
+{
+	TDSCOLUMN *bcpcol;
+	TDSBCPARRAY *dest;
+	TDS_SERVER_TYPE desttype;
+
+	if (!bcpinfo->bindinfo || column < 0 || column >= bcpinfo->bindinfo->num_cols)
+		return TDS_FAIL;
+
+	if (!bcpinfo->arrays) {
+		bcpinfo->arrays = tds_new0(TDSBCPARRAY, bcpinfo->bindinfo->num_cols);
+		if (!bcpinfo->arrays)
+			return TDS_FAIL;
+	}
+
+	dest = &bcpinfo->arrays[column];
+	*dest = *array;
+	dest->fixed_size = 0;
+	dest->desttype = TDS_INVALID_TYPE;
+	if (array->type == TDS_INVALID_TYPE)
+		return TDS_SUCCESS;
+
+	if (is_fixed_type(array->type))
+		dest->fixed_size = tds_get_size_by_type(array->type);
+
+	/* values with the same representation of the column are sent as they are */
+	bcpcol = bcpinfo->bindinfo->columns[column];
+	desttype = tds_get_conversion_type(bcpcol->column_type, bcpcol->column_size);
+	if (array->type == desttype && dest->fixed_size > 0)
+		return TDS_SUCCESS;
+	if ((is_char_type(array->type) && is_char_type(desttype))
+	    || (is_binary_type(array->type) && is_binary_type(desttype)))
+		return TDS_SUCCESS;
+
+	if (!tds_willconvert(array->type, desttype)) {
+		dest->type = TDS_INVALID_TYPE;
+		return TDS_FAIL;
+	}
+	dest->desttype = desttype;
+	return TDS_SUCCESS;
+}
+
+/**
+ * Get a value from an array bound column.
+ * \param array values of the column
+ * \param row row of the value
+ * \param[out] len length of the value
+ * \return pointer to the value, NULL if value is NULL
+ */
+static inline const TDS_CHAR *
+tds_bcp_array_value(const TDSBCPARRAY *array, int row, TDS_INT *len)
+{
+	if (array->type == TDS_INVALID_TYPE || (array->indicators && array->indicators[row] < 0))
+		return NULL;
+	if (array->fixed_size)
+		*len = array->fixed_size;
+	else if (!array->lengths)
+		*len = array->stride;
+	else if ((*len = array->lengths[row]) < 0)
+		return NULL;
+	return array->data + (size_t) row * array->stride;
+}
+
+/**
+ * Convert a value to column type storing it in bcp_column_data.
+ * \return TDS_SUCCESS or TDS_FAIL.
+ */
+static TDSRET
+tds_bcp_array_convert(TDSSOCKET *tds, TDSCOLUMN *bcpcol, TDS_SERVER_TYPE srctype, const TDS_CHAR *src, TDS_INT srclen,
+		      TDS_SERVER_TYPE desttype)
+{
+	BCPCOLDATA *coldata = bcpcol->bcp_column_data;
+	CONV_RESULT cr, *p_cr = &cr;
+	TDS_INT len;
+
+	if (!is_variable_type(desttype))
+		p_cr = (CONV_RESULT *) coldata->data;
+
+	len = tds_convert(tds_get_ctx(tds), srctype, src, srclen, desttype, p_cr);
+	if (len < 0) {
+		tdsdump_log(TDS_DBG_INFO1, "conversion from %d to %d failed\n", srctype, desttype);
+		return TDS_FAIL;
+	}
+
+	if (p_cr == &cr) {
+		free(coldata->data);
+		coldata->data = (TDS_UCHAR *) cr.c;
+	}
+	coldata->datalen = len;
+	coldata->is_null = false;
+	return TDS_SUCCESS;
+}
+
+/**
+ * Send rows from array bound columns, TDS 7.0+ version.
+ * Values are passed to put_data without copying them if possible.
+ */
+static TDSRET
+tds7_send_rows(TDSSOCKET *tds, TDSBCPINFO *bcpinfo, int first, int num_rows)
+{
+	TDSRESULTINFO *bindinfo = bcpinfo->bindinfo;
+	int row, i;
+
+	for (row = first; row < first + num_rows; ++row) {
+		tds_put_byte(tds, TDS_ROW_TOKEN);
+		for (i = 0; i < bindinfo->num_cols; i++) {
+			TDSCOLUMN *bindcol = bindinfo->columns[i];
+			const TDSBCPARRAY *array = &bcpinfo->arrays[i];
+			TDS_INT save_size;
+			unsigned char *save_data;
+			const TDS_CHAR *value;
+			TDS_INT len = 0;
+			TDSBLOB blob;
+			TDSRET rc;
+
+			/* see tds7_send_record */
+			if ((!bcpinfo->identity_insert_on && bindcol->column_identity) ||
+				bindcol->column_timestamp ||
+				bindcol->column_computed) {
+				continue;
+			}
+
+			value = tds_bcp_array_value(array, row, &len);
+			if (value && array->desttype != TDS_INVALID_TYPE) {
+				rc = tds_bcp_array_convert(tds, bindcol, array->type, value, len, array->desttype);
+				if (TDS_FAILED(rc))
+					return rc;
+				value = (const TDS_CHAR *) bindcol->bcp_column_data->data;
+				len = bindcol->bcp_column_data->datalen;
+			}
+
+			save_size = bindcol->column_cur_size;
+			save_data = bindcol->column_data;
+			if (!value) {
+				bindcol->column_cur_size = -1;
+			} else if (is_blob_col(bindcol)) {
+				bindcol->column_cur_size = len;
+				memset(&blob, 0, sizeof(blob));
+				blob.textvalue = (TDS_CHAR *) value;
+				bindcol->column_data = (unsigned char *) &blob;
+			} else {
+				bindcol->column_cur_size = len;
+				bindcol->column_data = (unsigned char *) value;
+			}
+			rc = bindcol->funcs->put_data(tds, bindcol, 1);
+			bindcol->column_cur_size = save_size;
+			bindcol->column_data = save_data;
+
+			if (TDS_FAILED(rc))
+				return rc;
+		}
+	}
+	return TDS_SUCCESS;
+}
+
+/**
+ * Store values of a row from array bound columns in bcp_column_data.
+ * \return TDS_SUCCESS or TDS_FAIL.
+ */
+static TDSRET
+tds_bcp_array_fill(TDSSOCKET *tds, TDSBCPINFO *bcpinfo, int row)
+{
+	TDSRESULTINFO *bindinfo = bcpinfo->bindinfo;
+	int i;
+
+	for (i = 0; i < bindinfo->num_cols; i++) {
+		TDSCOLUMN *bindcol = bindinfo->columns[i];
+		const TDSBCPARRAY *array = &bcpinfo->arrays[i];
+		TDS_SERVER_TYPE desttype = array->desttype;
+		const TDS_CHAR *value;
+		TDS_INT len = 0;
+
+		value = tds_bcp_array_value(array, row, &len);
+		if (!value) {
+			bindcol->bcp_column_data->datalen = 0;
+			bindcol->bcp_column_data->is_null = true;
+			continue;
+		}
+		if (desttype == TDS_INVALID_TYPE)
+			desttype = tds_get_conversion_type(bindcol->column_type, bindcol->column_size);
+		if (TDS_FAILED(tds_bcp_array_convert(tds, bindcol, array->type, value, len, desttype)))
+			return TDS_FAIL;
+	}
+	return TDS_SUCCESS;
+}
+
+/**
+ * Function to retrieve column data. Empty as data are already
+ * in bcp_column_data, see tds_bcp_array_fill.
+ */
+static TDSRET
+tds_bcp_no_col_data(TDSBCPINFO *bcpinfo, TDSCOLUMN *bcpcol, int offset)
+{
+	return TDS_SUCCESS;
+}
+
+/**
+ * Send many rows of data to server from columns bound with tds_bcp_bind_array.
+ * \tds
+ * \param bcpinfo BCP information
+ * \param null_error function to call if we try to send NULL if not allowed
+ * \param first index of first row to send
+ * \param num_rows number of rows to send
+ * \return TDS_SUCCESS or TDS_FAIL.
+ */
+TDSRET
+tds_bcp_send_rows(TDSSOCKET *tds, TDSBCPINFO *bcpinfo, tds_bcp_null_error null_error, int first, int num_rows)
+{
+	TDSRET rc = TDS_SUCCESS;
+	int row;
+
+	tdsdump_log(TDS_DBG_FUNC, "tds_bcp_send_rows(%p, %p, %p, %d, %d)\n", tds, bcpinfo, null_error, first, num_rows);
+
+	if (!bcpinfo->arrays || tds->out_flag != TDS_BULK || tds_set_state(tds, TDS_WRITING) != TDS_WRITING)
+		return TDS_FAIL;
+
+	if (IS_TDS7_PLUS(tds->conn)) {
+		rc = tds7_send_rows(tds, bcpinfo, first, num_rows);
+	} else {
+		for (row = first; row < first + num_rows && TDS_SUCCEED(rc); ++row) {
+			rc = tds_bcp_array_fill(tds, bcpinfo, row);
+			if (TDS_SUCCEED(rc))
+				rc = tds5_send_record(tds, bcpinfo, tds_bcp_no_col_data, null_error, row);
+		}
+	}
+
+	tds_set_state(tds, TDS_SENDING);
+	return rc;
+}
+
 static inline void
 tds5_swap_data(const TDSCOLUMN *col, void *p)
 {
@@ -1298,6 +1560,207 @@ tds_bcp_fread(TDSSOCKET * tds, TDSICONV * char_conv, FILE * stream, const char *
 	return res;
 }
 
+/** size of blocks read from host files */
+#define TDS_BCP_FILE_BLOCK 0x40000u
+
+/**
+ * Initialize a buffered reader of a host file.
+ * Reading starts from current position of the file.
+ * \param file reader to initialize
+ * \param f file to read from, must be kept open while reader is used
+ * \return TDS_SUCCESS or TDS_FAIL
+ */
+TDSRET
+tds_bcp_file_init(TDSBCPFILE * file, FILE * f)
+{
+	memset(file, 0, sizeof(*file));
+	file->f = f;
+	file->offset = ftello(f);
+	if (file->offset < 0)
+		file->offset = 0;
+	file->buf = tds_new(char, TDS_BCP_FILE_BLOCK);
+	if (!file->buf)
+		return TDS_FAIL;
+	file->size = TDS_BCP_FILE_BLOCK;
+	return TDS_SUCCESS;
+}
+
+/**
+ * Free buffers of a host file reader. The file is not closed.
+ */
+void
+tds_bcp_file_free(TDSBCPFILE * file)
+{
+	TDS_ZERO_FREE(file->buf);
+	TDS_ZERO_FREE(file->conv_buf);
+	file->size = file->conv_size = 0;
+	file->pos = file->len = 0;
+}
+
+/**
+ * Read another block from file, keeping not consumed data.
+ * \return false if no more data are available
+ */
+static bool
+tds_bcp_file_fill(TDSBCPFILE * file)
+{
+	size_t readed;
+
+	if (file->eof)
+		return false;
+
+	/* discard consumed data */
+	if (file->pos) {
+		memmove(file->buf, file->buf + file->pos, file->len - file->pos);
+		file->offset += file->pos;
+		file->len -= file->pos;
+		file->pos = 0;
+	}
+
+	/* a field does not fit, enlarge buffer */
+	if (file->size - file->len < TDS_BCP_FILE_BLOCK / 2u) {
+		if (!TDS_RESIZE(file->buf, file->size * 2u))
+			return false;
+		file->size *= 2u;
+	}
+
+	readed = fread(file->buf + file->len, 1, file->size - file->len, file->f);
+	if (readed == 0) {
+		file->eof = feof(file->f) != 0;
+		return false;
+	}
+	file->len += readed;
+	return true;
+}
+
+/**
+ * Get some bytes from file.
+ * \param file file reader
+ * \param len bytes to read
+ * \return pointer to data, valid till next call on reader,
+ *         NULL on end of file or error
+ */
+const char *
+tds_bcp_file_get(TDSBCPFILE * file, size_t len)
+{
+	const char *p;
+
+	while (file->len - file->pos < len)
+		if (!tds_bcp_file_fill(file))
+			return NULL;
+
+	p = file->buf + file->pos;
+	file->pos += len;
+	return p;
+}
+
+/**
+ * Read a field delimited by a terminator, converting it if needed.
+ * Terminator is searched with memchr(3) on the first byte, which
+ * examines many bytes at once, then confirmed for longer terminators.
+ * Data not needing conversion is returned directly from the read buffer.
+ * \tds
+ * \param char_conv conversion to apply, NULL for none
+ * \param file file reader
+ * \param terminator field terminator
+ * \param term_len terminator length in bytes, must be > 0
+ * \param outbuf pointer to field data, valid till next call on reader.
+ *        Data is not NUL terminated
+ * \param outbytes field length in bytes
+ * \retval TDS_SUCCESS  success
+ * \retval TDS_FAIL     error reading the column
+ * \retval TDS_NO_MORE_RESULTS end of file detected
+ */
+TDSRET
+tds_bcp_file_field(TDSSOCKET * tds, TDSICONV * char_conv, TDSBCPFILE * file,
+		   const char *terminator, size_t term_len, const char **outbuf, size_t * outbytes)
+{
+	const unsigned char first = (unsigned char) terminator[0];
+	size_t scan = file->pos, field_len;
+	const char *field, *p;
+	TDSRET res;
+	TDSSTATICINSTREAM r;
+	TDSDYNAMICSTREAM w;
+
+	assert(term_len > 0);
+
+	for (;;) {
+		const char *end = file->buf + file->len;
+
+		p = (const char *) memchr(file->buf + scan, first, end - (file->buf + scan));
+		while (p && (size_t) (end - p) >= term_len) {
+			if (memcmp(p + 1, terminator + 1, term_len - 1) == 0)
+				goto found;
+			p = (const char *) memchr(p + 1, first, end - (p + 1));
+		}
+		/* terminator could start at p, continue from there after reading */
+		scan = p ? (size_t) (p - file->buf) : file->len;
+		scan -= file->pos;
+		if (!tds_bcp_file_fill(file)) {
+			if (!file->eof)
+				return TDS_FAIL;
+			return file->len == file->pos ? TDS_NO_MORE_RESULTS : TDS_FAIL;
+		}
+		scan += file->pos;
+	}
+
+found:
+	field = file->buf + file->pos;
+	field_len = p - field;
+	file->pos += field_len + term_len;
+
+	if (!char_conv || (char_conv->flags & TDS_ENCODING_MEMCPY) != 0) {
+		*outbuf = field;
+		*outbytes = field_len;
+		return TDS_SUCCESS;
+	}
+
+	/* convert the field */
+	tds_staticin_stream_init(&r, field, field_len);
+	res = tds_dynamic_stream_init(&w, &file->conv_buf, file->conv_size);
+	if (TDS_FAILED(res))
+		return res;
+	file->conv_size = w.allocated;
+	res = tds_convert_stream(tds, char_conv, to_server, &r.stream, &w.stream);
+	file->conv_size = w.allocated;
+	if (TDS_FAILED(res))
+		return res;
+
+	*outbuf = (const char *) file->conv_buf;
+	*outbytes = w.size;
+	return TDS_SUCCESS;
+}
+
+/**
+ * Return offset in file of next byte to read.
+ */
+TDS_INT8
+tds_bcp_file_tell(const TDSBCPFILE * file)
+{
+	return file->offset + (TDS_INT8) file->pos;
+}
+
+/**
+ * Move to a given offset in file.
+ * Data still in the read buffer is reused.
+ * \return true on success
+ */
+bool
+tds_bcp_file_seek(TDSBCPFILE * file, TDS_INT8 offset)
+{
+	if (offset >= file->offset && offset <= file->offset + (TDS_INT8) file->len) {
+		file->pos = (size_t) (offset - file->offset);
+		return true;
+	}
+
+	if (fseeko(file->f, (offset_type) offset, SEEK_SET) != 0)
+		return false;
+	file->offset = offset;
+	file->pos = file->len = 0;
+	file->eof = false;
+	return true;
+}
+
 /**
  * Start writing writetext request.
  * This request start a bulk session.
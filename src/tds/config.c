@@ -86,6 +86,7 @@ static bool tds_read_interfaces(const char *server, TDSLOGIN * login);
 static bool parse_server_name_for_port(TDSLOGIN * connection, TDSLOGIN * login, bool update_server);
 static int tds_lookup_port(const char *portname);
 static void tds_config_encryption(const char * value, TDSLOGIN * login);
+static int tds_config_timeout(const char *value);
 
 static char *interf_file = NULL;
 
@@ -230,6 +231,8 @@ tds_read_config_info(TDSSOCKET * tds, TDSLOGIN * login, TDSLOCALE * locale)
 		tdsdump_log(TDS_DBG_INFO1, "\t%20s = %d\n", "major_version", TDS_MAJOR(connection));
 		tdsdump_log(TDS_DBG_INFO1, "\t%20s = %d\n", "minor_version", TDS_MINOR(connection));
 		tdsdump_log(TDS_DBG_INFO1, "\t%20s = %d\n", "block_size", connection->block_size);
+		tdsdump_log(TDS_DBG_INFO1, "\t%20s = %d\n", "packet_pool_size", connection->packet_pool_size);
+		tdsdump_log(TDS_DBG_INFO1, "\t%20s = %d\n", "statement_cache_size", connection->statement_cache_size);
 		tdsdump_log(TDS_DBG_INFO1, "\t%20s = %s\n", "language", tds_dstr_cstr(&connection->language));
 		tdsdump_log(TDS_DBG_INFO1, "\t%20s = %s\n", "server_charset", tds_dstr_cstr(&connection->server_charset));
 		tdsdump_log(TDS_DBG_INFO1, "\t%20s = %d\n", "connect_timeout", connection->connect_timeout);
@@ -249,6 +252,7 @@ tds_read_config_info(TDSSOCKET * tds, TDSLOGIN * login, TDSLOCALE * locale)
 			(not null terminated) */
 		tdsdump_log(TDS_DBG_INFO1, "\t%20s = %s\n", "database", tds_dstr_cstr(&connection->database));
 		tdsdump_log(TDS_DBG_INFO1, "\t%20s = %s\n", "dump_file", tds_dstr_cstr(&connection->dump_file));
+		tdsdump_log(TDS_DBG_INFO1, "\t%20s = %s\n", "discovery_file", tds_dstr_cstr(&connection->discovery_file));
 		tdsdump_log(TDS_DBG_INFO1, "\t%20s = %x\n", "debug_flags", connection->debug_flags);
 		tdsdump_log(TDS_DBG_INFO1, "\t%20s = %d\n", "text_size", connection->text_size);
 		tdsdump_log(TDS_DBG_INFO1, "\t%20s = %s\n", "server_realm_name", tds_dstr_cstr(&connection->server_realm_name));
@@ -258,6 +262,9 @@ tds_read_config_info(TDSSOCKET * tds, TDSLOGIN * login, TDSLOCALE * locale)
 		tdsdump_log(TDS_DBG_INFO1, "\t%20s = %d\n", "check_ssl_hostname", connection->check_ssl_hostname);
 		tdsdump_log(TDS_DBG_INFO1, "\t%20s = %s\n", "db_filename", tds_dstr_cstr(&connection->db_filename));
 		tdsdump_log(TDS_DBG_INFO1, "\t%20s = %d\n", "readonly_intent", connection->readonly_intent);
+		tdsdump_log(TDS_DBG_INFO1, "\t%20s = %d\n", "multi_subnet_failover", connection->multi_subnet_failover);
+		tdsdump_log(TDS_DBG_INFO1, "\t%20s = %d\n", "connect_retry_count", connection->connect_retry_count);
+		tdsdump_log(TDS_DBG_INFO1, "\t%20s = %d\n", "connect_retry_interval", connection->connect_retry_interval);
 #ifdef HAVE_OPENSSL
 		tdsdump_log(TDS_DBG_INFO1, "\t%20s = %s\n", "openssl_ciphers", tds_dstr_cstr(&connection->openssl_ciphers));
 #endif
@@ -492,6 +499,28 @@ tds_config_encryption(const char * value, TDSLOGIN * login)
 	login->encryption_level = lvl;
 }
 
+/**
+ * Parse a timeout value.
+ * Value is in seconds unless followed by "ms" suffix.
+ * @return timeout in milliseconds, 0 if not valid
+ */
+static int
+tds_config_timeout(const char *value)
+{
+	char *end;
+	long val = strtol(value, &end, 10);
+
+	if (val <= 0 || val > INT_MAX)
+		return 0;
+	while (*end == ' ')
+		++end;
+	if (!strcasecmp(end, "ms"))
+		return (int) val;
+	if (val > INT_MAX / 1000)
+		return INT_MAX;
+	return (int) val * 1000;
+}
+
 /**
  * Read a section of configuration file (INI style file)
  * @param in             configuration file
@@ -603,6 +632,14 @@ tds_parse_conf_section(const char *option, const char *value, void *param)
 		int val = atoi(value);
 		if (val >= 512 && val < 65536)
 			login->block_size = val;
+	} else if (!strcmp(option, TDS_STR_PACKET_POOL_SIZE)) {
+		int val = atoi(value);
+		if (val >= 0 && val <= 4096)
+			login->packet_pool_size = val;
+	} else if (!strcmp(option, TDS_STR_STMT_CACHE_SIZE)) {
+		int val = atoi(value);
+		if (val >= 0 && val <= 65536)
+			login->statement_cache_size = val;
 	} else if (!strcmp(option, TDS_STR_SWAPDT)) {
 		/* this option is deprecated, just check value for compatibility */
 		tds_config_boolean(option, value, login);
@@ -620,11 +657,13 @@ tds_parse_conf_section(const char *option, const char *value, void *param)
 		if (*value != '\0' && *end == '\0' && flags != LONG_MIN && flags != LONG_MAX)
 			login->debug_flags = flags;
 	} else if (!strcmp(option, TDS_STR_TIMEOUT) || !strcmp(option, TDS_STR_QUERY_TIMEOUT)) {
-		if (atoi(value))
-			login->query_timeout = atoi(value);
+		int timeout = tds_config_timeout(value);
+		if (timeout)
+			login->query_timeout = timeout;
 	} else if (!strcmp(option, TDS_STR_CONNTIMEOUT)) {
-		if (atoi(value))
-			login->connect_timeout = atoi(value);
+		int timeout = tds_config_timeout(value);
+		if (timeout)
+			login->connect_timeout = timeout;
 	} else if (!strcmp(option, TDS_STR_HOST)) {
 		char tmp[128];
 		struct addrinfo *addrs;
@@ -692,6 +731,18 @@ tds_parse_conf_section(const char *option, const char *value, void *param)
 		s = tds_dstr_copy(&login->openssl_ciphers, value);
 	} else if (!strcmp(option, TDS_STR_ENABLE_TLS_V1)) {
 		login->enable_tls_v1 = tds_config_boolean(option, value, login);
+	} else if (!strcmp(option, TDS_STR_DISCOVERY_FILE)) {
+		s = tds_dstr_copy(&login->discovery_file, value);
+	} else if (!strcmp(option, TDS_STR_MULTI_SUBNET)) {
+		login->multi_subnet_failover = tds_config_boolean(option, value, login);
+	} else if (!strcmp(option, TDS_STR_RETRY_COUNT)) {
+		int val = atoi(value);
+		if (val >= 0 && val <= 255)
+			login->connect_retry_count = val;
+	} else if (!strcmp(option, TDS_STR_RETRY_INTERVAL)) {
+		int val = atoi(value);
+		if (val >= 1 && val <= 60)
+			login->connect_retry_interval = val;
 	} else {
 		tdsdump_log(TDS_DBG_INFO1, "UNRECOGNIZED option '%s' ... ignoring.\n", option);
 	}
@@ -764,6 +815,18 @@ tds_config_login(TDSLOGIN * connection, TDSLOGIN * login)
 	if (login->block_size)
 		connection->block_size = login->block_size;
 
+	if (login->packet_pool_size >= 0)
+		connection->packet_pool_size = login->packet_pool_size;
+
+	if (login->statement_cache_size >= 0)
+		connection->statement_cache_size = login->statement_cache_size;
+
+	if (login->connect_retry_count >= 0)
+		connection->connect_retry_count = login->connect_retry_count;
+
+	if (login->connect_retry_interval >= 0)
+		connection->connect_retry_interval = login->connect_retry_interval;
+
 	if (login->gssapi_use_delegation)
 		connection->gssapi_use_delegation = login->gssapi_use_delegation;
 
@@ -791,12 +854,18 @@ tds_config_login(TDSLOGIN * connection, TDSLOGIN * login)
 	if (res && !tds_dstr_isempty(&login->server_spn))
 		res = tds_dstr_dup(&connection->server_spn, &login->server_spn);
 
+	if (res && !tds_dstr_isempty(&login->discovery_file))
+		res = tds_dstr_dup(&connection->discovery_file, &login->discovery_file);
+
 	/* copy other info not present in configuration file */
 	connection->capabilities = login->capabilities;
 
 	if (login->readonly_intent)
 		connection->readonly_intent = login->readonly_intent;
 
+	if (login->multi_subnet_failover)
+		connection->multi_subnet_failover = login->multi_subnet_failover;
+
 	connection->use_new_password = login->use_new_password;
 
 	if (login->use_ntlmv2_specified) {
@@ -47,6 +47,7 @@
 #include <freetds/tds.h>
 #include <freetds/convert.h>
 #include <freetds/bytes.h>
+#include <freetds/thread.h>
 #include <freetds/replacements.h>
 
 typedef unsigned short utf16_t;
@@ -1999,6 +2000,150 @@ tds_convert(const TDSCONTEXT *tds_ctx, int srctype, const void *src, TDS_UINT sr
 	return length;
 }
 
+/**
+ * Parse a fixed number of digits.
+ * @return true if all characters are digits
+ */
+static bool
+parse_fixed_digits(const char *s, unsigned int num, unsigned int *value)
+{
+	unsigned int n = 0;
+
+	for (; num; --num, ++s) {
+		if (*s < '0' || *s > '9')
+			return false;
+		n = n * 10u + (*s - '0');
+	}
+	*value = n;
+	return true;
+}
+
+/**
+ * Remove ODBC escape around a date or time, like {ts 'YYYY-MM-DD hh:mm:ss'}.
+ * Escapes {d '...'}, {t '...'} and {ts '...'} are accepted.
+ * @param pstr  string to check, updated to start of quoted value
+ * @param pend  end of string, updated to end of quoted value
+ */
+static void
+strip_odbc_date_escape(const char **pstr, const char **pend)
+{
+	const char *s = *pstr, *end = *pend, *value;
+
+	while (s != end && *s == ' ')
+		++s;
+	while (end != s && end[-1] == ' ')
+		--end;
+	if (end - s < 6 || *s != '{' || end[-1] != '}')
+		return;
+
+	++s;
+	--end;
+	while (s != end && *s == ' ')
+		++s;
+	if (s == end || (*s != 'd' && *s != 'D' && *s != 't' && *s != 'T'))
+		return;
+	if (end - s > 1 && (s[0] == 't' || s[0] == 'T') && (s[1] == 's' || s[1] == 'S'))
+		++s;
+	++s;
+	while (s != end && *s == ' ')
+		++s;
+	while (end != s && end[-1] == ' ')
+		--end;
+	if (end - s < 2 || *s != '\'' || end[-1] != '\'')
+		return;
+
+	value = s + 1;
+	--end;
+	if (memchr(value, '\'', end - value))
+		return;
+
+	*pstr = value;
+	*pend = end;
+}
+
+/**
+ * Parse common fixed formats in a single pass:
+ * YYYY-MM-DD or YYYYMMDD, optionally followed by a time, or a time alone.
+ * Time is hh:mm[:ss[.fffffffff]].
+ * Only values the general parser would store in the same way are accepted.
+ * @return true if parsed, false if the general parser should be used
+ */
+static bool
+parse_iso_datetime(const char *s, const char *end, struct tds_time *t_out)
+{
+	struct tds_time t = *t_out;
+	unsigned int year, month, mday, hours, minutes, seconds = 0;
+	unsigned int nanosecs = 0, ns_div = 1;
+
+	while (s != end && *s == ' ')
+		++s;
+	while (end != s && end[-1] == ' ')
+		--end;
+	if (end - s < 5)
+		return false;
+
+	/* date */
+	if (s[2] != ':') {
+		if (end - s < 8 || !parse_fixed_digits(s, 4, &year))
+			return false;
+		if (s[4] == '-') {
+			if (end - s < 10 || s[7] != '-' || !parse_fixed_digits(s + 5, 2, &month)
+			    || !parse_fixed_digits(s + 8, 2, &mday))
+				return false;
+			s += 10;
+		} else {
+			if (!parse_fixed_digits(s + 4, 2, &month) || !parse_fixed_digits(s + 6, 2, &mday))
+				return false;
+			s += 8;
+		}
+		if (year < 1753 || year > 9999 || month < 1 || month > 12 || mday < 1 || mday > 31)
+			return false;
+		t.tm_year = year - 1900;
+		t.tm_mon = month - 1;
+		t.tm_mday = mday;
+		if (s == end) {
+			*t_out = t;
+			return true;
+		}
+		if (*s != ' ')
+			return false;
+		while (*s == ' ')
+			++s;
+		if (end - s < 5)
+			return false;
+	}
+
+	/* time */
+	if (s[2] != ':' || !parse_fixed_digits(s, 2, &hours) || !parse_fixed_digits(s + 3, 2, &minutes))
+		return false;
+	s += 5;
+	if (s != end && *s == ':') {
+		if (end - s < 3 || !parse_fixed_digits(s + 1, 2, &seconds))
+			return false;
+		s += 3;
+		if (s != end && *s == '.') {
+			for (++s; s != end && *s >= '0' && *s <= '9'; ++s) {
+				if (ns_div < 1000000000u) {
+					nanosecs = nanosecs * 10u + (*s - '0');
+					ns_div *= 10u;
+				}
+			}
+			if (ns_div == 1)
+				return false;
+		}
+	}
+	if (s != end || hours > 23 || minutes > 59 || seconds > 59)
+		return false;
+
+	t.tm_hour = hours;
+	t.tm_min = minutes;
+	t.tm_sec = seconds;
+	if (nanosecs)
+		t.tm_ns = nanosecs * (1000000000u / ns_div);
+	*t_out = t;
+	return true;
+}
+
 static int
 string_to_datetime(const char *instr, TDS_UINT len, int desttype, CONV_RESULT * cr)
 {
@@ -2009,6 +2154,8 @@ string_to_datetime(const char *instr, TDS_UINT len, int desttype, CONV_RESULT *
 	};
 
 	char *in;
+	char in_buf[64];
+	const char *end = instr + len;
 	char *tok;
 	char *lasts;
 	char last_token[32];
@@ -2027,8 +2174,21 @@ string_to_datetime(const char *instr, TDS_UINT len, int desttype, CONV_RESULT *
 	memset(&t, '\0', sizeof(t));
 	t.tm_mday = 1;
 
-	in = tds_strndup(instr, len);
-	test_alloc(in);
+	strip_odbc_date_escape(&instr, &end);
+	len = (TDS_UINT) (end - instr);
+
+	if (parse_iso_datetime(instr, end, &t))
+		goto store;
+
+	/* free form, split in tokens */
+	in = in_buf;
+	if (len < sizeof(in_buf)) {
+		memcpy(in_buf, instr, len);
+		in_buf[len] = 0;
+	} else {
+		in = tds_strndup(instr, len);
+		test_alloc(in);
+	}
 
 	tok = strtok_r(in, " ,", &lasts);
 
@@ -2217,12 +2377,14 @@ string_to_datetime(const char *instr, TDS_UINT len, int desttype, CONV_RESULT *
 		tok = strtok_r(NULL, " ,", &lasts);
 	}
 
+	if (in != in_buf)
+		free(in);
+
+store:
 	i = (t.tm_mon - 13) / 12;
 	dt_days = 1461 * (t.tm_year + 1900 + i) / 4 +
 		(367 * (t.tm_mon - 1 - 12 * i)) / 12 - (3 * ((t.tm_year + 2000 + i) / 100)) / 4 + t.tm_mday - 693932;
 
-	free(in);
-
 	if (desttype == SYBDATE) {
 		cr->date = dt_days;
 		return sizeof(TDS_DATE);
@@ -2266,7 +2428,8 @@ string_to_datetime(const char *instr, TDS_UINT len, int desttype, CONV_RESULT *
 string_garbled:
 	tdsdump_log(TDS_DBG_INFO1,
 		    "error_handler:  Attempt to convert data stopped by syntax error in source field \n");
-	free(in);
+	if (in != in_buf)
+		free(in);
 	return TDS_CONVERT_SYNTAX;
 }
 
@@ -2325,6 +2488,11 @@ string_to_numeric(const char *instr, const char *pend, CONV_RESULT * cr)
 	if (cr->n.precision - cr->n.scale < digits)
 		return TDS_CONVERT_OVERFLOW;
 
+	/* number fits in native integers */
+	if (tds_numeric_from_digits(&cr->n, instr, digits, instr + digits + 1,
+				    decimals > cr->n.scale ? cr->n.scale : decimals))
+		return sizeof(TDS_NUMERIC);
+
 	/* copy digits before the dot */
 	memcpy(ptr, instr, digits);
 	ptr += digits;
@@ -2980,17 +3148,608 @@ two_digit(char *out, int num)
 	out[1] = num%10 + '0';
 }
 
+/*
+ * Compiled date formats.
+ * A format is parsed once into a list of instructions executed without
+ * allocations; formats using directives not handled here are passed
+ * to strftime(3). Locale dependent names are formatted by strftime(3)
+ * for every date so they follow LC_TIME changes.
+ */
+
+typedef enum
+{
+	TDS_DATE_LITERAL,
+	TDS_DATE_YEAR,
+	TDS_DATE_YEAR2,
+	TDS_DATE_MONTH,
+	TDS_DATE_DAY,
+	TDS_DATE_DAY_SPACE,
+	TDS_DATE_DAYOFYEAR,
+	TDS_DATE_HOUR,
+	TDS_DATE_HOUR12,
+	TDS_DATE_HOUR12_SPACE,
+	TDS_DATE_MINUTE,
+	TDS_DATE_SECOND,
+	TDS_DATE_WEEKDAY,
+	TDS_DATE_WEEKDAY_ISO,
+	TDS_DATE_FRACTION,
+	/** dot and fraction, nothing if precision is 0 */
+	TDS_DATE_FRACTION_DOT,
+	/** locale name (month, weekday, AM/PM), directive is in len */
+	TDS_DATE_LOCALE_NAME,
+} TDS_DATE_OP;
+
+/* formats recognized for fast path */
+enum
+{
+	TDS_DATE_ISO_NONE,
+	TDS_DATE_ISO_DATETIME,
+	TDS_DATE_ISO_DATE,
+	TDS_DATE_ISO_TIME
+};
+
+#define TDS_DATE_MAX_INSTR 64
+#define TDS_DATE_MAX_TEXT 1024
+
+typedef struct
+{
+	unsigned char op;
+	/** length of literal or strftime(3) directive */
+	unsigned char len;
+	/** position of literal in text */
+	unsigned short pos;
+} TDS_DATE_INSTR;
+
+struct tds_date_format
+{
+	unsigned char iso;
+	unsigned int num_instr;
+	unsigned int text_len;
+	TDS_DATE_INSTR instr[TDS_DATE_MAX_INSTR];
+	/** literals */
+	char text[TDS_DATE_MAX_TEXT];
+};
+
+#define TDS_DATE_FORMAT_CACHE 16
+
+/*
+ * Cache of compiled formats. Entries are only appended and never changed,
+ * so lookups do not need the mutex; the number of entries is published
+ * after the entry is filled.
+ */
+#if defined(__GNUC__)
+#define date_format_cache_count() __atomic_load_n(&date_format_cache_len, __ATOMIC_ACQUIRE)
+#define date_format_cache_publish(n) __atomic_store_n(&date_format_cache_len, n, __ATOMIC_RELEASE)
+#elif defined(_WIN32)
+#define date_format_cache_count() ((unsigned int) InterlockedCompareExchange(&date_format_cache_len, 0, 0))
+#define date_format_cache_publish(n) InterlockedExchange(&date_format_cache_len, n)
+#else
+/* no way to order memory accesses, searching without the mutex finds nothing */
+#define date_format_cache_count() 0u
+#define date_format_cache_publish(n) (date_format_cache_len = (n))
+#endif
+
+static tds_mutex date_format_mutex = TDS_MUTEX_INITIALIZER;
+static struct
+{
+	char *format;
+	/** compiled format, NULL if format cannot be compiled */
+	TDSDATEFORMAT *compiled;
+} date_format_cache[TDS_DATE_FORMAT_CACHE];
+#ifdef _WIN32
+static volatile LONG date_format_cache_len = 0;
+#else
+static unsigned int date_format_cache_len = 0;
+#endif
+
+static bool
+tds_date_format_add(TDSDATEFORMAT *fmt, TDS_DATE_OP op)
+{
+	TDS_DATE_INSTR *instr;
+
+	if (fmt->num_instr >= TDS_DATE_MAX_INSTR)
+		return false;
+	instr = &fmt->instr[fmt->num_instr++];
+	instr->op = op;
+	instr->len = 0;
+	instr->pos = 0;
+	return true;
+}
+
+static bool
+tds_date_format_add_text(TDSDATEFORMAT *fmt, const char *text, size_t len)
+{
+	TDS_DATE_INSTR *last = NULL;
+
+	for (; len > 255; text += 255, len -= 255)
+		if (!tds_date_format_add_text(fmt, text, 255))
+			return false;
+
+	if (fmt->text_len + len > TDS_DATE_MAX_TEXT)
+		return false;
+
+	/* join with previous literal if possible */
+	if (fmt->num_instr)
+		last = &fmt->instr[fmt->num_instr - 1];
+	if (!last || last->op != TDS_DATE_LITERAL || last->pos + last->len != fmt->text_len
+	    || last->len + len > 255) {
+		if (!tds_date_format_add(fmt, TDS_DATE_LITERAL))
+			return false;
+		last = &fmt->instr[fmt->num_instr - 1];
+		last->pos = fmt->text_len;
+	}
+	memcpy(fmt->text + fmt->text_len, text, len);
+	fmt->text_len += (unsigned int) len;
+	last->len += (unsigned char) len;
+	return true;
+}
+
 /**
- * format a date string according to an "extended" strftime(3) formatting definition.
+ * Compile a format for tds_date_format_apply.
+ * Names of months and weekdays are not stored, they are taken from
+ * locale current when the format is applied.
+ * @param format  format like tds_strftime
+ * @return compiled format or NULL if format contains directives not
+ *         supported or out of memory
+ */
+TDSDATEFORMAT *
+tds_date_format_compile(const char *format)
+{
+	TDSDATEFORMAT *fmt;
+	const char *p;
+	bool ok = true, z_found = false;
+	const TDS_DATE_INSTR *last;
+
+	fmt = tds_new0(TDSDATEFORMAT, 1);
+	if (!fmt)
+		return NULL;
+
+	p = format;
+	while (*p && ok) {
+		if (*p != '%') {
+			const char *next = strchr(p, '%');
+
+			if (!next)
+				next = strchr(p, 0);
+			ok = tds_date_format_add_text(fmt, p, next - p);
+			p = next;
+			continue;
+		}
+
+#define ADD(op) (ok = ok && tds_date_format_add(fmt, TDS_DATE_ ## op))
+#define ADD_TEXT(s) (ok = ok && tds_date_format_add_text(fmt, s, strlen(s)))
+		switch (p[1]) {
+		case 0:
+			/* not terminated format */
+			ADD_TEXT("%");
+			++p;
+			continue;
+		case '%':
+			ADD_TEXT("%");
+			break;
+		case 'n':
+			ADD_TEXT("\n");
+			break;
+		case 't':
+			ADD_TEXT("\t");
+			break;
+		case 'Y':
+			ADD(YEAR);
+			break;
+		case 'y':
+			ADD(YEAR2);
+			break;
+		case 'm':
+			ADD(MONTH);
+			break;
+		case 'd':
+			ADD(DAY);
+			break;
+		case 'e':
+			/* not portable: day of month, single digit preceded by a blank */
+			ADD(DAY_SPACE);
+			break;
+		case 'j':
+			ADD(DAYOFYEAR);
+			break;
+		case 'H':
+			ADD(HOUR);
+			break;
+		case 'I':
+			ADD(HOUR12);
+			break;
+		case 'l':
+			/* not portable: 12-hour, single digit preceded by a blank */
+			ADD(HOUR12_SPACE);
+			break;
+		case 'M':
+			ADD(MINUTE);
+			break;
+		case 'S':
+			ADD(SECOND);
+			break;
+		case 'w':
+			ADD(WEEKDAY);
+			break;
+		case 'u':
+			ADD(WEEKDAY_ISO);
+			break;
+		case 'F':
+			ADD(YEAR);
+			ADD_TEXT("-");
+			ADD(MONTH);
+			ADD_TEXT("-");
+			ADD(DAY);
+			break;
+		case 'T':
+			ADD(HOUR);
+			ADD_TEXT(":");
+			ADD(MINUTE);
+			ADD_TEXT(":");
+			ADD(SECOND);
+			break;
+		case 'R':
+			ADD(HOUR);
+			ADD_TEXT(":");
+			ADD(MINUTE);
+			break;
+		case 'D':
+			ADD(MONTH);
+			ADD_TEXT("/");
+			ADD(DAY);
+			ADD_TEXT("/");
+			ADD(YEAR2);
+			break;
+		case 'b':
+		case 'h':
+		case 'B':
+		case 'a':
+		case 'A':
+		case 'p':
+			ADD(LOCALE_NAME);
+			if (ok)
+				fmt->instr[fmt->num_instr - 1].len = (unsigned char) p[1];
+			break;
+		case 'z':
+			/* only first %z is the fraction of seconds */
+			if (z_found) {
+				ok = false;
+				break;
+			}
+			z_found = true;
+			last = fmt->num_instr ? &fmt->instr[fmt->num_instr - 1] : NULL;
+			if (last && last->op == TDS_DATE_LITERAL && fmt->text[last->pos + last->len - 1] == '.') {
+				/* dot is written by the fraction */
+				if (!--fmt->instr[fmt->num_instr - 1].len)
+					--fmt->num_instr;
+				ADD(FRACTION_DOT);
+			} else {
+				ADD(FRACTION);
+			}
+			break;
+		default:
+			ok = false;
+			break;
+		}
+#undef ADD
+#undef ADD_TEXT
+		p += 2;
+	}
+
+	if (!ok) {
+		free(fmt);
+		return NULL;
+	}
+
+	if (strcmp(format, "%Y-%m-%d %H:%M:%S.%z") == 0)
+		fmt->iso = TDS_DATE_ISO_DATETIME;
+	else if (strcmp(format, "%Y-%m-%d") == 0)
+		fmt->iso = TDS_DATE_ISO_DATE;
+	else if (strcmp(format, "%H:%M:%S.%z") == 0)
+		fmt->iso = TDS_DATE_ISO_TIME;
+	return fmt;
+}
+
+/**
+ * Free a format returned by tds_date_format_compile.
+ */
+void
+tds_date_format_free(TDSDATEFORMAT *fmt)
+{
+	free(fmt);
+}
+
+/**
+ * Write a number with at least width digits.
+ * @return pointer after number or NULL if it does not fit
+ */
+static char *
+tds_date_put_number(char *p, const char *end, unsigned int value, unsigned int width, char pad)
+{
+	char digits[16], *d = digits + sizeof(digits);
+	size_t len;
+
+	while (value >= 100) {
+		d -= 2;
+		memcpy(d, tds_digit_pairs + (value % 100u) * 2u, 2);
+		value /= 100u;
+	}
+	if (value >= 10) {
+		d -= 2;
+		memcpy(d, tds_digit_pairs + value * 2u, 2);
+	} else {
+		*--d = '0' + value;
+	}
+	while (digits + sizeof(digits) - d < (ptrdiff_t) width)
+		*--d = pad;
+
+	len = digits + sizeof(digits) - d;
+	if ((size_t) (end - p) < len)
+		return NULL;
+	memcpy(p, d, len);
+	return p + len;
+}
+
+static inline char *
+tds_date_put_2digits(char *p, unsigned int value)
+{
+	memcpy(p, tds_digit_pairs + value * 2u, 2);
+	return p + 2;
+}
+
+/** Write a number with at least 2 digits, most fields fit in 2 digits */
+static inline char *
+tds_date_put_2(char *p, const char *end, unsigned int value, char pad)
+{
+	if (value >= 100 || end - p < 2)
+		return tds_date_put_number(p, end, value, 2, pad);
+	memcpy(p, tds_digit_pairs + value * 2u, 2);
+	if (value < 10)
+		p[0] = pad;
+	return p + 2;
+}
+
+static char *
+tds_date_put_fraction(char *p, const TDSDATEREC *dr, int prec)
+{
+	unsigned int value = (unsigned int) dr->decimicrosecond % 10000000u;
+	char fraction[7];
+
+	/* always 7 digits, leading zeroes included */
+	fraction[0] = '0' + value / 1000000u;
+	value %= 1000000u;
+	tds_date_put_2digits(fraction + 1, value / 10000u);
+	tds_date_put_2digits(fraction + 3, value / 100u % 100u);
+	tds_date_put_2digits(fraction + 5, value % 100u);
+	memcpy(p, fraction, prec);
+	return p + prec;
+}
+
+/**
+ * Write a month or weekday name or AM/PM using strftime(3) so the
+ * name follows current locale.
+ * @return pointer after name or NULL if it does not fit
+ */
+static char *
+tds_date_put_locale_name(char *p, const char *end, char directive, const TDSDATEREC *dr)
+{
+	const char format[3] = { '%', directive, 0 };
+	char name[128];
+	struct tm tm;
+	size_t len;
+
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_sec = dr->second;
+	tm.tm_min = dr->minute;
+	tm.tm_hour = dr->hour;
+	tm.tm_mday = dr->day;
+	tm.tm_mon = dr->month;
+	tm.tm_year = dr->year - 1900;
+	tm.tm_wday = dr->weekday;
+	tm.tm_yday = dr->dayofyear - 1;
+
+	/* names can be empty (like AM/PM in some locales) */
+	len = strftime(name, sizeof(name), format, &tm);
+	if ((size_t) (end - p) < len)
+		return NULL;
+	memcpy(p, name, len);
+	return p + len;
+}
+
+/**
+ * Fast path for ISO formats, year must have 4 digits.
+ * @return length of string or 0 if buffer is too small
+ */
+static size_t
+tds_date_format_iso(char *buf, size_t maxsize, unsigned int iso, const TDSDATEREC *dr, int prec)
+{
+	char *p = buf;
+	size_t len;
+
+	len = iso == TDS_DATE_ISO_DATE ? 10 : 8 + (prec ? 1 + prec : 0);
+	if (iso == TDS_DATE_ISO_DATETIME)
+		len += 11;
+	if (maxsize <= len)
+		return 0;
+
+	if (iso != TDS_DATE_ISO_TIME) {
+		p = tds_date_put_2digits(p, dr->year / 100);
+		p = tds_date_put_2digits(p, dr->year % 100);
+		*p++ = '-';
+		p = tds_date_put_2digits(p, dr->month + 1);
+		*p++ = '-';
+		p = tds_date_put_2digits(p, dr->day);
+		if (iso == TDS_DATE_ISO_DATE) {
+			*p = 0;
+			return p - buf;
+		}
+		*p++ = ' ';
+	}
+	p = tds_date_put_2digits(p, dr->hour);
+	*p++ = ':';
+	p = tds_date_put_2digits(p, dr->minute);
+	*p++ = ':';
+	p = tds_date_put_2digits(p, dr->second);
+	if (prec) {
+		*p++ = '.';
+		p = tds_date_put_fraction(p, dr, prec);
+	}
+	*p = 0;
+	return p - buf;
+}
+
+/**
+ * Format a date using a compiled format.
+ * Same as tds_strftime but format is already compiled.
  * @param buf     output buffer
  * @param maxsize size of buffer in bytes (space include terminator)
- * @param format  format string passed to strftime(3), except that %z represents fraction of seconds.
+ * @param fmt     format returned by tds_date_format_compile
  * @param dr      date to convert
  * @param prec    second fraction precision (0-7).
  * @return length of string returned, 0 for error
  */
 size_t
-tds_strftime(char *buf, size_t maxsize, const char *format, const TDSDATEREC * dr, int prec)
+tds_date_format_apply(char *buf, size_t maxsize, const TDSDATEFORMAT *fmt, const TDSDATEREC * dr, int prec)
+{
+	const TDS_DATE_INSTR *instr, *instr_end;
+	char *p = buf, *end;
+
+	assert(buf && fmt && dr);
+	assert(0 <= dr->decimicrosecond && dr->decimicrosecond < 10000000);
+	if (prec < 0 || prec > 7)
+		prec = 3;
+
+	if (fmt->iso && dr->year >= 1000 && dr->year <= 9999)
+		return tds_date_format_iso(buf, maxsize, fmt->iso, dr, prec);
+
+	if (!maxsize)
+		return 0;
+	end = buf + maxsize - 1;
+
+	instr_end = fmt->instr + fmt->num_instr;
+	for (instr = fmt->instr; instr != instr_end && p; ++instr) {
+		switch ((TDS_DATE_OP) instr->op) {
+		case TDS_DATE_LITERAL:
+			if (end - p < instr->len)
+				return 0;
+			memcpy(p, fmt->text + instr->pos, instr->len);
+			p += instr->len;
+			continue;
+		case TDS_DATE_YEAR:
+			if (dr->year >= 1000 && dr->year <= 9999 && end - p >= 4) {
+				p = tds_date_put_2digits(p, dr->year / 100);
+				p = tds_date_put_2digits(p, dr->year % 100);
+				continue;
+			}
+			p = tds_date_put_number(p, end, dr->year, 1, '0');
+			continue;
+		case TDS_DATE_YEAR2:
+			p = tds_date_put_2(p, end, dr->year % 100, '0');
+			continue;
+		case TDS_DATE_MONTH:
+			p = tds_date_put_2(p, end, dr->month + 1, '0');
+			continue;
+		case TDS_DATE_DAY:
+			p = tds_date_put_2(p, end, dr->day, '0');
+			continue;
+		case TDS_DATE_DAY_SPACE:
+			p = tds_date_put_2(p, end, dr->day, ' ');
+			continue;
+		case TDS_DATE_DAYOFYEAR:
+			p = tds_date_put_number(p, end, dr->dayofyear, 3, '0');
+			continue;
+		case TDS_DATE_HOUR:
+			p = tds_date_put_2(p, end, dr->hour, '0');
+			continue;
+		case TDS_DATE_HOUR12:
+			p = tds_date_put_2(p, end, (dr->hour + 11u) % 12u + 1, '0');
+			continue;
+		case TDS_DATE_HOUR12_SPACE:
+			p = tds_date_put_2(p, end, (dr->hour + 11u) % 12u + 1, ' ');
+			continue;
+		case TDS_DATE_MINUTE:
+			p = tds_date_put_2(p, end, dr->minute, '0');
+			continue;
+		case TDS_DATE_SECOND:
+			p = tds_date_put_2(p, end, dr->second, '0');
+			continue;
+		case TDS_DATE_WEEKDAY:
+			p = tds_date_put_number(p, end, dr->weekday, 1, '0');
+			continue;
+		case TDS_DATE_WEEKDAY_ISO:
+			p = tds_date_put_number(p, end, dr->weekday ? dr->weekday : 7, 1, '0');
+			continue;
+		case TDS_DATE_FRACTION_DOT:
+			if (!prec)
+				continue;
+			if (end - p < prec + 1)
+				return 0;
+			*p++ = '.';
+			p = tds_date_put_fraction(p, dr, prec);
+			continue;
+		case TDS_DATE_FRACTION:
+			if (end - p < prec)
+				return 0;
+			p = tds_date_put_fraction(p, dr, prec);
+			continue;
+		case TDS_DATE_LOCALE_NAME:
+			p = tds_date_put_locale_name(p, end, (char) instr->len, dr);
+			continue;
+		}
+		return 0;
+	}
+	if (!p)
+		return 0;
+	*p = 0;
+	return p - buf;
+}
+
+/**
+ * Get compiled format from cache, compiling it if needed.
+ * Formats not in cache once the cache is full are not compiled.
+ * @param format  format to compile
+ * @return compiled format or NULL if format cannot be compiled or cached
+ */
+static const TDSDATEFORMAT *
+tds_date_format_get(const char *format)
+{
+	const TDSDATEFORMAT *fmt = NULL;
+	char *format_copy;
+	unsigned int i, len;
+
+	len = date_format_cache_count();
+	for (i = 0; i < len; ++i)
+		if (strcmp(date_format_cache[i].format, format) == 0)
+			return date_format_cache[i].compiled;
+	if (len >= TDS_DATE_FORMAT_CACHE)
+		return NULL;
+
+	tds_mutex_lock(&date_format_mutex);
+	/* check formats added by other threads */
+	len = (unsigned int) date_format_cache_len;
+	for (; i < len; ++i) {
+		if (strcmp(date_format_cache[i].format, format) == 0) {
+			fmt = date_format_cache[i].compiled;
+			break;
+		}
+	}
+	if (i >= len && len < TDS_DATE_FORMAT_CACHE && (format_copy = strdup(format)) != NULL) {
+		/* compiled formats are never freed, other threads could be using them */
+		date_format_cache[len].format = format_copy;
+		date_format_cache[len].compiled = tds_date_format_compile(format);
+		fmt = date_format_cache[len].compiled;
+		date_format_cache_publish(len + 1);
+	}
+	tds_mutex_unlock(&date_format_mutex);
+	return fmt;
+}
+
+/**
+ * Format a date rewriting our extensions and calling strftime(3).
+ * Used for formats which cannot be compiled.
+ */
+static size_t
+tds_strftime_libc(char *buf, size_t maxsize, const char *format, const TDSDATEREC * dr, int prec)
 {
 	struct tm tm;
 
@@ -2999,13 +3758,7 @@ tds_strftime(char *buf, size_t maxsize, const char *format, const TDSDATEREC * d
 	char *pz;
 	bool z_found = false;
 	
-	assert(buf);
-	assert(format);
-	assert(dr);
-	assert(0 <= dr->decimicrosecond && dr->decimicrosecond < 10000000);
-	if (prec < 0 || prec > 7)
-		prec = 3;
-
+	memset(&tm, 0, sizeof(tm));
 	tm.tm_sec = dr->second;
 	tm.tm_min = dr->minute;
 	tm.tm_hour = dr->hour;
@@ -3013,13 +3766,7 @@ tds_strftime(char *buf, size_t maxsize, const char *format, const TDSDATEREC * d
 	tm.tm_mon = dr->month;
 	tm.tm_year = dr->year - 1900;
 	tm.tm_wday = dr->weekday;
-	tm.tm_yday = dr->dayofyear;
-	tm.tm_isdst = 0;
-#ifdef HAVE_STRUCT_TM_TM_ZONE
-	tm.tm_zone = NULL;
-#elif defined(HAVE_STRUCT_TM___TM_ZONE)
-	tm.__tm_zone = NULL;
-#endif
+	tm.tm_yday = dr->dayofyear - 1;
 
 	/* more characters are required because we replace %z with up to 7 digits */
 	our_format = tds_new(char, strlen(format) + 1 + 5 + 1);
@@ -3085,6 +3832,34 @@ tds_strftime(char *buf, size_t maxsize, const char *format, const TDSDATEREC * d
 	return length;
 }
 
+/**
+ * format a date string according to an "extended" strftime(3) formatting definition.
+ * Formats are compiled once and cached, see tds_date_format_compile.
+ * @param buf     output buffer
+ * @param maxsize size of buffer in bytes (space include terminator)
+ * @param format  format string passed to strftime(3), except that %z represents fraction of seconds.
+ * @param dr      date to convert
+ * @param prec    second fraction precision (0-7).
+ * @return length of string returned, 0 for error
+ */
+size_t
+tds_strftime(char *buf, size_t maxsize, const char *format, const TDSDATEREC * dr, int prec)
+{
+	const TDSDATEFORMAT *fmt;
+
+	assert(buf);
+	assert(format);
+	assert(dr);
+	assert(0 <= dr->decimicrosecond && dr->decimicrosecond < 10000000);
+	if (prec < 0 || prec > 7)
+		prec = 3;
+
+	fmt = tds_date_format_get(format);
+	if (!fmt || dr->year < 0)
+		return tds_strftime_libc(buf, maxsize, format, dr, prec);
+	return tds_date_format_apply(buf, maxsize, fmt, dr, prec);
+}
+
 #if 0
 static TDS_UINT
 utf16len(const utf16_t * s)
@@ -703,6 +703,39 @@ error_memory:
 	return TDS_FAIL;
 }
 
+/**
+ * Check if data can be used directly from the received packet.
+ * This is possible only reading rows in zero copy mode, if data
+ * are contained in a single packet and do not require any
+ * conversion (like UTF-8 data for UTF-8 clients) or padding.
+ */
+static inline bool
+tds_can_view_packet(TDSSOCKET * tds, TDSCOLUMN * curcol, int colsize)
+{
+	if (!tds->zero_copy || !tds->decoding_row)
+		return false;
+	if (colsize > curcol->column_size || colsize > tds->in_len - tds->in_pos)
+		return false;
+	/* data in the same encoding of the client do not need conversion */
+	if (USE_ICONV && curcol->char_conv && !(curcol->char_conv->flags & TDS_ENCODING_MEMCPY))
+		return false;
+
+	/* only variable types, fixed ones would require alignment or swapping */
+	switch (curcol->column_type) {
+	case SYBVARCHAR:
+	case SYBVARBINARY:
+	case XSYBVARCHAR:
+	case XSYBVARBINARY:
+	case XSYBNVARCHAR:
+		return true;
+	case SYBLONGBINARY:
+		return curcol->column_usertype != USER_UNICHAR_TYPE;
+	default:
+		break;
+	}
+	return false;
+}
+
 /**
  * Read a data from wire
  * \param tds state information for the socket and the TDS protocol
@@ -815,6 +848,15 @@ tds_generic_get(TDSSOCKET * tds, TDSCOLUMN * curcol)
 
 	/* non-numeric and non-blob */
 
+	if (tds_can_view_packet(tds, curcol, colsize)) {
+		/* point directly into received packet, avoid a copy */
+		curcol->column_data = tds->in_buf + tds->in_pos;
+		tds->in_pos += colsize;
+		++tds->recv_packet_refs;
+		curcol->column_cur_size = colsize;
+		return TDS_SUCCESS;
+	}
+
 	if (USE_ICONV && curcol->char_conv) {
 		if (TDS_FAILED(tds_get_char_data(tds, (char *) dest, colsize, curcol)))
 			return TDS_FAIL;
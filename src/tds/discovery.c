@@ -0,0 +1,506 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/**
+ * \file
+ * \brief Cache of protocol discovery
+ *
+ * Remember the TDS version detected with "tds version = auto" and the
+ * port resolved from an instance name, so following connections to the
+ * same server can avoid the extra round trips.
+ * The cache is shared by the entire process and can be saved to a file
+ * to be shared with other processes.
+ * Updates to the file are serialized with a lock on a "<file>.lock" file;
+ * the file is read again before every update so changes done by other
+ * processes are not lost. Information already stored does not cause
+ * any update.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <errno.h>
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif /* HAVE_STDLIB_H */
+
+#if HAVE_STRING_H
+#include <string.h>
+#endif /* HAVE_STRING_H */
+
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#if HAVE_FCNTL_H
+#include <fcntl.h>
+#endif /* HAVE_FCNTL_H */
+
+#if HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif /* HAVE_SYS_STAT_H */
+
+#ifdef _WIN32
+# include <io.h>
+# include <process.h>
+# include <sys/locking.h>
+#endif
+
+#include <freetds/tds.h>
+#include <freetds/thread.h>
+#include <freetds/replacements.h>
+
+typedef struct tds_discovery_entry
+{
+	struct tds_discovery_entry *next;
+	char *host;
+	char *instance;
+	/** port from configuration, used as key only if instance is empty */
+	int port;
+	TDSDISCOVERY info;
+} TDS_DISCOVERY_ENTRY;
+
+static tds_mutex discovery_mutex = TDS_MUTEX_INITIALIZER;
+static TDS_DISCOVERY_ENTRY *discovery_entries = NULL;
+/** last file loaded, to avoid reading it for every connection */
+static char *discovery_loaded = NULL;
+/** identity of the last file loaded, file is read again if it changes */
+static struct stat discovery_loaded_stat;
+
+/**
+ * \addtogroup network
+ * @{
+ */
+
+static const char *
+tds_discovery_host(const TDSLOGIN *login)
+{
+	if (!tds_dstr_isempty(&login->server_host_name))
+		return tds_dstr_cstr(&login->server_host_name);
+	return tds_dstr_cstr(&login->server_name);
+}
+
+static TDS_DISCOVERY_ENTRY **
+tds_discovery_find(const char *host, const char *instance, int port)
+{
+	TDS_DISCOVERY_ENTRY **p, *entry;
+
+	if (instance[0])
+		port = 0;
+	for (p = &discovery_entries; (entry = *p) != NULL; p = &entry->next)
+		if (entry->port == port && strcasecmp(entry->host, host) == 0
+		    && strcasecmp(entry->instance, instance) == 0)
+			return p;
+	return NULL;
+}
+
+static void
+tds_discovery_free_entry(TDS_DISCOVERY_ENTRY *entry)
+{
+	free(entry->host);
+	free(entry->instance);
+	free(entry);
+}
+
+/**
+ * Add or update an entry, fields of info which are zero are not changed.
+ * @return true if entry changed
+ */
+static bool
+tds_discovery_update(const char *host, const char *instance, int port, const TDSDISCOVERY *info)
+{
+	TDS_DISCOVERY_ENTRY **p, *entry;
+	bool changed = false;
+
+	if (instance[0])
+		port = 0;
+
+	p = tds_discovery_find(host, instance, port);
+	if (p) {
+		entry = *p;
+	} else {
+		entry = tds_new0(TDS_DISCOVERY_ENTRY, 1);
+		if (!entry)
+			return false;
+		entry->host = strdup(host);
+		entry->instance = strdup(instance);
+		if (!entry->host || !entry->instance) {
+			tds_discovery_free_entry(entry);
+			return false;
+		}
+		entry->port = port;
+		entry->next = discovery_entries;
+		discovery_entries = entry;
+	}
+	if (info->tds_version && info->tds_version != entry->info.tds_version) {
+		entry->info.tds_version = info->tds_version;
+		changed = true;
+	}
+	if (info->port > 0 && info->port != entry->info.port) {
+		entry->info.port = info->port;
+		changed = true;
+	}
+	return changed;
+}
+
+/**
+ * Check if stored information already matches, fields of info which
+ * are zero are not compared.
+ */
+static bool
+tds_discovery_same(const char *host, const char *instance, int port, const TDSDISCOVERY *info)
+{
+	TDS_DISCOVERY_ENTRY **p;
+
+	p = tds_discovery_find(host, instance, port);
+	if (!p)
+		return false;
+	return (!info->tds_version || info->tds_version == (*p)->info.tds_version)
+	       && (info->port <= 0 || info->port == (*p)->info.port);
+}
+
+static void
+tds_discovery_free_all(void)
+{
+	TDS_DISCOVERY_ENTRY *entry;
+
+	while ((entry = discovery_entries) != NULL) {
+		discovery_entries = entry->next;
+		tds_discovery_free_entry(entry);
+	}
+}
+
+static bool
+tds_discovery_lock_fd(int fd)
+{
+#ifdef _WIN32
+	return _locking(fd, _LK_LOCK, 1) == 0;
+#else
+	struct flock lock;
+	int rc;
+
+	memset(&lock, 0, sizeof(lock));
+	lock.l_type = F_WRLCK;
+	lock.l_whence = SEEK_SET;
+	while ((rc = fcntl(fd, F_SETLKW, &lock)) != 0 && errno == EINTR)
+		continue;
+	return rc == 0;
+#endif
+}
+
+/**
+ * Take the lock serializing updates of a cache file.
+ * @return file descriptor to pass to tds_discovery_unlock, -1 on failure
+ */
+static int
+tds_discovery_lock(const char *filename)
+{
+	char *lock_name;
+	int fd;
+
+	if (asprintf(&lock_name, "%s.lock", filename) < 0)
+		return -1;
+	fd = open(lock_name, O_RDWR|O_CREAT, 0666);
+	free(lock_name);
+	if (fd >= 0 && tds_discovery_lock_fd(fd))
+		return fd;
+
+	/* go on without lock, another process could overwrite our changes */
+	tdsdump_log(TDS_DBG_ERROR, "Unable to lock discovery cache %s\n", filename);
+	if (fd >= 0)
+		close(fd);
+	return -1;
+}
+
+static void
+tds_discovery_unlock(int fd)
+{
+	if (fd < 0)
+		return;
+#ifdef _WIN32
+	lseek(fd, 0, SEEK_SET);
+	_locking(fd, _LK_UNLCK, 1);
+#endif
+	/* closing the file releases the lock */
+	close(fd);
+}
+
+/**
+ * Load entries from file, replacing entries in memory.
+ * The file is not read again if it did not change since last time,
+ * unless force is set.
+ * Every line contains host, instance, port, TDS version (in hexadecimal)
+ * and instance port separated by tabulations.
+ */
+static void
+tds_discovery_load(const char *filename, bool force)
+{
+	FILE *f;
+	char line[512];
+	struct stat st;
+
+	memset(&st, 0, sizeof(st));
+	if (stat(filename, &st) != 0)
+		memset(&st, 0, sizeof(st));
+
+	if (!force && discovery_loaded && strcmp(discovery_loaded, filename) == 0
+	    && st.st_ino == discovery_loaded_stat.st_ino && st.st_size == discovery_loaded_stat.st_size
+	    && st.st_mtime == discovery_loaded_stat.st_mtime)
+		return;
+
+	tds_discovery_free_all();
+	free(discovery_loaded);
+	discovery_loaded = strdup(filename);
+	discovery_loaded_stat = st;
+
+	f = fopen(filename, "r");
+	if (!f)
+		return;
+
+	while (fgets(line, sizeof(line), f)) {
+		char *fields[5], *p = line;
+		unsigned int n;
+		TDSDISCOVERY info;
+
+		if (line[0] == '#')
+			continue;
+		p[strcspn(p, "\r\n")] = 0;
+		for (n = 0; n < 5; ++n) {
+			fields[n] = p;
+			p = strchr(p, '\t');
+			if (!p)
+				break;
+			*p++ = 0;
+		}
+		if (n != 4 || !fields[0][0])
+			continue;
+
+		info.tds_version = (TDS_USMALLINT) strtol(fields[3], NULL, 16);
+		info.port = atoi(fields[4]);
+		if (!tds_discovery_find(fields[0], fields[1], atoi(fields[2])))
+			tds_discovery_update(fields[0], fields[1], atoi(fields[2]), &info);
+	}
+	fclose(f);
+}
+
+/**
+ * Create a new temporary file near filename.
+ * @return opened file, NULL on failure
+ */
+static FILE *
+tds_discovery_create_temp(const char *filename, char **tmp_name)
+{
+	int fd;
+	FILE *f;
+
+#ifdef _WIN32
+	if (asprintf(tmp_name, "%s.%d", filename, (int) getpid()) < 0)
+		return NULL;
+	fd = open(*tmp_name, O_WRONLY|O_CREAT|O_EXCL|O_TRUNC, 0666);
+#else
+	if (asprintf(tmp_name, "%s.XXXXXX", filename) < 0)
+		return NULL;
+	fd = mkstemp(*tmp_name);
+	/* same permissions fopen would have used */
+	if (fd >= 0) {
+		mode_t mask = umask(0);
+
+		umask(mask);
+		fchmod(fd, 0666 & ~mask);
+	}
+#endif
+	if (fd < 0) {
+		TDS_ZERO_FREE(*tmp_name);
+		return NULL;
+	}
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		remove(*tmp_name);
+		TDS_ZERO_FREE(*tmp_name);
+	}
+	return f;
+}
+
+/**
+ * Save all entries to file.
+ * Must be called holding the file lock, after reading the file again.
+ * File is written to a temporary file and then renamed so other
+ * processes reading it never see a partial file.
+ */
+static void
+tds_discovery_save(const char *filename)
+{
+	FILE *f;
+	char *tmp_name;
+	const TDS_DISCOVERY_ENTRY *entry;
+	bool ok = true;
+
+	f = tds_discovery_create_temp(filename, &tmp_name);
+	if (!f) {
+		tdsdump_log(TDS_DBG_ERROR, "Unable to write discovery cache %s\n", filename);
+		return;
+	}
+
+	fputs("# FreeTDS discovery cache, do not edit\n", f);
+	for (entry = discovery_entries; entry; entry = entry->next) {
+		if (!entry->info.tds_version && !entry->info.port)
+			continue;
+		if (fprintf(f, "%s\t%s\t%d\t%x\t%d\n", entry->host, entry->instance, entry->port,
+			    entry->info.tds_version, entry->info.port) < 0)
+			ok = false;
+	}
+	if (fclose(f) != 0)
+		ok = false;
+
+	if (ok && rename(tmp_name, filename) != 0) {
+		/* some systems do not allow to replace an existing file */
+		remove(filename);
+		ok = rename(tmp_name, filename) == 0;
+	}
+	if (!ok)
+		remove(tmp_name);
+	free(tmp_name);
+
+	/* memory now matches the file */
+	if (ok && stat(filename, &discovery_loaded_stat) != 0)
+		memset(&discovery_loaded_stat, 0, sizeof(discovery_loaded_stat));
+}
+
+/**
+ * Retrieve discovery information for the server specified in login.
+ * @param login  login structure, server host and instance name are used
+ *               as key; if a discovery cache file is configured it is read
+ * @param port   port from configuration, used as key if instance is not specified
+ * @param info   filled with information found
+ * @return true if found, false otherwise
+ */
+bool
+tds_discovery_get(const TDSLOGIN *login, int port, TDSDISCOVERY *info)
+{
+	TDS_DISCOVERY_ENTRY **p;
+
+	memset(info, 0, sizeof(*info));
+
+	tds_mutex_lock(&discovery_mutex);
+	if (!tds_dstr_isempty(&login->discovery_file))
+		tds_discovery_load(tds_dstr_cstr(&login->discovery_file), false);
+	p = tds_discovery_find(tds_discovery_host(login), tds_dstr_cstr(&login->instance_name), port);
+	if (p)
+		*info = (*p)->info;
+	tds_mutex_unlock(&discovery_mutex);
+
+	if (p)
+		tdsdump_log(TDS_DBG_INFO1, "Discovery cache hit for %s: version %x port %d\n",
+			    tds_discovery_host(login), info->tds_version, info->port);
+	return p != NULL;
+}
+
+/**
+ * Store discovery information for the server specified in login.
+ * Fields of info which are zero do not change stored information.
+ * @param login  login structure, see tds_discovery_get
+ * @param port   port from configuration, see tds_discovery_get
+ * @param info   information to store
+ */
+void
+tds_discovery_set(const TDSLOGIN *login, int port, const TDSDISCOVERY *info)
+{
+	const char *filename = NULL, *host = tds_discovery_host(login);
+	const char *instance = tds_dstr_cstr(&login->instance_name);
+	int lock = -1;
+
+	if (!tds_dstr_isempty(&login->discovery_file))
+		filename = tds_dstr_cstr(&login->discovery_file);
+
+	tds_mutex_lock(&discovery_mutex);
+	if (filename)
+		tds_discovery_load(filename, false);
+	/* usual case after a connection, do not lock and rewrite the file */
+	if (tds_discovery_same(host, instance, port, info)) {
+		tds_mutex_unlock(&discovery_mutex);
+		return;
+	}
+
+	/* read file again to not lose changes from other processes saving it */
+	if (filename) {
+		lock = tds_discovery_lock(filename);
+		tds_discovery_load(filename, true);
+	}
+	if (tds_discovery_update(host, instance, port, info) && filename)
+		tds_discovery_save(filename);
+	tds_discovery_unlock(lock);
+	tds_mutex_unlock(&discovery_mutex);
+}
+
+/**
+ * Remove discovery information for the server specified in login.
+ * Called when connection using information stored failed.
+ * @param login  login structure, see tds_discovery_get
+ * @param port   port from configuration, see tds_discovery_get
+ */
+void
+tds_discovery_invalidate(const TDSLOGIN *login, int port)
+{
+	TDS_DISCOVERY_ENTRY **p, *entry;
+	const char *filename = NULL;
+	int lock = -1;
+
+	if (!tds_dstr_isempty(&login->discovery_file))
+		filename = tds_dstr_cstr(&login->discovery_file);
+
+	tds_mutex_lock(&discovery_mutex);
+	if (filename)
+		tds_discovery_load(filename, false);
+	if (!tds_discovery_find(tds_discovery_host(login), tds_dstr_cstr(&login->instance_name), port)) {
+		tds_mutex_unlock(&discovery_mutex);
+		return;
+	}
+
+	if (filename) {
+		lock = tds_discovery_lock(filename);
+		tds_discovery_load(filename, true);
+	}
+	p = tds_discovery_find(tds_discovery_host(login), tds_dstr_cstr(&login->instance_name), port);
+	if (p) {
+		entry = *p;
+		*p = entry->next;
+		tds_discovery_free_entry(entry);
+		if (filename)
+			tds_discovery_save(filename);
+	}
+	tds_discovery_unlock(lock);
+	tds_mutex_unlock(&discovery_mutex);
+}
+
+/**
+ * Free all discovery information in memory.
+ * Files are not touched and will be read again if needed.
+ */
+void
+tds_discovery_clear(void)
+{
+	tds_mutex_lock(&discovery_mutex);
+	tds_discovery_free_all();
+	TDS_ZERO_FREE(discovery_loaded);
+	tds_mutex_unlock(&discovery_mutex);
+}
+
+/** @} */
@@ -0,0 +1,359 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/**
+ * \file
+ * \brief Prepared statements cache
+ *
+ * Statements prepared on the server are kept by the connection and
+ * reused when the same query is executed again with the same parameter
+ * types, avoiding to prepare it again.
+ * Statements are looked up using a hash table and the least recently
+ * used ones are unprepared when the cache is full.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <ctype.h>
+
+#if HAVE_STDLIB_H
+#include <stdlib.h>
+#endif /* HAVE_STDLIB_H */
+
+#if HAVE_STRING_H
+#include <string.h>
+#endif /* HAVE_STRING_H */
+
+#include <freetds/tds.h>
+#include <freetds/checks.h>
+
+#define TDS_ISSPACE(c) isspace((unsigned char) (c))
+
+#define MIN_BUCKETS 64u
+
+static void tds_dynamic_cache_evict(TDSCONNECTION *conn, TDSDYNAMIC *dyn);
+
+/**
+ * \addtogroup query
+ * @{
+ */
+
+/**
+ * Build the key for a query.
+ * The key contains the parameter types and the query with white spaces
+ * outside strings and comments collapsed.
+ * \param query  query with placeholders
+ * \param params parameters, can be NULL
+ * \param phash  returned hash of the key
+ * \return allocated key or NULL on memory error
+ */
+static char *
+tds_dynamic_cache_key(const char *query, TDSPARAMINFO *params, unsigned int *phash)
+{
+	const char *s, *e;
+	char *key, *p, *start;
+	int num_params = params ? params->num_cols : 0;
+	int i;
+	unsigned int hash;
+
+	key = tds_new(char, strlen(query) + num_params * 80 + 2);
+	if (!key)
+		return NULL;
+
+	p = key;
+	for (i = 0; i < num_params; ++i) {
+		const TDSCOLUMN *col = params->columns[i];
+
+		p += sprintf(p, "%d,%d,%d,%d,%d,%d,%d;", col->column_type, col->on_server.column_type,
+			     col->column_size, col->on_server.column_size,
+			     col->column_prec, col->column_scale, col->column_output);
+	}
+	*p++ = '|';
+
+	start = p;
+	for (s = query; *s; ) {
+		switch (*s) {
+		case '\'':
+		case '\"':
+		case '[':
+			e = tds_skip_quoted(s);
+			break;
+		case '-':
+		case '/':
+			e = tds_skip_comment(s);
+			break;
+		default:
+			if (!TDS_ISSPACE(*s)) {
+				*p++ = *s++;
+				continue;
+			}
+			while (TDS_ISSPACE(*s))
+				++s;
+			if (*s && p != start)
+				*p++ = ' ';
+			continue;
+		}
+		memcpy(p, s, e - s);
+		p += e - s;
+		s = e;
+	}
+	*p = 0;
+
+	/* FNV-1a */
+	hash = 2166136261u;
+	for (p = key; *p; ++p)
+		hash = (hash ^ (unsigned char) *p) * 16777619u;
+	*phash = hash;
+
+	return key;
+}
+
+static void
+tds_dynamic_cache_lru_unlink(TDSDYNAMICCACHE *cache, TDSDYNAMIC *dyn)
+{
+	if (dyn->lru_prev)
+		dyn->lru_prev->lru_next = dyn->lru_next;
+	else
+		cache->lru_first = dyn->lru_next;
+	if (dyn->lru_next)
+		dyn->lru_next->lru_prev = dyn->lru_prev;
+	else
+		cache->lru_last = dyn->lru_prev;
+	dyn->lru_prev = dyn->lru_next = NULL;
+}
+
+static void
+tds_dynamic_cache_lru_push(TDSDYNAMICCACHE *cache, TDSDYNAMIC *dyn)
+{
+	dyn->lru_prev = NULL;
+	dyn->lru_next = cache->lru_first;
+	if (cache->lru_first)
+		cache->lru_first->lru_prev = dyn;
+	else
+		cache->lru_last = dyn;
+	cache->lru_first = dyn;
+}
+
+/**
+ * Double the hash table size.
+ * On memory error the old table is kept, lookups are just slower.
+ */
+static void
+tds_dynamic_cache_grow(TDSDYNAMICCACHE *cache)
+{
+	unsigned int num_buckets = cache->num_buckets ? cache->num_buckets * 2 : MIN_BUCKETS;
+	TDSDYNAMIC **buckets, *dyn, *next;
+	unsigned int i;
+
+	buckets = tds_new0(TDSDYNAMIC *, num_buckets);
+	if (!buckets)
+		return;
+
+	for (i = 0; i < cache->num_buckets; ++i) {
+		for (dyn = cache->buckets[i]; dyn; dyn = next) {
+			next = dyn->cache_next;
+			dyn->cache_next = buckets[dyn->cache_hash & (num_buckets - 1)];
+			buckets[dyn->cache_hash & (num_buckets - 1)] = dyn;
+		}
+	}
+	free(cache->buckets);
+	cache->buckets = buckets;
+	cache->num_buckets = num_buckets;
+}
+
+/**
+ * Change maximum number of prepared statements cached by a connection.
+ * Statements exceeding the new limit are unprepared.
+ * \param conn       connection
+ * \param max_cached maximum number of statements, 0 disables the cache
+ */
+void
+tds_set_dynamic_cache_size(TDSCONNECTION *conn, unsigned int max_cached)
+{
+	TDSDYNAMICCACHE *cache = &conn->dyn_cache;
+
+	cache->max_cached = max_cached;
+	while (cache->num_cached > max_cached)
+		tds_dynamic_cache_evict(conn, cache->lru_last);
+}
+
+/**
+ * Find a prepared statement in the cache.
+ * The statement returned is referenced and must be released with
+ * tds_dynamic_cache_release.
+ * \param conn   connection
+ * \param query  query with placeholders
+ * \param params parameters, can be NULL
+ * \return prepared statement or NULL if not found
+ */
+TDSDYNAMIC *
+tds_dynamic_cache_get(TDSCONNECTION *conn, const char *query, TDSPARAMINFO *params)
+{
+	TDSDYNAMICCACHE *cache = &conn->dyn_cache;
+	TDSDYNAMIC *dyn;
+	unsigned int hash;
+	char *key;
+
+	if (!cache->num_cached)
+		return NULL;
+
+	key = tds_dynamic_cache_key(query, params, &hash);
+	if (!key)
+		return NULL;
+
+	for (dyn = cache->buckets[hash & (cache->num_buckets - 1)]; dyn; dyn = dyn->cache_next) {
+		/* statement should be prepared */
+		if (dyn->cache_hash != hash || dyn->num_id == 0 || dyn->defer_close)
+			continue;
+		if (strcmp(dyn->cache_key, key) == 0)
+			break;
+	}
+	free(key);
+
+	if (!dyn)
+		return NULL;
+
+	tdsdump_log(TDS_DBG_FUNC, "tds_dynamic_cache_get() : reusing dynamic_id %s\n", dyn->id);
+
+	tds_dynamic_cache_lru_unlink(cache, dyn);
+	tds_dynamic_cache_lru_push(cache, dyn);
+	++dyn->ref_count;
+	++dyn->cache_users;
+	return dyn;
+}
+
+/**
+ * Add a statement just prepared to the cache.
+ * The caller becomes a user of the statement and should release it with
+ * tds_dynamic_cache_release. If the cache is full the least recently
+ * used statement is unprepared.
+ * \param conn   connection
+ * \param dyn    statement, must be prepared with the given query and parameters
+ * \param query  query with placeholders
+ * \param params parameters, can be NULL
+ * \return TDS_SUCCESS if cached, TDS_FAIL if cache is disabled or on memory error
+ */
+TDSRET
+tds_dynamic_cache_put(TDSCONNECTION *conn, TDSDYNAMIC *dyn, const char *query, TDSPARAMINFO *params)
+{
+	TDSDYNAMICCACHE *cache = &conn->dyn_cache;
+	TDSDYNAMIC **bucket;
+
+	CHECK_DYNAMIC_EXTRA(dyn);
+
+	if (!cache->max_cached || dyn->cache_key || dyn->emulated)
+		return TDS_FAIL;
+
+	if (cache->num_cached >= cache->num_buckets)
+		tds_dynamic_cache_grow(cache);
+	if (!cache->buckets)
+		return TDS_FAIL;
+
+	dyn->cache_key = tds_dynamic_cache_key(query, params, &dyn->cache_hash);
+	if (!dyn->cache_key)
+		return TDS_FAIL;
+
+	bucket = &cache->buckets[dyn->cache_hash & (cache->num_buckets - 1)];
+	dyn->cache_next = *bucket;
+	*bucket = dyn;
+	tds_dynamic_cache_lru_push(cache, dyn);
+	++cache->num_cached;
+	++dyn->cache_users;
+
+	tdsdump_log(TDS_DBG_FUNC, "tds_dynamic_cache_put() : cached dynamic_id %s, %u cached\n", dyn->id, cache->num_cached);
+
+	while (cache->num_cached > cache->max_cached)
+		tds_dynamic_cache_evict(conn, cache->lru_last);
+
+	return TDS_SUCCESS;
+}
+
+/**
+ * Release a statement obtained with tds_dynamic_cache_get or added with
+ * tds_dynamic_cache_put.
+ * A statement no more in the cache is unprepared by its last user.
+ * \param conn connection
+ * \param pdyn statement to release, set to NULL
+ */
+void
+tds_dynamic_cache_release(TDSCONNECTION *conn, TDSDYNAMIC **pdyn)
+{
+	TDSDYNAMIC *dyn = *pdyn;
+
+	if (!dyn)
+		return;
+
+	if ((!dyn->cache_users || --dyn->cache_users == 0) && !dyn->cache_key)
+		tds_deferred_unprepare(conn, dyn);
+	tds_release_dynamic(pdyn);
+}
+
+/**
+ * Remove a statement from the cache.
+ * \param conn connection
+ * \param dyn  statement to remove, can be not cached
+ */
+void
+tds_dynamic_cache_remove(TDSCONNECTION *conn, TDSDYNAMIC *dyn)
+{
+	TDSDYNAMICCACHE *cache = &conn->dyn_cache;
+	TDSDYNAMIC **victim;
+
+	if (!dyn->cache_key)
+		return;
+
+	victim = &cache->buckets[dyn->cache_hash & (cache->num_buckets - 1)];
+	while (*victim != dyn)
+		victim = &(*victim)->cache_next;
+	*victim = dyn->cache_next;
+	dyn->cache_next = NULL;
+
+	tds_dynamic_cache_lru_unlink(cache, dyn);
+	--cache->num_cached;
+	TDS_ZERO_FREE(dyn->cache_key);
+}
+
+/**
+ * Remove a statement from the cache and unprepare it if not used.
+ * Statements still used are unprepared when the last user release them.
+ */
+static void
+tds_dynamic_cache_evict(TDSCONNECTION *conn, TDSDYNAMIC *dyn)
+{
+	tdsdump_log(TDS_DBG_FUNC, "tds_dynamic_cache_evict() : evicting dynamic_id %s\n", dyn->id);
+
+	tds_dynamic_cache_remove(conn, dyn);
+	if (!dyn->cache_users)
+		tds_deferred_unprepare(conn, dyn);
+}
+
+/**
+ * Free cache memory. All statements should be already deallocated.
+ */
+void
+tds_dynamic_cache_free(TDSCONNECTION *conn)
+{
+	TDSDYNAMICCACHE *cache = &conn->dyn_cache;
+
+	TDS_ZERO_FREE(cache->buckets);
+	cache->num_buckets = 0;
+}
+
+/** @} */
@@ -292,6 +292,8 @@ tds_iconv_reset(TDSICONV *conv)
 	conv->to.charset.canonic = conv->from.charset.canonic = 0;
 	conv->to.cd = (iconv_t) -1;
 	conv->from.cd = (iconv_t) -1;
+	conv->to.native = NULL;
+	conv->from.native = NULL;
 }
 
 /**
@@ -492,6 +494,10 @@ tds_iconv_info_init(TDSICONV * char_conv, int client_canonical, int server_canon
 		tdsdump_log(TDS_DBG_FUNC, "tds_iconv_info_init: cannot convert \"%s\"->\"%s\"\n", server->name, client->name);
 	}
 
+	/* use built-in converters for common conversions */
+	char_conv->to.native = tds_iconv_native_get(client_canonical, server_canonical);
+	char_conv->from.native = tds_iconv_native_get(server_canonical, client_canonical);
+
 	/* TODO, do some optimizations like UCS2 -> UTF8 min,max = 2,2 (UCS2) and 1,4 (UTF8) */
 
 	/* tdsdump_log(TDS_DBG_FUNC, "tds_iconv_info_init: converting \"%s\"->\"%s\"\n", client->name, server->name); */
@@ -516,6 +522,8 @@ tds_iconv_info_close(TDSICONV * char_conv)
 {
 	_iconv_close(&char_conv->to.cd);
 	_iconv_close(&char_conv->from.cd);
+	char_conv->to.native = NULL;
+	char_conv->from.native = NULL;
 }
 
 void
@@ -629,7 +637,7 @@ tds_iconv(TDSSOCKET * tds, TDSICONV * conv, TDS_ICONV_DIRECTION io,
 	}
 
 	/* silly case, memcpy */
-	if (conv->flags & TDS_ENCODING_MEMCPY || to->cd == invalid) {
+	if (conv->flags & TDS_ENCODING_MEMCPY || (to->cd == invalid && !to->native)) {
 		size_t len = *inbytesleft < *outbytesleft ? *inbytesleft : *outbytesleft;
 
 		memcpy(*outbuf, *inbuf, len);
@@ -647,7 +655,10 @@ tds_iconv(TDSSOCKET * tds, TDSICONV * conv, TDS_ICONV_DIRECTION io,
 	 */
 	for (;;) {
 		conv_errno = 0;
-		irreversible = tds_sys_iconv(to->cd, (ICONV_CONST char **) inbuf, inbytesleft, outbuf, outbytesleft);
+		if (to->native)
+			irreversible = to->native((const char **) inbuf, inbytesleft, outbuf, outbytesleft);
+		else
+			irreversible = tds_sys_iconv(to->cd, (ICONV_CONST char **) inbuf, inbytesleft, outbuf, outbytesleft);
 
 		/* iconv success, return */
 		if (irreversible != (size_t) - 1) {
@@ -997,7 +1008,7 @@ collate2charset(TDSCONNECTION * conn, TDS_UCHAR collate[5])
 	/* starting with bit 20 (little endian, so 3rd byte bit 4) there are 8 bits:
 	 * fIgnoreCase fIgnoreAccent fIgnoreKana fIgnoreWidth fBinary fBinary2 fUTF8 FRESERVEDBIT
 	 * so fUTF8 is on the 4th byte bit 2 */
-	if ((collate[3] & 0x4) != 0 && IS_TDS74_PLUS(conn))
+	if ((collate[3] & 0x4) != 0 && conn->utf8_support)
 		return TDS_CHARSET_UTF_8;
 
 	/*
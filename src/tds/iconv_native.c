@@ -0,0 +1,422 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/**
+ * \file
+ * \brief Built-in converters between UCS-2/UTF-16 and common client charsets
+ *
+ * Conversions between the server Unicode encoding and UTF-8, ISO-8859-1
+ * and CP1252 are very common, these converters avoid calling iconv for them.
+ * They follow iconv semantic so errors are handled by tds_iconv as usual.
+ */
+
+#include <config.h>
+
+#if HAVE_STRING_H
+#include <string.h>
+#endif /* HAVE_STRING_H */
+#if HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#include <freetds/tds.h>
+#include <freetds/iconv.h>
+#include <freetds/encodings.h>
+#include <freetds/utils/bjoern-utf8.h>
+
+/** client charsets handled */
+enum
+{
+	NATIVE_UTF8,
+	NATIVE_ISO1,
+	NATIVE_CP1252,
+	NATIVE_COUNT
+};
+
+/* Unicode characters of CP1252 0x80-0x9f, 0 if undefined */
+static const uint16_t cp1252_80[32] = {
+	0x20ac, 0,      0x201a, 0x0192, 0x201e, 0x2026, 0x2020, 0x2021,
+	0x02c6, 0x2030, 0x0160, 0x2039, 0x0152, 0,      0x017d, 0,
+	0,      0x2018, 0x2019, 0x201c, 0x201d, 0x2022, 0x2013, 0x2014,
+	0x02dc, 0x2122, 0x0161, 0x203a, 0x0153, 0,      0x017e, 0x0178,
+};
+
+#ifdef WORDS_BIGENDIAN
+#define UTF16_NOT_ASCII UINT64_C(0x80ff80ff80ff80ff)
+#else
+#define UTF16_NOT_ASCII UINT64_C(0xff80ff80ff80ff80)
+#endif
+
+/**
+ * Count leading ASCII bytes, 8 bytes at a time.
+ */
+static inline size_t
+ascii_run(const unsigned char *p, size_t len)
+{
+	size_t i = 0;
+	uint64_t v;
+
+	for (; i + 8 <= len; i += 8) {
+		memcpy(&v, p + i, 8);
+		if (v & UINT64_C(0x8080808080808080))
+			break;
+	}
+	for (; i < len && p[i] < 0x80; ++i)
+		continue;
+	return i;
+}
+
+/**
+ * Count leading ASCII characters in UTF-16LE, 4 characters at a time.
+ */
+static inline size_t
+ascii_run_utf16(const unsigned char *p, size_t len)
+{
+	size_t i = 0;
+	uint64_t v;
+
+	for (; i + 4 <= len; i += 4) {
+		memcpy(&v, p + i * 2, 8);
+		if (v & UTF16_NOT_ASCII)
+			break;
+	}
+	for (; i < len && p[i * 2] < 0x80 && p[i * 2 + 1] == 0; ++i)
+		continue;
+	return i;
+}
+
+/*
+ * Return values for get_*:
+ * - >0 bytes read
+ * - -EINVAL not enough data to read
+ * - -EILSEQ invalid encoding detected
+ * Return values for put_*:
+ * - >0 bytes written
+ * - -E2BIG no space left on output
+ * - -EILSEQ character can't be encoded in output charset
+ */
+
+static inline int
+get_utf16(const unsigned char *p, size_t len, bool ucs2, uint32_t *out)
+{
+	uint32_t c = p[0] | (p[1] << 8), c2;
+
+	*out = c;
+	if ((c & 0xf800) != 0xd800)
+		return 2;
+	if (ucs2 || c >= 0xdc00)
+		return -EILSEQ;
+	if (len < 4)
+		return -EINVAL;
+	c2 = p[2] | (p[3] << 8);
+	if ((c2 & 0xfc00) != 0xdc00)
+		return -EILSEQ;
+	*out = 0x10000 + ((c - 0xd800) << 10) + (c2 - 0xdc00);
+	return 4;
+}
+
+static inline int
+put_utf16(unsigned char *p, size_t len, bool ucs2, uint32_t c)
+{
+	if (len < 2)
+		return -E2BIG;
+	if (c < 0x10000) {
+		p[0] = (unsigned char) c;
+		p[1] = (unsigned char) (c >> 8);
+		return 2;
+	}
+	if (ucs2)
+		return -EILSEQ;
+	if (len < 4)
+		return -E2BIG;
+	c -= 0x10000;
+	p[0] = (unsigned char) (c >> 10);
+	p[1] = (unsigned char) (0xd8 | (c >> 18));
+	p[2] = (unsigned char) c;
+	p[3] = (unsigned char) (0xdc | ((c >> 8) & 3));
+	return 4;
+}
+
+static inline int
+get_client(int kind, const unsigned char *p, size_t len, uint32_t *out)
+{
+	uint32_t state = UTF8_ACCEPT;
+	size_t l, need;
+
+	switch (kind) {
+	case NATIVE_UTF8:
+		/*
+		 * incomplete sequence, like iconv check only continuation bytes,
+		 * lead bytes of old 5 and 6 bytes sequences are considered too
+		 */
+		if (p[0] < 0xc2 || p[0] >= 0xfe)
+			need = 1;
+		else
+			for (need = 2; (p[0] << need) & 0x80; ++need)
+				continue;
+		if (len < need) {
+			for (l = 1; l < len; ++l)
+				if ((p[l] & 0xc0) != 0x80)
+					return -EILSEQ;
+			return -EINVAL;
+		}
+		for (l = 0; l < need; ) {
+			switch (decode_utf8(&state, out, p[l++])) {
+			case UTF8_ACCEPT:
+				return (int) l;
+			case UTF8_REJECT:
+				return -EILSEQ;
+			}
+		}
+		return -EILSEQ;
+	case NATIVE_CP1252:
+		if (p[0] >= 0x80 && p[0] < 0xa0) {
+			*out = cp1252_80[p[0] - 0x80];
+			return *out ? 1 : -EILSEQ;
+		}
+		/* fall through */
+	default:
+		*out = p[0];
+		return 1;
+	}
+}
+
+static inline int
+put_client(int kind, unsigned char *p, size_t len, uint32_t c)
+{
+	int i, l;
+
+	if (kind == NATIVE_UTF8) {
+		l = c < 0x800 ? 2 : (c < 0x10000 ? 3 : 4);
+		if (c < 0x80)
+			l = 1;
+		if (len < (size_t) l)
+			return -E2BIG;
+		if (l == 1) {
+			p[0] = (unsigned char) c;
+			return 1;
+		}
+		for (i = l; --i > 0; c >>= 6)
+			p[i] = 0x80 | (c & 0x3f);
+		p[0] = (unsigned char) ((0xff00u >> l) | c);
+		return l;
+	}
+
+	if (len < 1)
+		return -E2BIG;
+	if (kind == NATIVE_CP1252 && (c >= 0x100 || (c >= 0x80 && c < 0xa0))) {
+		for (i = 0; i < 32; ++i)
+			if (cp1252_80[i] == c)
+				break;
+		if (i >= 32)
+			return -EILSEQ;
+		c = 0x80 + i;
+	}
+	if (c >= 0x100)
+		return -EILSEQ;
+	p[0] = (unsigned char) c;
+	return 1;
+}
+
+static inline size_t
+native_end(const char **inbuf, size_t *inbytesleft, char **outbuf, size_t *outbytesleft,
+	   const unsigned char *ib, size_t il, unsigned char *ob, size_t ol, int err)
+{
+	*inbuf = (const char *) ib;
+	*inbytesleft = il;
+	*outbuf = (char *) ob;
+	*outbytesleft = ol;
+	if (err) {
+		errno = err;
+		return (size_t) -1;
+	}
+	return 0;
+}
+
+/**
+ * Convert from a client charset to UCS-2LE/UTF-16LE.
+ */
+static inline size_t
+native_to_utf16(int kind, bool ucs2, const char **inbuf, size_t *inbytesleft, char **outbuf, size_t *outbytesleft)
+{
+	const unsigned char *ib;
+	unsigned char *ob;
+	size_t il, ol, n, i;
+	int err = 0, readed, written;
+	uint32_t c;
+
+	/* reset state, we don't have any */
+	if (!inbuf || !*inbuf)
+		return 0;
+
+	ib = (const unsigned char *) *inbuf;
+	il = *inbytesleft;
+	ob = (unsigned char *) *outbuf;
+	ol = *outbytesleft;
+
+	while (il) {
+		n = ascii_run(ib, il < ol / 2 ? il : ol / 2);
+		for (i = 0; i < n; ++i) {
+			ob[i * 2] = ib[i];
+			ob[i * 2 + 1] = 0;
+		}
+		ib += n;
+		il -= n;
+		ob += n * 2;
+		ol -= n * 2;
+		if (!il)
+			break;
+
+		readed = get_client(kind, ib, il, &c);
+		if (readed < 0) {
+			err = -readed;
+			break;
+		}
+		written = put_utf16(ob, ol, ucs2, c);
+		if (written < 0) {
+			err = -written;
+			break;
+		}
+		ib += readed;
+		il -= readed;
+		ob += written;
+		ol -= written;
+	}
+	return native_end(inbuf, inbytesleft, outbuf, outbytesleft, ib, il, ob, ol, err);
+}
+
+/**
+ * Convert from UCS-2LE/UTF-16LE to a client charset.
+ */
+static inline size_t
+native_from_utf16(int kind, bool ucs2, const char **inbuf, size_t *inbytesleft, char **outbuf, size_t *outbytesleft)
+{
+	const unsigned char *ib;
+	unsigned char *ob;
+	size_t il, ol, n, i;
+	int err = 0, readed, written;
+	uint32_t c;
+
+	/* reset state, we don't have any */
+	if (!inbuf || !*inbuf)
+		return 0;
+
+	ib = (const unsigned char *) *inbuf;
+	il = *inbytesleft;
+	ob = (unsigned char *) *outbuf;
+	ol = *outbytesleft;
+
+	while (il >= 2) {
+		n = ascii_run_utf16(ib, il / 2 < ol ? il / 2 : ol);
+		for (i = 0; i < n; ++i)
+			ob[i] = ib[i * 2];
+		ib += n * 2;
+		il -= n * 2;
+		ob += n;
+		ol -= n;
+		if (il < 2)
+			break;
+
+		readed = get_utf16(ib, il, ucs2, &c);
+		if (readed < 0) {
+			err = -readed;
+			break;
+		}
+		written = put_client(kind, ob, ol, c);
+		if (written < 0) {
+			err = -written;
+			break;
+		}
+		ib += readed;
+		il -= readed;
+		ob += written;
+		ol -= written;
+	}
+	if (!err && il)
+		err = EINVAL;
+	return native_end(inbuf, inbytesleft, outbuf, outbytesleft, ib, il, ob, ol, err);
+}
+
+#define NATIVE_FUNCS(name, kind) \
+static size_t \
+name ## _to_ucs2(const char **inbuf, size_t *inbytesleft, char **outbuf, size_t *outbytesleft) \
+{ \
+	return native_to_utf16(kind, true, inbuf, inbytesleft, outbuf, outbytesleft); \
+} \
+static size_t \
+name ## _to_utf16(const char **inbuf, size_t *inbytesleft, char **outbuf, size_t *outbytesleft) \
+{ \
+	return native_to_utf16(kind, false, inbuf, inbytesleft, outbuf, outbytesleft); \
+} \
+static size_t \
+ucs2_to_ ## name(const char **inbuf, size_t *inbytesleft, char **outbuf, size_t *outbytesleft) \
+{ \
+	return native_from_utf16(kind, true, inbuf, inbytesleft, outbuf, outbytesleft); \
+} \
+static size_t \
+utf16_to_ ## name(const char **inbuf, size_t *inbytesleft, char **outbuf, size_t *outbytesleft) \
+{ \
+	return native_from_utf16(kind, false, inbuf, inbytesleft, outbuf, outbytesleft); \
+}
+
+NATIVE_FUNCS(utf8, NATIVE_UTF8)
+NATIVE_FUNCS(iso1, NATIVE_ISO1)
+NATIVE_FUNCS(cp1252, NATIVE_CP1252)
+
+static const tds_iconv_native_t natives[NATIVE_COUNT][4] = {
+	{ utf8_to_ucs2,   utf8_to_utf16,   ucs2_to_utf8,   utf16_to_utf8 },
+	{ iso1_to_ucs2,   iso1_to_utf16,   ucs2_to_iso1,   utf16_to_iso1 },
+	{ cp1252_to_ucs2, cp1252_to_utf16, ucs2_to_cp1252, utf16_to_cp1252 },
+};
+
+static int
+native_kind(int canonic)
+{
+	switch (canonic) {
+	case TDS_CHARSET_UTF_8:
+		return NATIVE_UTF8;
+	case TDS_CHARSET_ISO_8859_1:
+		return NATIVE_ISO1;
+	case TDS_CHARSET_CP1252:
+		return NATIVE_CP1252;
+	}
+	return -1;
+}
+
+/**
+ * Get a built-in converter.
+ * \param from_canonic canonic charset to convert from
+ * \param to_canonic canonic charset to convert to
+ * \return converter or NULL if not available
+ */
+tds_iconv_native_t
+tds_iconv_native_get(int from_canonic, int to_canonic)
+{
+	int kind;
+
+	if ((to_canonic == TDS_CHARSET_UCS_2LE || to_canonic == TDS_CHARSET_UTF_16LE)
+	    && (kind = native_kind(from_canonic)) >= 0)
+		return natives[kind][to_canonic == TDS_CHARSET_UCS_2LE ? 0 : 1];
+
+	if ((from_canonic == TDS_CHARSET_UCS_2LE || from_canonic == TDS_CHARSET_UTF_16LE)
+	    && (kind = native_kind(to_canonic)) >= 0)
+		return natives[kind][from_canonic == TDS_CHARSET_UCS_2LE ? 2 : 3];
+
+	return NULL;
+}
@@ -50,6 +50,16 @@
 #include <freetds/thread.h>
 #include <freetds/utils.h>
 
+/*
+ * Records are stored in per thread buffers and written by a
+ * background thread. Requires thread local storage and atomic builtins.
+ */
+#if defined(TDS_HAVE_MUTEX) && !defined(_WIN32) && defined(__ATOMIC_ACQUIRE) && defined(HAVE_GETTIMEOFDAY)
+#define ENABLE_ASYNC_LOG 1
+#else
+#define ENABLE_ASYNC_LOG 0
+#endif
+
 /* for now all messages go to the log */
 int tds_debug_flags = TDS_DBGFLAG_ALL | TDS_DBGFLAG_SOURCE;
 int tds_g_append_mode = 0;
@@ -63,7 +73,22 @@ static tds_mutex g_dump_mutex = TDS_MUTEX_INITIALIZER;
 
 static FILE* tdsdump_append(void);
 
-#ifdef TDS_ATTRIBUTE_DESTRUCTOR
+#if ENABLE_ASYNC_LOG
+static void tdsdump_start_writer(void);
+static void tdsdump_stop_writer(void);
+static void tdsdump_drain(void);
+static bool tdsdump_async_record(unsigned int kind, const char *file, int line,
+				 const char *msg, size_t msg_len, const void *data, size_t data_len);
+static bool tdsdump_async_log(const char *file, int line, const char *fmt, va_list ap);
+
+/** log records are buffered, writer thread is running */
+static int g_dump_async;
+/** number of tdsdump_off calls active for current thread */
+static __thread int tls_dump_off;
+#endif
+
+/* flush buffered records at exit */
+#if defined(TDS_ATTRIBUTE_DESTRUCTOR) || ENABLE_ASYNC_LOG
 static void __attribute__((destructor))
 tds_util_deinit(void)
 {
@@ -89,6 +114,9 @@ tdsdump_off(TDSDUMP_OFF_ITEM *off_item)
 	off_item->next = off_list;
 	off_list = off_item;
 	tds_mutex_unlock(&g_dump_mutex);
+#if ENABLE_ASYNC_LOG
+	++tls_dump_off;
+#endif
 }				/* tdsdump_off()  */
 
 
@@ -106,6 +134,9 @@ tdsdump_on(TDSDUMP_OFF_ITEM *off_item)
 	for (curr = &off_list; *curr != NULL; curr = &(*curr)->next) {
 		if (*curr == off_item) {
 			*curr = (*curr)->next;
+#if ENABLE_ASYNC_LOG
+			--tls_dump_off;
+#endif
 			break;
 		}
 	}
@@ -141,6 +172,9 @@ tdsdump_open(const char *filename)
 	}
 
 	tds_write_dump = 0;
+#if ENABLE_ASYNC_LOG
+	tdsdump_stop_writer();
+#endif
 
 	/* free old one */
 	if (g_dumpfile != NULL && g_dumpfile != stdout && g_dumpfile != stderr)
@@ -170,8 +204,12 @@ tdsdump_open(const char *filename)
 		result = 0;
 	}
 
-	if (result)
+	if (result) {
 		tds_write_dump = 1;
+#if ENABLE_ASYNC_LOG
+		tdsdump_start_writer();
+#endif
+	}
 	tds_mutex_unlock(&g_dump_mutex);
 
 	if (result) {
@@ -213,6 +251,9 @@ tdsdump_close(void)
 {
 	tds_mutex_lock(&g_dump_mutex);
 	tds_write_dump = 0;
+#if ENABLE_ASYNC_LOG
+	tdsdump_stop_writer();
+#endif
 	if (g_dumpfile != NULL && g_dumpfile != stdout && g_dumpfile != stderr)
 		fclose(g_dumpfile);
 	g_dumpfile = NULL;
@@ -221,15 +262,19 @@ tdsdump_close(void)
 	tds_mutex_unlock(&g_dump_mutex);
 }				/* tdsdump_close()  */
 
+/**
+ * Write the prefix of a log line.
+ * \param time_str  time of the record, NULL to use current time
+ */
 static void
-tdsdump_start(FILE *file, const char *fname, int line)
+tdsdump_start(FILE *file, const char *fname, int line, const char *time_str)
 {
 	char buf[128], *pbuf;
 	int started = 0;
 
 	/* write always time before log */
 	if (tds_debug_flags & TDS_DBGFLAG_TIME) {
-		fputs(tds_timestamp_str(buf, 127), file);
+		fputs(time_str ? time_str : tds_timestamp_str(buf, 127), file);
 		started = 1;
 	}
 
@@ -279,57 +324,16 @@ current_thread_is_excluded(void)
 	return false;
 }
 
-#undef tdsdump_dump_buf
 /**
- * Dump the contents of data into the log file in a human readable format.
- * \param file       source file name
- * \param level_line line and level combined. This and file are automatically computed by
- *                   TDS_DBG_* macros.
- * \param msg        message to print before dump
- * \param buf        buffer to dump
- * \param length     number of bytes in the buffer
+ * Write data in hexadecimal and ASCII, 16 bytes per line.
  */
-void
-tdsdump_dump_buf(const char* file, unsigned int level_line, const char *msg, const void *buf, size_t length)
+static void
+tdsdump_hex(FILE *dumpfile, const void *buf, size_t length)
 {
 	size_t i, j;
 #define BYTES_PER_LINE 16
 	const unsigned char *data = (const unsigned char *) buf;
-	const int debug_lvl = level_line & 15;
-	const int line = level_line >> 4;
 	char line_buf[BYTES_PER_LINE * 8 + 16], *p;
-	FILE *dumpfile;
-
-	if (((tds_debug_flags >> debug_lvl) & 1) == 0 || !tds_write_dump)
-		return;
-
-	if (!g_dumpfile && !g_dump_filename)
-		return;
-
-	tds_mutex_lock(&g_dump_mutex);
-
-	if (current_thread_is_excluded()) {
-		tds_mutex_unlock(&g_dump_mutex);
-		return;
-	}
-
-	dumpfile = g_dumpfile;
-#ifdef TDS_HAVE_MUTEX
-	if (tds_g_append_mode && dumpfile == NULL)
-		dumpfile = g_dumpfile = tdsdump_append();
-#else
-	if (tds_g_append_mode)
-		dumpfile = tdsdump_append();
-#endif
-
-	if (dumpfile == NULL) {
-		tds_mutex_unlock(&g_dump_mutex);
-		return;
-	}
-
-	tdsdump_start(dumpfile, file, line);
-
-	fprintf(dumpfile, "%s\n", msg);
 
 	for (i = 0; i < length; i += BYTES_PER_LINE) {
 		p = line_buf;
@@ -369,6 +373,431 @@ tdsdump_dump_buf(const char* file, unsigned int level_line, const char *msg, con
 		fputs(line_buf, dumpfile);
 	}
 	fputs("\n", dumpfile);
+}
+
+#if ENABLE_ASYNC_LOG
+/* size of the log buffer of every thread, must be a power of 2 */
+#define TDSDUMP_BUFFER_SIZE (128u * 1024u)
+/* bigger records are written directly */
+#define TDSDUMP_MAX_RECORD (TDSDUMP_BUFFER_SIZE / 4u)
+/* interval for the writer thread to flush buffers, in milliseconds */
+#define TDSDUMP_FLUSH_MS 50
+
+enum {
+	TDSDUMP_REC_WRAP,	/**< skip to the start of the buffer */
+	TDSDUMP_REC_LOG,	/**< text from tdsdump_log */
+	TDSDUMP_REC_DUMP,	/**< message and data from tdsdump_dump_buf */
+};
+
+/** Header of a log record, followed by text and data */
+typedef struct {
+	/** record size, header included, multiple of 8 */
+	unsigned int size;
+	unsigned int kind;
+	unsigned int line;
+	unsigned int msg_len;
+	size_t data_len;
+	/** global order of the records */
+	TDS_UINT8 seq;
+	const char *file;
+	struct timeval tv;
+} TDSDUMP_RECORD;
+
+/**
+ * Log buffer of a thread.
+ * This is a ring filled by the owner thread without locks and
+ * emptied by the writer thread or any other thread holding g_dump_mutex.
+ */
+typedef struct tdsdump_buffer {
+	struct tdsdump_buffer *next;
+	/** end of written records, changed only by owner thread */
+	size_t head;
+	/** start of records not written to file, changed only with g_dump_mutex held */
+	size_t tail;
+	/** owner thread exited, free when empty */
+	bool dead;
+	unsigned char data[TDSDUMP_BUFFER_SIZE];
+} TDSDUMP_BUFFER;
+
+/** list of thread buffers, protected by g_dump_mutex */
+static TDSDUMP_BUFFER *g_dump_buffers;
+static __thread TDSDUMP_BUFFER *tls_dump_buffer;
+static TDS_UINT8 g_dump_seq;
+static pthread_key_t g_dump_key;
+static pthread_once_t g_dump_once = PTHREAD_ONCE_INIT;
+static bool g_dump_init_ok;
+static tds_condition g_dump_cond;
+static tds_thread g_dump_writer;
+static bool g_dump_stop;
+
+/**
+ * Called at thread exit, buffer will be freed when empty.
+ */
+static void
+tdsdump_buffer_release(void *arg)
+{
+	TDSDUMP_BUFFER *buf = (TDSDUMP_BUFFER *) arg;
+
+	tds_mutex_lock(&g_dump_mutex);
+	buf->dead = true;
+	if (!g_dump_async)
+		tdsdump_drain();
+	tds_mutex_unlock(&g_dump_mutex);
+}
+
+static void
+tdsdump_atfork_prepare(void)
+{
+	tds_mutex_lock(&g_dump_mutex);
+}
+
+static void
+tdsdump_atfork_parent(void)
+{
+	tds_mutex_unlock(&g_dump_mutex);
+}
+
+/* writer thread is not running in the child */
+static void
+tdsdump_atfork_child(void)
+{
+	g_dump_async = 0;
+	tds_mutex_unlock(&g_dump_mutex);
+}
+
+static void
+tdsdump_async_init(void)
+{
+	if (pthread_key_create(&g_dump_key, tdsdump_buffer_release))
+		return;
+	if (tds_cond_init(&g_dump_cond))
+		return;
+	pthread_atfork(tdsdump_atfork_prepare, tdsdump_atfork_parent, tdsdump_atfork_child);
+	g_dump_init_ok = true;
+}
+
+static TDSDUMP_BUFFER *
+tdsdump_buffer_get(void)
+{
+	TDSDUMP_BUFFER *buf = tls_dump_buffer;
+
+	if (TDS_LIKELY(buf != NULL))
+		return buf;
+
+	buf = tds_new(TDSDUMP_BUFFER, 1);
+	if (!buf)
+		return NULL;
+	buf->head = buf->tail = 0;
+	buf->dead = false;
+	if (pthread_setspecific(g_dump_key, buf)) {
+		free(buf);
+		return NULL;
+	}
+
+	tds_mutex_lock(&g_dump_mutex);
+	buf->next = g_dump_buffers;
+	g_dump_buffers = buf;
+	tds_mutex_unlock(&g_dump_mutex);
+
+	tls_dump_buffer = buf;
+	return buf;
+}
+
+/**
+ * Get space for a record in the buffer.
+ * @return record or NULL if buffer is full
+ */
+static TDSDUMP_RECORD *
+tdsdump_buffer_reserve(TDSDUMP_BUFFER *buf, size_t size)
+{
+	size_t head = buf->head;
+	size_t pos = head & (TDSDUMP_BUFFER_SIZE - 1);
+	size_t pad = TDSDUMP_BUFFER_SIZE - pos < size ? TDSDUMP_BUFFER_SIZE - pos : 0;
+
+	if (head + pad + size - __atomic_load_n(&buf->tail, __ATOMIC_ACQUIRE) > TDSDUMP_BUFFER_SIZE)
+		return NULL;
+
+	/* record must be contiguous, skip the end of the buffer */
+	if (pad) {
+		if (pad >= sizeof(TDSDUMP_RECORD))
+			((TDSDUMP_RECORD *) (buf->data + pos))->kind = TDSDUMP_REC_WRAP;
+		head += pad;
+		__atomic_store_n(&buf->head, head, __ATOMIC_RELEASE);
+	}
+	return (TDSDUMP_RECORD *) (buf->data + (head & (TDSDUMP_BUFFER_SIZE - 1)));
+}
+
+/**
+ * Get first record not written from a buffer.
+ * g_dump_mutex must be held.
+ */
+static const TDSDUMP_RECORD *
+tdsdump_buffer_peek(TDSDUMP_BUFFER *buf)
+{
+	size_t head = __atomic_load_n(&buf->head, __ATOMIC_ACQUIRE);
+
+	while (buf->tail != head) {
+		size_t pos = buf->tail & (TDSDUMP_BUFFER_SIZE - 1);
+		const TDSDUMP_RECORD *rec = (const TDSDUMP_RECORD *) (buf->data + pos);
+
+		if (TDSDUMP_BUFFER_SIZE - pos >= sizeof(TDSDUMP_RECORD) && rec->kind != TDSDUMP_REC_WRAP)
+			return rec;
+		__atomic_store_n(&buf->tail, buf->tail + (TDSDUMP_BUFFER_SIZE - pos), __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+static void
+tdsdump_write_record(FILE *dumpfile, const TDSDUMP_RECORD *rec)
+{
+	char time_buf[64], *time_str = NULL;
+	const char *text = (const char *) (rec + 1);
+
+	if (tds_debug_flags & TDS_DBGFLAG_TIME) {
+		struct tm res;
+		time_t t = rec->tv.tv_sec;
+
+		time_buf[0] = 0;
+		if (tds_localtime_r(&t, &res))
+			strftime(time_buf, 20, "%H:%M:%S", &res);
+		sprintf(strchr(time_buf, 0), ".%06lu", (unsigned long) rec->tv.tv_usec);
+		time_str = time_buf;
+	}
+
+	tdsdump_start(dumpfile, rec->file, rec->line, time_str);
+	fwrite(text, 1, rec->msg_len, dumpfile);
+	if (rec->kind == TDSDUMP_REC_DUMP) {
+		fputc('\n', dumpfile);
+		tdsdump_hex(dumpfile, text + rec->msg_len, rec->data_len);
+	}
+}
+
+/**
+ * Write all buffered records to the log file in the order
+ * they were produced.
+ * g_dump_mutex must be held.
+ */
+static void
+tdsdump_drain(void)
+{
+	TDSDUMP_BUFFER *buf, **pbuf;
+	FILE *dumpfile;
+
+	tds_mutex_check_owned(&g_dump_mutex);
+
+	dumpfile = g_dumpfile;
+	if (tds_g_append_mode && dumpfile == NULL)
+		dumpfile = g_dumpfile = tdsdump_append();
+
+	for (;;) {
+		TDSDUMP_BUFFER *min_buf = NULL;
+		const TDSDUMP_RECORD *rec, *min_rec = NULL;
+
+		for (buf = g_dump_buffers; buf; buf = buf->next) {
+			rec = tdsdump_buffer_peek(buf);
+			if (rec && (!min_rec || rec->seq < min_rec->seq)) {
+				min_rec = rec;
+				min_buf = buf;
+			}
+		}
+		if (!min_rec)
+			break;
+
+		if (dumpfile)
+			tdsdump_write_record(dumpfile, min_rec);
+		__atomic_store_n(&min_buf->tail, min_buf->tail + min_rec->size, __ATOMIC_RELEASE);
+	}
+	if (dumpfile)
+		fflush(dumpfile);
+
+	/* free buffers of terminated threads */
+	for (pbuf = &g_dump_buffers; (buf = *pbuf) != NULL; ) {
+		if (buf->dead) {
+			*pbuf = buf->next;
+			free(buf);
+		} else {
+			pbuf = &buf->next;
+		}
+	}
+}
+
+/**
+ * Add a record to the buffer of current thread.
+ * @return false if record can't be buffered
+ */
+static bool
+tdsdump_async_record(unsigned int kind, const char *file, int line,
+		     const char *msg, size_t msg_len, const void *data, size_t data_len)
+{
+	size_t size = (sizeof(TDSDUMP_RECORD) + msg_len + data_len + 7u) & ~((size_t) 7u);
+	TDSDUMP_BUFFER *buf;
+	TDSDUMP_RECORD *rec;
+	char *p;
+
+	if (size > TDSDUMP_MAX_RECORD)
+		return false;
+
+	buf = tdsdump_buffer_get();
+	if (!buf)
+		return false;
+
+	rec = tdsdump_buffer_reserve(buf, size);
+	if (TDS_UNLIKELY(!rec)) {
+		/* writer thread is behind, write records ourselves */
+		tds_mutex_lock(&g_dump_mutex);
+		tdsdump_drain();
+		tds_mutex_unlock(&g_dump_mutex);
+		rec = tdsdump_buffer_reserve(buf, size);
+		if (!rec)
+			return false;
+	}
+
+	rec->size = (unsigned int) size;
+	rec->kind = kind;
+	rec->line = line;
+	rec->msg_len = (unsigned int) msg_len;
+	rec->data_len = data_len;
+	rec->seq = __atomic_fetch_add(&g_dump_seq, 1, __ATOMIC_RELAXED);
+	rec->file = file;
+	gettimeofday(&rec->tv, NULL);
+	p = (char *) (rec + 1);
+	memcpy(p, msg, msg_len);
+	if (data_len)
+		memcpy(p + msg_len, data, data_len);
+
+	__atomic_store_n(&buf->head, buf->head + size, __ATOMIC_RELEASE);
+
+	/* wake up writer before buffer is full */
+	if (buf->head - __atomic_load_n(&buf->tail, __ATOMIC_RELAXED) > TDSDUMP_BUFFER_SIZE / 2)
+		tds_cond_signal(&g_dump_cond);
+	return true;
+}
+
+static bool
+tdsdump_async_log(const char *file, int line, const char *fmt, va_list ap)
+{
+	char text[1024];
+	int len;
+
+	len = vsnprintf(text, sizeof(text), fmt, ap);
+	if (len < 0 || len >= (int) sizeof(text))
+		return false;
+	return tdsdump_async_record(TDSDUMP_REC_LOG, file, line, text, len, NULL, 0);
+}
+
+static TDS_THREAD_PROC_DECLARE(tdsdump_writer_proc, arg)
+{
+	tds_mutex_lock(&g_dump_mutex);
+	while (!g_dump_stop) {
+		tdsdump_drain();
+		tds_cond_timedwait(&g_dump_cond, &g_dump_mutex, TDSDUMP_FLUSH_MS);
+	}
+	tdsdump_drain();
+	tds_mutex_unlock(&g_dump_mutex);
+	return TDS_THREAD_RESULT(0);
+}
+
+/**
+ * Start the thread writing buffered records.
+ * g_dump_mutex must be held.
+ */
+static void
+tdsdump_start_writer(void)
+{
+	pthread_once(&g_dump_once, tdsdump_async_init);
+	if (!g_dump_init_ok || g_dump_async)
+		return;
+
+	g_dump_stop = false;
+	if (tds_thread_create(&g_dump_writer, tdsdump_writer_proc, NULL) == 0)
+		__atomic_store_n(&g_dump_async, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Stop the writer thread, all records are written.
+ * g_dump_mutex must be held, it's released while waiting the thread.
+ */
+static void
+tdsdump_stop_writer(void)
+{
+	if (!g_dump_async)
+		return;
+
+	__atomic_store_n(&g_dump_async, 0, __ATOMIC_RELEASE);
+	g_dump_stop = true;
+	tds_cond_signal(&g_dump_cond);
+	tds_mutex_unlock(&g_dump_mutex);
+	tds_thread_join(g_dump_writer, NULL);
+	tds_mutex_lock(&g_dump_mutex);
+
+	/* records added while the thread was exiting */
+	tdsdump_drain();
+}
+#endif
+
+#undef tdsdump_dump_buf
+/**
+ * Dump the contents of data into the log file in a human readable format.
+ * \param file       source file name
+ * \param level_line line and level combined. This and file are automatically computed by
+ *                   TDS_DBG_* macros.
+ * \param msg        message to print before dump
+ * \param buf        buffer to dump
+ * \param length     number of bytes in the buffer
+ */
+void
+tdsdump_dump_buf(const char* file, unsigned int level_line, const char *msg, const void *buf, size_t length)
+{
+	const int debug_lvl = level_line & 15;
+	const int line = level_line >> 4;
+	FILE *dumpfile;
+
+	if (((tds_debug_flags >> debug_lvl) & 1) == 0 || !tds_write_dump)
+		return;
+
+	if (!g_dumpfile && !g_dump_filename)
+		return;
+
+#if ENABLE_ASYNC_LOG
+	/* data are formatted by the writer thread */
+	if (__atomic_load_n(&g_dump_async, __ATOMIC_ACQUIRE)) {
+		if (tls_dump_off)
+			return;
+		if (tdsdump_async_record(TDSDUMP_REC_DUMP, file, line, msg, strlen(msg), buf, length))
+			return;
+	}
+#endif
+
+	tds_mutex_lock(&g_dump_mutex);
+
+	if (current_thread_is_excluded()) {
+		tds_mutex_unlock(&g_dump_mutex);
+		return;
+	}
+
+#if ENABLE_ASYNC_LOG
+	/* keep order with buffered records */
+	tdsdump_drain();
+#endif
+
+	dumpfile = g_dumpfile;
+#ifdef TDS_HAVE_MUTEX
+	if (tds_g_append_mode && dumpfile == NULL)
+		dumpfile = g_dumpfile = tdsdump_append();
+#else
+	if (tds_g_append_mode)
+		dumpfile = tdsdump_append();
+#endif
+
+	if (dumpfile == NULL) {
+		tds_mutex_unlock(&g_dump_mutex);
+		return;
+	}
+
+	tdsdump_start(dumpfile, file, line, NULL);
+
+	fprintf(dumpfile, "%s\n", msg);
+	tdsdump_hex(dumpfile, buf, length);
 
 	fflush(dumpfile);
 
@@ -406,6 +835,20 @@ tdsdump_log(const char* file, unsigned int level_line, const char *fmt, ...)
 	if (!g_dumpfile && !g_dump_filename)
 		return;
 
+#if ENABLE_ASYNC_LOG
+	if (__atomic_load_n(&g_dump_async, __ATOMIC_ACQUIRE)) {
+		bool done;
+
+		if (tls_dump_off)
+			return;
+		va_start(ap, fmt);
+		done = tdsdump_async_log(file, line, fmt, ap);
+		va_end(ap);
+		if (done)
+			return;
+	}
+#endif
+
 	tds_mutex_lock(&g_dump_mutex);
 
 	if (current_thread_is_excluded()) {
@@ -413,6 +856,11 @@ tdsdump_log(const char* file, unsigned int level_line, const char *fmt, ...)
 		return;
 	}
 
+#if ENABLE_ASYNC_LOG
+	/* keep order with buffered records */
+	tdsdump_drain();
+#endif
+
 	dumpfile = g_dumpfile;
 #ifdef TDS_HAVE_MUTEX
 	if (tds_g_append_mode && dumpfile == NULL)
@@ -427,7 +875,7 @@ tdsdump_log(const char* file, unsigned int level_line, const char *fmt, ...)
 		return;
 	}
 
-	tdsdump_start(dumpfile, file, line);
+	tdsdump_start(dumpfile, file, line, NULL);
 
 	va_start(ap, fmt);
 
@@ -48,6 +48,7 @@
 #include <freetds/tds.h>
 #include <freetds/iconv.h>
 #include <freetds/utils/string.h>
+#include <freetds/utils.h>
 #include <freetds/bytes.h>
 #include <freetds/tls.h>
 #include <freetds/stream.h>
@@ -440,6 +441,60 @@ tds_setup_connection(TDSSOCKET *tds, TDSLOGIN *login, bool set_db, bool set_spid
 	return erc;
 }
 
+/**
+ * Try to connect to all server addresses at the same time.
+ * Only TCP addresses are used and every address is tried once, the
+ * first connection established is kept.
+ * @return TDSEOK on success or an error
+ */
+static TDSERRNO
+tds_open_socket_parallel(TDSSOCKET * tds, struct addrinfo *addrs, unsigned int port, int timeout_ms, int *p_oserr)
+{
+	struct addrinfo *addr, *list;
+	unsigned int num = 0, i;
+	TDSERRNO erc;
+	char name[128], other[128];
+
+	for (addr = addrs; addr != NULL; addr = addr->ai_next)
+		++num;
+
+	list = tds_new(struct addrinfo, num);
+	if (!list)
+		return TDSEMEM;
+
+	num = 0;
+	for (addr = addrs; addr != NULL; addr = addr->ai_next) {
+#ifndef _WIN32
+		if (addr->ai_socktype != SOCK_STREAM)
+			continue;
+#endif
+		/* skip duplicates */
+		tds_addrinfo2str(addr, name, sizeof(name));
+		for (i = 0; i < num; ++i)
+			if (list[i].ai_family == addr->ai_family
+			    && strcmp(tds_addrinfo2str(&list[i], other, sizeof(other)), name) == 0)
+				break;
+		if (i < num)
+			continue;
+
+		list[num] = *addr;
+		if (num)
+			list[num - 1].ai_next = &list[num];
+		++num;
+	}
+
+	if (!num) {
+		free(list);
+		return TDSECONN;
+	}
+	list[num - 1].ai_next = NULL;
+
+	tdsdump_log(TDS_DBG_INFO1, "Connecting to %u addresses in parallel\n", num);
+	erc = tds_open_socket(tds, list, port, timeout_ms, p_oserr);
+	free(list);
+	return erc;
+}
+
 /**
  * Do a connection to socket
  * @param tds connection structure. This should be a non-connected connection.
@@ -461,6 +516,8 @@ tds_connect(TDSSOCKET * tds, TDSLOGIN * login, int *p_oserr)
 	struct addrinfo *addrs;
 	int orig_port;
 	bool rerouted = false;
+	bool resolve_port, port_cached, port_retried = false;
+	TDSDISCOVERY info;
 	/* save to restore during redirected connection */
 	unsigned int orig_mars = login->mars;
 
@@ -479,19 +536,29 @@ tds_connect(TDSSOCKET * tds, TDSLOGIN * login, int *p_oserr)
 	}
 
 	if (TDS_MAJOR(login) == 0) {
-		unsigned int i;
+		unsigned int i, num_versions = 0;
 		TDSSAVECONTEXT save_ctx;
 		const TDSCONTEXT *old_ctx = tds_get_ctx(tds);
 		typedef void (*env_chg_func_t) (TDSSOCKET * tds, int type, char *oldval, char *newval);
 		env_chg_func_t old_env_chg = tds->env_chg_func;
+		TDS_USMALLINT try_versions[TDS_VECTOR_SIZE(versions) + 1];
+		const int cfg_port = login->port;
+
+		/* try first the version detected by a previous connection */
+		tds_discovery_get(login, cfg_port, &info);
+		if (info.tds_version)
+			try_versions[num_versions++] = info.tds_version;
+		for (i = 0; i < TDS_VECTOR_SIZE(versions); ++i)
+			if (versions[i] != info.tds_version)
+				try_versions[num_versions++] = versions[i];
 
 		init_save_context(&save_ctx, old_ctx);
 		tds_set_ctx(tds, &save_ctx.ctx);
 		tds->env_chg_func = tds_save_env;
 
-		for (i = 0; i < TDS_VECTOR_SIZE(versions); ++i) {
+		for (i = 0; i < num_versions; ++i) {
 			int orig_size = tds->conn->env.block_size;
-			login->tds_version = versions[i];
+			login->tds_version = try_versions[i];
 			reset_save_context(&save_ctx);
 
 			erc = tds_connect(tds, login, p_oserr);
@@ -511,6 +578,14 @@ tds_connect(TDSSOCKET * tds, TDSLOGIN * login, int *p_oserr)
 		tds_set_ctx(tds, old_ctx);
 		replay_save_context(tds, &save_ctx);
 		free_save_context(&save_ctx);
+
+		if (TDS_SUCCEED(erc)) {
+			info.tds_version = login->tds_version;
+			info.port = 0;
+			tds_discovery_set(login, cfg_port, &info);
+		} else if (info.tds_version) {
+			tds_discovery_invalidate(login, cfg_port);
+		}
 		
 		if (TDS_FAILED(erc))
 			tdserror(tds_get_ctx(tds), tds, -erc, *p_oserr);
@@ -531,6 +606,10 @@ tds_connect(TDSSOCKET * tds, TDSLOGIN * login, int *p_oserr)
 	tds->login = login;
 
 	tds->conn->tds_version = login->tds_version;
+	if (login->packet_pool_size >= 0)
+		tds_set_packet_pool_size(tds->conn, login->packet_pool_size);
+	if (login->statement_cache_size >= 0)
+		tds_set_dynamic_cache_size(tds->conn, login->statement_cache_size);
 
 	/* set up iconv if not already initialized*/
 	if (tds->conn->char_convs[client2ucs2]->to.cd == (iconv_t) -1) {
@@ -563,7 +642,27 @@ tds_connect(TDSSOCKET * tds, TDSLOGIN * login, int *p_oserr)
 reroute:
 	erc = TDSEINTF;
 	orig_port = login->port;
-	for (addrs = login->ip_addrs; addrs != NULL; addrs = addrs->ai_next) {
+	addrs = login->ip_addrs;
+
+	/* use port of the instance found by a previous connection, if any */
+	resolve_port = !rerouted && !login->port && !IS_TDS50(tds->conn) && !tds_dstr_isempty(&login->instance_name);
+	port_cached = false;
+	if (resolve_port && !port_retried && tds_discovery_get(login, 0, &info) && info.port > 0) {
+		login->port = orig_port = info.port;
+		port_cached = true;
+	}
+
+	/*
+	 * If port is known try all addresses at once so we wait at most a
+	 * single timeout. If port has to be discovered from the instance
+	 * name fall back to try one address at a time.
+	 */
+	if (login->multi_subnet_failover && login->port >= 1) {
+		erc = tds_open_socket_parallel(tds, addrs, login->port, connect_timeout, p_oserr);
+		addrs = NULL;
+	}
+
+	for (; addrs != NULL; addrs = addrs->ai_next) {
 
 		/*
 		 * By some reasons ftds forms 3 linked tds_addrinfo (addrs
@@ -606,6 +705,14 @@ reroute:
 		}
 	}
 
+	if (erc != TDSEOK && port_cached) {
+		/* instance could have moved to another port, ask again */
+		tds_discovery_invalidate(login, 0);
+		login->port = 0;
+		port_retried = true;
+		goto reroute;
+	}
+
 	if (erc != TDSEOK) {
 		if (login->port < 1)
 			tdsdump_log(TDS_DBG_ERROR, "invalid port number\n");
@@ -613,6 +720,12 @@ reroute:
 		tdserror(tds_get_ctx(tds), tds, erc, *p_oserr);
 		return -erc;
 	}
+
+	if (resolve_port && !port_cached) {
+		info.tds_version = 0;
+		info.port = login->port;
+		tds_discovery_set(login, 0, &info);
+	}
 		
 	/*
 	 * Beyond this point, we're connected to the server.  We know we have a valid TCP/IP address+socket pair.  
@@ -622,6 +735,8 @@ reroute:
 		
 	tds_set_state(tds, TDS_IDLE);
 	tds->conn->spid = -1;
+	tds->conn->utf8_support = 0;
+	tds->conn->recovery.acknowledged = 0;
 
 	/* discard possible previous authentication */
 	if (tds->conn->authentication) {
@@ -721,11 +836,330 @@ reroute:
 	return TDS_SUCCESS;
 }
 
+/**
+ * Save information needed to restore the session later.
+ * Called after a successful login, not during recovery.
+ */
+static void
+tds_recovery_init(TDSSOCKET * tds, TDSLOGIN * login)
+{
+	TDSCONNECTION *conn = tds->conn;
+	TDSSESSIONRECOVERY *recovery = &conn->recovery;
+
+	tds_free_login(recovery->login);
+	recovery->login = login;
+	TDS_ZERO_FREE(recovery->database);
+	TDS_ZERO_FREE(recovery->language);
+	tds_free_session_states(recovery->states);
+	recovery->states = NULL;
+	if (!login)
+		return;
+
+	if (conn->env.database)
+		recovery->database = strdup(conn->env.database);
+	if (conn->env.language)
+		recovery->language = strdup(conn->env.language);
+	memcpy(recovery->collation, conn->collation, sizeof(recovery->collation));
+}
+
 int
 tds_connect_and_login(TDSSOCKET * tds, TDSLOGIN * login)
 {
 	int oserr = 0;
-	return tds_connect(tds, login, &oserr);
+	int erc;
+	TDSLOGIN *copy = NULL;
+
+	/* keep a copy of the login to be able to restore the session, addresses are resolved again */
+	if (login->connect_retry_count > 0 && !login->mars)
+		copy = tds_login_dup(login);
+
+	erc = tds_connect(tds, login, &oserr);
+
+	if (TDS_SUCCEED(erc) && copy && tds->conn->recovery.acknowledged) {
+		/* do not detect version again */
+		copy->tds_version = login->tds_version;
+		tds_recovery_init(tds, copy);
+	} else {
+		tds_free_login(copy);
+		tds_recovery_init(tds, NULL);
+	}
+	return erc;
+}
+
+/**
+ * Write a B_VARCHAR string for session recovery data.
+ * \tds
+ * \param out  buffer to write to, NULL to just compute length
+ * \param s    string in client encoding, NULL for empty
+ * \return bytes written or -1 on error
+ */
+static int
+tds_recovery_put_string(TDSSOCKET * tds, unsigned char *out, const char *s)
+{
+	const char *converted;
+	size_t len;
+
+	if (!s || !s[0]) {
+		if (out)
+			out[0] = 0;
+		return 1;
+	}
+
+	converted = tds_convert_string(tds, tds->conn->char_convs[client2ucs2], s, -1, &len);
+	if (!converted)
+		return -1;
+	len = MIN(len / 2, 255);
+	if (out) {
+		out[0] = (unsigned char) len;
+		memcpy(out + 1, converted, len * 2);
+	}
+	tds_convert_string_free(s, converted);
+	return 1 + (int) len * 2;
+}
+
+/**
+ * Write a SessionRecoveryData structure.
+ * \tds
+ * \param out        buffer to write to, NULL to just compute length
+ * \param database   database, NULL if not changed
+ * \param collation  collation, NULL if not changed
+ * \param language   language, NULL if not changed
+ * \param states     session states
+ * \return bytes written or -1 on error
+ */
+static int
+tds_recovery_put_data(TDSSOCKET * tds, unsigned char *out, const char *database, const TDS_UCHAR *collation,
+		      const char *language, const TDSSESSIONSTATE *states)
+{
+	int len = 4, n;
+
+	n = tds_recovery_put_string(tds, out ? out + len : NULL, database);
+	if (n < 0)
+		return -1;
+	len += n;
+
+	if (out) {
+		out[len] = collation ? 5 : 0;
+		if (collation)
+			memcpy(out + len + 1, collation, 5);
+	}
+	len += collation ? 6 : 1;
+
+	n = tds_recovery_put_string(tds, out ? out + len : NULL, language);
+	if (n < 0)
+		return -1;
+	len += n;
+
+	for (; states; states = states->next) {
+		if (out) {
+			out[len] = states->id;
+			if (states->len < 0xff) {
+				out[len + 1] = (unsigned char) states->len;
+			} else {
+				out[len + 1] = 0xff;
+				TDS_PUT_UA4LE(out + len + 2, states->len);
+			}
+		}
+		len += states->len < 0xff ? 2 : 6;
+		if (out)
+			memcpy(out + len, states->data, states->len);
+		len += states->len;
+	}
+
+	/* length does not include itself */
+	if (out)
+		TDS_PUT_UA4LE(out, len - 4);
+	return len;
+}
+
+/**
+ * Compute feature data for a recovery login: the session state at login
+ * time followed by the changes from it.
+ * \tds
+ * \param out  buffer to write to, NULL to just compute length
+ * \return bytes written or -1 on error
+ */
+static int
+tds_recovery_put_feature(TDSSOCKET * tds, unsigned char *out)
+{
+	TDSCONNECTION *conn = tds->conn;
+	const TDSSESSIONRECOVERY *recovery = &conn->recovery;
+	const TDS_UCHAR *collation = NULL;
+	const char *database = NULL, *language = NULL;
+	int init_len, len;
+	static const TDS_UCHAR no_collation[5] = { 0 };
+
+	if (memcmp(recovery->collation, no_collation, 5) != 0)
+		collation = recovery->collation;
+	init_len = tds_recovery_put_data(tds, out, recovery->database, collation, recovery->language,
+					 recovery->initial_states);
+	if (init_len < 0)
+		return -1;
+
+#define CHANGED(name) (conn->env.name && strcmp(conn->env.name, recovery->name ? recovery->name : "") != 0)
+	if (CHANGED(database))
+		database = conn->env.database;
+	if (CHANGED(language))
+		language = conn->env.language;
+#undef CHANGED
+	collation = NULL;
+	if (memcmp(conn->collation, recovery->collation, 5) != 0)
+		collation = conn->collation;
+	len = tds_recovery_put_data(tds, out ? out + init_len : NULL, database, collation, language, recovery->states);
+	if (len < 0)
+		return -1;
+	return init_len + len;
+}
+
+/**
+ * Check if session can be restored, some state is lost reconnecting.
+ */
+static bool
+tds_recovery_possible(TDSCONNECTION * conn)
+{
+	static const TDS_UCHAR no_transaction[8] = { 0 };
+	TDSDYNAMIC *dyn;
+
+	if (!conn->recovery.acknowledged || !conn->recovery.recoverable)
+		return false;
+#if ENABLE_ODBC_MARS
+	if (conn->mars)
+		return false;
+#endif
+	if (memcmp(conn->tds72_transaction, no_transaction, 8) != 0 || conn->cursors)
+		return false;
+
+	/* prepared statements are lost, only unused cached ones can be prepared again */
+	for (dyn = conn->dyns; dyn; dyn = dyn->next)
+		if (dyn->num_id && (!dyn->cache_key || dyn->cache_users))
+			return false;
+	return true;
+}
+
+/**
+ * Forget statements prepared on the broken connection.
+ * Only unused cached statements can be prepared (see tds_recovery_possible),
+ * they are removed from the cache so they will be prepared again.
+ */
+static void
+tds_recovery_drop_dynamics(TDSCONNECTION * conn)
+{
+	TDSDYNAMIC *dyn, *next;
+
+	for (dyn = conn->dyns; dyn; dyn = next) {
+		next = dyn->next;
+		if (!dyn->num_id)
+			continue;
+		dyn->num_id = 0;
+		tds_dynamic_cache_remove(conn, dyn);
+		tds_deferred_unprepare(conn, dyn);
+	}
+}
+
+/**
+ * Check if an idle connection was closed by the server and, if possible,
+ * connect again restoring the session (TDS 7.4 session recovery).
+ * Called before sending a request, nothing of the request was sent so
+ * it can be sent safely on the new connection.
+ * Reconnection is tried "connect retry count" times waiting
+ * "connect retry interval" seconds between attempts.
+ * \tds
+ * \return true if connection was restored
+ */
+bool
+tds_recover_connection(TDSSOCKET * tds)
+{
+	TDSCONNECTION *conn = tds->conn;
+	TDSSESSIONRECOVERY *recovery = &conn->recovery;
+	TDSSAVECONTEXT save_ctx;
+	const TDSCONTEXT *old_ctx;
+	typedef void (*env_chg_func_t) (TDSSOCKET * tds, int type, char *oldval, char *newval);
+	env_chg_func_t old_env_chg;
+	TDS_INT old_timeout;
+	unsigned int i;
+	int len, n, count, interval, oserr = 0, erc = TDS_FAIL;
+
+	if (!recovery->login || recovery->recovering)
+		return false;
+	if (tds->state == TDS_IDLE) {
+		if (!tds_connection_closed(conn))
+			return false;
+	} else if (tds->state != TDS_DEAD) {
+		return false;
+	}
+
+	if (!tds_recovery_possible(conn)) {
+		tdsdump_log(TDS_DBG_INFO1, "Connection broken, session cannot be restored\n");
+		return false;
+	}
+	tdsdump_log(TDS_DBG_INFO1, "Connection broken, trying to restore session\n");
+
+	/* build state to restore before resetting connection */
+	len = tds_recovery_put_feature(tds, NULL);
+	if (len < 0 || !(recovery->data = tds_new(unsigned char, len)))
+		return false;
+	recovery->data_len = tds_recovery_put_feature(tds, recovery->data);
+
+	tds_close_socket(tds);
+
+	count = recovery->login->connect_retry_count;
+	interval = recovery->login->connect_retry_interval >= 0 ? recovery->login->connect_retry_interval : 10;
+
+	/* errors are reported only if all attempts fail */
+	old_ctx = tds_get_ctx(tds);
+	old_env_chg = tds->env_chg_func;
+	old_timeout = tds->query_timeout;
+	init_save_context(&save_ctx, old_ctx);
+	tds_set_ctx(tds, &save_ctx.ctx);
+	tds->env_chg_func = tds_save_env;
+	recovery->recovering = 1;
+
+	for (n = 0; n < count; ++n) {
+		TDSLOGIN *login;
+
+		if (n)
+			tds_sleep_ms(interval * 1000);
+		reset_save_context(&save_ctx);
+
+		login = tds_login_dup(recovery->login);
+		erc = TDS_FAIL;
+		if (login && TDS_SUCCEED(tds_lookup_host_set(tds_dstr_cstr(&login->server_host_name), &login->ip_addrs)))
+			erc = tds_connect(tds, login, &oserr);
+		tds->login = NULL;
+		tds_free_login(login);
+
+		/* connected but server refused to restore the session */
+		if (TDS_SUCCEED(erc) && !recovery->acknowledged) {
+			tdsdump_log(TDS_DBG_ERROR, "Server did not restore session\n");
+			tds_close_socket(tds);
+			erc = TDS_FAIL;
+			break;
+		}
+		if (TDS_SUCCEED(erc))
+			break;
+		tds_close_socket(tds);
+	}
+
+	recovery->recovering = 0;
+	TDS_ZERO_FREE(recovery->data);
+	recovery->data_len = 0;
+	tds->query_timeout = old_timeout;
+	tds->env_chg_func = old_env_chg;
+	tds_set_ctx(tds, old_ctx);
+
+	if (TDS_SUCCEED(erc)) {
+		/* messages from login are not interesting, environment changes are */
+		for (i = 0; i < save_ctx.num_msg; ++i)
+			tds_free_msg(&save_ctx.msgs[i].msg);
+		save_ctx.num_msg = 0;
+
+		tds_recovery_drop_dynamics(conn);
+		tdsdump_log(TDS_DBG_INFO1, "Session restored\n");
+	}
+	replay_save_context(tds, &save_ctx);
+	free_save_context(&save_ctx);
+
+	return TDS_SUCCEED(erc);
 }
 
 static int
@@ -967,6 +1401,9 @@ tds7_send_login(TDSSOCKET * tds, const TDSLOGIN * login)
 		"\x0a\x01\x00\x00\x00\x01"	/* Enable UTF-8 */
 		"\xff";
 	size_t ext_len = IS_TDS74_PLUS(tds->conn) ? sizeof(ext_data) - 1 : 0;
+	/* session recovery, data are empty unless restoring a broken connection */
+	const TDSSESSIONRECOVERY *recovery = &tds->conn->recovery;
+	size_t recovery_len = ext_len && login->connect_retry_count > 0 ? 5 + recovery->data_len : 0;
 
 	/* fields */
 	enum {
@@ -1088,7 +1525,7 @@ tds7_send_login(TDSSOCKET * tds, const TDSLOGIN * login)
 	tds7_crypt_pass(pwd, data_fields[NEW_PASSWORD].len, pwd);
 	packet_size += data_stream.size;
 	if (ext_len) {
-		packet_size += ext_len;
+		packet_size += ext_len + recovery_len;
 		pwd = (unsigned char *) data + data_fields[EXTENSION].pos - current_pos;
 		TDS_PUT_UA4LE(pwd, current_pos + data_stream.size + auth_len);
 	}
@@ -1214,6 +1651,11 @@ tds7_send_login(TDSSOCKET * tds, const TDSLOGIN * login)
 	if (tds->conn->authentication)
 		tds_put_n(tds, tds->conn->authentication->packet, auth_len);
 
+	if (recovery_len) {
+		tds_put_byte(tds, TDS_FEATURE_SESSIONRECOVERY);
+		TDS_PUT_INT(tds, recovery->data_len);
+		tds_put_n(tds, recovery->data, recovery->data_len);
+	}
 	if (ext_len)
 		tds_put_n(tds, ext_data, ext_len);
 
@@ -237,6 +237,8 @@ tds_dynamic_deallocated(TDSCONNECTION *conn, TDSDYNAMIC *dyn)
 	*victim = dyn->next;
 	dyn->next = NULL;
 
+	tds_dynamic_cache_remove(conn, dyn);
+
 	/* assure there is no id left */
 	dyn->num_id = 0;
 
@@ -570,10 +572,24 @@ tds_alloc_row(TDSRESULTINFO * res_info)
 		return TDS_FAIL;
 	res_info->row_free = tds_row_free;
 
-	/* fill column_data */
-	row_size = 0;
-	for (i = 0; i < num_cols; ++i) {
-		col = res_info->columns[i];
+	tds_reset_row_column_data(res_info);
+
+	return TDS_SUCCESS;
+}
+
+/**
+ * Make column_data of every column point back to current_row.
+ * Used after column data was pointing to some other buffer.
+ */
+void
+tds_reset_row_column_data(TDSRESULTINFO * res_info)
+{
+	int i;
+	unsigned char *ptr = res_info->current_row;
+	TDS_UINT row_size = 0;
+
+	for (i = 0; i < res_info->num_cols; ++i) {
+		TDSCOLUMN *col = res_info->columns[i];
 
 		col->column_data = ptr + row_size;
 
@@ -581,8 +597,6 @@ tds_alloc_row(TDSRESULTINFO * res_info)
 		row_size += (TDS_ALIGN_SIZE - 1);
 		row_size -= row_size % TDS_ALIGN_SIZE;
 	}
-
-	return TDS_SUCCESS;
 }
 
 TDSRET
@@ -999,6 +1013,10 @@ tds_alloc_login(int use_environment)
 	login->check_ssl_hostname = 1;
 	login->use_utf16 = 1;
 	login->bulk_copy = 1;
+	login->packet_pool_size = -1;
+	login->statement_cache_size = -1;
+	login->connect_retry_count = -1;
+	login->connect_retry_interval = -1;
 	tds_dstr_init(&login->server_name);
 	tds_dstr_init(&login->language);
 	tds_dstr_init(&login->server_charset);
@@ -1014,6 +1032,7 @@ tds_alloc_login(int use_environment)
 
 	tds_dstr_init(&login->database);
 	tds_dstr_init(&login->dump_file);
+	tds_dstr_init(&login->discovery_file);
 	tds_dstr_init(&login->client_charset);
 	tds_dstr_init(&login->instance_name);
 	tds_dstr_init(&login->server_realm_name);
@@ -1073,6 +1092,7 @@ tds_free_login(TDSLOGIN * login)
 
 	tds_dstr_free(&login->database);
 	tds_dstr_free(&login->dump_file);
+	tds_dstr_free(&login->discovery_file);
 	tds_dstr_free(&login->instance_name);
 	tds_dstr_free(&login->server_realm_name);
 	tds_dstr_free(&login->server_spn);
@@ -1084,6 +1104,84 @@ tds_free_login(TDSLOGIN * login)
 	free(login);
 }
 
+/**
+ * Duplicate a login structure.
+ * Addresses are not copied, caller should resolve server host name again.
+ * \param login  login to copy
+ * \return new login or NULL on failure
+ */
+TDSLOGIN *
+tds_login_dup(const TDSLOGIN * login)
+{
+	TDSLOGIN *copy;
+	unsigned int i;
+	bool ok = true;
+	static const size_t dstr_offsets[] = {
+		TDS_OFFSET(TDSLOGIN, server_name),
+		TDS_OFFSET(TDSLOGIN, language),
+		TDS_OFFSET(TDSLOGIN, server_charset),
+		TDS_OFFSET(TDSLOGIN, client_host_name),
+		TDS_OFFSET(TDSLOGIN, server_host_name),
+		TDS_OFFSET(TDSLOGIN, server_realm_name),
+		TDS_OFFSET(TDSLOGIN, server_spn),
+		TDS_OFFSET(TDSLOGIN, db_filename),
+		TDS_OFFSET(TDSLOGIN, cafile),
+		TDS_OFFSET(TDSLOGIN, crlfile),
+		TDS_OFFSET(TDSLOGIN, openssl_ciphers),
+		TDS_OFFSET(TDSLOGIN, app_name),
+		TDS_OFFSET(TDSLOGIN, user_name),
+		TDS_OFFSET(TDSLOGIN, password),
+		TDS_OFFSET(TDSLOGIN, new_password),
+		TDS_OFFSET(TDSLOGIN, library),
+		TDS_OFFSET(TDSLOGIN, client_charset),
+		TDS_OFFSET(TDSLOGIN, database),
+		TDS_OFFSET(TDSLOGIN, instance_name),
+		TDS_OFFSET(TDSLOGIN, dump_file),
+		TDS_OFFSET(TDSLOGIN, discovery_file),
+		TDS_OFFSET(TDSLOGIN, routing_address),
+	};
+
+	copy = tds_new(TDSLOGIN, 1);
+	if (!copy)
+		return NULL;
+
+	*copy = *login;
+	copy->ip_addrs = NULL;
+	for (i = 0; i < TDS_VECTOR_SIZE(dstr_offsets); ++i)
+		tds_dstr_init((DSTR *) ((char *) copy + dstr_offsets[i]));
+	for (i = 0; ok && i < TDS_VECTOR_SIZE(dstr_offsets); ++i)
+		ok = tds_dstr_dup((DSTR *) ((char *) copy + dstr_offsets[i]),
+				  (const DSTR *) ((const char *) login + dstr_offsets[i])) != NULL;
+	if (!ok) {
+		tds_free_login(copy);
+		return NULL;
+	}
+	return copy;
+}
+
+void
+tds_free_session_states(TDSSESSIONSTATE * state)
+{
+	while (state) {
+		TDSSESSIONSTATE *next = state->next;
+
+		free(state);
+		state = next;
+	}
+}
+
+static void
+tds_free_session_recovery(TDSSESSIONRECOVERY * recovery)
+{
+	tds_free_login(recovery->login);
+	free(recovery->database);
+	free(recovery->language);
+	tds_free_session_states(recovery->initial_states);
+	tds_free_session_states(recovery->states);
+	free(recovery->data);
+	memset(recovery, 0, sizeof(*recovery));
+}
+
 TDSPACKET *
 tds_alloc_packet(void *buf, unsigned len)
 {
@@ -1126,11 +1224,15 @@ tds_free_packets(TDSPACKET *packet)
 static void
 tds_deinit_connection(TDSCONNECTION *conn)
 {
+	unsigned i;
+
 	if (conn->authentication)
 		conn->authentication->free(conn, conn->authentication);
 	conn->authentication = NULL;
 	while (conn->dyns)
 		tds_dynamic_deallocated(conn, conn->dyns);
+	tds_dynamic_cache_free(conn);
+	tds_free_session_recovery(&conn->recovery);
 	while (conn->cursors)
 		tds_cursor_deallocated(conn, conn->cursors);
 	tds_ssl_deinit(conn);
@@ -1141,7 +1243,8 @@ tds_deinit_connection(TDSCONNECTION *conn)
 	free(conn->product_name);
 	free(conn->server);
 	tds_free_env(conn);
-	tds_free_packets(conn->packet_cache);
+	for (i = 0; i < TDS_PACKET_POOL_CLASSES; ++i)
+		tds_free_packets(conn->packet_pool.classes[i]);
 	tds_mutex_free(&conn->list_mtx);
 #if ENABLE_ODBC_MARS
 	tds_free_packets(conn->packets);
@@ -1160,6 +1263,7 @@ tds_init_connection(TDSCONNECTION *conn, TDSCONTEXT *context, unsigned int bufsi
 	conn->tds_ctx = context;
 	conn->ncharsize = 1;
 	conn->unicharsize = 1;
+	conn->packet_pool.max_cached = TDS_PACKET_POOL_DEFAULT;
 
 	if (tds_wakeup_init(&conn->wakeup))
 		goto Cleanup;
@@ -1459,6 +1563,7 @@ tds_free_socket(TDSSOCKET * tds)
 
 	tds_connection_remove_socket(tds->conn, tds);
 	tds_free_packets(tds->recv_packet);
+	tds_free_packets(tds->pinned_packets);
 	if (tds->frozen_packets)
 		tds_free_packets(tds->frozen_packets);
 	else
@@ -1882,6 +1987,7 @@ tds_deinit_bcpinfo(TDSBCPINFO *bcpinfo)
 	bcpinfo->bindinfo = NULL;
 	TDS_ZERO_FREE(bcpinfo->sybase_colinfo);
 	bcpinfo->sybase_count = 0;
+	TDS_ZERO_FREE(bcpinfo->arrays);
 }
 
 void
@@ -1921,4 +2027,137 @@ tds_realloc(void **pp, size_t new_size)
 	return p;
 }
 
+/**
+ * Block of memory used by an arena.
+ * Data follow the structure.
+ */
+struct tds_arena_block
+{
+	struct tds_arena_block *next;
+	/** usable bytes */
+	size_t size;
+	/** bytes already allocated */
+	size_t used;
+	/** allocations not released yet */
+	unsigned live;
+};
+
+#define TDS_ARENA_ALIGN(n) (((n) + TDS_ALIGN_SIZE - 1) / TDS_ALIGN_SIZE * TDS_ALIGN_SIZE)
+/** space used by every allocation to point back to its block */
+#define TDS_ARENA_ALLOC_HDR TDS_ARENA_ALIGN(sizeof(TDSARENABLOCK *))
+#define TDS_ARENA_BLOCK_HDR TDS_ARENA_ALIGN(sizeof(TDSARENABLOCK))
+#define TDS_ARENA_MIN_BLOCK 16384u
+
+/**
+ * Allocate memory from an arena.
+ * Memory is aligned as memory returned by malloc and is not initialized.
+ * \param arena arena to allocate from
+ * \param len bytes to allocate
+ * \return pointer to memory or NULL on out of memory
+ */
+void *
+tds_arena_alloc(TDSARENA * arena, size_t len)
+{
+	TDSARENABLOCK *block = arena->blocks;
+	unsigned char *p;
+
+	len = TDS_ARENA_ALLOC_HDR + TDS_ARENA_ALIGN(len);
+	if (!block || block->size - block->used < len) {
+		block = arena->spare;
+		if (block && block->size >= len) {
+			arena->spare = NULL;
+		} else {
+			size_t size = len > TDS_ARENA_MIN_BLOCK ? len : TDS_ARENA_MIN_BLOCK;
+
+			block = (TDSARENABLOCK *) malloc(TDS_ARENA_BLOCK_HDR + size);
+			if (!block)
+				return NULL;
+			block->size = size;
+		}
+		block->used = 0;
+		block->live = 0;
+		block->next = arena->blocks;
+		arena->blocks = block;
+	}
+
+	p = (unsigned char *) block + TDS_ARENA_BLOCK_HDR + block->used;
+	block->used += len;
+	++block->live;
+	*(TDSARENABLOCK **) p = block;
+	return p + TDS_ARENA_ALLOC_HDR;
+}
+
+/**
+ * Release memory allocated from an arena.
+ * Memory is returned to the arena only when all allocations of a block
+ * are released, this allows to use an arena for a queue.
+ * \param arena arena memory was allocated from
+ * \param ptr pointer to release, can be NULL
+ */
+void
+tds_arena_release(TDSARENA * arena, void *ptr)
+{
+	TDSARENABLOCK *block, **prev;
+
+	if (!ptr)
+		return;
+
+	block = *(TDSARENABLOCK **) ((unsigned char *) ptr - TDS_ARENA_ALLOC_HDR);
+	assert(block->live > 0);
+	if (--block->live)
+		return;
+
+	/* current block, just rewind it */
+	if (block == arena->blocks) {
+		block->used = 0;
+		return;
+	}
+
+	for (prev = &arena->blocks; *prev != block; prev = &(*prev)->next)
+		continue;
+	*prev = block->next;
+
+	/* keep largest block for reuse */
+	if (arena->spare && arena->spare->size >= block->size) {
+		free(block);
+	} else {
+		free(arena->spare);
+		arena->spare = block;
+	}
+}
+
+/**
+ * Release all memory allocated from an arena in one shot.
+ * A block is retained to serve next allocations.
+ * \param arena arena to reset
+ */
+void
+tds_arena_reset(TDSARENA * arena)
+{
+	TDSARENABLOCK *block, *next;
+
+	for (block = arena->blocks; block; block = next) {
+		next = block->next;
+		if (!arena->spare || arena->spare->size < block->size) {
+			free(arena->spare);
+			arena->spare = block;
+		} else {
+			free(block);
+		}
+	}
+	arena->blocks = NULL;
+}
+
+/**
+ * Free all memory used by an arena.
+ * \param arena arena to free
+ */
+void
+tds_arena_free(TDSARENA * arena)
+{
+	tds_arena_reset(arena);
+	free(arena->spare);
+	arena->spare = NULL;
+}
+
 /** @} */
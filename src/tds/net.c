@@ -368,7 +368,7 @@ typedef struct {
 } retry_addr;
 
 TDSERRNO
-tds_open_socket(TDSSOCKET *tds, struct addrinfo *addr, unsigned int port, int timeout, int *p_oserr)
+tds_open_socket(TDSSOCKET *tds, struct addrinfo *addr, unsigned int port, int timeout_ms, int *p_oserr)
 {
 	TDSCONNECTION *conn = tds->conn;
 	int len, i;
@@ -416,15 +416,14 @@ tds_open_socket(TDSSOCKET *tds, struct addrinfo *addr, unsigned int port, int ti
 	if (len == 1)
 		addresses[0].retry_count = MAX_RETRY;
 
-	timeout *= 1000;
-	if (!timeout) {
+	if (!timeout_ms) {
 		/* A timeout of zero means wait forever */
-		timeout = -1;
+		timeout_ms = -1;
 	}
 
 	/* now the list is full with sockets trying to connect */
 	while (len) {
-		int rc, poll_timeout = timeout;
+		int rc, poll_timeout = timeout_ms;
 
 		/* timeout */
 		if (poll_timeout >= 0) {
@@ -598,42 +597,87 @@ tds_connection_close(TDSCONNECTION *conn)
 #endif
 }
 
+/**
+ * Check, without blocking, if the server closed the connection.
+ * Used on idle connections where nothing is expected from the server.
+ * \return true if connection was closed or reset by the server
+ */
+bool
+tds_connection_closed(TDSCONNECTION *conn)
+{
+	struct pollfd fd;
+	char c;
+	int len;
+
+	if (TDS_IS_SOCKET_INVALID(conn->s))
+		return true;
+
+	fd.fd = conn->s;
+	fd.events = POLLIN;
+	fd.revents = 0;
+	if (poll(&fd, 1, 0) <= 0)
+		return false;
+
+	/* readable, check if it's just data or end of stream */
+	len = recv(conn->s, &c, 1, MSG_PEEK);
+	if (len > 0)
+		return false;
+	if (len < 0 && (sock_errno == TDSSOCK_EINTR || TDSSOCK_WOULDBLOCK(sock_errno)))
+		return false;
+	tdsdump_log(TDS_DBG_NETWORK, "connection closed by server\n");
+	return true;
+}
+
 /**
  * Select on a socket until it's available or the timeout expires. 
  * Meanwhile, call the interrupt function. 
+ * \param timeout_ms timeout in milliseconds, 0 to wait forever
  * \return	>0 ready descriptors
  *		 0 timeout 
  * 		<0 error (cf. errno).  Caller should  close socket and return failure. 
  * This function does not call tdserror or close the socket because it can't know the context in which it's being called.   
  */
 int
-tds_select(TDSSOCKET * tds, unsigned tds_sel, int timeout_seconds)
+tds_select(TDSSOCKET * tds, unsigned tds_sel, int timeout_ms)
 {
-	int rc, seconds;
-	unsigned int poll_seconds;
+	int rc;
+	bool has_handler;
+	unsigned int start;
 
 	assert(tds != NULL);
-	assert(timeout_seconds >= 0);
+	assert(timeout_ms >= 0);
 
 	/* 
 	 * The select loop.  
-	 * If an interrupt handler is installed, we iterate once per second, 
-	 * 	else we try once, timing out after timeout_seconds (0 == never). 
-	 * If select(2) is interrupted by a signal (e.g. press ^C in sqsh), we timeout.
-	 * 	(The application can retry if desired by installing a signal handler.)
+	 * If an interrupt handler is installed, we iterate at least once per second, 
+	 * 	else we try once, timing out after timeout_ms (0 == never). 
+	 * If select(2) is interrupted by a signal (e.g. press ^C in sqsh), we poll again
+	 * 	for the remaining time (or call the interrupt handler).
 	 *
-	 * We do not measure current time against end time, to avoid being tricked by ntpd(8) or similar. 
-	 * Instead, we just count down.  
+	 * Time is measured with tds_gettime_ms, which uses a monotonic clock
+	 * where available so we are not tricked by ntpd(8) or similar. 
 	 *
 	 * We exit on the first of these events:
 	 * 1.  a descriptor is ready. (return to caller)
 	 * 2.  select(2) returns an important error.  (return to caller)
-	 * A timeout of zero says "wait forever".  We do that by passing a NULL timeval pointer to select(2). 
+	 * 3.  the deadline expires.
+	 * A timeout of zero says "wait forever".  We do that by passing -1 to poll(2). 
 	 */
-	poll_seconds = (tds_get_ctx(tds) && tds_get_ctx(tds)->int_handler)? 1 : timeout_seconds;
-	for (seconds = timeout_seconds; timeout_seconds == 0 || seconds > 0; seconds -= poll_seconds) {
+	has_handler = tds_get_ctx(tds) && tds_get_ctx(tds)->int_handler;
+	start = tds_gettime_ms();
+	for (;;) {
 		struct pollfd fds[2];
-		int timeout = poll_seconds ? poll_seconds * 1000 : -1;
+		int timeout = -1;
+
+		if (timeout_ms) {
+			unsigned int elapsed = tds_gettime_ms() - start;
+
+			if (elapsed >= (unsigned int) timeout_ms)
+				return 0;
+			timeout = timeout_ms - elapsed;
+		}
+		if (has_handler && (timeout < 0 || timeout > 1000))
+			timeout = 1000;
 
 		if (TDS_IS_SOCKET_INVALID(tds_get_s(tds)))
 			return -1;
@@ -669,8 +713,6 @@ tds_select(TDSSOCKET * tds, unsigned tds_sel, int timeout_seconds)
 
 			switch (sock_errno) {
 			case TDSSOCK_EINTR:
-				/* FIXME this should be global maximun, not loop one */
-				seconds += poll_seconds;
 				break;	/* let interrupt handler be called */
 			default: /* documented: EFAULT, EBADF, EINVAL */
 				errstr = sock_strerror(sock_errno);
@@ -683,7 +725,7 @@ tds_select(TDSSOCKET * tds, unsigned tds_sel, int timeout_seconds)
 
 		assert(rc == 0 || (rc < 0 && sock_errno == TDSSOCK_EINTR));
 
-		if (tds_get_ctx(tds) && tds_get_ctx(tds)->int_handler) {	/* interrupt handler installed */
+		if (has_handler) {	/* interrupt handler installed */
 			/*
 			 * "If hndlintr() returns INT_CANCEL, DB-Library sends an attention token [TDS_BUFSTAT_ATTN]
 			 * to the server. This causes the server to discontinue command processing. 
@@ -696,6 +738,8 @@ tds_select(TDSSOCKET * tds, unsigned tds_sel, int timeout_seconds)
 			int timeout_action = (*tds_get_ctx(tds)->int_handler) (tds_get_parent(tds));
 			switch (timeout_action) {
 			case TDS_INT_CONTINUE:		/* keep waiting */
+				if (timeout_ms && tds_gettime_ms() - start >= (unsigned int) timeout_ms)
+					return 0;
 				continue;
 			case TDS_INT_CANCEL:		/* abort the current command batch */
 							/* FIXME tell tds_goodread() not to call tdserror() */
@@ -708,12 +752,43 @@ tds_select(TDSSOCKET * tds, unsigned tds_sel, int timeout_seconds)
 		}
 		/* 
 		 * We can reach here if no interrupt handler was installed and we either timed out or got EINTR. 
-		 * We cannot be polling, so we are about to drop out of the loop. 
+		 * In the latter case we continue waiting for the remaining time.
 		 */
-		assert(poll_seconds == timeout_seconds);
 	}
-	
-	return 0;
+}
+
+/**
+ * Check if data for a session is already available without reading from the socket.
+ * Data could be buffered by libTDS, by the TLS layer or, using MARS, received
+ * while reading for another session.
+ * Used by event loops which poll on the socket before reading.
+ */
+bool
+tds_read_pending(TDSSOCKET * tds)
+{
+	TDSCONNECTION *conn = tds->conn;
+	bool pending = false;
+
+	if (tds->in_pos < tds->in_len)
+		return true;
+
+	if (conn->tls_session && tds_ssl_pending(conn))
+		return true;
+
+#if ENABLE_ODBC_MARS
+	if (conn->mars) {
+		TDSPACKET *packet;
+
+		tds_mutex_lock(&conn->list_mtx);
+		for (packet = conn->packets; packet; packet = packet->next)
+			if (packet->sid == tds->sid) {
+				pending = true;
+				break;
+			}
+		tds_mutex_unlock(&conn->list_mtx);
+	}
+#endif
+	return pending;
 }
 
 /**
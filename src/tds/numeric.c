@@ -57,6 +57,155 @@ const int tds_numeric_bytes_per_prec[] = {
 TDS_COMPILE_CHECK(maxprecision,
 	MAXPRECISION < TDS_VECTOR_SIZE(tds_numeric_bytes_per_prec) );
 
+/** "00", "01", ... "99", used to output 2 digits at a time */
+const char tds_digit_pairs[201] =
+	"0001020304050607080910111213141516171819"
+	"2021222324252627282930313233343536373839"
+	"4041424344454647484950515253545556575859"
+	"6061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+/*
+ * Numbers with precision up to 18 fit in 64 bit, up to 38 in 128 bit.
+ * These are handled with native arithmetic, larger ones with packets.
+ */
+#define TDS_NUMERIC_PREC_UINT8 18
+
+static const TDS_UINT8 tds_pow10_uint8[TDS_NUMERIC_PREC_UINT8 + 1] = {
+	1u, 10u, 100u, 1000u, 10000u,
+	100000u, 1000000u, 10000000u, 100000000u, 1000000000u,
+	UINT64_C(10000000000), UINT64_C(100000000000), UINT64_C(1000000000000),
+	UINT64_C(10000000000000), UINT64_C(100000000000000), UINT64_C(1000000000000000),
+	UINT64_C(10000000000000000), UINT64_C(100000000000000000), UINT64_C(1000000000000000000)
+};
+
+#if defined(__SIZEOF_INT128__)
+#define TDS_NUMERIC_PREC_UINT128 38
+__extension__ typedef unsigned __int128 TDS_UINT128;
+
+static TDS_UINT128
+tds_pow10_uint128(unsigned int exp)
+{
+	TDS_UINT128 n = 1;
+
+	for (; exp > TDS_NUMERIC_PREC_UINT8; exp -= TDS_NUMERIC_PREC_UINT8)
+		n *= tds_pow10_uint8[TDS_NUMERIC_PREC_UINT8];
+	return n * tds_pow10_uint8[exp];
+}
+#endif
+
+static TDS_UINT8
+tds_numeric_get_uint8(const TDS_NUMERIC * numeric)
+{
+	const unsigned char *p = numeric->array + 1;
+	const unsigned char *const end = numeric->array + tds_numeric_bytes_per_prec[numeric->precision];
+	TDS_UINT8 n = 0;
+
+	for (; p != end; ++p)
+		n = (n << 8) | *p;
+	return n;
+}
+
+static void
+tds_numeric_put_uint8(TDS_NUMERIC * numeric, TDS_UINT8 n)
+{
+	unsigned char *p = numeric->array + tds_numeric_bytes_per_prec[numeric->precision];
+
+	for (; p != numeric->array + 1; n >>= 8)
+		*--p = (unsigned char) n;
+}
+
+#ifdef TDS_NUMERIC_PREC_UINT128
+static TDS_UINT128
+tds_numeric_get_uint128(const TDS_NUMERIC * numeric)
+{
+	const unsigned char *p = numeric->array + 1;
+	const unsigned char *const end = numeric->array + tds_numeric_bytes_per_prec[numeric->precision];
+	TDS_UINT128 n = 0;
+
+	for (; p != end; ++p)
+		n = (n << 8) | *p;
+	return n;
+}
+
+static void
+tds_numeric_put_uint128(TDS_NUMERIC * numeric, TDS_UINT128 n)
+{
+	unsigned char *p = numeric->array + tds_numeric_bytes_per_prec[numeric->precision];
+
+	for (; p != numeric->array + 1; n >>= 8)
+		*--p = (unsigned char) n;
+}
+#endif
+
+/**
+ * Write decimal digits of a number backward.
+ * @param p  end of digits
+ * @return start of digits
+ */
+static char *
+tds_uint8_digits(char *p, TDS_UINT8 n)
+{
+	while (n >= 100u) {
+		p -= 2;
+		memcpy(p, tds_digit_pairs + (unsigned int) (n % 100u) * 2u, 2);
+		n /= 100u;
+	}
+	if (n >= 10u) {
+		p -= 2;
+		memcpy(p, tds_digit_pairs + (unsigned int) n * 2u, 2);
+	} else {
+		*--p = '0' + (char) n;
+	}
+	return p;
+}
+
+#ifdef TDS_NUMERIC_PREC_UINT128
+static char *
+tds_uint128_digits(char *p, TDS_UINT128 n)
+{
+	const TDS_UINT8 chunk = tds_pow10_uint8[TDS_NUMERIC_PREC_UINT8];
+	char *end;
+
+	while (n >= chunk) {
+		end = p;
+		p = tds_uint8_digits(p, (TDS_UINT8) (n % chunk));
+		while (end - p < TDS_NUMERIC_PREC_UINT8)
+			*--p = '0';
+		n /= chunk;
+	}
+	return tds_uint8_digits(p, (TDS_UINT8) n);
+}
+#endif
+
+/**
+ * Output digits adding decimal point.
+ * @param s       output buffer
+ * @param digits  digits of the number, at least scale bytes before it must be available
+ * @param end     end of digits
+ * @param scale   digits after decimal point
+ * @return pointer to terminator written
+ */
+static char *
+tds_put_decimal(char *s, char *digits, const char *end, unsigned int scale)
+{
+	size_t len;
+
+	/* at least one digit before the point */
+	while ((size_t) (end - digits) <= scale)
+		*--digits = '0';
+	len = end - digits - scale;
+	memcpy(s, digits, len);
+	s += len;
+	if (scale) {
+		*s++ = '.';
+		memcpy(s, digits + len, scale);
+		s += scale;
+	}
+	*s = 0;
+	return s;
+}
+
 /*
  * money is a special case of numeric really...that why its here
  */
@@ -66,6 +215,7 @@ tds_money_to_string(const TDS_MONEY * money, char *s, bool use_2_digits)
 	TDS_INT8 mymoney;
 	TDS_UINT8 n;
 	char *p;
+	char digits[32];
 
 	/* sometimes money it's only 4-byte aligned so always compute 64-bit */
 	mymoney = (((TDS_INT8) money->tdsoldmoney.mnyhigh) << 32) | money->tdsoldmoney.mnylow;
@@ -78,13 +228,9 @@ tds_money_to_string(const TDS_MONEY * money, char *s, bool use_2_digits)
 	} else {
 		n = mymoney;
 	}
-	/* if machine is 64 bit you do not need to split n */
-	if (use_2_digits) {
-		n = (n+ 50) / 100;
-		sprintf(p, "%" PRIu64 ".%02u", n / 100u, (unsigned) (n % 100u));
-	} else {
-		sprintf(p, "%" PRIu64 ".%04u", n / 10000u, (unsigned) (n % 10000u));
-	}
+	if (use_2_digits)
+		n = (n + 50) / 100;
+	tds_put_decimal(p, tds_uint8_digits(digits + sizeof(digits), n), digits + sizeof(digits), use_2_digits ? 2 : 4);
 	return s;
 }
 
@@ -105,6 +251,7 @@ tds_numeric_to_string(const TDS_NUMERIC * numeric, char *s)
 
 	int num_bytes;
 	unsigned int remainder, n, i, m;
+	char digits[MAXPRECISION * 2 + 2];
 
 	/* a bit of debug */
 #if ENABLE_EXTRA_CHECKS
@@ -119,6 +266,19 @@ tds_numeric_to_string(const TDS_NUMERIC * numeric, char *s)
 	if (numeric->array[0] == 1)
 		*s++ = '-';
 
+	if (numeric->precision <= TDS_NUMERIC_PREC_UINT8) {
+		tds_put_decimal(s, tds_uint8_digits(digits + sizeof(digits), tds_numeric_get_uint8(numeric)),
+				digits + sizeof(digits), numeric->scale);
+		return 1;
+	}
+#ifdef TDS_NUMERIC_PREC_UINT128
+	if (numeric->precision <= TDS_NUMERIC_PREC_UINT128) {
+		tds_put_decimal(s, tds_uint128_digits(digits + sizeof(digits), tds_numeric_get_uint128(numeric)),
+				digits + sizeof(digits), numeric->scale);
+		return 1;
+	}
+#endif
+
 	/* put number in a 16bit array */
 	number = numeric->array;
 	num_bytes = tds_numeric_bytes_per_prec[numeric->precision];
@@ -268,6 +428,44 @@ tds_numeric_change_prec_scale(TDS_NUMERIC * numeric, unsigned char new_prec, uns
 		return sizeof(TDS_NUMERIC);
 	}
 
+	if (numeric->precision <= TDS_NUMERIC_PREC_UINT8 && new_prec <= TDS_NUMERIC_PREC_UINT8) {
+		TDS_UINT8 n = tds_numeric_get_uint8(numeric);
+
+		if (scale_diff >= 0) {
+			/* check overflow before multiply */
+			if (n >= tds_pow10_uint8[new_prec - scale_diff])
+				return TDS_CONVERT_OVERFLOW;
+			n *= tds_pow10_uint8[scale_diff];
+		} else {
+			n /= tds_pow10_uint8[-scale_diff];
+			if (n >= tds_pow10_uint8[new_prec])
+				return TDS_CONVERT_OVERFLOW;
+		}
+		numeric->precision = new_prec;
+		numeric->scale = new_scale;
+		tds_numeric_put_uint8(numeric, n);
+		return sizeof(TDS_NUMERIC);
+	}
+#ifdef TDS_NUMERIC_PREC_UINT128
+	if (numeric->precision <= TDS_NUMERIC_PREC_UINT128 && new_prec <= TDS_NUMERIC_PREC_UINT128) {
+		TDS_UINT128 n = tds_numeric_get_uint128(numeric);
+
+		if (scale_diff >= 0) {
+			if (n >= tds_pow10_uint128(new_prec - scale_diff))
+				return TDS_CONVERT_OVERFLOW;
+			n *= tds_pow10_uint128(scale_diff);
+		} else {
+			n /= tds_pow10_uint128(-scale_diff);
+			if (n >= tds_pow10_uint128(new_prec))
+				return TDS_CONVERT_OVERFLOW;
+		}
+		numeric->precision = new_prec;
+		numeric->scale = new_scale;
+		tds_numeric_put_uint128(numeric, n);
+		return sizeof(TDS_NUMERIC);
+	}
+#endif
+
 	/* package number */
 	bytes = tds_numeric_bytes_per_prec[numeric->precision] - 1;
 	i = 0;
@@ -353,7 +551,7 @@ tds_numeric_change_prec_scale(TDS_NUMERIC * numeric, unsigned char new_prec, uns
 	numeric->precision = new_prec;
 	numeric->scale = new_scale;
 	bytes = tds_numeric_bytes_per_prec[numeric->precision] - 1;
-	for (i = bytes / sizeof(TDS_WORD); i >= packet_len; --i)
+	for (i = (bytes - 1) / sizeof(TDS_WORD); i >= packet_len; --i)
 		packet[i] = 0;
 	for (i = 0; bytes >= sizeof(TDS_WORD); bytes -= sizeof(TDS_WORD), ++i) {
 		TDS_PUT_UA4BE(&numeric->array[bytes-3], packet[i]);
@@ -370,3 +568,70 @@ tds_numeric_change_prec_scale(TDS_NUMERIC * numeric, unsigned char new_prec, uns
 	return sizeof(TDS_NUMERIC);
 }
 
+/**
+ * Store a number given as decimal digits.
+ * Used by string conversions for numbers fitting in native integers.
+ * Precision, scale and sign of numeric should be already set.
+ * @param numeric     number to set
+ * @param digits      digits before decimal point, must fit (precision - scale)
+ * @param num_digits  number of digits before decimal point
+ * @param decimals    digits after decimal point
+ * @param num_decimals number of digits after decimal point, at most scale
+ * @return false if precision is too big, numeric is not changed
+ */
+bool
+tds_numeric_from_digits(TDS_NUMERIC * numeric, const char *digits, size_t num_digits,
+			const char *decimals, size_t num_decimals)
+{
+	const char *const digits_end = digits + num_digits;
+	const char *const decimals_end = decimals + num_decimals;
+	const unsigned int zeros = numeric->scale - (unsigned int) num_decimals;
+
+#ifdef TDS_NUMERIC_PREC_UINT128
+	if (numeric->precision > TDS_NUMERIC_PREC_UINT128)
+#else
+	if (numeric->precision > TDS_NUMERIC_PREC_UINT8)
+#endif
+		return false;
+
+	memset(numeric->array + 1, 0, sizeof(numeric->array) - 1);
+	if (numeric->precision <= TDS_NUMERIC_PREC_UINT8) {
+		TDS_UINT8 n = 0;
+
+		for (; digits != digits_end; ++digits)
+			n = n * 10u + (*digits - '0');
+		for (; decimals != decimals_end; ++decimals)
+			n = n * 10u + (*decimals - '0');
+		tds_numeric_put_uint8(numeric, n * tds_pow10_uint8[zeros]);
+		return true;
+	}
+#ifdef TDS_NUMERIC_PREC_UINT128
+	if (numeric->precision <= TDS_NUMERIC_PREC_UINT128) {
+		TDS_UINT8 n = 0;
+		TDS_UINT128 n128 = 0;
+		unsigned int num = 0;
+
+		/* accumulate up to 18 digits at a time in 64 bit */
+		for (; digits != digits_end; ++digits) {
+			n = n * 10u + (*digits - '0');
+			if (++num == TDS_NUMERIC_PREC_UINT8) {
+				n128 = n128 * tds_pow10_uint8[num] + n;
+				n = 0;
+				num = 0;
+			}
+		}
+		for (; decimals != decimals_end; ++decimals) {
+			n = n * 10u + (*decimals - '0');
+			if (++num == TDS_NUMERIC_PREC_UINT8) {
+				n128 = n128 * tds_pow10_uint8[num] + n;
+				n = 0;
+				num = 0;
+			}
+		}
+		n128 = n128 * tds_pow10_uint8[num] + n;
+		tds_numeric_put_uint128(numeric, n128 * tds_pow10_uint128(zeros));
+		return true;
+	}
+#endif
+	return false;
+}
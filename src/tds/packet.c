@@ -61,41 +61,65 @@
 #if ENABLE_ODBC_MARS
 static TDSRET tds_update_recv_wnd(TDSSOCKET *tds, TDS_UINT new_recv_wnd);
 static int tds_packet_write(TDSCONNECTION *conn);
+
+/** bulk packets which can be queued before waiting for the network */
+#define TDS_PIPELINE_DEPTH 8
 #endif
 
-/* get packet from the cache */
-static TDSPACKET *
+/* size class of a packet with given capacity */
+static inline unsigned
+tds_packet_pool_class(unsigned capacity)
+{
+	unsigned cls = 0;
+
+	capacity /= 512;
+	while (capacity > 1 && cls < TDS_PACKET_POOL_CLASSES - 1) {
+		capacity >>= 1;
+		++cls;
+	}
+	return cls;
+}
+
+/**
+ * Get a packet with at least len bytes of capacity.
+ * Packets are taken from the connection pool if possible.
+ */
+TDSPACKET *
 tds_get_packet(TDSCONNECTION *conn, unsigned len)
 {
-	TDSPACKET *packet, *to_free = NULL;
+	TDSPACKETPOOL *pool = &conn->packet_pool;
+	TDSPACKET *packet = NULL, **prev;
+	unsigned cls;
 
 	tds_mutex_lock(&conn->list_mtx);
-	while ((packet = conn->packet_cache) != NULL) {
-		--conn->num_cached_packets;
-		conn->packet_cache = packet->next;
-
-		/* return it */
-		if (packet->capacity >= len) {
-			TDS_MARK_UNDEFINED(packet->buf, packet->capacity);
-			packet->next = NULL;
-			tds_packet_zero_data_start(packet);
-			packet->data_len = 0;
-			packet->sid = 0;
+	/*
+	 * Packets in the class of len could be too small, any packet
+	 * in higher classes (beside last) is big enough.
+	 */
+	for (cls = tds_packet_pool_class(len); cls < TDS_PACKET_POOL_CLASSES; ++cls) {
+		for (prev = &pool->classes[cls]; (packet = *prev) != NULL; prev = &packet->next)
+			if (packet->capacity >= len)
+				break;
+		if (packet) {
+			*prev = packet->next;
+			--pool->num_cached;
 			break;
 		}
-
-		/* discard packet if too small */
-		packet->next = to_free;
-		to_free = packet;
 	}
+	if (packet)
+		++pool->stats.hits;
+	else
+		++pool->stats.misses;
 	tds_mutex_unlock(&conn->list_mtx);
 
-	if (to_free)
-		tds_free_packets(to_free);
-
 	if (!packet)
-		packet = tds_alloc_packet(NULL, len);
+		return tds_alloc_packet(NULL, len);
 
+	TDS_MARK_UNDEFINED(packet->buf, packet->capacity);
+	packet->next = NULL;
+	tds_packet_zero_data_start(packet);
+	packet->data_len = 0;
+	packet->sid = 0;
 	return packet;
 }
 
@@ -103,32 +127,98 @@ tds_get_packet(TDSCONNECTION *conn, unsigned len)
 static void
 tds_packet_cache_add(TDSCONNECTION *conn, TDSPACKET *packet)
 {
-	TDSPACKET *last;
-	unsigned count = 1;
+	TDSPACKETPOOL *pool = &conn->packet_pool;
+	TDSPACKET *next;
 
 	assert(conn && packet);
 	tds_mutex_check_owned(&conn->list_mtx);
 
-	if (conn->num_cached_packets >= 8) {
-		tds_free_packets(packet);
-		return;
-	}
+	for (; packet; packet = next) {
+		unsigned cls;
 
-	for (last = packet; last->next; last = last->next)
-		++count;
-
-	last->next = conn->packet_cache;
-	conn->packet_cache = packet;
-	conn->num_cached_packets += count;
+		next = packet->next;
+		++pool->stats.returned;
+		if (pool->num_cached >= pool->max_cached) {
+			++pool->stats.discarded;
+			free(packet);
+			continue;
+		}
+		cls = tds_packet_pool_class(packet->capacity);
+		packet->next = pool->classes[cls];
+		pool->classes[cls] = packet;
+		++pool->num_cached;
+	}
 
 #if ENABLE_EXTRA_CHECKS
-	count = 0;
-	for (packet = conn->packet_cache; packet; packet = packet->next)
-		++count;
-	assert(count == conn->num_cached_packets);
+	{
+		unsigned count = 0, cls;
+
+		for (cls = 0; cls < TDS_PACKET_POOL_CLASSES; ++cls)
+			for (packet = pool->classes[cls]; packet; packet = packet->next)
+				++count;
+		assert(count == pool->num_cached);
+	}
 #endif
 }
 
+/**
+ * Give packets back to the connection pool.
+ * \param packet list of packets to release, can be NULL
+ */
+void
+tds_put_packets(TDSCONNECTION *conn, TDSPACKET *packet)
+{
+	if (!packet)
+		return;
+
+	tds_mutex_lock(&conn->list_mtx);
+	tds_packet_cache_add(conn, packet);
+	tds_mutex_unlock(&conn->list_mtx);
+}
+
+/**
+ * Change maximum number of free packets kept by a connection.
+ * Packets exceeding the new limit are freed.
+ */
+void
+tds_set_packet_pool_size(TDSCONNECTION *conn, unsigned max_cached)
+{
+	TDSPACKETPOOL *pool = &conn->packet_pool;
+	TDSPACKET *to_free = NULL, *packet;
+	unsigned cls;
+
+	tds_mutex_lock(&conn->list_mtx);
+	pool->max_cached = max_cached;
+	/* drop biggest packets first */
+	for (cls = TDS_PACKET_POOL_CLASSES; pool->num_cached > max_cached && cls > 0; ) {
+		packet = pool->classes[cls - 1];
+		if (!packet) {
+			--cls;
+			continue;
+		}
+		pool->classes[cls - 1] = packet->next;
+		packet->next = to_free;
+		to_free = packet;
+		--pool->num_cached;
+		++pool->stats.discarded;
+	}
+	tds_mutex_unlock(&conn->list_mtx);
+
+	tds_free_packets(to_free);
+}
+
+/**
+ * Retrieve packet pool statistics of a connection.
+ */
+void
+tds_get_packet_pool_stats(TDSCONNECTION *conn, TDSPACKETPOOLSTATS *stats)
+{
+	tds_mutex_lock(&conn->list_mtx);
+	*stats = conn->packet_pool.stats;
+	stats->cached = conn->packet_pool.num_cached;
+	tds_mutex_unlock(&conn->list_mtx);
+}
+
 #if ENABLE_ODBC_MARS
 /* read partial packet */
 static bool
@@ -434,10 +524,63 @@ tds_connection_network(TDSCONNECTION *conn, TDSSOCKET *tds, int send)
 	conn->in_net_tds = NULL;
 }
 
+/**
+ * Find the packet to wait for before encoding more bulk data.
+ * \return oldest packet of the session if too many are queued, NULL otherwise
+ */
+static TDSPACKET *
+tds_pipeline_wait_packet(TDSCONNECTION *conn, uint16_t sid)
+{
+	TDSPACKET *packet, *oldest = NULL;
+	unsigned queued = 0;
+
+	for (packet = conn->send_packets; packet; packet = packet->next) {
+		if (packet->sid != sid)
+			continue;
+		if (!oldest)
+			oldest = packet;
+		++queued;
+	}
+	return queued > TDS_PIPELINE_DEPTH ? oldest : NULL;
+}
+
+/**
+ * Write queued packets till the socket would block.
+ * Called with list_mtx locked, returns with list_mtx locked.
+ */
+static void
+tds_connection_try_send(TDSCONNECTION *conn, TDSSOCKET *tds)
+{
+	struct pollfd fd;
+
+	if (conn->in_net_tds)
+		return;
+	conn->in_net_tds = tds;
+	tds_mutex_unlock(&conn->list_mtx);
+
+	while (conn->send_packets && !IS_TDSDEAD(tds)) {
+		fd.fd = tds_get_s(tds);
+		fd.events = POLLOUT;
+		fd.revents = 0;
+		if (poll(&fd, 1, 0) <= 0 || (fd.revents & POLLOUT) == 0)
+			break;
+		tds_packet_write(conn);
+	}
+
+	tds_mutex_lock(&conn->list_mtx);
+	conn->in_net_tds = NULL;
+}
+
 static TDSRET
 tds_connection_put_packet(TDSSOCKET *tds, TDSPACKET *packet)
 {
 	TDSCONNECTION *conn = tds->conn;
+	/*
+	 * Bulk data is not followed by other requests till the final packet
+	 * so packets can be queued while next rows are encoded.
+	 */
+	const bool pipeline = tds->out_flag == TDS_BULK && !conn->mars
+		&& (packet->buf[tds_packet_get_data_start(packet) + 1] & 1) == 0;
 
 	CHECK_TDS_EXTRA(tds);
 
@@ -475,6 +618,15 @@ tds_connection_put_packet(TDSSOCKET *tds, TDSPACKET *packet)
 			/* append packet */
 			tds_append_packet(&conn->send_packets, packet);
 			packet = NULL;
+
+			/* wait only if too many packets are queued */
+			if (pipeline) {
+				tds->sending_packet = tds_pipeline_wait_packet(conn, tds->sid);
+				if (!tds->sending_packet) {
+					tds_connection_try_send(conn, tds);
+					break;
+				}
+			}
 		}
 
 		/* network ok ? process network */
@@ -549,7 +701,14 @@ tds_read_packet(TDSSOCKET * tds)
 			/* remove our packet from list */
 			TDSPACKET *packet = *p_packet;
 			*p_packet = packet->next;
-			tds_packet_cache_add(conn, tds->recv_packet);
+			if (tds->recv_packet_refs) {
+				/* row data still point into the packet */
+				tds->recv_packet->next = tds->pinned_packets;
+				tds->pinned_packets = tds->recv_packet;
+				tds->recv_packet_refs = 0;
+			} else {
+				tds_packet_cache_add(conn, tds->recv_packet);
+			}
 			tds_mutex_unlock(&conn->list_mtx);
 
 			packet->next = NULL;
@@ -596,6 +755,20 @@ tds_read_packet(TDSSOCKET * tds)
 		return -1;
 	}
 
+	/* row data still point into the packet, use another one */
+	if (tds->recv_packet_refs) {
+		TDSPACKET *packet = tds_get_packet(tds->conn, tds->recv_packet->capacity);
+		if (TDS_UNLIKELY(!packet)) {
+			tds_close_socket(tds);
+			return -1;
+		}
+		tds->recv_packet->next = tds->pinned_packets;
+		tds->pinned_packets = tds->recv_packet;
+		tds->recv_packet_refs = 0;
+		tds->recv_packet = packet;
+		tds->in_buf = pkt = packet->buf;
+	}
+
 	tds->in_len = 0;
 	tds->in_pos = 0;
 	for (p = pkt, end = p+8; p < end;) {
@@ -640,6 +813,28 @@ tds_read_packet(TDSSOCKET * tds)
 #endif /* !ENABLE_ODBC_MARS */
 }
 
+/**
+ * Release packets referenced by the row data of current results.
+ * Column data are reset to point to the row buffer.
+ * \tds
+ */
+void
+tds_release_row_packets(TDSSOCKET * tds)
+{
+	if (!tds->recv_packet_refs && !tds->pinned_packets)
+		return;
+
+	if (tds->current_results && tds->current_results->current_row)
+		tds_reset_row_column_data(tds->current_results);
+
+	tds->recv_packet_refs = 0;
+	if (!tds->pinned_packets)
+		return;
+
+	tds_put_packets(tds->conn, tds->pinned_packets);
+	tds->pinned_packets = NULL;
+}
+
 #if ENABLE_ODBC_MARS
 static TDSRET
 tds_update_recv_wnd(TDSSOCKET *tds, TDS_UINT new_recv_wnd)
@@ -1295,6 +1295,49 @@ failure:
 	return rc;
 }
 
+/**
+ * Write a sp_executesql RPC call for a query with parameters.
+ * \tds
+ * \param converted_query      query with placeholders, already converted to UCS-2
+ * \param converted_query_len  length of converted query in bytes
+ * \param params               parameters to send
+ */
+static TDSRET
+tds7_send_execdirect(TDSSOCKET * tds, const char *converted_query, size_t converted_query_len, TDSPARAMINFO * params)
+{
+	TDSCOLUMN *param;
+	TDSFREEZE outer;
+	TDSRET rc;
+	int i;
+
+	tds_freeze(tds, &outer, 0);
+	/* procedure name */
+	if (IS_TDS71_PLUS(tds->conn)) {
+		tds_put_smallint(tds, -1);
+		tds_put_smallint(tds, TDS_SP_EXECUTESQL);
+	} else {
+		TDS_PUT_N_AS_UCS2(tds, "sp_executesql");
+	}
+	tds_put_smallint(tds, 0);
+
+	tds7_put_query_params(tds, converted_query, converted_query_len);
+	rc = tds7_write_param_def_from_query(tds, converted_query, converted_query_len, params);
+	if (TDS_FAILED(rc)) {
+		tds_freeze_abort(&outer);
+		return rc;
+	}
+	tds_freeze_close(&outer);
+
+	for (i = 0; params && i < params->num_cols; i++) {
+		param = params->columns[i];
+		TDS_PROPAGATE(tds_put_data_info(tds, param, 0));
+		TDS_PROPAGATE(tds_put_data(tds, param));
+	}
+
+	tds->current_op = TDS_OP_EXECUTESQL;
+	return TDS_SUCCESS;
+}
+
 /**
  * Submit a prepared query with parameters
  * \param tds     state information for the socket and the TDS protocol
@@ -1306,7 +1349,6 @@ TDSRET
 tds_submit_execdirect(TDSSOCKET * tds, const char *query, TDSPARAMINFO * params, TDSHEADERS * head)
 {
 	size_t query_len;
-	TDSCOLUMN *param;
 	TDSDYNAMIC *dyn;
 	size_t id_len;
 	TDSFREEZE outer;
@@ -1319,7 +1361,6 @@ tds_submit_execdirect(TDSSOCKET * tds, const char *query, TDSPARAMINFO * params,
 	query_len = strlen(query);
 
 	if (IS_TDS7_PLUS(tds->conn)) {
-		int i;
 		size_t converted_query_len;
 		const char *converted_query;
 		TDSRET rc;
@@ -1337,32 +1378,10 @@ tds_submit_execdirect(TDSSOCKET * tds, const char *query, TDSPARAMINFO * params,
 			tds_convert_string_free(query, converted_query);
 			return TDS_FAIL;
 		}
-		tds_freeze(tds, &outer, 0);
-		/* procedure name */
-		if (IS_TDS71_PLUS(tds->conn)) {
-			tds_put_smallint(tds, -1);
-			tds_put_smallint(tds, TDS_SP_EXECUTESQL);
-		} else {
-			TDS_PUT_N_AS_UCS2(tds, "sp_executesql");
-		}
-		tds_put_smallint(tds, 0);
-
-		tds7_put_query_params(tds, converted_query, converted_query_len);
-		rc = tds7_write_param_def_from_query(tds, converted_query, converted_query_len, params);
+		rc = tds7_send_execdirect(tds, converted_query, converted_query_len, params);
 		tds_convert_string_free(query, converted_query);
-		if (TDS_FAILED(rc)) {
-			tds_freeze_abort(&outer);
-			return rc;
-		}
-		tds_freeze_close(&outer);
+		TDS_PROPAGATE(rc);
 
-		for (i = 0; i < params->num_cols; i++) {
-			param = params->columns[i];
-			TDS_PROPAGATE(tds_put_data_info(tds, param, 0));
-			TDS_PROPAGATE(tds_put_data(tds, param));
-		}
-
-		tds->current_op = TDS_OP_EXECUTESQL;
 		return tds_query_flush_packet(tds);
 	}
 
@@ -1969,6 +1988,44 @@ tds4_send_emulated_rpc(TDSSOCKET * tds, const char *rpc_name, TDSPARAMINFO * par
 	return tds_query_flush_packet(tds);
 }
 
+/**
+ * Write a RPC call with its parameters.
+ * \tds
+ * \param rpc_name name of RPC
+ * \param params   parameters informations. NULL for no parameters
+ */
+static TDSRET
+tds7_send_rpc(TDSSOCKET * tds, const char *rpc_name, TDSPARAMINFO * params)
+{
+	TDSCOLUMN *param;
+	TDSFREEZE outer;
+	size_t written;
+	int i;
+	int num_params = params ? params->num_cols : 0;
+
+	/* procedure name */
+	tds_freeze(tds, &outer, 2);
+	tds_put_string(tds, rpc_name, -1);
+	written = tds_freeze_written(&outer) / 2 - 1;
+	tds_freeze_close_len(&outer, written);
+
+	/*
+	 * TODO support flags
+	 * bit 0 (1 as flag) in TDS7/TDS5 is "recompile"
+	 * bit 1 (2 as flag) in TDS7+ is "no metadata" bit 
+	 * (I don't know meaning of "no metadata")
+	 */
+	tds_put_smallint(tds, 0);
+
+	for (i = 0; i < num_params; i++) {
+		param = params->columns[i];
+		TDS_PROPAGATE(tds_put_data_info(tds, param, TDS_PUT_DATA_USE_NAME));
+		TDS_PROPAGATE(tds_put_data(tds, param));
+	}
+
+	return TDS_SUCCESS;
+}
+
 /**
  * Calls a RPC from server. Output parameters will be stored in tds->param_info.
  * \param tds      state information for the socket and the TDS protocol
@@ -1978,8 +2035,7 @@ tds4_send_emulated_rpc(TDSSOCKET * tds, const char *rpc_name, TDSPARAMINFO * par
 TDSRET
 tds_submit_rpc(TDSSOCKET * tds, const char *rpc_name, TDSPARAMINFO * params, TDSHEADERS * head)
 {
-	TDSCOLUMN *param;
-	int rpc_name_len, i;
+	int rpc_name_len;
 	int num_params = params ? params->num_cols : 0;
 
 	CHECK_TDS_EXTRA(tds);
@@ -1997,31 +2053,10 @@ tds_submit_rpc(TDSSOCKET * tds, const char *rpc_name, TDSPARAMINFO * params, TDS
 
 	rpc_name_len = (int)strlen(rpc_name);
 	if (IS_TDS7_PLUS(tds->conn)) {
-		TDSFREEZE outer;
-		size_t written;
-
 		if (tds_start_query_head(tds, TDS_RPC, head) != TDS_SUCCESS)
 			return TDS_FAIL;
 
-		/* procedure name */
-		tds_freeze(tds, &outer, 2);
-		tds_put_string(tds, rpc_name, rpc_name_len);
-		written = tds_freeze_written(&outer) / 2 - 1;
-		tds_freeze_close_len(&outer, written);
-
-		/*
-		 * TODO support flags
-		 * bit 0 (1 as flag) in TDS7/TDS5 is "recompile"
-		 * bit 1 (2 as flag) in TDS7+ is "no metadata" bit 
-		 * (I don't know meaning of "no metadata")
-		 */
-		tds_put_smallint(tds, 0);
-
-		for (i = 0; i < num_params; i++) {
-			param = params->columns[i];
-			TDS_PROPAGATE(tds_put_data_info(tds, param, TDS_PUT_DATA_USE_NAME));
-			TDS_PROPAGATE(tds_put_data(tds, param));
-		}
+		TDS_PROPAGATE(tds7_send_rpc(tds, rpc_name, params));
 
 		return tds_query_flush_packet(tds);
 	}
@@ -3399,17 +3434,26 @@ tds_multiple_query(TDSSOCKET *tds, TDSMULTIPLE *multiple, const char *query, TDS
 	return tds_send_emulated_execute(tds, query, params);
 }
 
+/**
+ * Start a new RPC in a batch, separating it from the previous one.
+ */
+static void
+tds7_multiple_next_rpc(TDSSOCKET *tds, TDSMULTIPLE *multiple)
+{
+	if (multiple->flags & MUL_STARTED) {
+		/* TODO define constant */
+		tds_put_byte(tds, IS_TDS72_PLUS(tds->conn) ? 0xff : 0x80);
+	}
+	multiple->flags |= MUL_STARTED;
+}
+
 TDSRET
 tds_multiple_execute(TDSSOCKET *tds, TDSMULTIPLE *multiple, TDSDYNAMIC * dyn)
 {
 	assert(multiple->type == TDS_MULTIPLE_EXECUTE);
 
 	if (IS_TDS7_PLUS(tds->conn)) {
-		if (multiple->flags & MUL_STARTED) {
-			/* TODO define constant */
-			tds_put_byte(tds, IS_TDS72_PLUS(tds->conn) ? 0xff : 0x80);
-		}
-		multiple->flags |= MUL_STARTED;
+		tds7_multiple_next_rpc(tds, multiple);
 
 		tds7_send_execute(tds, dyn);
 
@@ -3423,6 +3467,64 @@ tds_multiple_execute(TDSSOCKET *tds, TDSMULTIPLE *multiple, TDSDYNAMIC * dyn)
 	return tds_send_emulated_execute(tds, dyn->query, dyn->params);
 }
 
+/**
+ * Add a RPC call to a batch.
+ * Supported only by mssql, parameters are sent in binary form.
+ * \tds
+ * \param multiple  batch started with TDS_MULTIPLE_RPC type
+ * \param rpc_name  name of RPC
+ * \param params    parameters informations. NULL for no parameters
+ */
+TDSRET
+tds_multiple_rpc(TDSSOCKET *tds, TDSMULTIPLE *multiple, const char *rpc_name, TDSPARAMINFO * params)
+{
+	assert(multiple->type == TDS_MULTIPLE_RPC);
+
+	if (!IS_TDS7_PLUS(tds->conn))
+		return TDS_FAIL;
+
+	tds7_multiple_next_rpc(tds, multiple);
+
+	return tds7_send_rpc(tds, rpc_name, params);
+}
+
+/**
+ * Add a query with parameters to a batch.
+ * On mssql the query is executed using sp_executesql passing
+ * parameters in binary form, otherwise parameters are
+ * substituted in the query.
+ * \tds
+ * \param multiple  batch started with TDS_MULTIPLE_RPC type
+ * \param query     query with placeholders (?)
+ * \param params    parameters to send. NULL for no parameters
+ */
+TDSRET
+tds_multiple_execdirect(TDSSOCKET *tds, TDSMULTIPLE *multiple, const char *query, TDSPARAMINFO * params)
+{
+	size_t converted_query_len;
+	const char *converted_query;
+	TDSRET rc;
+
+	assert(multiple->type == TDS_MULTIPLE_RPC);
+
+	if (!IS_TDS7_PLUS(tds->conn)) {
+		if (multiple->flags & MUL_STARTED)
+			tds_put_string(tds, " ", 1);
+		multiple->flags |= MUL_STARTED;
+
+		return tds_send_emulated_execute(tds, query, params);
+	}
+
+	converted_query = tds_convert_string(tds, tds->conn->char_convs[client2ucs2], query, -1, &converted_query_len);
+	if (!converted_query)
+		return TDS_FAIL;
+
+	tds7_multiple_next_rpc(tds, multiple);
+	rc = tds7_send_execdirect(tds, converted_query, converted_query_len, params);
+	tds_convert_string_free(query, converted_query);
+	return rc;
+}
+
 /**
  * Send option commands to server.
  * Option commands are used to change server options.
@@ -3810,7 +3912,7 @@ tds_disconnect(TDSSOCKET * tds)
 	old_ctx = tds_get_ctx(tds);
 
 	/* avoid to stall forever */
-	tds->query_timeout = 5;
+	tds->query_timeout = 5000;
 
 	/* do not report errors to upper libraries */
 	tds_set_ctx(tds, &empty_ctx);
@@ -78,6 +78,7 @@ static TDSRET tds_process_cursor_tokens(TDSSOCKET * tds);
 static TDSRET tds_process_row(TDSSOCKET * tds);
 static TDSRET tds_process_nbcrow(TDSSOCKET * tds);
 static TDSRET tds_process_featureextack(TDSSOCKET * tds);
+static TDSRET tds_process_session_state(TDSSOCKET * tds);
 static TDSRET tds_process_param_result(TDSSOCKET * tds, TDSPARAMINFO ** info);
 static TDSRET tds7_process_result(TDSSOCKET * tds);
 static TDSDYNAMIC *tds_process_dynamic(TDSSOCKET * tds);
@@ -266,6 +267,8 @@ tds_process_default_tokens(TDSSOCKET * tds, int marker)
 		return tds_process_colinfo(tds, NULL, 0);
 		break;
 	case TDS_SESSIONSTATE_TOKEN:
+		return tds_process_session_state(tds);
+		break;
 	case TDS_ORDERBY2_TOKEN:
 		tdsdump_log(TDS_DBG_WARN, "Eating %s token\n", tds_token_name(marker));
 		tds_get_n(tds, NULL, tds_get_uint(tds));
@@ -1944,6 +1947,7 @@ tds_process_row(TDSSOCKET * tds)
 	unsigned int i;
 	TDSCOLUMN *curcol;
 	TDSRESULTINFO *info;
+	TDSRET rc = TDS_SUCCESS;
 
 	CHECK_TDS_EXTRA(tds);
 
@@ -1951,12 +1955,19 @@ tds_process_row(TDSSOCKET * tds)
 	if (!info || info->num_cols <= 0)
 		return TDS_FAIL;
 
+	if (tds->zero_copy)
+		tds_release_row_packets(tds);
+
+	tds->decoding_row = true;
 	for (i = 0; i < info->num_cols; i++) {
 		tdsdump_log(TDS_DBG_INFO1, "tds_process_row(): reading column %d \n", i);
 		curcol = info->columns[i];
-		TDS_PROPAGATE(curcol->funcs->get_data(tds, curcol));
+		rc = curcol->funcs->get_data(tds, curcol);
+		if (TDS_FAILED(rc))
+			break;
 	}
-	return TDS_SUCCESS;
+	tds->decoding_row = false;
+	return rc;
 }
 
 /**
@@ -1969,6 +1980,7 @@ tds_process_nbcrow(TDSSOCKET * tds)
 	TDSCOLUMN *curcol;
 	TDSRESULTINFO *info;
 	char *nbcbuf;
+	TDSRET rc = TDS_SUCCESS;
 
 	CHECK_TDS_EXTRA(tds);
 
@@ -1976,37 +1988,317 @@ tds_process_nbcrow(TDSSOCKET * tds)
 	if (!info || info->num_cols <= 0)
 		return TDS_FAIL;
 
+	if (tds->zero_copy)
+		tds_release_row_packets(tds);
+
 	nbcbuf = (char *) alloca((info->num_cols + 7) / 8);
 	tds_get_n(tds, nbcbuf, (info->num_cols + 7) / 8);
+	tds->decoding_row = true;
 	for (i = 0; i < info->num_cols; i++) {
 		curcol = info->columns[i];
 		tdsdump_log(TDS_DBG_INFO1, "tds_process_nbcrow(): reading column %d \n", i);
 		if (nbcbuf[i / 8] & (1 << (i % 8))) {
 			curcol->column_cur_size = -1;
 		} else {
+			rc = curcol->funcs->get_data(tds, curcol);
+			if (TDS_FAILED(rc))
+				break;
+		}
+	}
+	tds->decoding_row = false;
+	return rc;
+}
+
+/**
+ * Store a value just read into a column batch.
+ * Value has been already decoded into \a curcol.
+ */
+static void
+tds_batch_store(TDSCOLUMN * curcol, TDSCOLUMNBATCH * batch, TDS_UINT row, bool direct)
+{
+	TDS_INT len = curcol->column_cur_size;
+	const void *src;
+
+	if (len < 0) {
+		if (batch->lengths)
+			batch->lengths[row] = -1;
+		if (batch->nulls)
+			batch->nulls[row / 8] |= 1 << (row % 8);
+		return;
+	}
+
+	if (batch->nulls)
+		batch->nulls[row / 8] &= ~(1 << (row % 8));
+
+	/* value already in place, avoid a copy */
+	if (!direct) {
+		if (is_blob_col(curcol))
+			src = ((TDSBLOB *) curcol->column_data)->textvalue;
+		else
+			src = curcol->column_data;
+		if ((TDS_UINT) len > batch->stride)
+			len = batch->stride;
+		if (len > 0)
+			memcpy(batch->values + (size_t) row * batch->stride, src, len);
+	}
+	if (batch->lengths)
+		batch->lengths[row] = len;
+}
+
+/**
+ * Read a single ROW or NBCROW token into column batches.
+ * Marker should be already consumed.
+ */
+static TDSRET
+tds_process_row_into_batch(TDSSOCKET * tds, int marker, TDSCOLUMNBATCH * batch, TDS_UINT row)
+{
+	unsigned int i;
+	TDSRESULTINFO *info = tds->current_results;
+	unsigned char *nbcbuf = NULL;
+
+	if (marker == TDS_NBC_ROW_TOKEN) {
+		nbcbuf = (unsigned char *) alloca((info->num_cols + 7) / 8);
+		tds_get_n(tds, nbcbuf, (info->num_cols + 7) / 8);
+	}
+
+	for (i = 0; i < info->num_cols; i++) {
+		TDSCOLUMN *curcol = info->columns[i];
+		TDSCOLUMNBATCH *cb = &batch[i];
+		unsigned char *saved_data;
+		bool direct;
+		TDSRET rc;
+
+		if (nbcbuf && (nbcbuf[i / 8] & (1 << (i % 8)))) {
+			curcol->column_cur_size = -1;
+			if (cb->values)
+				tds_batch_store(curcol, cb, row, false);
+			continue;
+		}
+
+		if (!cb->values) {
 			TDS_PROPAGATE(curcol->funcs->get_data(tds, curcol));
+			continue;
 		}
+
+		/*
+		 * Decode straight into the caller slot if possible.
+		 * Blobs keep their data in a separate buffer so they need a copy.
+		 */
+		direct = !is_blob_col(curcol) && cb->stride >= curcol->funcs->row_len(curcol);
+		saved_data = curcol->column_data;
+		if (direct)
+			curcol->column_data = cb->values + (size_t) row * cb->stride;
+		rc = curcol->funcs->get_data(tds, curcol);
+		curcol->column_data = saved_data;
+		TDS_PROPAGATE(rc);
+
+		tds_batch_store(curcol, cb, row, direct);
 	}
 	return TDS_SUCCESS;
 }
 
+/**
+ * Read a run of rows directly into column-major buffers.
+ * Should be called when tds_process_tokens() returned TDS_ROW_RESULT
+ * stopping on the row (TDS_STOPAT_ROW) or after a previous call to
+ * this function.
+ * Reading stops at the first token which is not a row or when \a max_rows
+ * rows have been read.
+ * Fixed and variable types are decoded directly into \a batch slots, using
+ * the same format used by the row buffer, if the slot is large enough;
+ * blobs are copied and truncated to the slot size.
+ * The row buffer of the result (current_row) is left in an undefined state.
+ * \tds
+ * \param batch array of destinations, one for each column; a column with
+ *        NULL values is read but discarded
+ * \param max_rows maximum number of rows to read
+ * \param rows_read number of rows read
+ * \retval TDS_SUCCESS rows read (possibly 0 if next token is not a row)
+ * \retval TDS_NO_MORE_RESULTS no more data to read
+ * \retval TDS_FAIL on error
+ */
+TDSRET
+tds_process_row_batch(TDSSOCKET * tds, TDSCOLUMNBATCH * batch, TDS_UINT max_rows, TDS_UINT * rows_read)
+{
+	TDS_UINT row = 0;
+	TDSRET rc = TDS_SUCCESS;
+
+	CHECK_TDS_EXTRA(tds);
+
+	*rows_read = 0;
+
+	if (tds->state == TDS_IDLE || tds->state == TDS_SENDING)
+		return TDS_NO_MORE_RESULTS;
+
+	if (tds_set_state(tds, TDS_READING) != TDS_READING)
+		return TDS_FAIL;
+
+	if (tds->cur_cursor)
+		tds_set_current_results(tds, tds->cur_cursor->res_info);
+	else if (tds->res_info)
+		tds_set_current_results(tds, tds->res_info);
+
+	if (!tds->current_results || tds->current_results->num_cols <= 0) {
+		tds_set_state(tds, TDS_PENDING);
+		return TDS_FAIL;
+	}
+
+	/* values are stored in caller buffers, do not leave pointers to packets */
+	if (tds->zero_copy)
+		tds_release_row_packets(tds);
+
+	while (row < max_rows && !tds->in_cancel) {
+		int marker = tds_peek(tds);
+
+		if (marker != TDS_ROW_TOKEN && marker != TDS_NBC_ROW_TOKEN)
+			break;
+		tds_get_byte(tds);
+		tds->current_results->rows_exist = true;
+
+		rc = tds_process_row_into_batch(tds, marker, batch, row);
+		if (TDS_FAILED(rc))
+			break;
+		++row;
+	}
+	*rows_read = row;
+
+	if (TDS_FAILED(rc)) {
+		tds_close_socket(tds);
+		return rc;
+	}
+	if (IS_TDSDEAD(tds))
+		return TDS_FAIL;
+
+	tds_set_state(tds, TDS_PENDING);
+	return TDS_SUCCESS;
+}
+
+/**
+ * Read a set of session states (SessionStateDataSet) updating a list.
+ * States already in the list with the same id are replaced.
+ * \tds
+ * \param list  list of states to update
+ * \param len   length of data to read
+ */
+static void
+tds_process_session_states(TDSSOCKET * tds, TDSSESSIONSTATE ** list, TDS_UINT len)
+{
+	TDSCONNECTION *conn = tds->conn;
+
+	while (len >= 2) {
+		TDSSESSIONSTATE *state, **p;
+		TDS_TINYINT id;
+		TDS_UINT state_len;
+
+		id = tds_get_byte(tds);
+		state_len = tds_get_byte(tds);
+		len -= 2;
+		if (state_len == 0xff) {
+			if (len < 4)
+				break;
+			state_len = tds_get_uint(tds);
+			len -= 4;
+		}
+		if (state_len > len)
+			break;
+		len -= state_len;
+
+		state = (TDSSESSIONSTATE *) malloc(TDS_OFFSET(TDSSESSIONSTATE, data) + state_len);
+		if (!state) {
+			tds_get_n(tds, NULL, state_len);
+			conn->recovery.recoverable = 0;
+			continue;
+		}
+		state->id = id;
+		state->len = state_len;
+		tds_get_n(tds, state->data, state_len);
+
+		for (p = list; *p && (*p)->id != id; p = &(*p)->next)
+			continue;
+		state->next = *p ? (*p)->next : NULL;
+		free(*p);
+		*p = state;
+	}
+
+	/* invalid data, state cannot be restored */
+	if (len) {
+		tdsdump_log(TDS_DBG_ERROR, "Invalid session state data\n");
+		tds_get_n(tds, NULL, len);
+		conn->recovery.recoverable = 0;
+	}
+}
+
+/**
+ * Process SESSIONSTATE token, session state changes to restore
+ * after a reconnection.
+ * \tds
+ */
+static TDSRET
+tds_process_session_state(TDSSOCKET * tds)
+{
+	TDSSESSIONRECOVERY *recovery = &tds->conn->recovery;
+	TDS_UINT len;
+
+	CHECK_TDS_EXTRA(tds);
+
+	len = tds_get_uint(tds);
+	if (len < 5 || !recovery->acknowledged) {
+		tds_get_n(tds, NULL, len);
+		return TDS_SUCCESS;
+	}
+
+	/* sequence number, states are received in order */
+	tds_get_uint(tds);
+	recovery->recoverable = tds_get_byte(tds) & 1;
+	tds_process_session_states(tds, &recovery->states, len - 5);
+	return TDS_SUCCESS;
+}
+
 static TDSRET
 tds_process_featureextack(TDSSOCKET * tds)
 {
+	TDSCONNECTION *conn = tds->conn;
+
 	CHECK_TDS_EXTRA(tds);
 
-	/* TODO do something with it */
 	for (;;) {
 		TDS_UINT data_len;
 		TDS_TINYINT feature_id;
 
 		feature_id = tds_get_byte(tds);
-		if (feature_id == 0xff)
+		if (feature_id == TDS_FEATURE_TERMINATOR)
 			break;
 
 		data_len = tds_get_uint(tds);
+		tdsdump_log(TDS_DBG_INFO1, "feature %d acknowledged, %u bytes of data\n", feature_id, data_len);
+		switch (feature_id) {
+		case TDS_FEATURE_UTF8_SUPPORT:
+			if (data_len < 1)
+				break;
+			conn->utf8_support = (tds_get_byte(tds) & 1) != 0;
+			--data_len;
+			break;
+		case TDS_FEATURE_SESSIONRECOVERY:
+			/* states at login time, needed to restore the session */
+			conn->recovery.acknowledged = 1;
+			conn->recovery.recoverable = 1;
+			tds_free_session_states(conn->recovery.initial_states);
+			conn->recovery.initial_states = NULL;
+			tds_process_session_states(tds, &conn->recovery.initial_states, data_len);
+			data_len = 0;
+			break;
+		default:
+			break;
+		}
 		tds_get_n(tds, NULL, data_len);
 	}
+
+	/*
+	 * default collation is received before the acknowledge,
+	 * update server charset if it is UTF-8
+	 */
+	if (conn->utf8_support && (conn->collation[3] & 0x4) != 0)
+		tds7_srv_charset_changed(conn, conn->collation);
 	return TDS_SUCCESS;
 }
 
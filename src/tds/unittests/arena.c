@@ -0,0 +1,76 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test arena allocator.
+ */
+#include "common.h"
+#include <assert.h>
+
+#define NUM_ALLOCS 1000
+
+int
+main(int argc, char **argv)
+{
+	TDSARENA arena = { NULL, NULL };
+	unsigned char *ptrs[NUM_ALLOCS];
+	unsigned char *first;
+	int i, j;
+
+	/* allocations are aligned and do not overlap */
+	for (i = 0; i < NUM_ALLOCS; ++i) {
+		size_t len = 1 + i % 97;
+
+		ptrs[i] = (unsigned char *) tds_arena_alloc(&arena, len);
+		assert(ptrs[i]);
+		assert(((TDS_UINTPTR) ptrs[i]) % TDS_ALIGN_SIZE == 0);
+		memset(ptrs[i], i & 0xff, len);
+	}
+	for (i = 0; i < NUM_ALLOCS; ++i)
+		for (j = 0; j < 1 + i % 97; ++j)
+			assert(ptrs[i][j] == (i & 0xff));
+
+	/* large allocation */
+	first = (unsigned char *) tds_arena_alloc(&arena, 100000);
+	assert(first);
+	memset(first, 0, 100000);
+	tds_arena_release(&arena, first);
+
+	/* use as a queue, memory should be reused */
+	for (i = 0; i < NUM_ALLOCS; ++i)
+		tds_arena_release(&arena, ptrs[i]);
+	first = (unsigned char *) tds_arena_alloc(&arena, 64);
+	tds_arena_release(&arena, first);
+	for (i = 0; i < NUM_ALLOCS * 100; ++i) {
+		ptrs[i % 10] = (unsigned char *) tds_arena_alloc(&arena, 64);
+		assert(ptrs[i % 10]);
+		if (i >= 9)
+			tds_arena_release(&arena, ptrs[(i + 1) % 10]);
+	}
+
+	/* reset keep a block */
+	tds_arena_reset(&arena);
+	assert(arena.blocks == NULL && arena.spare != NULL);
+	assert(tds_arena_alloc(&arena, 10) != NULL);
+	assert(arena.spare == NULL);
+
+	tds_arena_free(&arena);
+	assert(arena.blocks == NULL && arena.spare == NULL);
+	return 0;
+}
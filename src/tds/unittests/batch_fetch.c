@@ -0,0 +1,264 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test batch (columnar) and zero copy row fetching and compare
+ * their speed with the row at a time path (if TDS_BENCHMARK is set).
+ * A fake server thread sends rows on a socket pair.
+ */
+#include "common.h"
+#include <assert.h>
+#include <freetds/bytes.h>
+#include <freetds/thread.h>
+
+#if HAVE_UNISTD_H
+#undef getpid
+#include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#include <freetds/replacements.h>
+
+#define NUM_ROWS 100000
+#define NUM_COLS 3
+#define PACKET_SIZE 4096
+#define STR_SIZE 20
+#define BATCH_ROWS 1000
+
+static TEST_REPLY server_data;
+
+/* build a stream with NUM_ROWS rows (INT4, INTN, VARCHAR) and a final DONE */
+static void
+build_rows(void)
+{
+	int n;
+	uint8_t row[1 + 4 + 5 + 2 + STR_SIZE];
+
+	for (n = 0; n < NUM_ROWS; ++n) {
+		uint8_t *p = row;
+		int len;
+
+		*p++ = TDS_ROW_TOKEN;
+		TDS_PUT_UA4LE(p, n);
+		p += 4;
+		if (n % 7 == 3) {
+			*p++ = 0;
+		} else {
+			*p++ = 4;
+			TDS_PUT_UA4LE(p, n * 3);
+			p += 4;
+		}
+		len = sprintf((char *) p + 2, "row %d", n);
+		TDS_PUT_UA2LE(p, len);
+		p += 2 + len;
+		reply_append(&server_data, row, p - row);
+	}
+	reply_append_done(&server_data, 0, 0);
+}
+
+/* send rows, data is too big to be sent before the client reads it */
+static TDS_THREAD_PROC_DECLARE(fake_server_proc, arg)
+{
+	TDS_SYS_SOCKET s = TDS_PTR2INT(arg);
+
+	fake_server_send(s, &server_data, PACKET_SIZE);
+	CLOSESOCKET(s);
+	return TDS_THREAD_RESULT(0);
+}
+
+/* values read by the client */
+static TDS_INT ids[NUM_ROWS];
+static TDS_INT nums[NUM_ROWS];
+static TDS_INT num_lens[NUM_ROWS];
+static char strs[NUM_ROWS][STR_SIZE];
+static TDS_INT str_lens[NUM_ROWS];
+
+static void
+check_values(void)
+{
+	int n;
+	char expected[STR_SIZE + 1];
+
+	for (n = 0; n < NUM_ROWS; ++n) {
+		assert(ids[n] == n);
+		if (n % 7 == 3) {
+			assert(num_lens[n] == -1);
+		} else {
+			assert(num_lens[n] == 4);
+			assert(nums[n] == n * 3);
+		}
+		sprintf(expected, "row %d", n);
+		assert(str_lens[n] == strlen(expected));
+		assert(memcmp(strs[n], expected, str_lens[n]) == 0);
+	}
+}
+
+static void
+fetch_by_row(TDSSOCKET *tds)
+{
+	TDS_INT result_type;
+	int n = 0;
+	TDSRESULTINFO *info = tds->res_info;
+
+	while (tds_process_tokens(tds, &result_type, NULL, TDS_RETURN_ROW) == TDS_SUCCESS) {
+		TDSCOLUMN *col;
+
+		if (result_type != TDS_ROW_RESULT)
+			continue;
+		assert(n < NUM_ROWS);
+
+		/* copy to the client as front ends do */
+		col = info->columns[0];
+		memcpy(&ids[n], col->column_data, 4);
+		col = info->columns[1];
+		num_lens[n] = col->column_cur_size;
+		if (col->column_cur_size >= 0)
+			memcpy(&nums[n], col->column_data, 4);
+		col = info->columns[2];
+		str_lens[n] = col->column_cur_size;
+		memcpy(strs[n], col->column_data, col->column_cur_size);
+		++n;
+	}
+	assert(n == NUM_ROWS);
+}
+
+/* same as fetch_by_row but allowing data to point into packets */
+static void
+fetch_zero_copy(TDSSOCKET *tds)
+{
+	TDSRESULTINFO *info = tds->res_info;
+	unsigned char *row_data = info->columns[2]->column_data;
+
+	tds->zero_copy = true;
+	fetch_by_row(tds);
+
+	/* string column should have been read from packets */
+	assert(tds->pinned_packets != NULL || tds->recv_packet_refs > 0);
+	tds_release_row_packets(tds);
+	assert(info->columns[2]->column_data == row_data);
+}
+
+static void
+fetch_by_batch(TDSSOCKET *tds)
+{
+	TDS_INT result_type;
+	TDS_UINT n = 0, rows;
+	TDSCOLUMNBATCH batch[NUM_COLS];
+	TDSRET rc;
+
+	for (;;) {
+		rc = tds_process_tokens(tds, &result_type, NULL, TDS_STOPAT_ROW|TDS_RETURN_DONE);
+		if (rc != TDS_SUCCESS || result_type != TDS_ROW_RESULT)
+			break;
+
+		for (;;) {
+			memset(batch, 0, sizeof(batch));
+			batch[0].values = (TDS_UCHAR *) &ids[n];
+			batch[0].stride = sizeof(ids[0]);
+			batch[1].values = (TDS_UCHAR *) &nums[n];
+			batch[1].stride = sizeof(nums[0]);
+			batch[1].lengths = &num_lens[n];
+			batch[2].values = (TDS_UCHAR *) strs[n];
+			batch[2].stride = STR_SIZE;
+			batch[2].lengths = &str_lens[n];
+
+			rows = NUM_ROWS - n;
+			if (rows > BATCH_ROWS)
+				rows = BATCH_ROWS;
+			rc = tds_process_row_batch(tds, batch, rows, &rows);
+			assert(rc == TDS_SUCCESS);
+			n += rows;
+			if (!rows)
+				break;
+		}
+	}
+	assert(n == NUM_ROWS);
+}
+
+static unsigned
+test(void (*fetch)(TDSSOCKET *tds))
+{
+	TDSCONTEXT *ctx;
+	TDSSOCKET *tds;
+	TDS_SYS_SOCKET server;
+	tds_thread fake_thread;
+	TDSRESULTINFO *info;
+	unsigned start;
+	int i;
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+	tds = tds_alloc_socket(ctx, PACKET_SIZE);
+	assert(tds);
+	tds->conn->tds_version = 0x704;
+
+	/* result with an INT4, an INTN and a VARCHAR */
+	info = tds_alloc_results(NUM_COLS);
+	assert(info);
+	tds_set_column_type(tds->conn, info->columns[0], SYBINT4);
+	tds_set_column_type(tds->conn, info->columns[1], SYBINTN);
+	info->columns[1]->column_size = info->columns[1]->on_server.column_size = 4;
+	tds_set_column_type(tds->conn, info->columns[2], XSYBVARCHAR);
+	info->columns[2]->column_size = info->columns[2]->on_server.column_size = STR_SIZE;
+	for (i = 0; i < NUM_COLS; ++i)
+		assert(info->columns[i]->funcs);
+	assert(TDS_SUCCEED(tds_alloc_row(info)));
+	tds->res_info = info;
+	tds_set_current_results(tds, info);
+
+	/* provide connection to a fake server */
+	server = fake_server_connect(tds);
+	tds->state = TDS_PENDING;
+	if (tds_thread_create(&fake_thread, fake_server_proc, TDS_INT2PTR(server)) != 0) {
+		perror("tds_thread_create");
+		exit(1);
+	}
+
+	memset(ids, 0xff, sizeof(ids));
+	memset(strs, 0, sizeof(strs));
+
+	start = tds_gettime_ms();
+	fetch(tds);
+	start = tds_gettime_ms() - start;
+
+	check_values();
+
+	tds_thread_join(fake_thread, NULL);
+	tds_free_socket(tds);
+	tds_free_context(ctx);
+	return start;
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned by_row, by_batch, zero_copy;
+
+	tdsdump_open(getenv("TDSDUMP"));
+
+	build_rows();
+
+	by_row = test(fetch_by_row);
+	by_batch = test(fetch_by_batch);
+	zero_copy = test(fetch_zero_copy);
+	if (run_benchmarks())
+		printf("%d rows, row at a time %u ms, batch %u ms, zero copy %u ms\n", NUM_ROWS, by_row, by_batch, zero_copy);
+
+	reply_free(&server_data);
+	return 0;
+}
@@ -0,0 +1,244 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test rows sent from array bound columns are encoded
+ * like rows sent one at a time.
+ * With TDS_BENCHMARK set compare speed too.
+ */
+#include "common.h"
+#include <freetds/convert.h>
+#include <assert.h>
+
+#define NUM_ROWS 100
+#define NUM_COLS 5
+#define STR_SIZE 20
+#define ROUNDS 2000
+
+static TDS_INT ids[NUM_ROWS];
+static TDS_INT nums[NUM_ROWS];
+static TDS_SMALLINT num_nulls[NUM_ROWS];
+static char strs[NUM_ROWS][STR_SIZE];
+static TDS_INT str_lens[NUM_ROWS];
+static double flts[NUM_ROWS];
+static char bigs[NUM_ROWS][16];
+static TDS_INT big_lens[NUM_ROWS];
+
+static TDSBCPARRAY arrays[NUM_COLS];
+
+static void
+build_rows(void)
+{
+	int i;
+
+	for (i = 0; i < NUM_ROWS; ++i) {
+		ids[i] = i * 3 - 50;
+		nums[i] = i * 1000;
+		num_nulls[i] = i % 7 == 0 ? -1 : 0;
+		str_lens[i] = sprintf(strs[i], "row %d", i);
+		if (i % 11 == 0)
+			str_lens[i] = -1;
+		flts[i] = i / 4.0;
+		big_lens[i] = sprintf(bigs[i], "%d", i * 12345);
+	}
+
+	arrays[0].type = SYBINT4;
+	arrays[0].data = (const TDS_CHAR *) ids;
+	arrays[0].stride = sizeof(ids[0]);
+
+	arrays[1].type = SYBINT4;
+	arrays[1].data = (const TDS_CHAR *) nums;
+	arrays[1].stride = sizeof(nums[0]);
+	arrays[1].indicators = num_nulls;
+
+	arrays[2].type = SYBCHAR;
+	arrays[2].data = strs[0];
+	arrays[2].stride = STR_SIZE;
+	arrays[2].lengths = str_lens;
+
+	arrays[3].type = SYBFLT8;
+	arrays[3].data = (const TDS_CHAR *) flts;
+	arrays[3].stride = sizeof(flts[0]);
+
+	/* needs a conversion */
+	arrays[4].type = SYBCHAR;
+	arrays[4].data = bigs[0];
+	arrays[4].stride = sizeof(bigs[0]);
+	arrays[4].lengths = big_lens;
+}
+
+/* get data like a front end would do, converting each value */
+static TDSRET
+get_col_data(TDSBCPINFO *bcpinfo, TDSCOLUMN *bcpcol, int offset)
+{
+	TDSSOCKET *tds = (TDSSOCKET *) bcpinfo->parent;
+	BCPCOLDATA *coldata = bcpcol->bcp_column_data;
+	const TDSBCPARRAY *array = NULL;
+	TDS_SERVER_TYPE desttype;
+	CONV_RESULT cr, *p_cr = &cr;
+	TDS_INT len;
+	int i;
+
+	for (i = 0; i < NUM_COLS; ++i)
+		if (bcpinfo->bindinfo->columns[i] == bcpcol)
+			array = &arrays[i];
+	assert(array);
+
+	len = array->lengths ? array->lengths[offset] : tds_get_size_by_type(array->type);
+	if (len < 0 || (array->indicators && array->indicators[offset] < 0)) {
+		coldata->datalen = 0;
+		coldata->is_null = true;
+		return TDS_SUCCESS;
+	}
+
+	desttype = tds_get_conversion_type(bcpcol->column_type, bcpcol->column_size);
+	if (!is_variable_type(desttype))
+		p_cr = (CONV_RESULT *) coldata->data;
+	len = tds_convert(tds_get_ctx(tds), array->type, array->data + offset * array->stride, len, desttype, p_cr);
+	if (len < 0)
+		return TDS_FAIL;
+	if (p_cr == &cr) {
+		free(coldata->data);
+		coldata->data = (TDS_UCHAR *) cr.c;
+	}
+	coldata->datalen = len;
+	coldata->is_null = false;
+	return TDS_SUCCESS;
+}
+
+static void
+null_error(TDSBCPINFO *bcpinfo, int index, int offset)
+{
+	fprintf(stderr, "unexpected NULL error\n");
+	exit(1);
+}
+
+static void
+reset(TDSSOCKET *tds)
+{
+	tds->out_pos = 8;
+	tds->state = TDS_IDLE;
+	tds->out_flag = TDS_BULK;
+}
+
+static void
+send_by_record(TDSSOCKET *tds, TDSBCPINFO *bcpinfo)
+{
+	int row;
+
+	reset(tds);
+	for (row = 0; row < NUM_ROWS; ++row)
+		assert(TDS_SUCCEED(tds_bcp_send_record(tds, bcpinfo, get_col_data, null_error, row)));
+}
+
+static void
+send_by_array(TDSSOCKET *tds, TDSBCPINFO *bcpinfo)
+{
+	reset(tds);
+	assert(TDS_SUCCEED(tds_bcp_send_rows(tds, bcpinfo, null_error, 0, NUM_ROWS)));
+}
+
+static void
+bench(TDSSOCKET *tds, TDSBCPINFO *bcpinfo)
+{
+	unsigned by_record, by_array;
+	int i;
+
+	by_record = tds_gettime_ms();
+	for (i = 0; i < ROUNDS; ++i)
+		send_by_record(tds, bcpinfo);
+	by_record = tds_gettime_ms() - by_record;
+
+	by_array = tds_gettime_ms();
+	for (i = 0; i < ROUNDS; ++i)
+		send_by_array(tds, bcpinfo);
+	by_array = tds_gettime_ms() - by_array;
+
+	printf("%d rows, row at a time %u ms, arrays %u ms\n", NUM_ROWS * ROUNDS, by_record, by_array);
+}
+
+int
+main(int argc, char **argv)
+{
+	TDSCONTEXT *ctx;
+	TDSSOCKET *tds;
+	TDSBCPINFO *bcpinfo;
+	TDSRESULTINFO *info;
+	unsigned char *expected;
+	unsigned expected_len;
+	int i;
+
+	tdsdump_open(getenv("TDSDUMP"));
+
+	build_rows();
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+	tds = tds_alloc_socket(ctx, 65536);
+	assert(tds);
+	tds->conn->tds_version = 0x704;
+
+	/* an INT4, an INTN, a VARCHAR, a FLTN and a BIGINT */
+	bcpinfo = tds_alloc_bcpinfo();
+	assert(bcpinfo);
+	bcpinfo->parent = tds;
+	info = tds_alloc_results(NUM_COLS);
+	assert(info);
+	bcpinfo->bindinfo = info;
+	tds_set_column_type(tds->conn, info->columns[0], SYBINT4);
+	tds_set_column_type(tds->conn, info->columns[1], SYBINTN);
+	info->columns[1]->column_size = info->columns[1]->on_server.column_size = 4;
+	tds_set_column_type(tds->conn, info->columns[2], XSYBVARCHAR);
+	info->columns[2]->column_size = info->columns[2]->on_server.column_size = STR_SIZE;
+	tds_set_column_type(tds->conn, info->columns[3], SYBFLTN);
+	info->columns[3]->column_size = info->columns[3]->on_server.column_size = 8;
+	tds_set_column_type(tds->conn, info->columns[4], SYBINT8);
+	for (i = 0; i < NUM_COLS; ++i) {
+		TDSCOLUMN *col = info->columns[i];
+
+		assert(col->funcs);
+		col->bcp_column_data = tds_alloc_bcp_column_data(col->column_size > 8 ? col->column_size : 8);
+		assert(col->bcp_column_data);
+		assert(TDS_SUCCEED(tds_bcp_bind_array(bcpinfo, i, &arrays[i])));
+	}
+	assert(bcpinfo->arrays[0].desttype == TDS_INVALID_TYPE);
+	assert(bcpinfo->arrays[2].desttype == TDS_INVALID_TYPE);
+	assert(bcpinfo->arrays[4].desttype == SYBINT8);
+
+	/* rows must be the same */
+	send_by_record(tds, bcpinfo);
+	expected_len = tds->out_pos;
+	expected = tds_new(unsigned char, expected_len);
+	assert(expected);
+	memcpy(expected, tds->out_buf, expected_len);
+
+	send_by_array(tds, bcpinfo);
+	assert(tds->out_pos == expected_len);
+	assert(memcmp(tds->out_buf, expected, expected_len) == 0);
+
+	if (run_benchmarks())
+		bench(tds, bcpinfo);
+
+	reset(tds);
+	free(expected);
+	tds_free_bcpinfo(bcpinfo);
+	tds_free_socket(tds);
+	tds_free_context(ctx);
+	return 0;
+}
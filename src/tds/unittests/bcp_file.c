@@ -0,0 +1,225 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test the buffered reader of BCP host files, fields
+ * crossing read blocks, multi byte terminators and conversions.
+ */
+#include "common.h"
+#include <freetds/iconv.h>
+#include <assert.h>
+
+#if HAVE_UNISTD_H
+#undef getpid
+#include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+static const char out_file[] = "bcp_file.out";
+
+static FILE *
+write_file(const char *data, size_t len)
+{
+	FILE *f = fopen(out_file, "w+b");
+
+	assert(f);
+	assert(fwrite(data, 1, len, f) == len);
+	assert(fseek(f, 0L, SEEK_SET) == 0);
+	return f;
+}
+
+static void
+check_field(TDSBCPFILE *file, TDSICONV *conv, const char *term, const char *expected, size_t expected_len)
+{
+	const char *out = NULL;
+	size_t out_len = 0;
+
+	assert(tds_bcp_file_field(NULL, conv, file, term, strlen(term), &out, &out_len) == TDS_SUCCESS);
+	if (out_len != expected_len || memcmp(out, expected, expected_len) != 0) {
+		fprintf(stderr, "wrong field, got %u bytes expected %u\n", (unsigned) out_len, (unsigned) expected_len);
+		exit(1);
+	}
+}
+
+/* many rows, more than a read block */
+static void
+test_rows(void)
+{
+	char *data, *p, field[64];
+	TDSBCPFILE file;
+	FILE *f;
+	int i;
+	const int rows = 20000;
+	const char *out;
+	size_t out_len;
+
+	data = tds_new(char, rows * 40);
+	assert(data);
+	for (p = data, i = 0; i < rows; ++i)
+		p += sprintf(p, "%d|!col %d|!%s\r\n", i, i * 7, i % 3 ? "x" : "");
+
+	f = write_file(data, p - data);
+	assert(tds_bcp_file_init(&file, f) == TDS_SUCCESS);
+	for (i = 0; i < rows; ++i) {
+		sprintf(field, "%d", i);
+		check_field(&file, NULL, "|!", field, strlen(field));
+		sprintf(field, "col %d", i * 7);
+		check_field(&file, NULL, "|!", field, strlen(field));
+		check_field(&file, NULL, "\r\n", "x", i % 3 ? 1 : 0);
+	}
+	assert(tds_bcp_file_tell(&file) == p - data);
+	assert(tds_bcp_file_field(NULL, NULL, &file, "|!", 2, &out, &out_len) == TDS_NO_MORE_RESULTS);
+	tds_bcp_file_free(&file);
+	fclose(f);
+	free(data);
+}
+
+/* a field bigger than the read buffer */
+static void
+test_big_field(void)
+{
+	const size_t big = 0x100000 + 123;
+	char *data;
+	TDSBCPFILE file;
+	FILE *f;
+	const char *out;
+	size_t out_len;
+
+	data = tds_new(char, big + 10);
+	assert(data);
+	memset(data, 'a', big);
+	/* partial terminators inside data */
+	data[1000] = '|';
+	data[0x40000 - 1] = '|';
+	memcpy(data + big, "|||!z|!", 7);
+
+	f = write_file(data, big + 7);
+	assert(tds_bcp_file_init(&file, f) == TDS_SUCCESS);
+	check_field(&file, NULL, "|!", data, big + 2);
+	check_field(&file, NULL, "|!", "z", 1);
+	assert(tds_bcp_file_field(NULL, NULL, &file, "|!", 2, &out, &out_len) == TDS_NO_MORE_RESULTS);
+	assert(file.eof);
+	tds_bcp_file_free(&file);
+	fclose(f);
+	free(data);
+}
+
+/* end of file in the middle of a field */
+static void
+test_partial(void)
+{
+	TDSBCPFILE file;
+	FILE *f;
+	const char *out;
+	size_t out_len;
+
+	f = write_file("abc,de", 6);
+	assert(tds_bcp_file_init(&file, f) == TDS_SUCCESS);
+	check_field(&file, NULL, ",", "abc", 3);
+	assert(tds_bcp_file_field(NULL, NULL, &file, ",", 1, &out, &out_len) == TDS_FAIL);
+	tds_bcp_file_free(&file);
+	fclose(f);
+}
+
+/* length prefixed data and seeking back */
+static void
+test_get_seek(void)
+{
+	TDSBCPFILE file;
+	FILE *f;
+	const char *p;
+	TDS_INT8 start;
+
+	f = write_file("\x03" "abc\x02" "de" "fgh\n", 11);
+	assert(tds_bcp_file_init(&file, f) == TDS_SUCCESS);
+	p = tds_bcp_file_get(&file, 1);
+	assert(p && p[0] == 3);
+	p = tds_bcp_file_get(&file, 3);
+	assert(p && memcmp(p, "abc", 3) == 0);
+	start = tds_bcp_file_tell(&file);
+	assert(start == 4);
+	p = tds_bcp_file_get(&file, 3);
+	assert(p && memcmp(p, "\x02" "de", 3) == 0);
+	check_field(&file, NULL, "\n", "fgh", 3);
+	assert(tds_bcp_file_get(&file, 1) == NULL);
+	assert(file.eof);
+
+	/* seek inside buffer */
+	assert(tds_bcp_file_seek(&file, start));
+	p = tds_bcp_file_get(&file, 7);
+	assert(p && memcmp(p, "\x02" "defgh\n", 7) == 0);
+
+	/* seek outside buffer */
+	file.offset = 100;
+	assert(tds_bcp_file_seek(&file, 1));
+	assert(!file.eof);
+	check_field(&file, NULL, "\x02", "abc", 3);
+	assert(tds_bcp_file_tell(&file) == 5);
+
+	tds_bcp_file_free(&file);
+	fclose(f);
+}
+
+/* fields converted from UTF-8 */
+static void
+test_convert(void)
+{
+	TDSCONTEXT *ctx = tds_alloc_context(NULL);
+	TDSSOCKET *tds = tds_alloc_socket(ctx, 512);
+	TDSICONV *conv;
+	TDSBCPFILE file;
+	FILE *f;
+	int i;
+
+	assert(ctx && tds);
+	tds_iconv_open(tds->conn, "ISO-8859-1", 0);
+	conv = tds_iconv_get(tds->conn, "UTF-8", "ISO-8859-1");
+	assert(conv);
+
+	f = write_file("\xc3\xa0" "b\t\tc\xc3\xa8\t", 9);
+	assert(tds_bcp_file_init(&file, f) == TDS_SUCCESS);
+	for (i = 0; i < 2; ++i) {
+		check_field(&file, conv, "\t", "\xe0" "b", 2);
+		check_field(&file, conv, "\t", "", 0);
+		check_field(&file, conv, "\t", "c\xe8", 2);
+		assert(tds_bcp_file_seek(&file, 0));
+	}
+	tds_bcp_file_free(&file);
+	fclose(f);
+
+	tds_free_socket(tds);
+	tds_free_context(ctx);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *tdsdump = getenv("TDSDUMP");
+
+	if (tdsdump)
+		tdsdump_open(tdsdump);
+
+	test_rows();
+	test_big_field();
+	test_partial();
+	test_get_seek();
+	test_convert();
+
+	unlink(out_file);
+	return 0;
+}
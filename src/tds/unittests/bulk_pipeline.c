@@ -0,0 +1,138 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test bulk packets are queued when the server does not
+ * read and that all data is sent in order.
+ */
+#include "common.h"
+#include <assert.h>
+#include <freetds/bytes.h>
+
+#if HAVE_UNISTD_H
+#undef getpid
+#include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#include <freetds/replacements.h>
+
+#define PACKET_SIZE 4096
+#define DATA_SIZE 300000
+
+static tds_mutex server_mtx = TDS_MUTEX_INITIALIZER;
+static unsigned char data[DATA_SIZE];
+
+static unsigned char
+expected(size_t pos)
+{
+	return (unsigned char) (pos * 7 + (pos >> 9));
+}
+
+static void
+read_full(TDS_SYS_SOCKET s, unsigned char *buf, size_t len)
+{
+	while (len) {
+		int got = READSOCKET(s, buf, len);
+
+		assert(got > 0);
+		buf += got;
+		len -= got;
+	}
+}
+
+/* fake server, wait to be released then check packets */
+static TDS_THREAD_PROC_DECLARE(server_proc, arg)
+{
+	TDS_SYS_SOCKET s = TDS_PTR2INT(arg);
+	unsigned char header[8], buf[PACKET_SIZE];
+	size_t pos = 0, i;
+	unsigned len;
+
+	tds_mutex_lock(&server_mtx);
+	tds_mutex_unlock(&server_mtx);
+
+	for (;;) {
+		read_full(s, header, 8);
+		assert(header[0] == TDS_BULK);
+		len = TDS_GET_A2BE(header + 2);
+		assert(len > 8 && len <= PACKET_SIZE);
+		read_full(s, buf, len - 8);
+		for (i = 0; i < len - 8; ++i, ++pos)
+			assert(buf[i] == expected(pos));
+		if (header[1] & 1)
+			break;
+	}
+	assert(pos == DATA_SIZE);
+	return TDS_THREAD_RESULT(0);
+}
+
+int
+main(void)
+{
+#if ENABLE_ODBC_MARS
+	TDSCONTEXT *ctx;
+	TDSSOCKET *tds;
+	TDS_SYS_SOCKET server_socket;
+	tds_thread server;
+	TDSPACKET *packet;
+	unsigned queued;
+	size_t i;
+	int sndbuf = 1024;
+
+	tdsdump_open(getenv("TDSDUMP"));
+
+	for (i = 0; i < DATA_SIZE; ++i)
+		data[i] = expected(i);
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+	tds = tds_alloc_socket(ctx, PACKET_SIZE);
+	assert(tds);
+
+	server_socket = fake_server_connect(tds);
+	setsockopt(tds_get_s(tds), SOL_SOCKET, SO_SNDBUF, (const void *) &sndbuf, sizeof(sndbuf));
+	setsockopt(server_socket, SOL_SOCKET, SO_RCVBUF, (const void *) &sndbuf, sizeof(sndbuf));
+	tds->state = TDS_IDLE;
+
+	tds_mutex_lock(&server_mtx);
+	assert(tds_thread_create(&server, server_proc, TDS_INT2PTR(server_socket)) == 0);
+
+	/* server is not reading, these packets must be queued */
+	tds->out_flag = TDS_BULK;
+	tds_put_n(tds, data, PACKET_SIZE * 4);
+	queued = 0;
+	for (packet = tds->conn->send_packets; packet; packet = packet->next)
+		++queued;
+	printf("queued %u packets\n", queued);
+	assert(queued > 0);
+
+	/* release server, rest of data will wait for it */
+	tds_mutex_unlock(&server_mtx);
+	tds_put_n(tds, data + PACKET_SIZE * 4, DATA_SIZE - PACKET_SIZE * 4);
+	assert(TDS_SUCCEED(tds_flush_packet(tds)));
+	assert(tds->conn->send_packets == NULL);
+
+	tds_thread_join(server, NULL);
+
+	tds_free_socket(tds);
+	tds_free_context(ctx);
+	CLOSESOCKET(server_socket);
+#endif
+	return 0;
+}
@@ -1,5 +1,13 @@
 #define TDS_DONT_DEFINE_DEFAULT_FUNCTIONS
 #include "common.h"
+#include <assert.h>
+#include <freetds/bytes.h>
+
+#if HAVE_UNISTD_H
+#undef getpid
+#include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
 #include <freetds/replacements.h>
 
 char USER[512];
@@ -171,3 +179,127 @@ run_query(TDSSOCKET * tds, const char *query)
 
 	return TDS_SUCCESS;
 }
+
+/**
+ * Check if timings should be measured and printed.
+ * Benchmarks are slow and their output is noise in normal test runs,
+ * set TDS_BENCHMARK environment variable to enable them.
+ */
+bool
+run_benchmarks(void)
+{
+	const char *p = getenv("TDS_BENCHMARK");
+
+	return p && p[0] && strcmp(p, "0") != 0;
+}
+
+/**
+ * Append data to a reply.
+ * Tests not needing a real server build replies token by token
+ * and send them with fake_server_reply or fake_server_send.
+ */
+void
+reply_append(TEST_REPLY *reply, const void *data, size_t len)
+{
+	assert(TDS_RESIZE(reply->data, reply->len + len) != NULL);
+	memcpy(reply->data + reply->len, data, len);
+	reply->len += len;
+}
+
+void
+reply_append_byte(TEST_REPLY *reply, unsigned char b)
+{
+	reply_append(reply, &b, 1);
+}
+
+/** Append a little endian integer of len bytes */
+void
+reply_append_le(TEST_REPLY *reply, unsigned value, unsigned len)
+{
+	for (; len; --len, value >>= 8)
+		reply_append_byte(reply, value & 0xff);
+}
+
+/** Append a DONE token, row count is in TDS 7.2 format */
+void
+reply_append_done(TEST_REPLY *reply, unsigned status, unsigned rows)
+{
+	reply_append_byte(reply, TDS_DONE_TOKEN);
+	reply_append_le(reply, status, 2);
+	reply_append_le(reply, 0, 2);
+	reply_append_le(reply, rows, 4);
+	reply_append_le(reply, 0, 4);
+}
+
+void
+reply_free(TEST_REPLY *reply)
+{
+	TDS_ZERO_FREE(reply->data);
+	reply->len = 0;
+}
+
+/**
+ * Connect tds to a fake server using a socket pair.
+ * @return server side of the connection
+ */
+TDS_SYS_SOCKET
+fake_server_connect(TDSSOCKET *tds)
+{
+	TDS_SYS_SOCKET sockets[2];
+
+	assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) >= 0);
+	tds_set_s(tds, sockets[0]);
+	return sockets[1];
+}
+
+/**
+ * Send a reply from the fake server side, split in packets.
+ * @return false if the client closed the connection
+ */
+bool
+fake_server_send(TDS_SYS_SOCKET s, const TEST_REPLY *reply, size_t packet_size)
+{
+	unsigned char *packet;
+	size_t pos = 0;
+	unsigned char num = 1;
+	bool ok = true;
+
+	assert(packet_size > 8);
+	packet = tds_new(unsigned char, packet_size);
+	assert(packet);
+
+	do {
+		size_t len = reply->len - pos;
+
+		if (len > packet_size - 8)
+			len = packet_size - 8;
+		memset(packet, 0, 8);
+		packet[0] = TDS_REPLY;
+		packet[1] = pos + len >= reply->len ? 1 : 0;
+		TDS_PUT_UA2BE(packet + 2, len + 8);
+		packet[6] = num++;
+		memcpy(packet + 8, reply->data + pos, len);
+		if (WRITESOCKET(s, packet, len + 8) != len + 8) {
+			ok = false;
+			break;
+		}
+		pos += len;
+	} while (pos < reply->len);
+
+	free(packet);
+	return ok;
+}
+
+/**
+ * Connect tds to a fake server which sent a reply and closed the connection.
+ * Reply must fit into the socket buffer.
+ */
+void
+fake_server_reply(TDSSOCKET *tds, const TEST_REPLY *reply)
+{
+	TDS_SYS_SOCKET s = fake_server_connect(tds);
+
+	assert(fake_server_send(s, reply, tds->conn->env.block_size));
+	CLOSESOCKET(s);
+	tds->state = TDS_PENDING;
+}
@@ -43,4 +43,23 @@ char *to_utf8(const char *src, char *dest);
 typedef void tds_any_type_t(TDSSOCKET *tds, TDSCOLUMN *col);
 void tds_all_types(TDSSOCKET *tds, tds_any_type_t *func);
 
+bool run_benchmarks(void);
+
+/* data sent by a fake server, see fake_server_reply */
+typedef struct
+{
+	unsigned char *data;
+	size_t len;
+} TEST_REPLY;
+
+void reply_append(TEST_REPLY *reply, const void *data, size_t len);
+void reply_append_byte(TEST_REPLY *reply, unsigned char b);
+void reply_append_le(TEST_REPLY *reply, unsigned value, unsigned len);
+void reply_append_done(TEST_REPLY *reply, unsigned status, unsigned rows);
+void reply_free(TEST_REPLY *reply);
+
+TDS_SYS_SOCKET fake_server_connect(TDSSOCKET *tds);
+bool fake_server_send(TDS_SYS_SOCKET s, const TEST_REPLY *reply, size_t packet_size);
+void fake_server_reply(TDSSOCKET *tds, const TEST_REPLY *reply);
+
 #endif
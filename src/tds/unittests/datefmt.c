@@ -0,0 +1,261 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test compiled date formats give the same results of
+ * strftime(3) and compare speed (if TDS_BENCHMARK is set).
+ */
+#include "common.h"
+#include <freetds/convert.h>
+#include <freetds/time.h>
+#include <assert.h>
+#include <locale.h>
+
+#define BENCH_ROUNDS 200000
+
+static const char *const formats[] = {
+	"%b %e %Y %I:%M%p",
+	"%Y-%m-%d %H:%M:%S.%z",
+	"%Y-%m-%d",
+	"%H:%M:%S.%z",
+	"%b %d %Y %I:%M%p",
+	"%a %A %B %h %j %u %w %y",
+	"%D %F %T %R %%%n%t",
+	"%e %l",
+	"x%z",
+	".%z",
+	"%z%H",
+	"%%.%z",
+	"%d/%m/%Y %H.%M.%S",
+	"%",
+	"no directives",
+	/* not compiled */
+	"%c",
+	"%z %z",
+	"%Y %C",
+};
+
+/* locales with names different from C, tested if available */
+static const char *const locales[] = {
+	"fr_FR.UTF-8",
+	"de_DE.UTF-8",
+	"it_IT.UTF-8",
+	"es_ES.UTF-8",
+};
+
+/* previous implementation, rewrite format and call strftime */
+static size_t
+libc_strftime(char *buf, size_t maxsize, const char *format, const TDSDATEREC * dr, int prec)
+{
+	struct tm tm;
+	size_t length;
+	char *our_format, *pz, fraction[12];
+	bool z_found = false;
+
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_sec = dr->second;
+	tm.tm_min = dr->minute;
+	tm.tm_hour = dr->hour;
+	tm.tm_mday = dr->day;
+	tm.tm_mon = dr->month;
+	tm.tm_year = dr->year - 1900;
+	tm.tm_wday = dr->weekday;
+	tm.tm_yday = dr->dayofyear - 1;
+
+	our_format = tds_new(char, strlen(format) + 1 + 5 + 1);
+	assert(our_format);
+	strcpy(our_format, format);
+
+	for (pz = our_format; *pz; ) {
+		if (*pz++ != '%')
+			continue;
+
+		switch (*pz) {
+		case 0:
+			*pz++ = '%';
+			*pz = 0;
+			continue;
+		case 'e':
+			pz[-1] = dr->day < 10 ? ' ' : dr->day / 10 + '0';
+			pz[0] = dr->day % 10 + '0';
+			break;
+		case 'l':
+			pz[-1] = (dr->hour + 11) % 12 + 1 < 10 ? ' ' : '1';
+			pz[0] = ((dr->hour + 11) % 12 + 1) % 10 + '0';
+			break;
+		case 'z':
+			if (z_found)
+				break;
+			z_found = true;
+
+			--pz;
+			if (prec || pz <= our_format || pz[-1] != '.') {
+				sprintf(fraction, "%07d", dr->decimicrosecond);
+				memcpy(pz, fraction, prec);
+				strcpy(pz + prec, format + (pz - our_format) + 2);
+				pz += prec;
+			} else {
+				strcpy(pz - 1, format + (pz - our_format) + 2);
+				pz--;
+			}
+			continue;
+		}
+		++pz;
+	}
+
+	length = strftime(buf, maxsize, our_format, &tm);
+	free(our_format);
+	return length;
+}
+
+static void
+compare(const char *format, const TDSDATEREC *dr, int prec)
+{
+	char out1[1024], out2[1024];
+	size_t len1, len2;
+
+	TDSDATEFORMAT *fmt;
+
+	len1 = libc_strftime(out1, sizeof(out1), format, dr, prec);
+	len2 = tds_strftime(out2, sizeof(out2), format, dr, prec);
+	if (len1 != len2 || strcmp(out1, out2) != 0) {
+		fprintf(stderr, "Format '%s' prec %d: got '%s' expected '%s'\n", format, prec, out2, out1);
+		exit(1);
+	}
+
+	/* tds_strftime does not compile formats once its cache is full */
+	fmt = tds_date_format_compile(format);
+	if (fmt && dr->year >= 0) {
+		len2 = tds_date_format_apply(out2, sizeof(out2), fmt, dr, prec);
+		if (len1 != len2 || strcmp(out1, out2) != 0) {
+			fprintf(stderr, "Compiled format '%s' prec %d: got '%s' expected '%s'\n", format, prec, out2, out1);
+			exit(1);
+		}
+	}
+	tds_date_format_free(fmt);
+
+	/* exactly sized buffer and buffer too small */
+	if (len1) {
+		assert(tds_strftime(out2, len1 + 1, format, dr, prec) == len1);
+		assert(strcmp(out1, out2) == 0);
+		assert(tds_strftime(out2, len1, format, dr, prec) == 0);
+	}
+}
+
+static void
+compare_all(const TDSDATEREC *dr)
+{
+	unsigned int i;
+	int prec;
+
+	for (i = 0; i < TDS_VECTOR_SIZE(formats); ++i)
+		for (prec = 0; prec <= 7; ++prec)
+			compare(formats[i], dr, prec);
+}
+
+static void
+bench(const char *format)
+{
+	TDSDATEREC dr;
+	TDS_DATETIME dt;
+	char out[256];
+	unsigned int i, by_libc, by_compiled;
+	size_t total = 0;
+
+	dt.dtdays = 45000;
+	dt.dttime = 12345678;
+	tds_datecrack(SYBDATETIME, &dt, &dr);
+
+	by_libc = tds_gettime_ms();
+	for (i = 0; i < BENCH_ROUNDS; ++i)
+		total += libc_strftime(out, sizeof(out), format, &dr, 3);
+	by_libc = tds_gettime_ms() - by_libc;
+
+	by_compiled = tds_gettime_ms();
+	for (i = 0; i < BENCH_ROUNDS; ++i)
+		total -= tds_strftime(out, sizeof(out), format, &dr, 3);
+	by_compiled = tds_gettime_ms() - by_compiled;
+
+	assert(total == 0);
+	printf("'%s' %u dates, libc %u ms, compiled %u ms\n", format, BENCH_ROUNDS, by_libc, by_compiled);
+}
+
+int
+main(void)
+{
+	TDSDATEREC dr;
+	TDS_DATETIME dt;
+	char long_format[600];
+	char out[16];
+	TDSDATEFORMAT *fmt;
+	unsigned int i;
+
+	tdsdump_open(getenv("TDSDUMP"));
+
+	/* dates from 1753 to 9999 at different times */
+	for (dt.dtdays = -53690; dt.dtdays <= 2958463; dt.dtdays += 997) {
+		dt.dttime = (TDS_UINT) ((dt.dtdays + 53690) * 7919u % (24u * 60u * 60u * 300u));
+		assert(TDS_SUCCEED(tds_datecrack(SYBDATETIME, &dt, &dr)));
+		dr.decimicrosecond = (dt.dtdays & 0xffff) * 101;
+		compare_all(&dr);
+	}
+
+	/* years with less than 4 digits and all hours */
+	memset(&dr, 0, sizeof(dr));
+	dr.day = 3;
+	dr.dayofyear = 3;
+	for (dr.year = 1; dr.year < 10000; dr.year = dr.year * 3 + 7) {
+		dr.hour = dr.year % 24;
+		dr.weekday = dr.year % 7;
+		compare_all(&dr);
+	}
+
+	/* names must follow locale changes after formats are compiled */
+	for (i = 0; i < TDS_VECTOR_SIZE(locales); ++i) {
+		if (!setlocale(LC_TIME, locales[i]))
+			continue;
+		compare_all(&dr);
+	}
+	setlocale(LC_TIME, "C");
+
+	/* long literals */
+	memset(long_format, 'x', sizeof(long_format) - 10);
+	strcpy(long_format + sizeof(long_format) - 10, "%Y.%z");
+	compare(long_format, &dr, 3);
+	compare(long_format, &dr, 0);
+
+	/* empty and small buffers */
+	fmt = tds_date_format_compile("%Y-%m-%d");
+	assert(fmt);
+	dr.year = 2026;
+	assert(tds_date_format_apply(out, 0, fmt, &dr, 3) == 0);
+	assert(tds_date_format_apply(out, 10, fmt, &dr, 3) == 0);
+	assert(tds_date_format_apply(out, 11, fmt, &dr, 3) == 10);
+	tds_date_format_free(fmt);
+	assert(tds_date_format_compile("%c") == NULL);
+	assert(tds_date_format_compile("%z%z") == NULL);
+
+	if (run_benchmarks()) {
+		bench(STD_DATETIME_FMT);
+		bench("%Y-%m-%d %H:%M:%S.%z");
+		bench("%d/%m/%Y %H.%M.%S");
+	}
+
+	return 0;
+}
@@ -0,0 +1,165 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test cache of TDS version and instance port discovery,
+ * both in memory and saved to file.
+ */
+#include "common.h"
+#include <assert.h>
+
+#define CACHE_FILE "discovery.cache"
+
+static TDSLOGIN *
+make_login(const char *host, const char *instance)
+{
+	TDSLOGIN *login = tds_alloc_login(false);
+
+	assert(login);
+	assert(tds_dstr_copy(&login->server_host_name, host));
+	assert(tds_dstr_copy(&login->instance_name, instance));
+	return login;
+}
+
+static void
+check(const TDSLOGIN *login, int port, TDS_USMALLINT tds_version, int instance_port)
+{
+	TDSDISCOVERY info;
+
+	if (!tds_version && !instance_port) {
+		assert(!tds_discovery_get(login, port, &info));
+		return;
+	}
+	assert(tds_discovery_get(login, port, &info));
+	assert(info.tds_version == tds_version);
+	assert(info.port == instance_port);
+}
+
+static void
+set(const TDSLOGIN *login, int port, TDS_USMALLINT tds_version, int instance_port)
+{
+	TDSDISCOVERY info;
+
+	info.tds_version = tds_version;
+	info.port = instance_port;
+	tds_discovery_set(login, port, &info);
+}
+
+int
+main(void)
+{
+	TDSLOGIN *sybase, *instance, *instance2, *other;
+	FILE *f;
+
+	tdsdump_open(getenv("TDSDUMP"));
+
+	sybase = make_login("sybhost", "");
+	instance = make_login("mssql", "SQLEXPRESS");
+	instance2 = make_login("MSSQL", "sqlexpress2");
+	other = make_login("otherhost", "");
+
+	/* memory only */
+	check(sybase, 5000, 0, 0);
+	set(sybase, 5000, 0x500, 0);
+	check(sybase, 5000, 0x500, 0);
+	/* without instance port is part of the key */
+	check(sybase, 5001, 0, 0);
+
+	/* port and version are updated separately */
+	set(instance, 0, 0, 50123);
+	check(instance, 0, 0, 50123);
+	set(instance, 0, 0x704, 0);
+	check(instance, 0, 0x704, 50123);
+	/* with instance port is not part of the key */
+	check(instance, 1433, 0x704, 50123);
+	check(instance2, 0, 0, 0);
+
+	tds_discovery_invalidate(instance, 0);
+	check(instance, 0, 0, 0);
+	check(sybase, 5000, 0x500, 0);
+
+	/* saved to file */
+	tds_discovery_clear();
+	remove(CACHE_FILE);
+	remove(CACHE_FILE ".lock");
+	assert(tds_dstr_copy(&sybase->discovery_file, CACHE_FILE));
+	assert(tds_dstr_copy(&instance->discovery_file, CACHE_FILE));
+	assert(tds_dstr_copy(&instance2->discovery_file, CACHE_FILE));
+	assert(tds_dstr_copy(&other->discovery_file, CACHE_FILE));
+
+	set(sybase, 5000, 0x500, 0);
+	set(instance, 0, 0x704, 50123);
+	set(instance2, 0, 0, 50124);
+
+	/* read back from file */
+	tds_discovery_clear();
+	check(sybase, 5000, 0x500, 0);
+	check(instance, 0, 0x704, 50123);
+	check(instance2, 0, 0, 50124);
+
+	/* file is not locked nor written if nothing changes */
+	remove(CACHE_FILE ".lock");
+	set(instance, 0, 0x704, 50123);
+	set(instance, 0, 0, 50123);
+	set(instance2, 0, 0, 50124);
+	tds_discovery_invalidate(other, 4000);
+	f = fopen(CACHE_FILE ".lock", "r");
+	assert(!f);
+	set(sybase, 5000, 0x550, 0);
+	f = fopen(CACHE_FILE ".lock", "r");
+	assert(f);
+	fclose(f);
+	tds_discovery_clear();
+	check(sybase, 5000, 0x550, 0);
+
+	/* invalidation is saved too */
+	tds_discovery_invalidate(instance, 0);
+	tds_discovery_clear();
+	check(instance, 0, 0, 0);
+	check(instance2, 0, 0, 50124);
+
+	/* changes from other processes are merged, not overwritten */
+	f = fopen(CACHE_FILE, "a");
+	assert(f);
+	fputs("otherhost\t\t4000\t500\t0\n", f);
+	fclose(f);
+	set(instance, 0, 0x704, 50125);
+	tds_discovery_clear();
+	check(other, 4000, 0x500, 0);
+	check(instance, 0, 0x704, 50125);
+	check(instance2, 0, 0, 50124);
+
+	/* file changed by other processes is read again */
+	f = fopen(CACHE_FILE, "w");
+	assert(f);
+	fputs("otherhost\t\t4000\t702\t0\n", f);
+	fclose(f);
+	check(other, 4000, 0x702, 0);
+	check(instance, 0, 0, 0);
+
+	tds_discovery_clear();
+	remove(CACHE_FILE);
+	remove(CACHE_FILE ".lock");
+
+	tds_free_login(other);
+	tds_free_login(sybase);
+	tds_free_login(instance);
+	tds_free_login(instance2);
+	return 0;
+}
@@ -0,0 +1,212 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test prepared statements cache lookups, query normalization,
+ * LRU eviction and sharing of statements.
+ */
+#include "common.h"
+#include <assert.h>
+
+static TDSCONNECTION *conn;
+static TDS_INT next_id = 1;
+
+static TDSPARAMINFO *
+make_params(TDS_SERVER_TYPE type, int size)
+{
+	TDSPARAMINFO *params = tds_alloc_param_result(NULL);
+
+	assert(params);
+	tds_set_column_type(conn, params->columns[0], type);
+	if (size)
+		params->columns[0]->column_size = params->columns[0]->on_server.column_size = size;
+	return params;
+}
+
+/* simulate a statement prepared on server */
+static TDSDYNAMIC *
+prepare(const char *query, TDSPARAMINFO *params)
+{
+	TDSDYNAMIC *dyn = tds_alloc_dynamic(conn, NULL);
+
+	assert(dyn);
+	dyn->num_id = next_id++;
+	assert(TDS_SUCCEED(tds_dynamic_cache_put(conn, dyn, query, params)));
+	return dyn;
+}
+
+static int
+num_dynamics(void)
+{
+	TDSDYNAMIC *dyn;
+	int n = 0;
+
+	for (dyn = conn->dyns; dyn; dyn = dyn->next)
+		++n;
+	return n;
+}
+
+static void
+test_lookup(void)
+{
+	TDSPARAMINFO *int_params = make_params(SYBINT4, 0);
+	TDSPARAMINFO *char_params = make_params(SYBVARCHAR, 20);
+	TDSPARAMINFO *char_params2 = make_params(SYBVARCHAR, 40);
+	TDSDYNAMIC *dyn, *found;
+
+	dyn = prepare("SELECT * FROM t WHERE id = ?", int_params);
+	tds_dynamic_cache_release(conn, &dyn);
+
+	/* white spaces are not significant */
+	found = tds_dynamic_cache_get(conn, "  SELECT *\n\tFROM t  WHERE id = ?  ", int_params);
+	assert(found);
+	tds_dynamic_cache_release(conn, &found);
+
+	/* but they are inside strings and comments */
+	dyn = prepare("SELECT 'a  b' -- x\n FROM t WHERE id = ?", int_params);
+	tds_dynamic_cache_release(conn, &dyn);
+	assert(!tds_dynamic_cache_get(conn, "SELECT 'a b' -- x\n FROM t WHERE id = ?", int_params));
+	assert(!tds_dynamic_cache_get(conn, "SELECT 'a  b' -- x FROM t WHERE id = ?", int_params));
+	found = tds_dynamic_cache_get(conn, "SELECT 'a  b'   -- x\n    FROM t WHERE id = ?", int_params);
+	assert(found);
+	tds_dynamic_cache_release(conn, &found);
+
+	/* parameter types should match */
+	assert(!tds_dynamic_cache_get(conn, "SELECT * FROM t WHERE id = ?", char_params));
+	dyn = prepare("SELECT * FROM t WHERE id = ?", char_params);
+	tds_dynamic_cache_release(conn, &dyn);
+	assert(!tds_dynamic_cache_get(conn, "SELECT * FROM t WHERE id = ?", char_params2));
+	found = tds_dynamic_cache_get(conn, "SELECT * FROM t WHERE id = ?", char_params);
+	assert(found && found->params == NULL);
+	tds_dynamic_cache_release(conn, &found);
+
+	/* statements not prepared yet are not returned */
+	dyn = tds_alloc_dynamic(conn, NULL);
+	assert(dyn);
+	assert(TDS_SUCCEED(tds_dynamic_cache_put(conn, dyn, "SELECT ?", int_params)));
+	assert(!tds_dynamic_cache_get(conn, "SELECT ?", int_params));
+	tds_dynamic_cache_release(conn, &dyn);
+
+	assert(conn->dyn_cache.num_cached == 4);
+
+	tds_free_param_results(int_params);
+	tds_free_param_results(char_params);
+	tds_free_param_results(char_params2);
+}
+
+static void
+test_eviction(void)
+{
+	TDSPARAMINFO *params = make_params(SYBINT4, 0);
+	TDSDYNAMIC *dyn, *used;
+	char query[64];
+	int i;
+
+	/* disabling the cache unprepares all statements */
+	tds_set_dynamic_cache_size(conn, 0);
+	assert(conn->dyn_cache.num_cached == 0);
+	dyn = tds_alloc_dynamic(conn, NULL);
+	assert(dyn);
+	assert(TDS_FAILED(tds_dynamic_cache_put(conn, dyn, "SELECT 1", NULL)));
+	tds_release_dynamic(&dyn);
+
+	/* simulate unprepare */
+	while (conn->dyns)
+		tds_dynamic_deallocated(conn, conn->dyns);
+	conn->pending_close = 0;
+
+	tds_set_dynamic_cache_size(conn, 100);
+	for (i = 0; i < 1000; ++i) {
+		sprintf(query, "SELECT %d, ?", i);
+		dyn = prepare(query, params);
+		if (i == 0) {
+			/* keep using first statement */
+			used = dyn;
+			continue;
+		}
+		tds_dynamic_cache_release(conn, &dyn);
+
+		/* recently used statement are kept */
+		if (i % 10 == 0) {
+			sprintf(query, "SELECT %d, ?", i - 5);
+			dyn = tds_dynamic_cache_get(conn, query, params);
+			assert(dyn);
+			tds_dynamic_cache_release(conn, &dyn);
+		}
+	}
+	assert(conn->dyn_cache.num_cached == 100);
+	assert(conn->pending_close);
+
+	/* evicted statements are going to be unprepared */
+	i = 0;
+	for (dyn = conn->dyns; dyn; dyn = dyn->next) {
+		if (dyn->defer_close) {
+			assert(!dyn->cache_key);
+			++i;
+		}
+	}
+	assert(i == 1000 - 100 - 1);
+	assert(num_dynamics() == 1000);
+
+	/* statement evicted but still used, unprepared on last release */
+	assert(!used->cache_key && !used->defer_close);
+	assert(!tds_dynamic_cache_get(conn, "SELECT 0, ?", params));
+	tds_dynamic_cache_release(conn, &used);
+	for (dyn = conn->dyns; dyn; dyn = dyn->next)
+		assert(dyn->cache_key || dyn->defer_close);
+
+	/* simulate unprepare */
+	for (dyn = conn->dyns; dyn; ) {
+		TDSDYNAMIC *next = dyn->next;
+
+		if (dyn->defer_close)
+			tds_dynamic_deallocated(conn, dyn);
+		dyn = next;
+	}
+	assert(num_dynamics() == 100);
+
+	tds_free_param_results(params);
+}
+
+int
+main(void)
+{
+	TDSCONTEXT *ctx;
+	TDSSOCKET *tds;
+
+	tdsdump_open(getenv("TDSDUMP"));
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+	tds = tds_alloc_socket(ctx, 512);
+	assert(tds);
+	conn = tds->conn;
+	conn->tds_version = 0x704;
+
+	/* disabled by default */
+	assert(conn->dyn_cache.max_cached == 0);
+	tds_set_dynamic_cache_size(conn, 10);
+
+	test_lookup();
+	test_eviction();
+
+	tds_free_socket(tds);
+	tds_free_context(ctx);
+	return 0;
+}
@@ -0,0 +1,144 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test UTF-8 support acknowledge is parsed and UTF-8 data
+ * is passed to UTF-8 clients without conversions.
+ * Server replies are written on a socket pair.
+ */
+#include "common.h"
+#include <assert.h>
+#include <freetds/iconv.h>
+#include <freetds/encodings.h>
+
+/* Latin1_General_100_CI_AS_SC_UTF8 */
+static const unsigned char utf8_collation[5] = { 0x09, 0x04, 0xd0, 0x04, 0x00 };
+static const char utf8_text[] = "h\xc3\xa9llo";
+
+static TEST_REPLY reply;
+
+/* build a reply like the end of a login followed by a result */
+static void
+build_reply(bool utf8_ack)
+{
+	const size_t text_len = strlen(utf8_text);
+
+	reply_free(&reply);
+
+	/* default collation */
+	reply_append_byte(&reply, TDS_ENVCHANGE_TOKEN);
+	reply_append_le(&reply, 1 + 1 + 5 + 1, 2);
+	reply_append_byte(&reply, TDS_ENV_SQLCOLLATION);
+	reply_append_byte(&reply, 5);
+	reply_append(&reply, utf8_collation, 5);
+	reply_append_byte(&reply, 0);
+
+	/* acknowledge UTF-8 support */
+	reply_append_byte(&reply, TDS_CONTROL_FEATUREEXTACK_TOKEN);
+	reply_append_byte(&reply, TDS_FEATURE_UTF8_SUPPORT);
+	reply_append_le(&reply, 1, 4);
+	reply_append_byte(&reply, utf8_ack ? 1 : 0);
+	reply_append_byte(&reply, TDS_FEATURE_TERMINATOR);
+
+	/* a VARCHAR(20) column with UTF-8 collation */
+	reply_append_byte(&reply, TDS7_RESULT_TOKEN);
+	reply_append_le(&reply, 1, 2);
+	reply_append_le(&reply, 0, 4);	/* user type */
+	reply_append_le(&reply, 1, 2);	/* flags, nullable */
+	reply_append_byte(&reply, XSYBVARCHAR);
+	reply_append_le(&reply, 20, 2);
+	reply_append(&reply, utf8_collation, 5);
+	reply_append_byte(&reply, 1);
+	reply_append(&reply, "c\0", 2);
+
+	/* a row */
+	reply_append_byte(&reply, TDS_ROW_TOKEN);
+	reply_append_le(&reply, text_len, 2);
+	reply_append(&reply, utf8_text, text_len);
+
+	reply_append_done(&reply, TDS_DONE_COUNT, 1);
+}
+
+static void
+test(bool utf8_ack)
+{
+	TDSCONTEXT *ctx;
+	TDSSOCKET *tds;
+	TDSCONNECTION *conn;
+	TDS_INT result_type;
+	TDSCOLUMN *col;
+	TDSICONV *char_conv;
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+	tds = tds_alloc_socket(ctx, 4096);
+	assert(tds);
+	conn = tds->conn;
+	conn->tds_version = 0x704;
+	assert(TDS_SUCCEED(tds_iconv_open(conn, "UTF-8", 1)));
+
+	build_reply(utf8_ack);
+	fake_server_reply(tds, &reply);
+	tds->zero_copy = true;
+
+	assert(tds_process_tokens(tds, &result_type, NULL, TDS_TOKEN_RESULTS) == TDS_SUCCESS);
+	assert(result_type == TDS_ROWFMT_RESULT);
+
+	/* collation was received before the acknowledge */
+	assert(conn->utf8_support == utf8_ack);
+	char_conv = conn->char_convs[client2server_chardata];
+	assert(char_conv->to.charset.canonic == (utf8_ack ? TDS_CHARSET_UTF_8 : TDS_CHARSET_CP1252));
+
+	col = tds->res_info->columns[0];
+	assert(col->char_conv);
+	assert(col->char_conv->to.charset.canonic == (utf8_ack ? TDS_CHARSET_UTF_8 : TDS_CHARSET_CP1252));
+	assert(!!(col->char_conv->flags & TDS_ENCODING_MEMCPY) == utf8_ack);
+
+	assert(tds_process_tokens(tds, &result_type, NULL, TDS_RETURN_ROW) == TDS_SUCCESS);
+	assert(result_type == TDS_ROW_RESULT);
+	if (utf8_ack) {
+		/* data used directly from the packet */
+		assert(col->column_cur_size == strlen(utf8_text));
+		assert(memcmp(col->column_data, utf8_text, col->column_cur_size) == 0);
+		assert(col->column_data >= tds->in_buf && col->column_data < tds->in_buf + tds->in_len);
+	} else {
+		/* converted from CP1252 */
+		assert(col->column_cur_size == strlen(utf8_text) + 2);
+		assert(memcmp(col->column_data, "h\xc3\x83\xc2\xa9llo", col->column_cur_size) == 0);
+	}
+	tds_release_row_packets(tds);
+
+	while (tds_process_tokens(tds, &result_type, NULL, TDS_TOKEN_RESULTS) == TDS_SUCCESS)
+		continue;
+
+	tds_free_socket(tds);
+	tds_free_context(ctx);
+}
+
+int
+main(void)
+{
+	tdsdump_open(getenv("TDSDUMP"));
+
+	test(true);
+	test(false);
+
+	reply_free(&reply);
+	return 0;
+}
@@ -0,0 +1,258 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test built-in converters give the same results of iconv,
+ * including errors, and compare speed (if TDS_BENCHMARK is set).
+ */
+#include "common.h"
+#include <freetds/iconv.h>
+#include <freetds/encodings.h>
+#include <assert.h>
+
+#define BENCH_SIZE 65536
+#define BENCH_ROUNDS 200
+
+typedef struct
+{
+	int canonic;
+	const char *name;
+} TEST_CHARSET;
+
+static const TEST_CHARSET clients[] = {
+	{ TDS_CHARSET_UTF_8, "UTF-8" },
+	{ TDS_CHARSET_ISO_8859_1, "ISO-8859-1" },
+	{ TDS_CHARSET_CP1252, "CP1252" },
+};
+
+static const TEST_CHARSET servers[] = {
+	{ TDS_CHARSET_UCS_2LE, "UCS-2LE" },
+	{ TDS_CHARSET_UTF_16LE, "UTF-16LE" },
+};
+
+static iconv_t cd;
+static tds_iconv_native_t native;
+static const char *test_name;
+
+/* convert with both iconv and native converter, results must be the same */
+static void
+compare(const void *in, size_t in_len, size_t out_size)
+{
+	char out1[1024], out2[1024];
+	const char *ib1 = (const char *) in, *ib2 = (const char *) in;
+	char *ob1 = out1, *ob2 = out2;
+	size_t il1 = in_len, il2 = in_len, ol1 = out_size, ol2 = out_size;
+	size_t res1, res2;
+	int err1 = 0, err2 = 0;
+
+	assert(out_size <= sizeof(out1));
+
+	tds_sys_iconv(cd, NULL, NULL, NULL, NULL);
+	errno = 0;
+	res1 = tds_sys_iconv(cd, (ICONV_CONST char **) &ib1, &il1, &ob1, &ol1);
+	if (res1 == (size_t) -1)
+		err1 = errno;
+	errno = 0;
+	res2 = native(&ib2, &il2, &ob2, &ol2);
+	if (res2 == (size_t) -1)
+		err2 = errno;
+
+	if ((res1 == (size_t) -1) != (res2 == (size_t) -1) || err1 != err2 || il1 != il2 || ol1 != ol2
+	    || memcmp(out1, out2, out_size - ol1) != 0) {
+		fprintf(stderr, "%s: different results, iconv err %d left %u/%u, native err %d left %u/%u\n",
+			test_name, err1, (unsigned) il1, (unsigned) ol1, err2, (unsigned) il2, (unsigned) ol2);
+		exit(1);
+	}
+}
+
+static void
+compare_all_sizes(const void *in, size_t in_len)
+{
+	size_t out_size;
+
+	for (out_size = 0; out_size <= in_len * 2 + 4; ++out_size)
+		compare(in, in_len, out_size);
+	for (; in_len > 0; --in_len)
+		compare(in, in_len, 1024);
+}
+
+static void
+set_converter(const TEST_CHARSET *from, const TEST_CHARSET *to)
+{
+	if (cd != (iconv_t) -1)
+		tds_sys_iconv_close(cd);
+	cd = tds_sys_iconv_open(to->name, from->name);
+	native = tds_iconv_native_get(from->canonic, to->canonic);
+	assert(native);
+}
+
+typedef struct
+{
+	const char *data;
+	size_t len;
+} SAMPLE;
+
+#define S(s) { s, sizeof(s) - 1 }
+
+/* sample strings in UTF-16LE */
+static const SAMPLE utf16_samples[] = {
+	S("h\0e\0l\0l\0o\0 \0w\0o\0r\0l\0d\0!\0 \0a\0s\0c\0i\0i\0 \0o\0n\0l\0y\0"),
+	S("c\0a\0f\0\xe9\0 \0\xe0\0\xff\0\x80\0\x9f\0\xa0\0"),
+	S("\xac\x20\x1a\x20\x92\x01\x78\x01\x22\x21x\0"),
+	S("\x2d\x4e\x87\x65" "a\0b\0c\0d\0e\0f\0"),
+	S("a\0\x3d\xd8\x00\xdez\0"),
+	S("\x3d\xd8\x00\xde"),
+	/* lone surrogates */
+	S("a\0\x00\xdez\0"),
+	S("a\0\x3d\xd8z\0"),
+	S("a\0b\0\x3d\xd8"),
+	/* odd length */
+	S("a\0b\0c"),
+};
+
+static const SAMPLE client_samples[] = {
+	S("hello world! ascii only, more than 8 characters"),
+	S("caf\xc3\xa9 \xe2\x82\xac \xe4\xb8\xad\xe6\x96\x87 \xf0\x9f\x98\x80 end"),
+	S("caf\xe9 \x80 \x81 \x8d \x9f \xa0 \xff"),
+	S("bad \xc3 utf8"),
+	S("bad \xc0\xaf overlong"),
+	S("bad \xed\xa0\x80 surrogate"),
+	S("truncated \xe2\x82"),
+	S("truncated \xf0\x9f\x98"),
+};
+
+static void
+bench(const TEST_CHARSET *from, const TEST_CHARSET *to, const char *in, size_t in_len)
+{
+	char *out = tds_new(char, BENCH_SIZE * 4);
+	const char *ib;
+	char *ob;
+	size_t il, ol;
+	unsigned int start, by_iconv, by_native;
+	int i;
+
+	assert(out);
+
+	set_converter(from, to);
+	start = tds_gettime_ms();
+	for (i = 0; i < BENCH_ROUNDS; ++i) {
+		ib = in;
+		il = in_len;
+		ob = out;
+		ol = BENCH_SIZE * 4;
+		assert(tds_sys_iconv(cd, (ICONV_CONST char **) &ib, &il, &ob, &ol) != (size_t) -1);
+	}
+	by_iconv = tds_gettime_ms() - start;
+
+	start = tds_gettime_ms();
+	for (i = 0; i < BENCH_ROUNDS; ++i) {
+		ib = in;
+		il = in_len;
+		ob = out;
+		ol = BENCH_SIZE * 4;
+		assert(native(&ib, &il, &ob, &ol) != (size_t) -1);
+	}
+	by_native = tds_gettime_ms() - start;
+
+	printf("%s -> %s, %u bytes, iconv %u ms, native %u ms\n", from->name, to->name,
+	       (unsigned) in_len * BENCH_ROUNDS, by_iconv, by_native);
+	free(out);
+}
+
+static void
+benchmarks(void)
+{
+	char *ascii = tds_new(char, BENCH_SIZE);
+	char *utf8 = tds_new(char, BENCH_SIZE * 2);
+	char *ucs2 = tds_new(char, BENCH_SIZE * 2);
+	size_t i, utf8_len = 0;
+
+	assert(ascii && utf8 && ucs2);
+	for (i = 0; i < BENCH_SIZE; ++i) {
+		ascii[i] = 'a' + i % 26;
+		ucs2[i * 2] = ascii[i];
+		ucs2[i * 2 + 1] = 0;
+		/* some accented letters */
+		if (i % 16 == 15) {
+			ucs2[i * 2] = (char) 0xe8;
+			utf8[utf8_len++] = (char) 0xc3;
+			utf8[utf8_len++] = (char) 0xa8;
+		} else {
+			utf8[utf8_len++] = ascii[i];
+		}
+	}
+
+	bench(&clients[0], &servers[0], ascii, BENCH_SIZE);
+	bench(&servers[0], &clients[0], ucs2, BENCH_SIZE * 2);
+	bench(&clients[0], &servers[0], utf8, utf8_len);
+	bench(&clients[1], &servers[0], ascii, BENCH_SIZE);
+	bench(&servers[0], &clients[1], ucs2, BENCH_SIZE * 2);
+
+	free(ascii);
+	free(utf8);
+	free(ucs2);
+}
+
+int
+main(int argc, char **argv)
+{
+	char name[128];
+	int c, s, i;
+
+	tdsdump_open(getenv("TDSDUMP"));
+
+	cd = (iconv_t) -1;
+
+	/* not handled conversions */
+	assert(tds_iconv_native_get(TDS_CHARSET_UTF_8, TDS_CHARSET_ISO_8859_1) == NULL);
+	assert(tds_iconv_native_get(TDS_CHARSET_UCS_2LE, TDS_CHARSET_UTF_16LE) == NULL);
+
+	for (c = 0; c < TDS_VECTOR_SIZE(clients); ++c) {
+		for (s = 0; s < TDS_VECTOR_SIZE(servers); ++s) {
+			test_name = name;
+
+			set_converter(&servers[s], &clients[c]);
+			for (i = 0; i < TDS_VECTOR_SIZE(utf16_samples); ++i) {
+				sprintf(name, "%s -> %s sample %d", servers[s].name, clients[c].name, i);
+				compare_all_sizes(utf16_samples[i].data, utf16_samples[i].len);
+			}
+
+			set_converter(&clients[c], &servers[s]);
+			for (i = 0; i < TDS_VECTOR_SIZE(client_samples); ++i) {
+				sprintf(name, "%s -> %s sample %d", clients[c].name, servers[s].name, i);
+				compare_all_sizes(client_samples[i].data, client_samples[i].len);
+			}
+
+			/* all single bytes */
+			for (i = 0; i < 256; ++i) {
+				char in[1];
+
+				in[0] = (char) i;
+				sprintf(name, "%s -> %s byte %d", clients[c].name, servers[s].name, i);
+				compare(in, 1, 16);
+			}
+		}
+	}
+
+	if (run_benchmarks())
+		benchmarks();
+
+	tds_sys_iconv_close(cd);
+	return 0;
+}
@@ -0,0 +1,164 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Check logging from many threads: messages from every thread
+ * must be complete and in order, including packet dumps and
+ * long lines.
+ */
+#include "common.h"
+#include <assert.h>
+#include <freetds/utils.h>
+
+#if HAVE_UNISTD_H
+#undef getpid
+#include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+enum {
+	LOOP = 5000,
+	THREADS = 4,
+	DUMP_EVERY = 50,
+	LONG_EVERY = 700,
+	DUMP_LEN = 40,
+};
+
+static char long_text[2000];
+
+static TDS_THREAD_PROC_DECLARE(log_func, idx_ptr)
+{
+	const int idx = TDS_PTR2INT(idx_ptr);
+	const char letter = 'A' + idx;
+	unsigned char data[DUMP_LEN];
+	char msg[32];
+	int i, j;
+
+	for (i = 0; i < LOOP; ++i) {
+		tdsdump_log(TDS_DBG_ERROR, "line %c %d\n", letter, i);
+		if (i % DUMP_EVERY == 0) {
+			for (j = 0; j < DUMP_LEN; ++j)
+				data[j] = (unsigned char) (i + j);
+			sprintf(msg, "dump %c %d", letter, i);
+			tdsdump_dump_buf(TDS_DBG_NETWORK, msg, data, DUMP_LEN);
+		}
+		if (i % LONG_EVERY == 0)
+			tdsdump_log(TDS_DBG_ERROR, "long %c %d %s\n", letter, i, long_text);
+	}
+
+	return TDS_THREAD_RESULT(0);
+}
+
+/* check hexadecimal lines of a dump */
+static void
+check_dump(FILE *f, int num)
+{
+	char line[1024], expected[8];
+	int n;
+
+	for (n = 0; n < DUMP_LEN; n += 16) {
+		assert(fgets(line, sizeof(line), f) != NULL);
+		sprintf(expected, "%04x ", n);
+		assert(strncmp(line, expected, 5) == 0);
+		sprintf(expected, "%02x", (unsigned char) (num + n));
+		assert(strncmp(line + 5, expected, 2) == 0);
+	}
+	assert(fgets(line, sizeof(line), f) != NULL);
+	assert(strcmp(line, "\n") == 0);
+}
+
+int
+main(int argc, char **argv)
+{
+	int i, ret;
+	tds_thread threads[THREADS];
+	FILE *f;
+	char line[4096], kind[8];
+	int wrong_lines = 0;
+	int nexts[THREADS], dumps[THREADS], longs[THREADS];
+
+	tds_debug_flags = TDS_DBGFLAG_ALL | TDS_DBGFLAG_SOURCE;
+
+	memset(long_text, 'x', sizeof(long_text) - 1);
+	for (i = 0; i < THREADS; ++i)
+		nexts[i] = dumps[i] = longs[i] = 0;
+
+	unlink("log_async.out");
+	tdsdump_open("log_async.out");
+
+	for (i = 1; i < THREADS; ++i) {
+		ret = tds_thread_create(&threads[i], log_func, TDS_INT2PTR(i));
+		assert(ret == 0);
+	}
+	log_func(TDS_INT2PTR(0));
+	for (i = 1; i < THREADS; ++i) {
+		ret = tds_thread_join(threads[i], NULL);
+		assert(ret == 0);
+	}
+
+	tdsdump_close();
+
+	f = fopen("log_async.out", "r");
+	assert(f != NULL);
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		char thread_letter;
+		int num_line, num, idx;
+		const char *p = strstr(line, "log_async.c:");
+
+		/* ignore some start lines */
+		if (p == NULL) {
+			assert(++wrong_lines < 4);
+			continue;
+		}
+
+		ret = sscanf(p, "log_async.c:%d:%7s %c %d", &num_line, kind, &thread_letter, &num);
+		assert(ret == 4);
+
+		assert(thread_letter >= 'A' && thread_letter < 'A' + THREADS);
+		idx = thread_letter - 'A';
+
+		if (strcmp(kind, "dump") == 0) {
+			assert(num == dumps[idx] * DUMP_EVERY);
+			assert(num == nexts[idx] - 1);
+			check_dump(f, num);
+			++dumps[idx];
+			continue;
+		}
+		if (strcmp(kind, "long") == 0) {
+			assert(num == longs[idx] * LONG_EVERY);
+			assert(num == nexts[idx] - 1);
+			assert(strlen(line) > sizeof(long_text));
+			++longs[idx];
+			continue;
+		}
+		assert(strcmp(kind, "line") == 0);
+		assert(num == nexts[idx]);
+		++nexts[idx];
+	}
+	fclose(f);
+
+	for (i = 0; i < THREADS; ++i) {
+		assert(nexts[i] == LOOP);
+		assert(dumps[i] == (LOOP + DUMP_EVERY - 1) / DUMP_EVERY);
+		assert(longs[i] == (LOOP + LONG_EVERY - 1) / LONG_EVERY);
+	}
+
+	unlink("log_async.out");
+	return 0;
+}
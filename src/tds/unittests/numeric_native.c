@@ -0,0 +1,242 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test conversions of numerics using native integers give the
+ * same results of the generic code and compare speed (if TDS_BENCHMARK
+ * is set).
+ * Numbers with precision above 38 always use the generic code so same
+ * values are converted with precision increased by GENERIC_PREC.
+ */
+#include "common.h"
+#include <freetds/convert.h>
+#include <assert.h>
+
+#define GENERIC_PREC 39
+#define BENCH_ROUNDS 200000
+
+static TDSCONTEXT *ctx;
+static unsigned int seed = 12345;
+
+static unsigned int
+rnd(unsigned int max)
+{
+	seed = seed * 1103515245u + 12345u;
+	return (seed >> 8) % max;
+}
+
+static void
+make_number(char *out, unsigned int int_digits, unsigned int scale)
+{
+	unsigned int i;
+
+	if (rnd(2))
+		*out++ = '-';
+	if (!int_digits)
+		*out++ = '0';
+	for (i = 0; i < int_digits; ++i)
+		*out++ = (char) ('0' + (i ? rnd(10) : 1 + rnd(9)));
+	if (scale) {
+		*out++ = '.';
+		for (i = 0; i < scale; ++i)
+			*out++ = (char) ('0' + rnd(10));
+	}
+	*out = 0;
+}
+
+static TDS_INT
+to_numeric(const char *s, unsigned int prec, unsigned int scale, TDS_NUMERIC *num)
+{
+	CONV_RESULT cr;
+	TDS_INT ret;
+
+	memset(&cr, 0, sizeof(cr));
+	cr.n.precision = prec;
+	cr.n.scale = scale;
+	ret = tds_convert(ctx, SYBVARCHAR, s, (TDS_UINT) strlen(s), SYBNUMERIC, &cr);
+	*num = cr.n;
+	return ret;
+}
+
+static void
+check_string(const TDS_NUMERIC *num, const char *expected)
+{
+	char out[100];
+
+	assert(tds_numeric_to_string(num, out) > 0);
+	if (strcmp(out, expected) != 0) {
+		fprintf(stderr, "numeric(%d,%d) got '%s' expected '%s'\n", num->precision, num->scale, out, expected);
+		exit(1);
+	}
+}
+
+/* change precision and scale of both numbers, results must be the same */
+static void
+compare_change(const TDS_NUMERIC *native, const TDS_NUMERIC *generic, unsigned int prec, unsigned int scale)
+{
+	TDS_NUMERIC n1 = *native, n2 = *generic;
+	TDS_INT ret1, ret2;
+	char out1[100], out2[100];
+
+	ret1 = tds_numeric_change_prec_scale(&n1, prec, scale);
+	ret2 = tds_numeric_change_prec_scale(&n2, prec, scale);
+	assert(ret1 == ret2);
+	if (ret1 < 0)
+		return;
+	assert(tds_numeric_to_string(&n1, out1) > 0);
+	assert(tds_numeric_to_string(&n2, out2) > 0);
+	if (strcmp(out1, out2) != 0) {
+		fprintf(stderr, "numeric(%d,%d) -> (%u,%u) got '%s' expected '%s'\n", native->precision, native->scale,
+			prec, scale, out1, out2);
+		exit(1);
+	}
+}
+
+static void
+compare_int(const TDS_NUMERIC *native, const TDS_NUMERIC *generic, int desttype)
+{
+	CONV_RESULT cr1, cr2;
+	TDS_INT ret1, ret2;
+
+	memset(&cr1, 0, sizeof(cr1));
+	memset(&cr2, 0, sizeof(cr2));
+	ret1 = tds_convert(ctx, SYBNUMERIC, native, sizeof(*native), desttype, &cr1);
+	ret2 = tds_convert(ctx, SYBNUMERIC, generic, sizeof(*generic), desttype, &cr2);
+	assert(ret1 == ret2);
+	if (ret1 > 0)
+		assert(memcmp(&cr1, &cr2, ret1) == 0);
+}
+
+static void
+test(unsigned int prec, unsigned int scale, unsigned int int_digits)
+{
+	char number[100];
+	TDS_NUMERIC native, generic;
+
+	make_number(number, int_digits, scale);
+
+	assert(to_numeric(number, prec, scale, &native) > 0);
+	assert(to_numeric(number, prec + GENERIC_PREC, scale, &generic) > 0);
+	check_string(&native, number);
+	check_string(&generic, number);
+
+	compare_change(&native, &generic, prec, scale);
+	compare_change(&native, &generic, 1 + rnd(38), 0);
+	compare_change(&native, &generic, 18, 4);
+	compare_change(&native, &generic, 38, 10);
+	compare_change(&native, &generic, prec, rnd(prec + 1));
+	compare_change(&native, &generic, prec < 38 ? prec + 1 : prec, scale < prec ? scale + 1 : scale);
+
+	compare_int(&native, &generic, SYBINT4);
+	compare_int(&native, &generic, SYBINT8);
+	compare_int(&native, &generic, SYBMONEY);
+}
+
+static void
+bench(unsigned int prec, unsigned int scale)
+{
+	char number[100], out[100];
+	TDS_NUMERIC native, generic, tmp;
+	unsigned int i, t_native, t_generic;
+
+	make_number(number, prec - scale, scale);
+	assert(to_numeric(number, prec, scale, &native) > 0);
+	assert(to_numeric(number, prec + GENERIC_PREC, scale, &generic) > 0);
+
+	t_native = tds_gettime_ms();
+	for (i = 0; i < BENCH_ROUNDS; ++i)
+		tds_numeric_to_string(&native, out);
+	t_native = tds_gettime_ms() - t_native;
+	t_generic = tds_gettime_ms();
+	for (i = 0; i < BENCH_ROUNDS; ++i)
+		tds_numeric_to_string(&generic, out);
+	t_generic = tds_gettime_ms() - t_generic;
+	printf("numeric(%u,%u) to string, native %u ms, generic %u ms\n", prec, scale, t_native, t_generic);
+
+	t_native = tds_gettime_ms();
+	for (i = 0; i < BENCH_ROUNDS; ++i)
+		to_numeric(number, prec, scale, &tmp);
+	t_native = tds_gettime_ms() - t_native;
+	t_generic = tds_gettime_ms();
+	for (i = 0; i < BENCH_ROUNDS; ++i)
+		to_numeric(number, prec + GENERIC_PREC, scale, &tmp);
+	t_generic = tds_gettime_ms() - t_generic;
+	printf("string to numeric(%u,%u), native %u ms, generic %u ms\n", prec, scale, t_native, t_generic);
+
+	t_native = tds_gettime_ms();
+	for (i = 0; i < BENCH_ROUNDS; ++i) {
+		tmp = native;
+		tds_numeric_change_prec_scale(&tmp, prec, scale - 2);
+	}
+	t_native = tds_gettime_ms() - t_native;
+	t_generic = tds_gettime_ms();
+	for (i = 0; i < BENCH_ROUNDS; ++i) {
+		tmp = generic;
+		tds_numeric_change_prec_scale(&tmp, prec + GENERIC_PREC, scale - 2);
+	}
+	t_generic = tds_gettime_ms() - t_generic;
+	printf("numeric(%u,%u) change scale, native %u ms, generic %u ms\n", prec, scale, t_native, t_generic);
+}
+
+int
+main(void)
+{
+	unsigned int prec, scale, int_digits, i;
+	TDS_MONEY money;
+	TDS_NUMERIC num;
+	char out[64];
+
+	tdsdump_open(getenv("TDSDUMP"));
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+
+	for (prec = 1; prec <= 38; ++prec)
+		for (scale = 0; scale <= prec; ++scale)
+			for (int_digits = 0; int_digits <= prec - scale; ++int_digits)
+				for (i = 0; i < 4; ++i)
+					test(prec, scale, int_digits);
+
+	/* limits */
+	memset(&num, 0, sizeof(num));
+	num.precision = 18;
+	memcpy(num.array, "\x00\x0d\xe0\xb6\xb3\xa7\x63\xff\xff", 9);
+	check_string(&num, "999999999999999999");
+
+	/* money */
+	money.tdsoldmoney.mnyhigh = 0x80000000;
+	money.tdsoldmoney.mnylow = 0;
+	assert(strcmp(tds_money_to_string(&money, out, false), "-922337203685477.5808") == 0);
+	assert(strcmp(tds_money_to_string(&money, out, true), "-922337203685477.58") == 0);
+	money.tdsoldmoney.mnyhigh = 0;
+	money.tdsoldmoney.mnylow = 5;
+	assert(strcmp(tds_money_to_string(&money, out, false), "0.0005") == 0);
+	assert(strcmp(tds_money_to_string(&money, out, true), "0.00") == 0);
+	money.tdsoldmoney.mnylow = 123456;
+	assert(strcmp(tds_money_to_string(&money, out, false), "12.3456") == 0);
+	assert(strcmp(tds_money_to_string(&money, out, true), "12.35") == 0);
+
+	if (run_benchmarks()) {
+		bench(18, 4);
+		bench(38, 10);
+	}
+
+	tds_free_context(ctx);
+	return 0;
+}
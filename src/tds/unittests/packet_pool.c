@@ -0,0 +1,137 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test packet pool and measure allocations saved using
+ * different pool sizes.
+ */
+#include "common.h"
+#include <assert.h>
+
+#define NUM_PACKETS 25
+#define ROUNDS 20000
+
+static const unsigned sizes[] = { 16, 1024, 4096 + 16, 32768 + 16, 65536 + 16 };
+#define NUM_SIZES TDS_VECTOR_SIZE(sizes)
+
+/* simulate a connection with some packets in flight of mixed sizes */
+static unsigned
+churn(TDSCONNECTION *conn)
+{
+	TDSPACKET *packets[NUM_PACKETS];
+	unsigned round, i, start;
+
+	start = tds_gettime_ms();
+	for (round = 0; round < ROUNDS; ++round) {
+		for (i = 0; i < NUM_PACKETS; ++i) {
+			unsigned len = sizes[(i + round) % NUM_SIZES];
+
+			packets[i] = tds_get_packet(conn, len);
+			assert(packets[i]);
+			assert(packets[i]->capacity >= len);
+			assert(packets[i]->next == NULL);
+			assert(packets[i]->data_len == 0);
+			packets[i]->buf[len - 1] = 0;
+		}
+		for (i = 0; i < NUM_PACKETS; ++i)
+			tds_put_packets(conn, packets[i]);
+	}
+	return tds_gettime_ms() - start;
+}
+
+static TDSPACKETPOOLSTATS
+test(TDSCONNECTION *conn, unsigned pool_size)
+{
+	TDSPACKETPOOLSTATS stats;
+	unsigned elapsed;
+
+	tds_set_packet_pool_size(conn, pool_size);
+	elapsed = churn(conn);
+
+	tds_get_packet_pool_stats(conn, &stats);
+	assert(stats.hits + stats.misses == (TDS_UINT8) ROUNDS * NUM_PACKETS);
+	assert(stats.returned == (TDS_UINT8) ROUNDS * NUM_PACKETS);
+	assert(stats.cached <= pool_size);
+	assert(stats.returned - stats.discarded == stats.cached + stats.hits);
+
+	printf("pool size %2u: %7u allocations, %7u reused, %u ms\n", pool_size,
+	       (unsigned) stats.misses, (unsigned) stats.hits, elapsed);
+	return stats;
+}
+
+int
+main(void)
+{
+	TDSCONTEXT *ctx;
+	TDSSOCKET *tds;
+	TDSPACKETPOOLSTATS stats, small, big;
+	TDSPACKET *packet;
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+
+	/* default size */
+	tds = tds_alloc_socket(ctx, 512);
+	assert(tds);
+	packet = tds_get_packet(tds->conn, 100);
+	tds_put_packets(tds->conn, packet);
+	tds_get_packet_pool_stats(tds->conn, &stats);
+	assert(stats.misses == 1 && stats.cached == 1);
+
+	/* a bigger packet is reused for a smaller request */
+	packet = tds_get_packet(tds->conn, 30);
+	assert(packet && packet->capacity >= 100);
+	tds_get_packet_pool_stats(tds->conn, &stats);
+	assert(stats.hits == 1 && stats.cached == 0);
+	tds_put_packets(tds->conn, packet);
+
+	/* a smaller packet is not used for a bigger request but kept */
+	packet = tds_get_packet(tds->conn, 10000);
+	assert(packet && packet->capacity >= 10000);
+	tds_get_packet_pool_stats(tds->conn, &stats);
+	assert(stats.misses == 2 && stats.cached == 1);
+	tds_put_packets(tds->conn, packet);
+
+	/* shrinking the pool frees packets */
+	tds_set_packet_pool_size(tds->conn, 1);
+	tds_get_packet_pool_stats(tds->conn, &stats);
+	assert(stats.cached == 1 && stats.discarded == 1);
+	tds_set_packet_pool_size(tds->conn, 0);
+	tds_get_packet_pool_stats(tds->conn, &stats);
+	assert(stats.cached == 0);
+	tds_free_socket(tds);
+
+	/* compare allocations with different pool sizes */
+	tds = tds_alloc_socket(ctx, 512);
+	assert(tds);
+	small = test(tds->conn, TDS_PACKET_POOL_DEFAULT);
+	tds_free_socket(tds);
+
+	tds = tds_alloc_socket(ctx, 512);
+	assert(tds);
+	big = test(tds->conn, NUM_PACKETS);
+	tds_free_socket(tds);
+
+	/* with enough space in the pool only first round allocates */
+	assert(big.misses == NUM_PACKETS);
+	assert(big.misses < small.misses);
+
+	tds_free_context(ctx);
+	return 0;
+}
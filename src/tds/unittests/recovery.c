@@ -0,0 +1,351 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test session state tracking used to restore broken
+ * connections and detection of connections closed by the server.
+ * Server replies are written on a socket pair.
+ */
+#undef NDEBUG
+
+/* allows to use some internal functions */
+#include "../login.c"
+
+#include "common.h"
+#include <assert.h>
+
+#if HAVE_UNISTD_H
+#undef getpid
+#include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#include <freetds/replacements.h>
+
+static TEST_REPLY reply;
+
+static void
+start_reply(void)
+{
+	reply_free(&reply);
+}
+
+static void
+process_reply(TDSSOCKET *tds)
+{
+	TDS_INT result_type;
+
+	fake_server_reply(tds, &reply);
+
+	while (tds_process_tokens(tds, &result_type, NULL, TDS_TOKEN_RESULTS) == TDS_SUCCESS)
+		continue;
+
+	CLOSESOCKET(tds_get_s(tds));
+	tds_set_s(tds, INVALID_SOCKET);
+	tds->state = TDS_DEAD;
+}
+
+static void
+check_state(const TDSSESSIONSTATE *list, TDS_TINYINT id, const char *value)
+{
+	for (; list; list = list->next)
+		if (list->id == id)
+			break;
+	if (!value) {
+		assert(!list);
+		return;
+	}
+	assert(list);
+	assert(list->len == strlen(value));
+	assert(memcmp(list->data, value, list->len) == 0);
+}
+
+static void
+test_states(void)
+{
+	TDSCONTEXT *ctx;
+	TDSSOCKET *tds;
+	TDSSESSIONRECOVERY *recovery;
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+	tds = tds_alloc_socket(ctx, 4096);
+	assert(tds);
+	tds->conn->tds_version = 0x704;
+	recovery = &tds->conn->recovery;
+
+	/* acknowledge with initial states, one using long length */
+	start_reply();
+	reply_append_byte(&reply, TDS_CONTROL_FEATUREEXTACK_TOKEN);
+	reply_append_byte(&reply, TDS_FEATURE_SESSIONRECOVERY);
+	reply_append_le(&reply, 4 + 9, 4);
+	reply_append(&reply, "\x01\x02" "ab", 4);
+	reply_append(&reply, "\x02\xff\x03\x00\x00\x00" "cde", 9);
+	reply_append_byte(&reply, TDS_FEATURE_TERMINATOR);
+	reply_append_done(&reply, 0, 0);
+	process_reply(tds);
+
+	assert(recovery->acknowledged);
+	assert(recovery->recoverable);
+	check_state(recovery->initial_states, 1, "ab");
+	check_state(recovery->initial_states, 2, "cde");
+	check_state(recovery->states, 1, NULL);
+
+	/* changes after login, same id replaced */
+	start_reply();
+	reply_append_byte(&reply, TDS_SESSIONSTATE_TOKEN);
+	reply_append_le(&reply, 5 + 5 + 3, 4);
+	reply_append_le(&reply, 0, 4);
+	reply_append_byte(&reply, 1);
+	reply_append(&reply, "\x01\x03" "xyz", 5);
+	reply_append(&reply, "\x03\x01" "q", 3);
+	reply_append_done(&reply, 0, 0);
+	process_reply(tds);
+
+	start_reply();
+	reply_append_byte(&reply, TDS_SESSIONSTATE_TOKEN);
+	reply_append_le(&reply, 5 + 4, 4);
+	reply_append_le(&reply, 1, 4);
+	reply_append_byte(&reply, 1);
+	reply_append(&reply, "\x01\x02" "uv", 4);
+	reply_append_done(&reply, 0, 0);
+	process_reply(tds);
+
+	assert(recovery->recoverable);
+	check_state(recovery->states, 1, "uv");
+	check_state(recovery->states, 3, "q");
+	check_state(recovery->initial_states, 1, "ab");
+
+	/* server tells state cannot be restored */
+	start_reply();
+	reply_append_byte(&reply, TDS_SESSIONSTATE_TOKEN);
+	reply_append_le(&reply, 5 + 3, 4);
+	reply_append_le(&reply, 2, 4);
+	reply_append_byte(&reply, 0);
+	reply_append(&reply, "\x03\x01" "r", 3);
+	reply_append_done(&reply, 0, 0);
+	process_reply(tds);
+
+	assert(!recovery->recoverable);
+	check_state(recovery->states, 1, "uv");
+	check_state(recovery->states, 3, "r");
+
+	/* not enabled, nothing to restore */
+	assert(!recovery->login);
+	assert(!tds_recover_connection(tds));
+
+	tds_free_socket(tds);
+	tds_free_context(ctx);
+}
+
+/* put a string as B_VARCHAR, only ASCII */
+static void
+append_ucs2(TEST_REPLY *out, const char *s)
+{
+	reply_append_byte(out, (unsigned char) strlen(s));
+	for (; *s; ++s)
+		reply_append_le(out, (unsigned char) *s, 2);
+}
+
+static void
+test_feature(void)
+{
+	static const TDS_UCHAR collation[5] = { 0x09, 0x04, 0xd0, 0x00, 0x34 };
+	TDSCONTEXT *ctx;
+	TDSSOCKET *tds;
+	TDSCONNECTION *conn;
+	TEST_REPLY expected = { NULL, 0 };
+	unsigned char *data;
+	int len;
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+	tds = tds_alloc_socket(ctx, 4096);
+	assert(tds);
+	conn = tds->conn;
+	conn->tds_version = 0x704;
+	tds_iconv_open(conn, "ISO-8859-1", 1);
+
+	/* state at login time */
+	start_reply();
+	reply_append_byte(&reply, TDS_CONTROL_FEATUREEXTACK_TOKEN);
+	reply_append_byte(&reply, TDS_FEATURE_SESSIONRECOVERY);
+	reply_append_le(&reply, 4, 4);
+	reply_append(&reply, "\x01\x02" "ab", 4);
+	reply_append_byte(&reply, TDS_FEATURE_TERMINATOR);
+	reply_append_done(&reply, 0, 0);
+	process_reply(tds);
+
+	conn->env.database = strdup("db1");
+	conn->env.language = strdup("us_english");
+	assert(conn->env.database && conn->env.language);
+	memcpy(conn->collation, collation, 5);
+	tds_recovery_init(tds, tds_alloc_login(false));
+	assert(conn->recovery.login);
+
+	/* changes after login, language and collation did not change */
+	free(conn->env.database);
+	conn->env.database = strdup("db2");
+	assert(conn->env.database);
+	start_reply();
+	reply_append_byte(&reply, TDS_SESSIONSTATE_TOKEN);
+	reply_append_le(&reply, 5 + 3, 4);
+	reply_append_le(&reply, 0, 4);
+	reply_append_byte(&reply, 1);
+	reply_append(&reply, "\x03\x01" "q", 3);
+	reply_append_done(&reply, 0, 0);
+	process_reply(tds);
+
+	/* initial data */
+	reply_append_le(&expected, 7 + 6 + 21 + 4, 4);
+	append_ucs2(&expected, "db1");
+	reply_append_byte(&expected, 5);
+	reply_append(&expected, collation, 5);
+	append_ucs2(&expected, "us_english");
+	reply_append(&expected, "\x01\x02" "ab", 4);
+	/* changes */
+	reply_append_le(&expected, 7 + 1 + 1 + 3, 4);
+	append_ucs2(&expected, "db2");
+	reply_append_byte(&expected, 0);
+	reply_append_byte(&expected, 0);
+	reply_append(&expected, "\x03\x01" "q", 3);
+
+	len = tds_recovery_put_feature(tds, NULL);
+	assert(len == (int) expected.len);
+	data = tds_new(unsigned char, len);
+	assert(data);
+	assert(tds_recovery_put_feature(tds, data) == len);
+	assert(memcmp(data, expected.data, len) == 0);
+
+	free(data);
+	reply_free(&expected);
+	tds_free_socket(tds);
+	tds_free_context(ctx);
+}
+
+static void
+test_dynamics(void)
+{
+	TDSCONTEXT *ctx;
+	TDSSOCKET *tds;
+	TDSCONNECTION *conn;
+	TDSDYNAMIC *cached, *unprepared;
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+	tds = tds_alloc_socket(ctx, 4096);
+	assert(tds);
+	conn = tds->conn;
+	conn->tds_version = 0x704;
+	conn->recovery.acknowledged = 1;
+	conn->recovery.recoverable = 1;
+	tds_set_dynamic_cache_size(conn, 10);
+
+	/* cached statements not in use do not prevent recovery */
+	cached = tds_alloc_dynamic(conn, NULL);
+	assert(cached);
+	cached->num_id = 1;
+	assert(TDS_SUCCEED(tds_dynamic_cache_put(conn, cached, "SELECT ?", NULL)));
+	assert(!tds_recovery_possible(conn));
+	tds_dynamic_cache_release(conn, &cached);
+	unprepared = tds_alloc_dynamic(conn, NULL);
+	assert(unprepared);
+	assert(tds_recovery_possible(conn));
+
+	/* after recovery they are prepared again, not reused */
+	tds_recovery_drop_dynamics(conn);
+	assert(conn->dyn_cache.num_cached == 0);
+	assert(!tds_dynamic_cache_get(conn, "SELECT ?", NULL));
+	assert(conn->dyns == unprepared && !unprepared->next);
+
+	tds_release_dynamic(&unprepared);
+	tds_free_socket(tds);
+	tds_free_context(ctx);
+}
+
+static void
+test_closed(void)
+{
+	TDSCONTEXT *ctx;
+	TDSSOCKET *tds;
+	TDS_SYS_SOCKET server;
+	char c;
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+	tds = tds_alloc_socket(ctx, 4096);
+	assert(tds);
+
+	assert(tds_connection_closed(tds->conn));
+
+	server = fake_server_connect(tds);
+	assert(!tds_connection_closed(tds->conn));
+
+	/* pending data is not a closed connection */
+	assert(WRITESOCKET(server, "x", 1) == 1);
+	assert(!tds_connection_closed(tds->conn));
+	assert(READSOCKET(tds_get_s(tds), &c, 1) == 1);
+
+	CLOSESOCKET(server);
+	assert(tds_connection_closed(tds->conn));
+
+	tds_free_socket(tds);
+	tds_free_context(ctx);
+}
+
+static void
+test_login_dup(void)
+{
+	TDSLOGIN *login, *copy;
+
+	login = tds_alloc_login(false);
+	assert(login);
+	assert(tds_set_user(login, "user"));
+	assert(tds_set_passwd(login, "secret"));
+	assert(tds_dstr_copy(&login->database, "db"));
+	login->connect_retry_count = 3;
+
+	copy = tds_login_dup(login);
+	assert(copy);
+	assert(strcmp(tds_dstr_cstr(&copy->user_name), "user") == 0);
+	assert(strcmp(tds_dstr_cstr(&copy->password), "secret") == 0);
+	assert(strcmp(tds_dstr_cstr(&copy->database), "db") == 0);
+	assert(strcmp(tds_dstr_cstr(&copy->server_name), tds_dstr_cstr(&login->server_name)) == 0);
+	assert(copy->connect_retry_count == 3);
+	assert(copy->ip_addrs == NULL);
+
+	/* strings are not shared */
+	tds_free_login(login);
+	assert(strcmp(tds_dstr_cstr(&copy->user_name), "user") == 0);
+	tds_free_login(copy);
+}
+
+int
+main(void)
+{
+	tdsdump_open(getenv("TDSDUMP"));
+
+	test_states();
+	test_feature();
+	test_dynamics();
+	test_closed();
+	test_login_dup();
+
+	reply_free(&reply);
+	return 0;
+}
@@ -0,0 +1,147 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test batches of RPCs are encoded as single RPCs
+ * separated by the batch flag.
+ */
+#include "common.h"
+#include <assert.h>
+
+#define NUM_ROWS 3
+
+static TDSSOCKET *tds;
+static TDSPARAMINFO *params;
+
+typedef TDSRET (*add_rpc_t)(TDSMULTIPLE *multiple);
+
+static TDSRET
+add_rpc(TDSMULTIPLE *multiple)
+{
+	return tds_multiple_rpc(tds, multiple, "my_proc", params);
+}
+
+static TDSRET
+add_execdirect(TDSMULTIPLE *multiple)
+{
+	return tds_multiple_execdirect(tds, multiple, "INSERT INTO t VALUES(?, ?)", params);
+}
+
+static TDSRET
+add_execdirect_noparams(TDSMULTIPLE *multiple)
+{
+	return tds_multiple_execdirect(tds, multiple, "DELETE FROM t", NULL);
+}
+
+/* build a batch, return bytes written */
+static unsigned int
+build(add_rpc_t add, int num_rows)
+{
+	TDSMULTIPLE multiple;
+	int i;
+
+	tds->out_pos = 8;
+	assert(TDS_SUCCEED(tds_multiple_init(tds, &multiple, TDS_MULTIPLE_RPC, NULL)));
+	assert(tds->out_flag == TDS_RPC);
+	for (i = 0; i < num_rows; ++i)
+		assert(TDS_SUCCEED(add(&multiple)));
+	assert(tds->out_flag == TDS_RPC);
+	/* do not send, just discard */
+	tds_set_state(tds, TDS_IDLE);
+	return tds->out_pos;
+}
+
+static void
+test(const char *name, add_rpc_t add, TDS_USMALLINT version, unsigned char separator)
+{
+	unsigned char single[1024];
+	unsigned int single_len, head_len, rpc_len, len;
+	const unsigned char *p;
+	int i;
+
+	tds->conn->tds_version = version;
+
+	/* find request headers length */
+	head_len = build(add, 0);
+
+	single_len = build(add, 1);
+	assert(single_len <= sizeof(single));
+	memcpy(single, tds->out_buf, single_len);
+	rpc_len = single_len - head_len;
+	assert(rpc_len > 0);
+
+	len = build(add, NUM_ROWS);
+	assert(len == head_len + (rpc_len + 1) * NUM_ROWS - 1);
+	assert(memcmp(tds->out_buf, single, single_len) == 0);
+	for (i = 1, p = tds->out_buf + single_len; i < NUM_ROWS; ++i, p += rpc_len + 1) {
+		assert(p[0] == separator);
+		assert(memcmp(p + 1, single + head_len, rpc_len) == 0);
+	}
+	printf("%s version %x: %u bytes each RPC\n", name, version, rpc_len);
+}
+
+int
+main(void)
+{
+	TDSCONTEXT *ctx;
+	TDSCOLUMN *col;
+
+	tdsdump_open(getenv("TDSDUMP"));
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+	tds = tds_alloc_socket(ctx, 4096);
+	assert(tds);
+	tds->conn->tds_version = 0x704;
+	tds->state = TDS_IDLE;
+	tds_iconv_open(tds->conn, "ISO-8859-1", 1);
+
+	/* an INT and a VARCHAR */
+	params = tds_alloc_param_result(NULL);
+	assert(params);
+	params = tds_alloc_param_result(params);
+	assert(params);
+
+	col = params->columns[0];
+	tds_set_param_type(tds->conn, col, SYBINT4);
+	assert(tds_alloc_param_data(col));
+	*(TDS_INT *) col->column_data = 1234;
+	col->column_cur_size = 4;
+
+	col = params->columns[1];
+	tds_set_param_type(tds->conn, col, SYBVARCHAR);
+	col->column_size = col->on_server.column_size = 20;
+	assert(tds_alloc_param_data(col));
+	memcpy(col->column_data, "hello", 5);
+	col->column_cur_size = 5;
+
+	test("rpc", add_rpc, 0x704, 0xff);
+	test("rpc", add_rpc, 0x701, 0x80);
+	test("execdirect", add_execdirect, 0x704, 0xff);
+	test("execdirect", add_execdirect, 0x701, 0x80);
+	test("execdirect", add_execdirect, 0x700, 0x80);
+	test("execdirect without parameters", add_execdirect_noparams, 0x704, 0xff);
+	test("execdirect without parameters", add_execdirect_noparams, 0x701, 0x80);
+
+	tds->out_pos = 8;
+	tds_free_param_results(params);
+	tds_free_socket(tds);
+	tds_free_context(ctx);
+	return 0;
+}
@@ -338,6 +338,26 @@ main(int argc, char **argv)
 	test("20060102", SYBDATETIME, "38717 0");
 	test("060102", SYBDATETIME, "38717 0");
 
+	/* fixed formats, same results of free form */
+	test("2006-01-02 12:34:56", SYBDATETIME, "38717 13588800");
+	test("Jan 02 2006 12:34:56", SYBDATETIME, "38717 13588800");
+	test("  20060102 12:34  ", SYBDATETIME, "38717 13572000");
+	test("2006-01-02 1:34:56", SYBDATETIME, "38717 1708800");
+	test("2006-01-02 01:34:56", SYBDATETIME, "38717 1708800");
+	test("2006-02-31", SYBDATETIME, "38777 0");
+	test("Feb 31 2006", SYBDATETIME, "38777 0");
+	test("2006-01-02 12:34:56.3371234567", SYB5BIGDATETIME, "0x00e0e621122b80e3");
+	test("12:34:56.3", SYBTIME, "13588890");
+	test("2006-01-02x", SYBDATETIME, "error");
+	test("2006-01-02 12:34:56 x", SYBDATETIME, "error");
+
+	/* ODBC escapes */
+	test("{d '2006-01-02'}", SYBDATETIME, "38717 0");
+	test("{ts '2006-01-02 12:34:56.337'}", SYBDATETIME, "38717 13588901");
+	test(" { T '12:34:56.337' } ", SYBTIME, "13588901");
+	test("{ts 'Jan 02 2006 12:34'}", SYBDATETIME, "38717 13572000");
+	test("{ts '2006-01-02'", SYBDATETIME, "error");
+
 	test("2006-01-02", SYBDATE, "38717");
 	test("12:34:56.337", SYBTIME, "13588901");
 
@@ -0,0 +1,126 @@
+/* FreeTDS - Library of routines accessing Sybase and Microsoft databases
+ * Copyright (C) 2026  Frediano Ziglio
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Purpose: test millisecond timeouts, both parsing configuration
+ * and waiting on sockets.
+ */
+#include "common.h"
+#include <assert.h>
+
+#if HAVE_UNISTD_H
+#undef getpid
+#include <unistd.h>
+#endif /* HAVE_UNISTD_H */
+
+#if HAVE_POLL_H
+#include <poll.h>
+#endif /* HAVE_POLL_H */
+
+#include <freetds/replacements.h>
+
+static int handler_calls = 0;
+
+static int
+int_handler(void *parent)
+{
+	++handler_calls;
+	return TDS_INT_CONTINUE;
+}
+
+/* wait on socket and return elapsed time */
+static unsigned
+wait_socket(TDSSOCKET *tds, int timeout_ms, int expected)
+{
+	unsigned start = tds_gettime_ms();
+	int rc = tds_select(tds, TDSSELREAD, timeout_ms);
+
+	assert(expected ? rc > 0 : rc == 0);
+	return tds_gettime_ms() - start;
+}
+
+static void
+test_config(void)
+{
+	TDSLOGIN *login = tds_alloc_login(0);
+
+	assert(login);
+
+	tds_parse_conf_section(TDS_STR_TIMEOUT, "3", login);
+	assert(login->query_timeout == 3000);
+	tds_parse_conf_section(TDS_STR_TIMEOUT, "150ms", login);
+	assert(login->query_timeout == 150);
+	tds_parse_conf_section(TDS_STR_CONNTIMEOUT, "250 ms", login);
+	assert(login->connect_timeout == 250);
+	tds_parse_conf_section(TDS_STR_CONNTIMEOUT, "7", login);
+	assert(login->connect_timeout == 7000);
+
+	/* invalid values are ignored */
+	tds_parse_conf_section(TDS_STR_TIMEOUT, "-4", login);
+	assert(login->query_timeout == 150);
+	tds_parse_conf_section(TDS_STR_TIMEOUT, "0", login);
+	assert(login->query_timeout == 150);
+
+	tds_free_login(login);
+}
+
+int
+main(void)
+{
+	TDSCONTEXT *ctx;
+	TDSSOCKET *tds;
+	TDS_SYS_SOCKET server;
+	unsigned elapsed;
+
+	test_config();
+
+	ctx = tds_alloc_context(NULL);
+	assert(ctx);
+	tds = tds_alloc_socket(ctx, 512);
+	assert(tds);
+	server = fake_server_connect(tds);
+
+	/* timeout should be honored with millisecond precision */
+	elapsed = wait_socket(tds, 150, 0);
+	printf("150 ms timeout took %u ms\n", elapsed);
+	assert(elapsed >= 140 && elapsed < 900);
+
+	/* same with an interrupt handler installed, which is called at least once per second */
+	ctx->int_handler = int_handler;
+	elapsed = wait_socket(tds, 300, 0);
+	printf("300 ms timeout with handler took %u ms, handler called %d times\n", elapsed, handler_calls);
+	assert(elapsed >= 290 && elapsed < 900);
+	assert(handler_calls >= 1);
+
+	handler_calls = 0;
+	elapsed = wait_socket(tds, 1500, 0);
+	assert(elapsed >= 1490 && elapsed < 2500);
+	assert(handler_calls >= 2);
+	ctx->int_handler = NULL;
+
+	/* data available */
+	assert(WRITESOCKET(server, "x", 1) == 1);
+	elapsed = wait_socket(tds, 5000, 1);
+	assert(elapsed < 1000);
+
+	CLOSESOCKET(server);
+	tds_free_socket(tds);
+	tds_free_context(ctx);
+	return 0;
+}
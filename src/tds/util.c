@@ -141,6 +141,11 @@ tds_set_state(TDSSOCKET * tds, TDS_STATE state)
 	case TDS_WRITING:
 		CHECK_TDS_EXTRA(tds);
 
+		/* connection closed by server while idle, try to restore it */
+		if (tds->conn->recovery.login && (prior_state == TDS_IDLE || prior_state == TDS_DEAD)
+		    && tds_recover_connection(tds))
+			prior_state = tds->state;
+
 		if (tds_mutex_trylock(&tds->wire_mtx))
 			return tds->state;
 
@@ -62,9 +62,9 @@ new_cond_signal(tds_condition * cond)
 }
 
 static int
-new_cond_timedwait(tds_condition * cond, tds_raw_mutex * mtx, int timeout_sec)
+new_cond_timedwait(tds_condition * cond, tds_raw_mutex * mtx, int timeout_ms)
 {
-	if (sleep_cv(&cond->cv, &mtx->crit, timeout_sec <= 0 ? INFINITE : timeout_sec * 1000))
+	if (sleep_cv(&cond->cv, &mtx->crit, timeout_ms <= 0 ? INFINITE : timeout_ms))
 		return 0;
 	return ETIMEDOUT;
 }
@@ -95,12 +95,12 @@ old_cond_signal(tds_condition * cond)
 }
 
 static int
-old_cond_timedwait(tds_condition * cond, tds_raw_mutex * mtx, int timeout_sec)
+old_cond_timedwait(tds_condition * cond, tds_raw_mutex * mtx, int timeout_ms)
 {
 	int res;
 
 	LeaveCriticalSection(&mtx->crit);
-	res = WaitForSingleObject(cond->ev, timeout_sec < 0 ? INFINITE : timeout_sec * 1000);
+	res = WaitForSingleObject(cond->ev, timeout_ms < 0 ? INFINITE : timeout_ms);
 	EnterCriticalSection(&mtx->crit);
 	return res == WAIT_TIMEOUT ? ETIMEDOUT : 0;
 }
@@ -152,16 +152,16 @@ detect_cond_signal(tds_condition * cond)
 }
 
 static int
-detect_cond_timedwait(tds_condition * cond, tds_raw_mutex * mtx, int timeout_sec)
+detect_cond_timedwait(tds_condition * cond, tds_raw_mutex * mtx, int timeout_ms)
 {
 	detect_cond();
-	return tds_raw_cond_timedwait(cond, mtx, timeout_sec);
+	return tds_raw_cond_timedwait(cond, mtx, timeout_ms);
 }
 
 int (*tds_raw_cond_init) (tds_condition * cond) = detect_cond_init;
 int (*tds_raw_cond_destroy) (tds_condition * cond) = detect_cond_destroy;
 int (*tds_raw_cond_signal) (tds_condition * cond) = detect_cond_signal;
-int (*tds_raw_cond_timedwait) (tds_condition * cond, tds_raw_mutex * mtx, int timeout_sec) = detect_cond_timedwait;
+int (*tds_raw_cond_timedwait) (tds_condition * cond, tds_raw_mutex * mtx, int timeout_ms) = detect_cond_timedwait;
 
 #elif defined(TDS_HAVE_PTHREAD_MUTEX) && !defined(TDS_NO_THREADSAFE)
 
@@ -198,19 +198,19 @@ int tds_raw_cond_init(tds_condition *cond)
 #endif
 }
 
-int tds_raw_cond_timedwait(tds_condition *cond, tds_raw_mutex *mtx, int timeout_sec)
+int tds_raw_cond_timedwait(tds_condition *cond, tds_raw_mutex *mtx, int timeout_ms)
 {
 	struct timespec ts;
 #if !defined(HAVE_PTHREAD_COND_TIMEDWAIT_RELATIVE_NP) && !defined(USE_CLOCK_IN_COND)
 	struct timeval tv;
 #endif
 
-	if (timeout_sec <= 0)
+	if (timeout_ms <= 0)
 		return tds_raw_cond_wait(cond, mtx);
 
 #if defined(HAVE_PTHREAD_COND_TIMEDWAIT_RELATIVE_NP)
-	ts.tv_sec = timeout_sec;
-	ts.tv_nsec = 0;
+	ts.tv_sec = timeout_ms / 1000;
+	ts.tv_nsec = (timeout_ms % 1000) * 1000000;
 	return pthread_cond_timedwait_relative_np(cond, mtx, &ts);
 #else
 
@@ -228,7 +228,12 @@ int tds_raw_cond_timedwait(tds_condition *cond, tds_raw_mutex *mtx, int timeout_
 #  error No way to get a proper time!
 #  endif
 
-	ts.tv_sec += timeout_sec;
+	ts.tv_sec += timeout_ms / 1000;
+	ts.tv_nsec += (timeout_ms % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_nsec -= 1000000000;
+		++ts.tv_sec;
+	}
 	return pthread_cond_timedwait(cond, mtx, &ts);
 #endif
 }
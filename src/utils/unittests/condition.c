@@ -90,11 +90,13 @@ int main(void)
 
 	/* check timed version */
 
-	check(tds_cond_timedwait(&cond, &mtx, 1) != ETIMEDOUT, "should not succeed to wait condition");
+	check(tds_cond_timedwait(&cond, &mtx, 1000) != ETIMEDOUT, "should not succeed to wait condition");
+
+	check(tds_cond_timedwait(&cond, &mtx, 50) != ETIMEDOUT, "should not succeed to wait condition");
 
 	check(tds_thread_create(&th, signal_proc, &cond) != 0, "error creating thread");
 
-	check(tds_cond_timedwait(&cond, &mtx, 1), "error on timed waiting condition");
+	check(tds_cond_timedwait(&cond, &mtx, 1000), "error on timed waiting condition");
 
 	res = &th; /* just to avoid NULL */
 	check(tds_thread_join(th, &res) != 0, "error waiting thread");